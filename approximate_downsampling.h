@@ -0,0 +1,156 @@
+/**
+	Downsampling assignment
+
+	approximate_downsampling.h
+*/
+
+#pragma once
+
+#include "downsampling.h"
+#include "heavy_hitters_histogram.h"
+
+
+/**
+	exact_levels value of computeDownsamplesApproximate(..) that switches to approximate histograms at the first level
+	whose exact histograms hold more than K labels per cell on average.
+*/
+const std::size_t automatic_exact_levels = std::size_t(-1);
+
+
+/**
+	Returns the average number of labels per histogram of a level.
+*/
+template <typename T, std::size_t InlineCapacity>
+double averageHistogramSize(const std::vector<CompactHistogram<T, InlineCapacity> > &level) {
+	const CompactHistogram<T, InlineCapacity> *hists = level.data();
+	size_t total = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, level.size()), size_t(0),
+		[hists](const tbb::blocked_range<size_t> &r, size_t sum) {
+			for (size_t i = r.begin(); i != r.end(); ++i) {
+				sum += hists[i].size;
+			}
+			return sum;
+		},
+		[](size_t a, size_t b) { return a + b; });
+	return (double)total / level.size();
+}
+
+
+/**
+	Appends the error bounds of a level of summaries to errors.
+*/
+template <typename T, std::size_t NumDims, std::size_t K>
+void appendErrors(const std::vector<HeavyHitters<T, K> > &level, const std::array<size_t, NumDims> &extents,
+				  std::vector<ArrayNd<unsigned int, NumDims> > &errors) {
+	errors.emplace_back(extents);
+	unsigned int *output = errors.back().data();
+	const HeavyHitters<T, K> *hists = level.data();
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, level.size()), [output, hists](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(); i != r.end(); ++i) {
+			output[i] = hists[i].error;
+		}
+	});
+}
+
+
+/**
+    Approximate version of computeDownsamplesParallel(..) with a fixed amount of memory per cell.
+
+	The first exact_levels levels are computed with exact histograms (CompactHistogram<T>), the coarser ones
+	with heavy hitters summaries of at most K labels (HeavyHitters<T, K>), so the memory and the merge time of
+	the coarse levels do not depend on the number of distinct labels.
+
+	Along with every l-downsample the function returns the error bound of each of its cells: the true count
+	of the returned label is at most errors[l - 1](cell) smaller than the count of the exact mode
+	(0 means the cell is exact). In particular the result is exact wherever the count of the returned label
+	exceeds the count of every other label by more than the error.
+
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - Output vector contains all l-downsamplings of the original image.
+		errors - Output vector contains the error bounds of all l-downsamplings.
+		exact_levels - number of levels computed exactly, automatic_exact_levels switches to the summaries
+			at the first level where the exact histograms have more than K labels on average
+*/
+template <typename T, std::size_t NumDims, std::size_t K>
+void computeDownsamplesApproximate(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results,
+								   std::vector<ArrayNd<unsigned int, NumDims> > &errors,
+								   std::size_t exact_levels = automatic_exact_levels) {
+	typedef CompactHistogram<T> Exact;
+	typedef HeavyHitters<T, K> Approximate;
+
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		assert((A.shape()[k] & (A.shape()[k] - 1)) == 0 && "extents of A must be powers of 2");
+	}
+
+	std::size_t num_levels = numDownsamples(A);
+	if (num_levels == 0) {
+		return;
+	}
+	results.reserve(results.size() + num_levels);
+	errors.reserve(errors.size() + num_levels);
+
+	std::array<size_t, NumDims> extents = halfExtents(A);
+	std::size_t level = 0;
+	HistogramLevels<Approximate> approximate;
+
+	if (exact_levels == 0) {
+		/// summaries from the start
+		std::vector<Approximate> &output = approximate.next(product(extents));
+		results.emplace_back(extents);
+		ParallelCreateMaps<T, NumDims, Approximate> parallelCreateMaps(makeView(A), makeView(output.data(), extents),
+			&approximate.arenas[1 - approximate.current], makeView(results.back()));
+		forEachBlock(product(extents), parallelCreateMaps, true);
+		approximate.swap();
+		appendErrors(approximate.buffers[approximate.current], extents, errors);
+		level = 1;
+	}
+	else {
+		/// exact levels, see buildPyramid(..)
+		HistogramLevels<Exact> exact;
+		std::vector<Exact> &output = exact.next(product(extents));
+		results.emplace_back(extents);
+		ParallelCreateMaps<T, NumDims, Exact> parallelCreateMaps(makeView(A), makeView(output.data(), extents),
+			&exact.arenas[1 - exact.current], makeView(results.back()));
+		forEachBlock(product(extents), parallelCreateMaps, true);
+		exact.swap();
+		level = 1;
+
+		while (level < num_levels) {
+			bool switch_now = exact_levels == automatic_exact_levels
+				? averageHistogramSize(exact.buffers[exact.current]) > K : level >= exact_levels;
+			if (switch_now) {
+				break;
+			}
+			extents = mergeLevel(exact, extents, results, true);
+			++level;
+		}
+
+		std::array<size_t, NumDims> level_extents = halfExtents(A);
+		for (std::size_t l = 0; l != level; ++l) {
+			errors.emplace_back(level_extents);
+			std::fill(errors.back().data(), errors.back().data() + errors.back().num_elements(), 0u);
+			level_extents = halfExtents(level_extents);
+		}
+
+		if (level < num_levels) {
+			/// the exact histograms of the last exact level become summaries, the next level is merged from them
+			const std::vector<Exact> &input = exact.buffers[exact.current];
+			std::vector<Approximate> &converted = approximate.next(input.size());
+			PerThread<std::pair<std::vector<LabelCount<T> >, std::vector<unsigned int> > > scratch;
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, input.size()), [&](const tbb::blocked_range<size_t> &r) {
+				std::pair<std::vector<LabelCount<T> >, std::vector<unsigned int> > &local = scratch.local();
+				for (size_t i = r.begin(); i != r.end(); ++i) {
+					convertMap(input[i], converted[i], local.first, local.second);
+				}
+			});
+			approximate.swap();
+		}
+	}
+
+	/// approximate levels
+	while (level < num_levels) {
+		extents = mergeLevel(approximate, extents, results, true);
+		appendErrors(approximate.buffers[approximate.current], extents, errors);
+		++level;
+	}
+}
@@ -0,0 +1,290 @@
+/**
+	Downsampling assignment
+
+	async_downsampling.h
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include "downsampling.h"
+
+
+/**
+	Handle of a pyramid built in the background by computeDownsamplesAsync(..).
+
+	Two threads work behind the handle: the builder computes the levels one after the other (with the parallel
+	loops of computeDownsamplesParallel(..)) and the deliverer calls the callback for every finished level,
+	finest first. So while the callback of level k writes it to storage or sends it to a viewer,
+	level k+1 is being computed.
+	The callback returns false (or the caller calls cancel()) to stop: levels not started yet are not built and
+	finished levels are not delivered anymore. A level that is being built is finished first.
+
+	The image must outlive the handle. The destructor waits for both threads, like the future of std::async.
+*/
+template <typename T, std::size_t NumDims>
+class AsyncPyramid {
+public:
+	/**
+		Called with the number of the level (1 for the 1-downsample) and the level itself.
+		The level stays valid until the handle is destroyed. Returns false to cancel the remaining levels.
+	*/
+	typedef std::function<bool (std::size_t, const ArrayNd<T, NumDims> &)> Callback;
+
+private:
+	const ArrayNd<T, NumDims> &A;
+	Callback callback;
+	std::vector<ArrayNd<T, NumDims> > results;   // all levels, allocated up front
+	std::vector<ArrayView<T, NumDims> > views;
+	std::atomic<bool> stop;
+	std::atomic<std::size_t> num_delivered;
+
+	std::mutex mutex;
+	std::condition_variable level_built;
+	std::size_t num_built;   // guarded by mutex, as is build_done
+	bool build_done;
+
+	std::future<void> builder;
+	std::future<void> deliverer;
+
+	AsyncPyramid(const AsyncPyramid &);
+	AsyncPyramid &operator=(const AsyncPyramid &);
+
+	/**
+		Makes levels 1..n available to the deliverer.
+	*/
+	void publish(std::size_t n, bool done) {
+		std::lock_guard<std::mutex> lock(mutex);
+		num_built = n;
+		build_done = done;
+		level_built.notify_all();
+	}
+
+	/**
+		Builds and publishes the first levels (see createFirstLevels(..)), returns the number of levels built.
+		The levels after them are merged from the hashmaps left in levels.
+	*/
+	template <typename Histogram>
+	std::size_t buildFirstLevels(HistogramLevels<Histogram> &levels, std::false_type) {
+		createFirstLevels(A, levels, views.data(), views.size(), true, std::false_type());
+		publish(1, views.size() == 1);
+		return 1;
+	}
+
+	/**
+		2-d version: the 1-downsample of the SIMD kernel is published before the hashmaps of the 2-downsample are built
+		from the 4x4 blocks, so it is delivered (and a cancel() takes effect) without waiting for them.
+	*/
+	template <typename Histogram>
+	std::size_t buildFirstLevels(HistogramLevels<Histogram> &levels, std::true_type) {
+		ArrayView<const T, 2> view = makeView(A);
+		if (!canUseModes2x2(view, views[0])) {
+			return buildFirstLevels(levels, std::false_type());
+		}
+
+		if constexpr (HasModeKernel<T>::value) {
+			computeModes2x2(view, views[0], true, levels.profile);
+		}
+		publish(1, views.size() == 1);
+		if (stop || createLevels4x4(A, levels, views.data(), views.size(), true) == 0) {
+			return 1;
+		}
+		publish(2, views.size() == 2);
+		return 2;
+	}
+
+	/**
+		Builds the levels with the Histogram type, one level at a time (see buildPyramid(..)).
+	*/
+	template <typename Histogram>
+	void build(Histogram *) {
+		HistogramLevels<Histogram> levels;
+		std::size_t n = buildFirstLevels(levels, std::integral_constant<bool, NumDims == 2>());
+
+		std::array<size_t, NumDims> extents = levelExtents(A, n);
+		for (; n != views.size() && !stop; ++n) {
+			extents = mergeLevel(levels, extents, views[n], true);
+			publish(n + 1, n + 1 == views.size());
+		}
+	}
+
+	void build(AutoHistogram *) {
+		withAutoHistogram(A, true, [&](auto *histogram) {
+			build(histogram);
+		});
+	}
+
+	/**
+		Builder thread. The deliverer is told that the build is over however it ends.
+	*/
+	template <typename Histogram>
+	void runBuilder() {
+		try {
+			if (!views.empty()) {
+				build((Histogram *)0);
+			}
+		}
+		catch (...) {
+			publish(num_built, true);
+			throw;
+		}
+		publish(num_built, true);
+	}
+
+	/**
+		Deliverer thread: calls the callback for every level as soon as it is built.
+	*/
+	void runDeliverer() {
+		for (std::size_t l = 0; ; ++l) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				level_built.wait(lock, [&]() { return num_built > l || build_done; });
+				if (num_built <= l) {
+					return;
+				}
+			}
+			if (stop) {
+				return;
+			}
+
+			bool more;
+			try {
+				more = callback(l + 1, results[l]);
+			}
+			catch (...) {
+				stop = true;
+				throw;
+			}
+			++num_delivered;
+			if (!more) {
+				stop = true;
+			}
+		}
+	}
+
+public:
+	/**
+		Starts building the pyramid of A with the given Histogram type (see computeDownsamplesAsync(..)).
+	*/
+	template <typename Histogram>
+	AsyncPyramid(const ArrayNd<T, NumDims> &A, const Callback &callback, Histogram *)
+		: A(A), callback(callback), stop(false), num_delivered(0), num_built(0), build_done(false) {
+
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			assert((A.shape()[k] & (A.shape()[k] - 1)) == 0 && "extents of A must be powers of 2");
+		}
+
+		/// the levels are allocated before the threads start, the vector never reallocates
+		std::size_t num_levels = numDownsamples(A);
+		results.reserve(num_levels);
+		views.reserve(num_levels);
+		std::array<size_t, NumDims> extents = halfExtents(A);
+		for (std::size_t l = 0; l != num_levels; ++l) {
+			results.emplace_back(extents);
+			views.push_back(makeView(results.back()));
+			extents = halfExtents(extents);
+		}
+
+		builder = std::async(std::launch::async, [this]() { runBuilder<Histogram>(); });
+		deliverer = std::async(std::launch::async, [this]() { runDeliverer(); });
+	}
+
+	~AsyncPyramid() {
+		try {
+			wait();
+		}
+		catch (...) {
+		}
+	}
+
+	/**
+		Stops the build after the level that is being computed, no more levels are delivered.
+	*/
+	void cancel() {
+		stop = true;
+	}
+
+	bool cancelled() const {
+		return stop;
+	}
+
+	/**
+		Number of levels built so far (levels 1..numBuilt() can be read from the callback's arguments).
+	*/
+	std::size_t numBuilt() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return num_built;
+	}
+
+	/**
+		Number of levels passed to the callback so far.
+	*/
+	std::size_t numDelivered() const {
+		return num_delivered;
+	}
+
+	/**
+		Waits until the build and the delivery are over.
+		Rethrows the first exception thrown by the build or by the callback.
+	*/
+	void wait() {
+		std::exception_ptr error;
+		std::future<void> *threads[] = {&builder, &deliverer};
+		for (std::future<void> *thread : threads) {
+			if (thread->valid()) {
+				try {
+					thread->get();
+				}
+				catch (...) {
+					if (!error) {
+						error = std::current_exception();
+					}
+				}
+			}
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	/**
+		Waits for the build and returns the levels that were built, finest first
+		(all numDownsamples(A) of them unless the build was cancelled).
+	*/
+	const std::vector<ArrayNd<T, NumDims> > &get() {
+		wait();
+		while (results.size() > num_built) {
+			results.pop_back();
+		}
+		return results;
+	}
+};
+
+
+/**
+    Asynchronous version of computeDownsamplesParallel(..) that delivers the levels as they are computed.
+
+	computeDownsamplesParallel(..) returns when the whole pyramid is done, so a caller that writes the levels
+	to storage starts only then. Here the function returns at once: callback(l, level) is called for every level
+	as soon as it is built, finest first, on a thread of its own, so the I/O of level l overlaps with
+	the computation of level l+1. Callers that need only the first few levels return false from the callback
+	(or call cancel() on the handle) and the remaining levels are not computed.
+	The levels are bit-identical to computeDownsamplesParallel(..).
+
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T,
+			it must not change until the returned handle is destroyed
+		callback - called with each level, see AsyncPyramid<T, NumDims>::Callback
+	Returns the handle of the build, see AsyncPyramid.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+std::unique_ptr<AsyncPyramid<T, NumDims> > computeDownsamplesAsync(const ArrayNd<T, NumDims> &A,
+		const typename AsyncPyramid<T, NumDims>::Callback &callback) {
+	return std::unique_ptr<AsyncPyramid<T, NumDims> >(new AsyncPyramid<T, NumDims>(A, callback, (Histogram *)0));
+}
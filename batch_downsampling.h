@@ -0,0 +1,144 @@
+/**
+	Downsampling assignment
+
+	batch_downsampling.h
+*/
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include "downsampling.h"
+
+
+/**
+	Pool of HistogramLevels<Histogram> shared by the images of a batch.
+	An image takes levels from the pool for the time it is processed and gives them back, so the buffers and
+	arenas grown by one image are reused by the next ones. The pool only grows up to the number of images
+	processed at the same time.
+	Levels are not tied to threads: with nested parallelism a thread that waits for the inner loop of one image
+	may start another image, which must not get the same levels.
+*/
+template <typename Histogram>
+class LevelsPool {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<HistogramLevels<Histogram> > > levels;
+
+public:
+	std::unique_ptr<HistogramLevels<Histogram> > acquire() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (levels.empty()) {
+			return std::unique_ptr<HistogramLevels<Histogram> >(new HistogramLevels<Histogram>());
+		}
+		std::unique_ptr<HistogramLevels<Histogram> > result = std::move(levels.back());
+		levels.pop_back();
+		return result;
+	}
+
+	void release(std::unique_ptr<HistogramLevels<Histogram> > used) {
+		std::lock_guard<std::mutex> lock(mutex);
+		levels.push_back(std::move(used));
+	}
+};
+
+
+/**
+	Scratch memory of computeDownsamplesBatch(..) for the given Histogram type.
+	Pass the same object to several calls to reuse the memory across batches.
+*/
+template <typename T, typename Histogram>
+struct BatchScratch {
+	LevelsPool<Histogram> levels;
+
+	LevelsPool<Histogram> &pool(Histogram *) {
+		return levels;
+	}
+};
+
+
+/**
+	AutoHistogram version of BatchScratch: a pool for each histogram type withAutoHistogram(..) can pick,
+	since every image of a batch gets its own type.
+*/
+template <typename T>
+struct BatchScratch<T, AutoHistogram> {
+	LevelsPool<CompactHistogram<T> > compact;
+	LevelsPool<DenseHistogram<T, 16> > dense16;
+	LevelsPool<DenseHistogram<T, 64> > dense64;
+
+	LevelsPool<CompactHistogram<T> > &pool(CompactHistogram<T> *) {
+		return compact;
+	}
+
+	LevelsPool<DenseHistogram<T, 16> > &pool(DenseHistogram<T, 16> *) {
+		return dense16;
+	}
+
+	LevelsPool<DenseHistogram<T, 64> > &pool(DenseHistogram<T, 64> *) {
+		return dense64;
+	}
+};
+
+
+/**
+	Builds the pyramid of one image of a batch with levels from the pool of scratch.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Scratch>
+void buildBatchPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, Scratch &scratch, Histogram *) {
+	LevelsPool<Histogram> &pool = scratch.pool((Histogram *)0);
+	std::unique_ptr<HistogramLevels<Histogram> > levels = pool.acquire();
+	buildPyramid(A, results, true, *levels);
+	pool.release(std::move(levels));
+}
+
+template <typename T, std::size_t NumDims, typename Scratch>
+void buildBatchPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, Scratch &scratch, AutoHistogram *) {
+	withAutoHistogram(A, true, [&](auto *histogram) {
+		buildBatchPyramid(A, results, scratch, histogram);
+	});
+}
+
+
+/**
+    Computes the pyramids of a batch of images (e.g. the slices of a volume), like computeDownsamplesParallel(..)
+	for each of them.
+
+	Calling computeDownsamplesParallel(..) in a loop runs the parallel loops of one image at a time, so the small
+	images and the coarse levels of every image leave most threads idle, and every image allocates its levels of
+	hashmaps from scratch. Here the images are a parallel loop themselves and the loops of every image are nested
+	in it: TBB runs levels of different images at the same time and threads steal work across images.
+	The levels of hashmaps come from a pool (see LevelsPool) and are reused by the following images.
+
+	Parameters:
+		images - pointer to the first of num_images images, of any sizes (powers of 2)
+		num_images - number of images in the batch
+		results - Output, results[i] contains all l-downsamplings of images[i]
+		scratch - if not null, the scratch memory is taken from (and kept in) this object
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesBatch(const ArrayNd<T, NumDims> *images, std::size_t num_images,
+							 std::vector<std::vector<ArrayNd<T, NumDims> > > &results, BatchScratch<T, Histogram> *scratch = 0) {
+	std::unique_ptr<BatchScratch<T, Histogram> > local_scratch;
+	if (!scratch) {
+		local_scratch.reset(new BatchScratch<T, Histogram>());
+		scratch = local_scratch.get();
+	}
+
+	results.resize(num_images);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, num_images, 1), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(); i != r.end(); ++i) {
+			results[i].clear();
+			buildBatchPyramid(images[i], results[i], *scratch, (Histogram *)0);
+		}
+	});
+}
+
+
+/**
+	computeDownsamplesBatch(..) for a vector of images.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesBatch(const std::vector<ArrayNd<T, NumDims> > &images, std::vector<std::vector<ArrayNd<T, NumDims> > > &results,
+							 BatchScratch<T, Histogram> *scratch = 0) {
+	computeDownsamplesBatch<T, NumDims, Histogram>(images.data(), images.size(), results, scratch);
+}
@@ -0,0 +1,407 @@
+/**
+	Downsampling assignment
+
+	benchmark.cpp
+
+	Benchmark driver, a separate program from main.cpp:
+		g++ -O3 -march=native -DNDEBUG -std=c++17 benchmark.cpp downsampling.cpp utilities.cpp simd_modes.cpp -ltbb -o benchmark
+		./benchmark [size] 
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include "async_downsampling.h"
+#include "batch_downsampling.h"
+#include "block_statistics.h"
+#include "dataflow_downsampling.h"
+#include "foreground_downsampling.h"
+#include "morton_downsampling.h"
+#include "persistent_pyramid.h"
+#include "pyramid_profile.h"
+
+/**
+	Seconds elapsed since start.
+*/
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+	Bytes of hashmap levels from `first_level` down to the coarsest level of an image of size x size pixels.
+	Every such level is written to memory once and read back once by the next level, 
+	so this is the memory traffic that the tiled traversal avoids for the levels computed within tiles.
+*/
+template <typename Histogram>
+static double levelBytes(size_t size, size_t first_level) {
+	double bytes = 0;
+	for (size_t extent = size >> first_level; extent >= 1; extent /= 2) {
+		bytes += 2.0 * extent * extent * sizeof(Histogram);
+	}
+	return bytes;
+}
+
+/**
+	Times computeDownsamplesParallel(..) (breadth first) against computeDownsamplesTiled(..) (depth first)
+	for the histogram type Histogram and checks that they produce the same pyramid.
+*/
+template <typename Histogram>
+static void benchTiled(const UintArray2d &A, const char *name) {
+	size_t size = A.shape()[0];
+	size_t tile_levels = numDownsamples(std::array<size_t, 2>{{defaultTileSize<2>(), defaultTileSize<2>()}});
+
+	std::vector<UintArray2d> breadth_first;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	computeDownsamplesParallel<unsigned int, 2, Histogram>(A, breadth_first);
+	double breadth_first_seconds = secondsSince(start);
+
+	std::vector<UintArray2d> tiled;
+	start = std::chrono::steady_clock::now();
+	computeDownsamplesTiled<unsigned int, 2, Histogram>(A, tiled);
+	double tiled_seconds = secondsSince(start);
+
+	/// breadth first, 2-d images of unsigned int start with hashmaps at level 2 (see createFirstLevels(..))
+	double pixels = (double)A.num_elements();
+	std::cout << name << " breadth-first: " << breadth_first_seconds << " s, " << pixels / breadth_first_seconds / 1e6 << " Mpixels/s, "
+		<< levelBytes<Histogram>(size, 2) / 1e6 << " MB of hashmap levels through memory" << std::endl;
+	std::cout << name << " tiled:         " << tiled_seconds << " s, " << pixels / tiled_seconds / 1e6 << " Mpixels/s, "
+		<< levelBytes<Histogram>(size, tile_levels) / 1e6 << " MB of hashmap levels through memory"
+		<< (tiled == breadth_first ? "" : " (RESULTS DIFFER)") << std::endl;
+}
+
+/**
+	Times computeDownsamplesDataflow(..) (no barriers between levels) and prints the utilization of the threads
+	at every level. With one loop per level the coarse levels run on one thread while the others wait.
+*/
+template <typename Histogram>
+static void benchDataflow(const UintArray2d &A, const char *name) {
+	std::vector<UintArray2d> tiled;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	computeDownsamplesTiled<unsigned int, 2, Histogram>(A, tiled);
+	double tiled_seconds = secondsSince(start);
+
+	std::vector<UintArray2d> dataflow;
+	PyramidTrace trace;
+	start = std::chrono::steady_clock::now();
+	computeDownsamplesDataflow<unsigned int, 2, Histogram>(A, dataflow, defaultTileSize<2>(), &trace);
+	double dataflow_seconds = secondsSince(start);
+
+	std::cout << name << " dataflow: " << dataflow_seconds << " s (tiled with a barrier per level: " << tiled_seconds << " s) on "
+		<< trace.num_threads << " threads" << (dataflow == tiled ? "" : " (RESULTS DIFFER)") << std::endl;
+	printTrace(std::cout, trace);
+}
+
+/**
+	Times an edit of a 64x64 region applied to a PersistentPyramid against recomputing the whole pyramid.
+*/
+template <typename Histogram>
+static void benchUpdate(const UintArray2d &A, const char *name) {
+	PersistentPyramid<unsigned int, 2, Histogram> pyramid(A);
+
+	UintArray2d patch(boost::extents[64][64]);
+	std::fill(patch.data(), patch.data() + patch.num_elements(), 1u);
+	std::array<size_t, 2> corner = {{A.shape()[0] / 3, A.shape()[1] / 3}};
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	pyramid.update(corner, patch);
+	double update_seconds = secondsSince(start);
+
+	std::vector<UintArray2d> results;
+	start = std::chrono::steady_clock::now();
+	computeDownsamplesParallel<unsigned int, 2, Histogram>(pyramid.image(), results);
+	double full_seconds = secondsSince(start);
+
+	std::cout << name << " 64x64 edit: " << update_seconds * 1e3 << " ms incremental, " << full_seconds * 1e3 << " ms full recompute"
+		<< (results == pyramid.downsamples() ? "" : " (RESULTS DIFFER)") << std::endl;
+}
+
+/**
+	Times the mode of a large rectangle from the histogram pyramid (PersistentPyramid::regionMode(..))
+	against counting its pixels.
+*/
+template <typename Histogram>
+static void benchQuery(const UintArray2d &A, const char *name) {
+	PersistentPyramid<unsigned int, 2, Histogram> pyramid(A);
+	std::array<size_t, 2> corner = {{A.shape()[0] / 8 + 3, A.shape()[1] / 8 + 5}};
+	std::array<size_t, 2> extents = {{A.shape()[0] / 2 + 7, A.shape()[1] / 2 + 1}};
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	unsigned int mode = pyramid.regionMode(corner, extents);
+	double query_seconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	HashMap counts;
+	for (size_t i = corner[0]; i != corner[0] + extents[0]; ++i) {
+		for (size_t j = corner[1]; j != corner[1] + extents[1]; ++j) {
+			++counts[A[i][j]];
+		}
+	}
+	unsigned int scanned_mode = findMode(counts);
+	double scan_seconds = secondsSince(start);
+
+	std::cout << name << " mode of a " << extents[0] << "x" << extents[1] << " region: " << query_seconds * 1e3 << " ms from the pyramid, "
+		<< scan_seconds * 1e3 << " ms scanning pixels" << (mode == scanned_mode ? "" : " (RESULTS DIFFER)") << std::endl;
+}
+
+/**
+	Times computeDownsamplesBatch(..) against computeDownsamplesParallel(..) called for each image,
+	on num_images slices of size x size pixels that look like a segmentation (regions of one label
+	with their own ids, plus noise). Reports images per second.
+*/
+static void benchBatch(size_t num_images, size_t size) {
+	std::vector<UintArray2d> slices;
+	std::mt19937 generator(2);
+	for (size_t i = 0; i != num_images; ++i) {
+		slices.push_back(UintArray2d(boost::extents[size][size]));
+		for (size_t y = 0; y != size; ++y) {
+			for (size_t x = 0; x != size; ++x) {
+				slices.back()[y][x] = generator() % 32 == 0 ? generator() % 5000 : (unsigned int)(i / 8 * 100 + y / 37 * 10 + x / 41);
+			}
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::vector<UintArray2d> > one_by_one(num_images);
+	for (size_t i = 0; i != num_images; ++i) {
+		computeDownsamplesParallel<unsigned int, 2>(slices[i], one_by_one[i]);
+	}
+	double loop_seconds = secondsSince(start);
+
+	BatchScratch<unsigned int, AutoHistogram> scratch;
+	std::vector<std::vector<UintArray2d> > batch;
+	computeDownsamplesBatch(slices, batch, &scratch);
+	start = std::chrono::steady_clock::now();
+	computeDownsamplesBatch(slices, batch, &scratch);
+	double batch_seconds = secondsSince(start);
+
+	std::cout << num_images << " slices of " << size << "x" << size << ": " << num_images / batch_seconds << " images/s batched, " 
+		<< num_images / loop_seconds << " images/s one by one" << (batch == one_by_one ? "" : " (RESULTS DIFFER)") << std::endl;
+}
+
+/**
+	Times computeDownsamplesParallel(..) of the same labels stored as pixels of type T.
+*/
+template <typename T>
+static void benchWidth(const UintArray2d &A, const char *name) {
+	ArrayNd<T, 2> narrow(boost::extents[A.shape()[0]][A.shape()[1]]);
+	std::copy(A.data(), A.data() + A.num_elements(), narrow.data());
+
+	std::vector<ArrayNd<T, 2> > results;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	computeDownsamplesParallel(narrow, results);
+	double seconds = secondsSince(start);
+	std::cout << name << " pixels: " << seconds << " s, " << A.num_elements() / seconds / 1e6 << " Mpixels/s, " 
+		<< A.num_elements() * sizeof(T) / 1e6 << " MB of input" << std::endl;
+}
+
+/**
+	Times computeDownsamplesParallel(..) of a range of levels against the whole pyramid.
+*/
+static void benchRange(const UintArray2d &A, LevelRange range, const char *name) {
+	std::vector<UintArray2d> all;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	computeDownsamplesParallel<unsigned int, 2>(A, all);
+	double all_seconds = secondsSince(start);
+
+	std::vector<UintArray2d> wanted;
+	start = std::chrono::steady_clock::now();
+	computeDownsamplesParallel<unsigned int, 2>(A, wanted, range);
+	double range_seconds = secondsSince(start);
+
+	LevelRange resolved = range.resolve(all.size());
+	bool same = wanted.size() == resolved.size();
+	for (size_t i = 0; same && i != wanted.size(); ++i) {
+		same = wanted[i] == all[resolved.first - 1 + i];
+	}
+	std::cout << name << ": levels " << resolved.first << "-" << resolved.last << " " << range_seconds << " s, all levels " 
+		<< all_seconds << " s" << (same ? "" : " (RESULTS DIFFER)") << std::endl;
+}
+
+/**
+	Times the modes plus RunnerUp, ModeShare and NumLabels in one pass against a pass for the modes 
+	and a separate pass for each statistic.
+*/
+static void benchStatistics(const UintArray2d &A, const char *name) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<UintArray2d> modes, runner_up_modes, share_modes, labels_modes;
+	StatisticPyramids<unsigned int, 2, RunnerUp> runner_up;
+	StatisticPyramids<unsigned int, 2, ModeShare> share;
+	StatisticPyramids<unsigned int, 2, NumLabels> labels;
+	computeDownsamplesParallel<unsigned int, 2>(A, modes);
+	computeDownsamplesParallel(A, runner_up_modes, runner_up);
+	computeDownsamplesParallel(A, share_modes, share);
+	computeDownsamplesParallel(A, labels_modes, labels);
+	double separate_seconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	std::vector<UintArray2d> fused_modes;
+	StatisticPyramids<unsigned int, 2, RunnerUp, ModeShare, NumLabels> fused;
+	computeDownsamplesParallel(A, fused_modes, fused);
+	double fused_seconds = secondsSince(start);
+
+	bool same = fused_modes == modes && fused.get<RunnerUp>() == runner_up.get<RunnerUp>() 
+		&& fused.get<ModeShare>() == share.get<ModeShare>() && fused.get<NumLabels>() == labels.get<NumLabels>();
+	std::cout << name << ": modes and 3 statistics in one pass " << fused_seconds << " s, in 4 passes " 
+		<< separate_seconds << " s" << (same ? "" : " (RESULTS DIFFER)") << std::endl;
+}
+
+/**
+	Compares computeDownsamplesForeground(..) on a segmentation that is mostly background (label 0)
+	with computeDownsamplesParallel(..), which counts the background too.
+*/
+static void benchForeground(size_t size, double foreground_share) {
+	UintArray2d A(boost::extents[size][size]);
+	std::fill(A.data(), A.data() + A.num_elements(), 0u);
+	std::mt19937 generator(1);
+	const size_t blob = 64;
+	for (size_t b = 0; b != (size_t)(foreground_share * size * size / (blob * blob)); ++b) {
+		size_t y0 = generator() % (size - blob), x0 = generator() % (size - blob);
+		for (size_t y = y0; y != y0 + blob; ++y) {
+			for (size_t x = x0; x != x0 + blob; ++x) {
+				A[y][x] = 1 + generator() % 8;
+			}
+		}
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<UintArray2d> results;
+	computeDownsamplesParallel(A, results);
+	double all_seconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	ForegroundTiles<2> tiles = findForegroundTiles(A, IgnoredLabels<unsigned int>(0u));
+	double scan_seconds = secondsSince(start);
+	std::vector<UintArray2d> foreground_results;
+	computeDownsamplesForeground(A, foreground_results, IgnoredLabels<unsigned int>(0u), &tiles);
+	double foreground_seconds = secondsSince(start);
+
+	std::cout << "ignored background, " << (int)(foreground_share * 100) << "% foreground: " << foreground_seconds 
+		<< " s (scan " << scan_seconds << " s, " << tiles.tiles.size() << " of " << product(tiles.num_tiles) 
+		<< " tiles), all labels " << all_seconds << " s" << std::endl;
+}
+
+/**
+	Compares the Z-order engine with the row-major one for the Histogram type: with the conversions
+	from and to row-major, and on an image that is in Z-order already.
+*/
+template <typename Histogram>
+static void benchMorton(const UintArray2d &A, const char *name) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<UintArray2d> results;
+	computeDownsamplesParallel<unsigned int, 2, Histogram>(A, results);
+	double row_major_seconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	std::vector<UintArray2d> morton_results;
+	computeDownsamplesMorton<unsigned int, 2, Histogram>(A, morton_results);
+	double converted_seconds = secondsSince(start);
+
+	MortonArray<unsigned int, 2> M;
+	toMorton(A, M);
+	start = std::chrono::steady_clock::now();
+	std::vector<MortonArray<unsigned int, 2> > levels;
+	computeDownsamplesMorton<unsigned int, 2, Histogram>(M, levels);
+	double morton_seconds = secondsSince(start);
+
+	std::cout << name << ": z-order " << morton_seconds << " s, with conversions " << converted_seconds 
+		<< " s, row-major " << row_major_seconds << " s" << (morton_results == results ? "" : " (RESULTS DIFFER)") << std::endl;
+}
+
+/**
+	Cost of recording a PyramidProfile, and the profile itself as JSON.
+*/
+static void benchProfile(const UintArray2d &A, const char *name) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<UintArray2d> results;
+	computeDownsamplesParallel(A, results);
+	double seconds = secondsSince(start);
+
+	start = std::chrono::steady_clock::now();
+	std::vector<UintArray2d> profiled_results;
+	PyramidProfile profile;
+	computeDownsamplesParallel(A, profiled_results, profile);
+	double profiled_seconds = secondsSince(start);
+
+	std::cout << name << ": profiled " << profiled_seconds << " s, not profiled " << seconds << " s"
+		<< (profiled_results == results ? "" : " (RESULTS DIFFER)") << std::endl;
+	writeJson(std::cout, profile);
+	std::cout << std::endl;
+}
+
+/**
+	Writes a level to file, the consumer of benchAsync(..).
+*/
+static bool writeLevel(std::FILE *file, const UintArray2d &level) {
+	std::fwrite(level.data(), sizeof(unsigned int), level.num_elements(), file);
+	std::fflush(file);
+	return true;
+}
+
+/**
+	Times computing the pyramid and then writing every level to a temporary file against 
+	computeDownsamplesAsync(..) writing each level while the next one is computed.
+*/
+static void benchAsync(const UintArray2d &A, const char *name) {
+	std::FILE *file = std::tmpfile();
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<UintArray2d> results;
+	computeDownsamplesParallel<unsigned int, 2>(A, results);
+	for (size_t l = 0; l != results.size(); ++l) {
+		writeLevel(file, results[l]);
+	}
+	double sync_seconds = secondsSince(start);
+
+	std::rewind(file);
+	start = std::chrono::steady_clock::now();
+	std::unique_ptr<AsyncPyramid<unsigned int, 2> > pyramid = computeDownsamplesAsync(A,
+		[&](std::size_t, const UintArray2d &level) { return writeLevel(file, level); });
+	pyramid->wait();
+	double async_seconds = secondsSince(start);
+	std::fclose(file);
+
+	std::cout << name << ": compute then write " << sync_seconds << " s, async " << async_seconds << " s" 
+		<< (pyramid->get() == results ? "" : " (RESULTS DIFFER)") << std::endl;
+}
+
+/**
+	Returns a size x size image of random labels in [0, num_labels).
+*/
+static UintArray2d randomImage(size_t size, unsigned int num_labels) {
+	UintArray2d A(boost::extents[size][size]);
+	std::mt19937 generator(1);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = generator() % num_labels;
+	}
+	return A;
+}
+
+int main(int argc, char **argv) {
+	size_t size = argc > 1 ? std::atoi(argv[1]) : 4096;
+
+	UintArray2d few_labels = randomImage(size, 8);
+	benchWidth<uint8_t>(few_labels, "8 labels, uint8");
+	benchWidth<uint16_t>(few_labels, "8 labels, uint16");
+	benchWidth<unsigned int>(few_labels, "8 labels, uint32");
+	benchWidth<uint64_t>(few_labels, "8 labels, uint64");
+	benchTiled<DenseHistogram<unsigned int, 16> >(few_labels, "dense16, 8 labels");
+	benchDataflow<DenseHistogram<unsigned int, 16> >(few_labels, "dense16, 8 labels");
+	benchUpdate<DenseHistogram<unsigned int, 16> >(few_labels, "dense16, 8 labels");
+	benchQuery<DenseHistogram<unsigned int, 16> >(few_labels, "dense16, 8 labels");
+	benchAsync(few_labels, "8 labels");
+	benchRange(few_labels, LevelRange(3, 5), "8 labels");
+	benchRange(few_labels, LevelRange(LevelRange::coarsest), "8 labels");
+	benchStatistics(few_labels, "8 labels");
+	benchProfile(few_labels, "8 labels");
+	benchForeground(size, 0.1);
+	benchMorton<DenseHistogram<unsigned int, 16> >(few_labels, "dense16, 8 labels");
+
+	UintArray2d many_labels = randomImage(size, 1000000);
+	benchTiled<CompactHistogram<unsigned int> >(many_labels, "compact, 10^6 labels");
+	benchMorton<CompactHistogram<unsigned int> >(many_labels, "compact, 10^6 labels");
+
+	benchBatch(512, 256);
+	return 0;
+}
@@ -0,0 +1,131 @@
+/**
+	Downsampling assignment
+
+	benchmark_suite.cpp
+
+	Regression benchmark, a separate program from main.cpp and benchmark.cpp:
+		g++ -O3 -march=native -DNDEBUG -std=c++17 benchmark_suite.cpp downsampling.cpp utilities.cpp simd_modes.cpp -ltbb -o benchmark_suite
+		./benchmark_suite [max_size] [repeats] [max_threads] [seed] > results.jsonl
+
+	Times computeDownsamples(..) and computeDownsamplesParallel(..) with 1, 2, 4 .. max_threads threads
+	on the synthetic images of every regime (see syntheticImage(..)), for sizes 1024^2 .. max_size^2.
+	The "numa" lines split the same threads between the NUMA nodes of the machine, each node building its
+	partition of the image (see ExecutionContext), to compare with the "parallel" lines across sockets;
+	on a machine with a single node, or with 1 thread, both are the same run.
+	Each line of the output is a JSON object with the median time of the repeats, the throughput and
+	the peak resident memory of the run, so runs on different builds can be compared by a script.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include "execution_context.h"
+#include "synthetic_images.h"
+
+/**
+	Resets the peak resident memory of the process, so peakRssBytes() reports the peak of what follows
+	(Linux only: writing 5 to /proc/self/clear_refs resets VmHWM).
+*/
+static void resetPeakRss() {
+	std::ofstream clear_refs("/proc/self/clear_refs");
+	clear_refs << "5";
+}
+
+/**
+	Returns the peak resident memory of the process in bytes (VmHWM), 0 where /proc is not available.
+*/
+static size_t peakRssBytes() {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, 6, "VmHWM:") == 0) {
+			return (size_t)std::atoll(line.c_str() + 6) * 1024;
+		}
+	}
+	return 0;
+}
+
+/**
+	Time of one run and the peak memory during it.
+*/
+struct Run {
+	double seconds;
+	size_t peak_rss_bytes;
+};
+
+/**
+	Runs build repeats times and returns the median time and the largest peak memory.
+	The outputs are freed before every run, so their allocation is part of the time.
+*/
+template <typename Build>
+static Run medianRun(int repeats, Build build) {
+	std::vector<double> seconds;
+	size_t peak_rss_bytes = 0;
+	for (int i = 0; i != repeats; ++i) {
+		std::vector<UintArray2d> results;
+		resetPeakRss();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		build(results);
+		seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		peak_rss_bytes = std::max(peak_rss_bytes, peakRssBytes());
+	}
+	std::sort(seconds.begin(), seconds.end());
+	Run run = {seconds[seconds.size() / 2], peak_rss_bytes};
+	return run;
+}
+
+/**
+	Writes a result as one line of JSON.
+*/
+static void report(ImageRegime regime, size_t size, const char *mode, int threads, const Run &run, double serial_seconds) {
+	double pixels = (double)size * size;
+	std::cout << "{\"regime\": \"" << regimeName(regime) << "\", \"size\": " << size << ", \"mode\": \"" << mode
+		<< "\", \"threads\": " << threads << ", \"seconds\": " << run.seconds << ", \"mpixels_per_second\": " << pixels / run.seconds / 1e6
+		<< ", \"speedup\": " << serial_seconds / run.seconds << ", \"peak_rss_bytes\": " << run.peak_rss_bytes
+		<< ", \"input_bytes\": " << (size_t)pixels * sizeof(unsigned int) << "}" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	size_t max_size = argc > 1 ? std::atoll(argv[1]) : 4096;
+	int repeats = argc > 2 ? std::atoi(argv[2]) : 3;
+	int max_threads = argc > 3 ? std::atoi(argv[3]) : tbb::this_task_arena::max_concurrency();
+	uint64_t seed = argc > 4 ? std::atoll(argv[4]) : 1;
+
+	std::vector<int> thread_counts;
+	for (int threads = 1; threads < max_threads; threads *= 2) {
+		thread_counts.push_back(threads);
+	}
+	thread_counts.push_back(max_threads);
+
+	for (size_t size = 1024; size <= max_size; size *= 2) {
+		for (int r = 0; r != NUM_REGIMES; ++r) {
+			ImageRegime regime = (ImageRegime)r;
+			UintArray2d A = syntheticImage(regime, size, seed);
+
+			Run serial = medianRun(repeats, [&](std::vector<UintArray2d> &results) {
+				computeDownsamples(A, results);
+			});
+			report(regime, size, "serial", 1, serial, serial.seconds);
+
+			for (std::size_t t = 0; t != thread_counts.size(); ++t) {
+				ExecutionContext context(thread_counts[t]);
+				Run parallel = medianRun(repeats, [&](std::vector<UintArray2d> &results) {
+					computeDownsamplesParallel(A, results, context);
+				});
+				report(regime, size, "parallel", thread_counts[t], parallel, serial.seconds);
+			}
+
+			for (std::size_t t = 0; t != thread_counts.size(); ++t) {
+				ExecutionContext context(thread_counts[t], true);
+				Run numa = medianRun(repeats, [&](std::vector<UintArray2d> &results) {
+					computeDownsamplesParallel(A, results, context);
+				});
+				report(regime, size, "numa", thread_counts[t], numa, serial.seconds);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,270 @@
+/**
+	Downsampling assignment
+
+	block_statistics.h
+*/
+
+#pragma once
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "downsampling.h"
+
+
+/**
+	Statistics of a block that can be computed from its histogram together with the mode
+	(see computeDownsamplesParallel(..) with StatisticPyramids).
+	Each one is a struct with a Reducer<T> template: Reducer<T>::value_type is the pixel type of its pyramid,
+	add(label, count) is called for every label of the histogram of a block and result() returns the statistic.
+*/
+
+/**
+	Second most frequent label of a block (ties are broken as for the mode, see isBetterMode(..)).
+	Equal to the mode for uniform blocks.
+*/
+struct RunnerUp {
+	template <typename T>
+	struct Reducer {
+		typedef T value_type;
+
+		T best, second;
+		unsigned int best_count, second_count;
+
+		Reducer() : best(), second(), best_count(0), second_count(0) {}
+
+		void add(T label, unsigned int count) {
+			if (isBetterMode(label, count, best, best_count)) {
+				second = best;
+				second_count = best_count;
+				best = label;
+				best_count = count;
+			}
+			else if (isBetterMode(label, count, second, second_count)) {
+				second = label;
+				second_count = count;
+			}
+		}
+
+		T result() const {
+			return second_count != 0 ? second : best;
+		}
+	};
+};
+
+
+/**
+	Share of the pixels of a block that have the mode label, in (0, 1] (purity of the block).
+*/
+struct ModeShare {
+	template <typename T>
+	struct Reducer {
+		typedef float value_type;
+
+		unsigned int max_count, total;
+
+		Reducer() : max_count(0), total(0) {}
+
+		void add(T, unsigned int count) {
+			max_count = count > max_count ? count : max_count;
+			total += count;
+		}
+
+		float result() const {
+			return (float)max_count / (float)total;
+		}
+	};
+};
+
+
+/**
+	Number of distinct labels of a block.
+*/
+struct NumLabels {
+	template <typename T>
+	struct Reducer {
+		typedef unsigned int value_type;
+
+		unsigned int num_labels;
+
+		Reducer() : num_labels(0) {}
+
+		void add(T, unsigned int) {
+			++num_labels;
+		}
+
+		unsigned int result() const {
+			return num_labels;
+		}
+	};
+};
+
+
+/**
+	Position of Statistic in the list of statistics (a compile error if it is not in the list).
+*/
+template <typename Statistic, typename First, typename... Rest>
+struct StatisticIndex : std::integral_constant<std::size_t, 1 + StatisticIndex<Statistic, Rest...>::value> {};
+
+template <typename Statistic, typename... Rest>
+struct StatisticIndex<Statistic, Statistic, Rest...> : std::integral_constant<std::size_t, 0> {};
+
+
+/**
+	Statistics parameter of ParallelCreateMaps and ParallelMergeMaps that computes the Statistics of every cell
+	of a level from its histogram (a single pass over the labels for all of them) and writes them to their images.
+*/
+template <typename T, std::size_t NumDims, typename... Statistics>
+class BlockStatistics {
+	std::tuple<ArrayView<typename Statistics::template Reducer<T>::value_type, NumDims>...> outputs;
+
+	template <std::size_t... I>
+	void store(const std::tuple<typename Statistics::template Reducer<T>...> &reducers, const std::array<size_t, NumDims> &cell,
+			   std::index_sequence<I...>) const {
+		((std::get<I>(outputs)(cell) = std::get<I>(reducers).result()), ...);
+	}
+
+public:
+	BlockStatistics(const ArrayView<typename Statistics::template Reducer<T>::value_type, NumDims> &... outputs) : outputs(outputs...) {}
+
+	template <typename Histogram>
+	void operator()(const Histogram &hist, const std::array<size_t, NumDims> &cell) const {
+		std::tuple<typename Statistics::template Reducer<T>...> reducers;
+		forEachCount(hist, [&](T label, unsigned int count) {
+			std::apply([&](auto &... reducer) { (reducer.add(label, count), ...); }, reducers);
+		});
+		store(reducers, cell, std::index_sequence_for<Statistics...>());
+	}
+};
+
+
+/**
+	Output of computeDownsamplesParallel(..) with statistics: a pyramid for each of the Statistics,
+	aligned with the pyramid of modes (get<S>()[l] has the extents of the (l+1)-downsample).
+	E.g. StatisticPyramids<unsigned int, 2, RunnerUp, ModeShare, NumLabels>.
+*/
+template <typename T, std::size_t NumDims, typename... Statistics>
+class StatisticPyramids {
+	std::tuple<std::vector<ArrayNd<typename Statistics::template Reducer<T>::value_type, NumDims> >...> pyramids;
+
+	template <std::size_t... I>
+	void reserve(std::size_t n, std::index_sequence<I...>) {
+		(std::get<I>(pyramids).reserve(std::get<I>(pyramids).size() + n), ...);
+	}
+
+	template <std::size_t... I>
+	BlockStatistics<T, NumDims, Statistics...> addLevel(const std::array<size_t, NumDims> &extents, std::index_sequence<I...>) {
+		(std::get<I>(pyramids).emplace_back(extents), ...);
+		return BlockStatistics<T, NumDims, Statistics...>(makeView(std::get<I>(pyramids).back())...);
+	}
+
+public:
+	/**
+		The pyramid of Statistic, level 1 first.
+	*/
+	template <typename Statistic>
+	std::vector<ArrayNd<typename Statistic::template Reducer<T>::value_type, NumDims> > &get() {
+		return std::get<StatisticIndex<Statistic, Statistics...>::value>(pyramids);
+	}
+
+	/**
+		Makes room for n more levels in every pyramid, so adding them does not reallocate.
+	*/
+	void reserve(std::size_t n) {
+		reserve(n, std::index_sequence_for<Statistics...>());
+	}
+
+	/**
+		Appends a level with the given extents to every pyramid and returns the statistics that fill it.
+	*/
+	BlockStatistics<T, NumDims, Statistics...> addLevel(const std::array<size_t, NumDims> &extents) {
+		return addLevel(extents, std::index_sequence_for<Statistics...>());
+	}
+};
+
+
+/**
+	computeDownsamplesParallel(..) with statistics, for a given Histogram type (see buildPyramid(..)).
+	Every level is built from the histograms of the previous one as in the engine, with the statistics computed
+	by the same loop. The SIMD first level is not used: the statistics of level 1 need its histograms.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename... Statistics>
+void buildStatisticsPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results,
+							StatisticPyramids<T, NumDims, Statistics...> &statistics, bool parallel, Histogram *) {
+	typedef BlockStatistics<T, NumDims, Statistics...> LevelStatistics;
+
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		assert((A.shape()[k] & (A.shape()[k] - 1)) == 0 && "extents of A must be powers of 2");
+	}
+	std::size_t num_levels = numDownsamples(A);
+	results.reserve(results.size() + num_levels);
+	statistics.reserve(num_levels);
+
+	HistogramLevels<Histogram> levels;
+	std::array<size_t, NumDims> previous_extents;
+	std::array<size_t, NumDims> extents = halfExtents(A);
+	for (std::size_t l = 1; l <= num_levels; ++l) {
+		results.emplace_back(extents);
+		LevelStatistics level_statistics = statistics.addLevel(extents);
+		std::vector<Histogram> &output = levels.next(product(extents));
+
+		if (l == 1) {
+			ParallelCreateMaps<T, NumDims, Histogram, LevelStatistics> parallelCreateMaps(makeView(A), makeView(output.data(), extents),
+				&levels.arenas[1 - levels.current], makeView(results.back()), level_statistics);
+			forEachBlock(product(extents), parallelCreateMaps, parallel);
+		}
+		else {
+			ParallelMergeMaps<T, NumDims, Histogram, LevelStatistics> parallelMergeMaps(
+				makeView(levels.buffers[levels.current].data(), previous_extents), makeView(output.data(), extents),
+				&levels.arenas[1 - levels.current], makeView(results.back()), level_statistics);
+			forEachBlock(product(extents), parallelMergeMaps, parallel);
+		}
+		levels.swap();
+
+		previous_extents = extents;
+		extents = halfExtents(extents);
+	}
+}
+
+
+/**
+	AutoHistogram version of buildStatisticsPyramid(..).
+*/
+template <typename T, std::size_t NumDims, typename... Statistics>
+void buildStatisticsPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results,
+							StatisticPyramids<T, NumDims, Statistics...> &statistics, bool parallel, AutoHistogram *) {
+	withAutoHistogram(A, parallel, [&](auto *histogram) {
+		buildStatisticsPyramid(A, results, statistics, parallel, histogram);
+	});
+}
+
+
+/**
+    computeDownsamplesParallel(..) that also computes per block statistics in the same pass.
+
+	The runner-up label, the share of the mode and the number of labels of every block are in the histograms
+	the engine builds for the modes anyway. Here they are computed from each histogram right after it is built,
+	so one traversal fills the pyramid of modes and an aligned pyramid for each of the Statistics
+	(RunnerUp, ModeShare, NumLabels, chosen at compile time; statistics that are not listed cost nothing).
+	The modes are bit-identical to computeDownsamplesParallel(..).
+
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - Output vector contains all l-downsamplings of the original image.
+		statistics - Output, the pyramids of the statistics (see StatisticPyramids)
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram, typename... Statistics>
+void computeDownsamplesParallel(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results,
+								StatisticPyramids<T, NumDims, Statistics...> &statistics) {
+	buildStatisticsPyramid(A, results, statistics, true, (Histogram *)0);
+}
+
+
+/**
+	Single threaded version of computeDownsamplesParallel(..) with statistics.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram, typename... Statistics>
+void computeDownsamples(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results,
+						StatisticPyramids<T, NumDims, Statistics...> &statistics) {
+	buildStatisticsPyramid(A, results, statistics, false, (Histogram *)0);
+}
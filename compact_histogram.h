@@ -0,0 +1,311 @@
+/**
+	Downsampling assignment
+
+	compact_histogram.h
+*/
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "utilities.h"
+
+
+/**
+	(label, count) pair stored by CompactHistogram<T>.
+*/
+template <typename T>
+struct LabelCount {
+	T label;
+	unsigned int count;
+};
+
+
+/**
+	Memory arena shared by all compact histograms of one pyramid level.
+	Every thread allocates from its own list of chunks by bumping a pointer, so allocations
+	need no locking and cost a few instructions. Nothing is freed individually:
+	reset() releases the memory of a whole level at once. The chunks are kept and reused by the next
+	level built in the arena, so a pyramid (or a batch of them, see computeDownsamplesBatch(..))
+	allocates chunks only until it reaches its largest level.
+*/
+template <typename T>
+class CompactArena {
+	static const std::size_t chunk_entries = std::size_t(1) << 16;
+
+	struct Local {
+		std::vector<std::unique_ptr<LabelCount<T>[]> > chunks;
+		std::vector<std::unique_ptr<LabelCount<T>[]> > large;   // allocations larger than a chunk
+		std::size_t num_used_chunks;
+		std::size_t used;    // number of entries used in chunks[num_used_chunks - 1]
+		std::vector<LabelCount<T> > scratch;
+
+		Local() : num_used_chunks(0), used(chunk_entries) {}
+
+		void recycle() {
+			large.clear();
+			num_used_chunks = 0;
+			used = chunk_entries;
+		}
+	};
+
+	PerThread<Local> locals;
+
+public:
+	/**
+		Returns uninitialized storage for n entries, valid until reset() is called.
+	*/
+	LabelCount<T> *allocate(std::size_t n) {
+		Local &local = locals.local();
+		if (n > chunk_entries) {
+			/// too large for a chunk, give it an allocation of its own (and keep bumping in the current chunk)
+			local.large.push_back(std::unique_ptr<LabelCount<T>[]>(new LabelCount<T>[n]));
+			return local.large.back().get();
+		}
+		if (local.used + n > chunk_entries) {
+			if (local.num_used_chunks == local.chunks.size()) {
+				local.chunks.push_back(std::unique_ptr<LabelCount<T>[]>(new LabelCount<T>[chunk_entries]));
+			}
+			++local.num_used_chunks;
+			local.used = 0;
+		}
+		LabelCount<T> *p = local.chunks[local.num_used_chunks - 1].get() + local.used;
+		local.used += n;
+		return p;
+	}
+
+	/**
+		Per thread buffer used while merging histograms.
+	*/
+	std::vector<LabelCount<T> > &scratch() {
+		return locals.local().scratch;
+	}
+
+	/**
+		Frees all histograms allocated from the arena (the chunks are kept for the next level).
+		Complexity: O(number of threads), independent of the number of histograms
+	*/
+	void reset() {
+		for (std::size_t i = 0; i != locals.size(); ++i) {
+			locals[i].recycle();
+		}
+	}
+
+	/**
+		Frees the histograms allocated by the calling thread only.
+		Used by tasks that own a level privately (e.g. the levels of a tile in computeDownsamplesTiled(..)).
+	*/
+	void resetLocal() {
+		locals.local().recycle();
+	}
+};
+
+
+/**
+	Compact histogram for images with many distinct labels (e.g. segmentations with 64-bit segment IDs).
+
+	The histogram is a sorted array of (label, count) pairs. Up to InlineCapacity pairs are stored inside
+	the object itself, larger histograms spill into the CompactArena of their pyramid level.
+	For uint32 labels a level-1 cell of a 2-d image takes 40 bytes, where BasicHashMap<T> needs
+	a bucket array and a heap node per label (about 300 bytes).
+
+	The object does not own spilled entries, copying it is shallow and the entries are released
+	together with the rest of the level by CompactArena<T>::reset().
+*/
+template <typename T, std::size_t InlineCapacity = 4>
+struct CompactHistogram {
+	unsigned int size;
+	union {
+		LabelCount<T> inline_entries[InlineCapacity];
+		LabelCount<T> *spilled_entries;
+	};
+
+	CompactHistogram() : size(0) {}
+
+	const LabelCount<T> *begin() const {
+		return size <= InlineCapacity ? inline_entries : spilled_entries;
+	}
+
+	const LabelCount<T> *end() const {
+		return begin() + size;
+	}
+
+	/**
+		Copies n sorted entries into the histogram, spilling into the arena if they do not fit inline.
+	*/
+	void assign(const LabelCount<T> *entries, std::size_t n, CompactArena<T> &arena) {
+		LabelCount<T> *dst = n <= InlineCapacity ? inline_entries : (spilled_entries = arena.allocate(n));
+		std::copy(entries, entries + n, dst);
+		size = (unsigned int)n;
+	}
+};
+
+
+template <typename T, std::size_t InlineCapacity>
+struct HistogramArena<CompactHistogram<T, InlineCapacity> > {
+	typedef CompactArena<T> type;
+};
+
+
+/**
+	Copies the spilled entries of hist into arena, so hist stays valid after its own arena is reset.
+*/
+template <typename T, std::size_t InlineCapacity>
+void relocateMap(CompactHistogram<T, InlineCapacity> &hist, CompactArena<T> &arena) {
+	if (hist.size > InlineCapacity) {
+		hist.assign(hist.begin(), hist.size, arena);
+	}
+}
+
+
+/**
+    Compact histogram version of createMap(..).
+	Parameters:
+		block - values of a 2x2..x2 block
+		hist - Output histogram
+		arena - arena of the level hist belongs to
+	Returns the mode of the block.
+	Complexity: O(BlockSize^2), the block is sorted with insertion sort
+*/
+template <typename T, std::size_t BlockSize, std::size_t InlineCapacity>
+T createMap(const std::array<T, BlockSize> &block, CompactHistogram<T, InlineCapacity> &hist, CompactArena<T> &arena) {
+	/// uniform block: a single entry, no sorting
+	bool uniform = true;
+	for (std::size_t i = 1; i != BlockSize; ++i) {
+		uniform = uniform && block[i] == block[0];
+	}
+	if (uniform) {
+		hist.inline_entries[0].label = block[0];
+		hist.inline_entries[0].count = (unsigned int)BlockSize;
+		hist.size = 1;
+		return block[0];
+	}
+
+	std::array<T, BlockSize> sorted = block;
+	for (std::size_t i = 1; i != BlockSize; ++i) {
+		T value = sorted[i];
+		std::size_t j = i;
+		for (; j != 0 && value < sorted[j - 1]; --j) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = value;
+	}
+
+	std::array<LabelCount<T>, BlockSize> entries;
+	std::size_t n = 0;
+	T mode = sorted[0];
+	unsigned int max_num_occurances = 0;
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		if (n != 0 && entries[n - 1].label == sorted[i]) {
+			++entries[n - 1].count;
+		}
+		else {
+			entries[n].label = sorted[i];
+			entries[n].count = 1;
+			++n;
+		}
+		if (isBetterMode(entries[n - 1].label, entries[n - 1].count, mode, max_num_occurances)) {
+			mode = entries[n - 1].label;
+			max_num_occurances = entries[n - 1].count;
+		}
+	}
+
+	hist.assign(entries.data(), n, arena);
+	return mode;
+}
+
+
+/**
+	Compact histogram version of mergeMaps(..).
+	The children are sorted by label, so they are combined with a single linear k-way merge
+	(no lookups): at every step the smallest label among the heads of the children is appended to the output
+	together with the sum of its counts.
+	Parameters:
+		maps - pointers to the 2^ndims histograms of a block
+		output_map - Output histogram
+		arena - arena of the level output_map belongs to
+	Returns the mode of the merged histogram.
+	Complexity: O(N * BlockSize) where N is the number of elements in output_map
+*/
+template <typename T, std::size_t BlockSize, std::size_t InlineCapacity>
+T mergeMaps(const std::array<CompactHistogram<T, InlineCapacity> *, BlockSize> &maps,
+			CompactHistogram<T, InlineCapacity> &output_map, CompactArena<T> &arena) {
+
+	/// uniform children with the same label (a histogram of size 1 is a uniform cell): O(BlockSize)
+	bool uniform = maps[0]->size == 1;
+	unsigned int uniform_count = 0;
+	for (std::size_t i = 0; i != BlockSize && uniform; ++i) {
+		uniform = maps[i]->size == 1 && maps[i]->inline_entries[0].label == maps[0]->inline_entries[0].label;
+		if (!uniform) {
+			break;
+		}
+		uniform_count += maps[i]->inline_entries[0].count;
+	}
+	if (uniform) {
+		output_map.inline_entries[0].label = maps[0]->inline_entries[0].label;
+		output_map.inline_entries[0].count = uniform_count;
+		output_map.size = 1;
+		return output_map.inline_entries[0].label;
+	}
+
+	std::array<const LabelCount<T> *, BlockSize> heads;
+	std::array<const LabelCount<T> *, BlockSize> ends;
+	std::size_t total = 0;
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		heads[i] = maps[i]->begin();
+		ends[i] = maps[i]->end();
+		total += maps[i]->size;
+	}
+
+	std::vector<LabelCount<T> > &merged = arena.scratch();
+	merged.resize(total);
+
+	std::size_t n = 0;
+	T mode = T();
+	unsigned int max_num_occurances = 0;
+	while (true) {
+		bool found = false;
+		T label = T();
+		for (std::size_t i = 0; i != BlockSize; ++i) {
+			if (heads[i] != ends[i] && (!found || heads[i]->label < label)) {
+				label = heads[i]->label;
+				found = true;
+			}
+		}
+		if (!found) {
+			break;
+		}
+
+		unsigned int count = 0;
+		for (std::size_t i = 0; i != BlockSize; ++i) {
+			if (heads[i] != ends[i] && heads[i]->label == label) {
+				count += heads[i]->count;
+				++heads[i];
+			}
+		}
+
+		merged[n].label = label;
+		merged[n].count = count;
+		++n;
+		if (isBetterMode(label, count, mode, max_num_occurances)) {
+			mode = label;
+			max_num_occurances = count;
+		}
+	}
+
+	output_map.assign(merged.data(), n, arena);
+	return mode;
+}
+
+
+/**
+	Calls function(label, count) for every entry of hist, in increasing order of labels.
+*/
+template <typename T, std::size_t InlineCapacity, typename Function>
+void forEachCount(const CompactHistogram<T, InlineCapacity> &hist, Function function) {
+	for (const LabelCount<T> *entry = hist.begin(); entry != hist.end(); ++entry) {
+		function(entry->label, entry->count);
+	}
+}
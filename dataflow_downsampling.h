@@ -0,0 +1,264 @@
+/**
+	Downsampling assignment
+
+	dataflow_downsampling.h
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include "tiled_downsampling.h"
+
+
+/**
+	A task of the dataflow pyramid: the level it produced and when it ran (seconds since the start of the build).
+*/
+struct TaskInterval {
+	std::size_t level;
+	double start;
+	double end;
+};
+
+
+/**
+	Schedule of a pyramid built by computeDownsamplesDataflow(..), for finding idle threads.
+	Tasks that take a tile through levels 1..tile_levels are recorded with level = tile_levels,
+	every other task merged a single cell of its level.
+*/
+struct PyramidTrace {
+	int num_threads;
+	double seconds;       // wall time of the whole build
+	std::vector<TaskInterval> tasks;
+};
+
+
+/**
+	Prints one line per level of a trace: the number of its tasks, the time span they ran in, their total time and
+	a timeline of width columns where '#' marks the time the tasks of the level were running.
+	The last line is the utilization of the threads (total time of all tasks / (wall time * num_threads))
+	and the tail of the build: the time after the last tile, when only coarse cells were left.
+	With a loop per level the spans of the levels would not overlap and during the tail
+	all threads but one would wait for the few cells of the coarse levels.
+*/
+inline void printTrace(std::ostream &out, const PyramidTrace &trace, std::size_t width = 64) {
+	std::size_t first_level = std::size_t(-1);
+	std::size_t num_levels = 0;
+	for (std::size_t i = 0; i != trace.tasks.size(); ++i) {
+		first_level = std::min(first_level, trace.tasks[i].level);
+		num_levels = std::max(num_levels, trace.tasks[i].level);
+	}
+
+	double total_busy = 0;
+	double last_tile = 0;
+	for (std::size_t l = first_level; l <= num_levels; ++l) {
+		double start = trace.seconds;
+		double end = 0;
+		double busy = 0;
+		std::size_t num_tasks = 0;
+		std::string timeline(width, '.');
+		for (std::size_t i = 0; i != trace.tasks.size(); ++i) {
+			const TaskInterval &task = trace.tasks[i];
+			if (task.level != l) {
+				continue;
+			}
+			start = std::min(start, task.start);
+			end = std::max(end, task.end);
+			busy += task.end - task.start;
+			++num_tasks;
+			std::size_t first = (std::size_t)(task.start / trace.seconds * width);
+			std::size_t last = (std::size_t)(task.end / trace.seconds * width);
+			for (std::size_t c = first; c <= last && c < width; ++c) {
+				timeline[c] = '#';
+			}
+		}
+		if (l == first_level) {
+			last_tile = end;
+		}
+		total_busy += busy;
+		out << "  level " << l << (l == first_level ? " (tiles)" : "") << ": " << num_tasks << " tasks, " 
+			<< start * 1e3 << " - " << end * 1e3 << " ms, busy " << busy * 1e3 << " ms |" << timeline << "|" << std::endl;
+	}
+	out << "  utilization " << 100 * total_busy / (trace.seconds * trace.num_threads) << "% of " << trace.num_threads 
+		<< " threads, tail after the last tile " << (trace.seconds - last_tile) * 1e3 << " ms" << std::endl;
+}
+
+
+/**
+	Returns the tile with the given position in Morton (Z) order on a grid of num_tiles tiles
+	(powers of 2, not necessarily equal), so the 2^NumDims children of every coarse cell are consecutive.
+*/
+template <std::size_t NumDims>
+std::array<size_t, NumDims> mortonTile(size_t position, const std::array<size_t, NumDims> &num_tiles) {
+	std::array<size_t, NumDims> tile = {};
+	for (std::size_t bit = 0; position != 0; ++bit) {
+		for (std::size_t k = NumDims; k-- > 0; ) {
+			if ((size_t(1) << bit) < num_tiles[k]) {
+				tile[k] |= (position & 1) << bit;
+				position >>= 1;
+			}
+		}
+	}
+	return tile;
+}
+
+
+/**
+	computeDownsamplesDataflow(..) engine for a given Histogram type (see buildPyramid(..)).
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildDataflowPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, size_t tile_size,
+						  PyramidTrace *trace, Histogram *) {
+	typedef typename HistogramArena<Histogram>::type Arena;
+
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		assert((A.shape()[k] & (A.shape()[k] - 1)) == 0 && "extents of A must be powers of 2");
+	}
+	assert(tile_size >= 2 && (tile_size & (tile_size - 1)) == 0 && "tile size must be a power of 2");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	PerThread<std::vector<TaskInterval> > intervals;
+	/// without a trace the tasks run without reading the clock
+	auto timed = [&](std::size_t level, auto task) {
+		if (!trace) {
+			task();
+			return;
+		}
+		double task_start = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		task();
+		TaskInterval interval = {level, task_start, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()};
+		intervals.local().push_back(interval);
+	};
+
+	std::size_t num_levels = numDownsamples(A);
+	if (num_levels == 0) {
+		return;
+	}
+
+	/// tiles as in buildTiledPyramid(..)
+	std::array<size_t, NumDims> tile_extents;
+	std::array<size_t, NumDims> num_tiles;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		tile_extents[k] = std::min(tile_size, (size_t)A.shape()[k]);
+		num_tiles[k] = A.shape()[k] / tile_extents[k];
+	}
+	std::size_t tile_levels = numDownsamples(tile_extents);
+
+	/// every level is allocated up front, cells of different levels are written at the same time
+	results.reserve(results.size() + num_levels);
+	std::vector<ArrayView<T, NumDims> > level_results;
+	std::vector<std::array<size_t, NumDims> > level_extents;
+	std::array<size_t, NumDims> extents = halfExtents(A);
+	for (std::size_t l = 1; l <= num_levels; ++l) {
+		results.emplace_back(extents);
+		level_results.push_back(makeView(results.back()));
+		level_extents.push_back(extents);
+		extents = halfExtents(extents);
+	}
+	std::vector<ArrayView<T, NumDims> > tile_results(level_results.begin(), level_results.begin() + tile_levels);
+
+	/**
+		Hashmaps of the levels tile_levels..num_levels (all alive at once, there is no point where a level is done),
+		each with its own arena, and for each coarse cell the number of its children that are not merged yet.
+	*/
+	std::size_t num_coarse = num_levels - tile_levels;
+	std::vector<std::vector<Histogram> > hists(num_coarse + 1);
+	std::unique_ptr<Arena[]> arenas(new Arena[num_coarse + 1]);
+	std::vector<std::unique_ptr<std::atomic<unsigned int>[]> > pending(num_coarse + 1);
+	std::vector<ParallelMergeMaps<T, NumDims, Histogram> > merges;
+	for (std::size_t c = 0; c <= num_coarse; ++c) {
+		size_t n = product(level_extents[tile_levels + c - 1]);
+		hists[c].resize(n);
+		if (c != 0) {
+			pending[c].reset(new std::atomic<unsigned int>[n]);
+			for (size_t i = 0; i != n; ++i) {
+				pending[c][i] = 1u << NumDims;
+			}
+			merges.push_back(ParallelMergeMaps<T, NumDims, Histogram>(makeView(hists[c - 1].data(), level_extents[tile_levels + c - 2]),
+				makeView(hists[c].data(), level_extents[tile_levels + c - 1]), &arenas[c], level_results[tile_levels + c - 1]));
+		}
+	}
+
+	Arena tile_arenas[2];
+	PerThread<TileLevels<Histogram> > tile_levels_storage;
+	ParallelTiles<T, NumDims, Histogram> parallelTiles(makeView(A), tile_extents, &tile_results,
+		makeView(hists[0].data(), level_extents[tile_levels - 1]), &arenas[0], tile_arenas, &tile_levels_storage);
+
+	/**
+		Parallel loop over tiles in Morton order, the only loop of the build.
+		When a task finishes a cell it decrements the counter of the parent cell, the task that finishes
+		the last child goes on to merge the parent (and so on up the pyramid). So a coarse cell is merged
+		as soon as its own children are done while other tiles are still running.
+	*/
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, product(num_tiles), 1), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t position = r.begin(); position != r.end(); ++position) {
+			std::array<size_t, NumDims> cell = mortonTile(position, num_tiles);
+			size_t t = 0;
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				t = t * num_tiles[k] + cell[k];
+			}
+			timed(tile_levels, [&]() { parallelTiles(tbb::blocked_range<size_t>(t, t + 1)); });
+
+			for (std::size_t c = 1; c <= num_coarse; ++c) {
+				cell = halfExtents(cell);
+				const std::array<size_t, NumDims> &parent_extents = level_extents[tile_levels + c - 1];
+				size_t i = 0;
+				for (std::size_t k = 0; k != NumDims; ++k) {
+					i = i * parent_extents[k] + cell[k];
+				}
+				if (--pending[c][i] != 0) {
+					break;
+				}
+				timed(tile_levels + c, [&]() { merges[c - 1](tbb::blocked_range<size_t>(i, i + 1)); });
+			}
+		}
+	});
+
+	if (trace) {
+		trace->num_threads = tbb::this_task_arena::max_concurrency();
+		trace->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		trace->tasks.clear();
+		for (std::size_t i = 0; i != intervals.size(); ++i) {
+			trace->tasks.insert(trace->tasks.end(), intervals[i].begin(), intervals[i].end());
+		}
+	}
+}
+
+
+/**
+	AutoHistogram version of buildDataflowPyramid(..).
+*/
+template <typename T, std::size_t NumDims>
+void buildDataflowPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, size_t tile_size,
+						  PyramidTrace *trace, AutoHistogram *) {
+	withAutoHistogram(A, true, [&](auto *histogram) {
+		buildDataflowPyramid(A, results, tile_size, trace, histogram);
+	});
+}
+
+
+/**
+    Dependency driven version of computeDownsamplesTiled(..), without a barrier between levels.
+
+	computeDownsamplesParallel(..) runs a parallel loop per level and computeDownsamplesTiled(..) one for the tiles
+	plus one per coarse level; each loop waits for all of its iterations. The coarse levels have only a few cells,
+	so most threads are idle during them and while the slowest tiles finish.
+	Here the whole pyramid is a single loop over tiles: a cell of level k+1 is merged as soon as its 2^NumDims
+	children of level k are done, by the task that finished the last of them (continuation passing,
+	the counters of unfinished children are atomic). Tiles are visited in Morton order so siblings finish together.
+	The result is bit-identical to computeDownsamplesParallel(..).
+
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - Output vector contains all l-downsamplings of the original image.
+		tile_size - extent of a tile along each dimention, a power of 2 (see defaultTileSize())
+		trace - if not null, receives the start and end time of every task (see printTrace(..))
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesDataflow(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results,
+								size_t tile_size = defaultTileSize<NumDims>(), PyramidTrace *trace = 0) {
+	buildDataflowPyramid(A, results, tile_size, trace, (Histogram *)0);
+}
@@ -0,0 +1,140 @@
+/**
+	Downsampling assignment
+
+	dense_histogram.h
+*/
+
+#pragma once
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include "utilities.h"
+
+
+/**
+	Histogram with a fixed number of bins: counts[v] is the number of occurances of pixel value v.
+	It is an alternative to BasicHashMap<T> for images with a small label alphabet (all values < NumBins),
+	e.g. uint8/uint16 class maps. There is no hashing, no node allocation and no pointer chasing:
+	merging 2^ndims histograms is a plain element-wise add of contiguous arrays and the mode is found with
+	a max reduction followed by a search for the first bin holding the max. Both loops have a fixed trip count
+	and no data dependent branches, so the compiler turns them into SIMD code.
+
+	Memory: NumBins * sizeof(unsigned int) bytes per cell, i.e. 64 bytes for 16 bins and 1 KB for 256 bins.
+	The level-1 array holds one histogram for every 2^ndims pixels, so large bin counts trade memory for speed.
+*/
+template <typename T, std::size_t NumBins>
+struct DenseHistogram {
+	static const std::size_t num_bins = NumBins;
+
+	std::array<unsigned int, NumBins> counts;
+};
+
+
+/**
+	Returns the index of the largest count. Ties are broken in favour of the smaller bin,
+	which is the same rule as isBetterMode(..) uses for hashmaps.
+	Complexity: O(NumBins), vectorized
+*/
+template <std::size_t NumBins>
+inline std::size_t findDenseMode(const std::array<unsigned int, NumBins> &counts) {
+	unsigned int max_count = 0;
+	for (std::size_t b = 0; b != NumBins; ++b) {
+		max_count = counts[b] > max_count ? counts[b] : max_count;
+	}
+	std::size_t b = 0;
+	while (counts[b] != max_count) {
+		++b;
+	}
+	return b;
+}
+
+
+/**
+    Dense histogram version of createMap(..).
+	Parameters:	
+		block - values of a 2x2..x2 block, all of them must be less than NumBins
+		hist - Output histogram
+	Returns the mode of the block.
+
+	The mode is picked among the values of the block instead of scanning all NumBins bins.
+	Complexity: O(NumBins) for clearing the bins (memset) + O(BlockSize)
+*/
+template <typename T, std::size_t BlockSize, std::size_t NumBins>
+T createMap(const std::array<T, BlockSize> &block, DenseHistogram<T, NumBins> &hist) {
+	hist.counts.fill(0);
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		assert(!(block[i] < T(0)) && (std::size_t)block[i] < NumBins && "pixel value does not fit into the dense histogram");
+		++hist.counts[block[i]];
+	}
+
+	T mode = block[0];
+	unsigned int max_num_occurances = hist.counts[block[0]];
+	for (std::size_t i = 1; i != BlockSize; ++i) {
+		if (isBetterMode(block[i], hist.counts[block[i]], mode, max_num_occurances)) {
+			mode = block[i];
+			max_num_occurances = hist.counts[block[i]];
+		}
+	}
+	return mode;
+}
+
+
+/**
+	Dense histogram version of mergeMaps(..).
+	Parameters:	
+		maps - pointers to the 2^ndims histograms of a block
+		output_map - Output histogram
+	Returns the mode of the merged histogram.
+	Complexity: O(NumBins * BlockSize), vectorized
+*/
+template <typename T, std::size_t BlockSize, std::size_t NumBins>
+T mergeMaps(const std::array<DenseHistogram<T, NumBins> *, BlockSize> &maps, DenseHistogram<T, NumBins> &output_map) {
+	output_map.counts = maps[0]->counts;
+	for (std::size_t i = 1; i != BlockSize; ++i) {
+		const unsigned int *counts = maps[i]->counts.data();
+		for (std::size_t b = 0; b != NumBins; ++b) {
+			output_map.counts[b] += counts[b];
+		}
+	}
+	return (T)findDenseMode(output_map.counts);
+}
+
+
+/**
+	Dense histogram versions of findMode(..), addMap(..), addCount(..) and countOf(..) (see PersistentPyramid).
+*/
+template <typename T, std::size_t NumBins>
+T findMode(const DenseHistogram<T, NumBins> &hist) {
+	return (T)findDenseMode(hist.counts);
+}
+
+template <typename T, std::size_t NumBins>
+void addMap(const DenseHistogram<T, NumBins> &from, DenseHistogram<T, NumBins> &to) {
+	for (std::size_t b = 0; b != NumBins; ++b) {
+		to.counts[b] += from.counts[b];
+	}
+}
+
+template <typename T, std::size_t NumBins>
+unsigned int addCount(DenseHistogram<T, NumBins> &hist, T label, int delta) {
+	assert(!(label < T(0)) && (std::size_t)label < NumBins && "pixel value does not fit into the dense histogram");
+	return hist.counts[label] += delta;
+}
+
+template <typename T, std::size_t NumBins>
+unsigned int countOf(const DenseHistogram<T, NumBins> &hist, T label) {
+	return !(label < T(0)) && (std::size_t)label < NumBins ? hist.counts[label] : 0;
+}
+
+
+/**
+	Calls function(label, count) for every bin that is not empty, in increasing order of labels.
+*/
+template <typename T, std::size_t NumBins, typename Function>
+void forEachCount(const DenseHistogram<T, NumBins> &hist, Function function) {
+	for (std::size_t b = 0; b != NumBins; ++b) {
+		if (hist.counts[b] != 0) {
+			function((T)b, hist.counts[b]);
+		}
+	}
+}
@@ -8,11 +8,20 @@
 #pragma once
 
 #include "boost/multi_array.hpp"
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <limits>
+#include <type_traits>
 #include <unordered_map>
 #include <iostream>
 #include "tbb/parallel_for.h"
+#include "tbb/parallel_reduce.h"
 #include "utilities.h"
+#include "dense_histogram.h"
+#include "compact_histogram.h"
+#include "simd_modes.h"
+#include "pyramid_buffer.h"
 
 
 /**
@@ -24,9 +33,8 @@
 
 	The function is parallelized to take advantage of multiple processor cores.
 
-	In order to keep the solution unclattered and better demonstrate the idea (and also because of shortage of time)
-	this function accepts only 2-dimentional arrays as its input.
-	Note however, the code can easily be modified to address inputs of other dimentions. 
+	This is the 2-dimentional entry point, it is a thin wrapper around 
+	computeDownsamplesParallel<T, NumDims>(..) declared below which handles arrays of any dimention.
 
 	Time complexity: O(N * num_downsamples / n_cores), where N is the total number of elements in original array A,
 		nd = min(L1, L2 ..., Ld) is the total number of possible downsamplings 
@@ -37,6 +45,16 @@
 void computeDownsamplesParallel(const UintArray2d &A, std::vector<UintArray2d> &results);
 
 
+/**
+	2-dimentional entry points for 8, 16 and 64-bit labels. The pixels are read in their own width and the
+	downsamples have the same type as A: a uint8 image is never widened to unsigned int, which would
+	read and write 4x as many bytes (the pyramid is bound by memory bandwidth).
+*/
+void computeDownsamplesParallel(const Uint8Array2d &A, std::vector<Uint8Array2d> &results);
+void computeDownsamplesParallel(const Uint16Array2d &A, std::vector<Uint16Array2d> &results);
+void computeDownsamplesParallel(const Uint64Array2d &A, std::vector<Uint64Array2d> &results);
+
+
 /**
     Single threaded version of void computeDownsamplesParallel(..) function
 
@@ -44,17 +62,115 @@ void computeDownsamplesParallel(const UintArray2d &A, std::vector<UintArray2d> &
 		nd = min(L1, L2 ..., Ld) is the total number of possible downsamplings 
 */
 void computeDownsamples(const UintArray2d &A, std::vector<UintArray2d> &results);
+void computeDownsamples(const Uint8Array2d &A, std::vector<Uint8Array2d> &results);
+void computeDownsamples(const Uint16Array2d &A, std::vector<Uint16Array2d> &results);
+void computeDownsamples(const Uint64Array2d &A, std::vector<Uint64Array2d> &results);
+
+
+/**
+	Returns the extents of the array obtained by downsampling A once (every dimention is divided by 2).
+*/
+template <typename Array>
+std::array<size_t, Array::dimensionality> halfExtents(const Array &A) {
+	std::array<size_t, Array::dimensionality> extents;
+	for (std::size_t k = 0; k != Array::dimensionality; ++k) {
+		extents[k] = A.shape()[k] / 2;
+	}
+	return extents;
+}
+
+
+/**
+	Returns the extents of an array obtained by downsampling an array with the given extents once.
+*/
+template <std::size_t NumDims>
+std::array<size_t, NumDims> halfExtents(const std::array<size_t, NumDims> &extents) {
+	std::array<size_t, NumDims> result;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		result[k] = extents[k] / 2;
+	}
+	return result;
+}
+
+
+/**
+	Returns the number of downsamples of A, i.e. nd = min(L1, L2 ..., Ld) for an array of size 2^L1 x 2^L2 x ... x 2^Ld.
+*/
+template <std::size_t NumDims>
+std::size_t numDownsamples(const std::array<size_t, NumDims> &extents) {
+	std::size_t min_extent = *std::min_element(extents.begin(), extents.end());
+	std::size_t n = 0;
+	while ((min_extent >>= 1) != 0) {
+		++n;
+	}
+	return n;
+}
+
+template <typename Array>
+std::size_t numDownsamples(const Array &A) {
+	std::array<size_t, Array::dimensionality> extents;
+	std::copy(A.shape(), A.shape() + Array::dimensionality, extents.begin());
+	return numDownsamples(extents);
+}
+
+
+/**
+	Statistics parameter of ParallelCreateMaps and ParallelMergeMaps when only the modes are computed.
+	A Statistics object is called with the histogram of every cell right after it is built 
+	(see BlockStatistics in block_statistics.h).
+*/
+struct NoStatistics {
+	template <typename Histogram, std::size_t NumDims>
+	void operator()(const Histogram &, const std::array<size_t, NumDims> &) const {}
+};
+
+
+/**
+	Profile parameter of HistogramLevels for runs that are not profiled. The engine calls the same hooks
+	for every level and every chunk of its loops, here they are empty and compiled away
+	(see PyramidRecorder in pyramid_profile.h for the one that records).
+*/
+struct NoProfile {
+	typedef NoStatistics Statistics;
+
+	template <std::size_t NumDims>
+	void beginLevel(const std::array<size_t, NumDims> &, const char *) {}
+
+	void endLevel() {}
+
+	Statistics statistics() const {
+		return Statistics();
+	}
+
+	template <typename Body>
+	const Body &wrap(const Body &body) const {
+		return body;
+	}
+};
 
 
 /**
     ParallelCreateMaps class defines Body for TBB parallel_for in which operator() processes a chunk of the loop.
+	T is the pixel type and NumDims is the number of dimentions of the original image.
+	Histogram is the type used to count pixel values of a block (BasicHashMap<T>, DenseHistogram<T, NumBins>,
+	CompactHistogram<T>), it has to provide createMap(..) and mergeMaps(..) overloads.
+
+	The body works on views (see ArrayView), so it only holds pointers and neither we nor TBB copy the image.
+	The same body processes whole images and tiles of them (see computeDownsamplesTiled(..)).
 */
-class ParallelCreateMaps {  
-	const UintArray2d A;
-	UintArray2d::index_gen indices;
-	HashMapArray2d *hash_array;
-	UintArray2d *result;
-	std::vector<size_t> sizes;   // size of the original image A
+template <typename T, std::size_t NumDims, typename Histogram = BasicHashMap<T>, typename Statistics = NoStatistics>
+class ParallelCreateMaps {
+public:
+	// number of elements in a 2x2..x2 block
+	static const std::size_t BlockSize = std::size_t(1) << NumDims;
+
+private:
+	ArrayView<const T, NumDims> A;
+	ArrayView<Histogram, NumDims> hash_array;
+	typename HistogramArena<Histogram>::type *arena;
+	ArrayView<T, NumDims> result;
+	Statistics statistics;
+	std::array<index, BlockSize> offsets;   // memory offsets of the block elements relative to the first element of the block
 
 public:
 
@@ -62,47 +178,798 @@ public:
 		Constructor parameters: 
 			A - original input array/image
 			hash_array - output, array of hashmaps.
-			result - output, 1-downsampled image
+			arena - memory arena of hash_array (see HistogramArena)
+			result - output, 1-downsampled image (not stored if result.origin is null)
+			statistics - called with the hashmap of every cell (see NoStatistics)
 	*/
-	ParallelCreateMaps(const UintArray2d &A, HashMapArray2d *hash_array, UintArray2d *result);
+	ParallelCreateMaps(const ArrayView<const T, NumDims> &A, const ArrayView<Histogram, NumDims> &hash_array, 
+			typename HistogramArena<Histogram>::type *arena, const ArrayView<T, NumDims> &result, 
+			const Statistics &statistics = Statistics())
+		: A(A), hash_array(hash_array), arena(arena), result(result), statistics(statistics) {
+
+			offsets = blockOffsets<NumDims>(A.strides.data());
+	}
 
 
 	/**
 		operator() defines how we should process a chunk of the loop.
-		Given an original 2-d array A, it devides the array into blocks of size 2x2.
-		In a sinlge iteration of the loop it computes a hashmap for a 2x2 sub-array (or 2x2x2 subarray for 3-d array, etc.), 
+		Given an original array A, it devides the array into blocks of size 2x2 (2x2x2 for 3-d array, etc.).
+		In a sinlge iteration of the loop it computes a hashmap for a 2x2..x2 sub-array, 
 		where a hushmap contain counts corresponding to the number of different pixel values in
 		the sub-array. It outputs array of hashmaps and 1-downsampled image.
+
+		Instead of iterating along the each dimention of the array and having nested for loops as a result,
+		we use a single for loop. getIndices<NumDims>(..) takes a global index of the block and returns 
+		the index of its first element along each dimention. Since NumDims is known at compile time, 
+		the index math and the gathering of the 2^NumDims block elements are unrolled by the compiler.
 	*/
-	void operator()( const tbb::blocked_range<size_t>& r ) const;
+	void operator()( const tbb::blocked_range<size_t>& r ) const {
+		for( size_t i=r.begin(); i!=r.end(); ++i ) {
+
+			// given single (global) block index i, we obtain the index of the first element of the block (takes O(1) time)
+			std::array<size_t, NumDims> corner = getIndices<NumDims>(i, A.shape);
+			const T *first = &A(corner);
+
+			std::array<T, BlockSize> block;
+			for (std::size_t j = 0; j != BlockSize; ++j) {
+				block[j] = first[offsets[j]];
+			}
+
+			std::array<size_t, NumDims> cell = halfExtents(corner);
+			T mode = createMap(block, hash_array(cell), *arena);
+			if (result.origin) {
+				result(cell) = mode;
+			}
+			statistics(hash_array(cell), cell);
+		}		
+	}
 };
 
 
 /**
     ParallelMergeMaps class defines Body for TBB parallel_for 
 */
+template <typename T, std::size_t NumDims, typename Histogram = BasicHashMap<T>, typename Statistics = NoStatistics>
 class ParallelMergeMaps {
-	UintArray2d::index_gen indices;
-	HashMapArray2d *input_array;
-	HashMapArray2d *output_array;
-	UintArray2d *result;
-	std::vector<size_t> sizes; // size of the *input_array
+public:
+	// number of elements in a 2x2..x2 block
+	static const std::size_t BlockSize = std::size_t(1) << NumDims;
+
+private:
+	ArrayView<Histogram, NumDims> input_array;
+	ArrayView<Histogram, NumDims> output_array;
+	typename HistogramArena<Histogram>::type *arena;
+	ArrayView<T, NumDims> result;
+	Statistics statistics;
+	std::array<index, BlockSize> offsets;   // memory offsets of the block elements relative to the first element of the block
 
 public:
 	/**
 		Constructor parameters: 
-			input_array - input 2-d array of hash maps
-			output_array - output 2-d array of hash maps 
-			result - output, downsampled image
+			input_array - input n-d array of hash maps, the hash maps are consumed by mergeMaps(..)
+			output_array - output n-d array of hash maps 
+			arena - memory arena of output_array (see HistogramArena)
+			result - output, downsampled image (not stored if result.origin is null)
+			statistics - called with the merged hashmap of every cell (see NoStatistics)
 	*/
-	ParallelMergeMaps(HashMapArray2d *input_array, HashMapArray2d *output_array, UintArray2d *result);
+	ParallelMergeMaps(const ArrayView<Histogram, NumDims> &input_array, const ArrayView<Histogram, NumDims> &output_array, 
+			typename HistogramArena<Histogram>::type *arena, const ArrayView<T, NumDims> &result, 
+			const Statistics &statistics = Statistics())
+		: input_array(input_array), output_array(output_array), arena(arena), result(result), statistics(statistics) {
+
+			offsets = blockOffsets<NumDims>(input_array.strides.data());
+	}
 
 
 	/**
 		operator() defines how we should process a chunk of the loop.
-		Given an array of hashmaps it devides the array into blocks of size 2x2.
-		In each iteration of the loop the function merges all hash maps in a 2x2 block into a single hash map
+		Given an array of hashmaps it devides the array into blocks of size 2x2..x2.
+		In each iteration of the loop the function merges all hash maps in a block into a single hash map
 		summing values for same keys. It outputs a reduced array of hashmaps and a downsampled image.
 	*/
-	void operator()( const tbb::blocked_range<size_t>& r ) const; 
-};
\ No newline at end of file
+	void operator()( const tbb::blocked_range<size_t>& r ) const {
+		for( size_t i=r.begin(); i!=r.end(); ++i ) {
+
+			std::array<size_t, NumDims> corner = getIndices<NumDims>(i, input_array.shape);
+			Histogram *first = &input_array(corner);
+
+			std::array<Histogram *, BlockSize> block;
+			for (std::size_t j = 0; j != BlockSize; ++j) {
+				block[j] = first + offsets[j];
+			}
+
+			std::array<size_t, NumDims> cell = halfExtents(corner);
+			T mode = mergeMaps(block, output_array(cell), *arena);
+			if (result.origin) {
+				result(cell) = mode;
+			}
+			statistics(output_array(cell), cell);
+		}		
+	}
+};
+
+
+/**
+    ParallelModes2x2 class defines Body for TBB parallel_for that computes the 1-downsample of a 2-d image 
+	with the SIMD kernels of modes2x2(..), one output row per iteration. No histograms are built.
+	The rows of A must be contiguous (A.strides[1] == 1).
+*/
+template <typename T>
+class ParallelModes2x2 {
+	ArrayView<const T, 2> A;
+	ArrayView<T, 2> result;
+
+public:
+	ParallelModes2x2(const ArrayView<const T, 2> &A, const ArrayView<T, 2> &result) : A(A), result(result) {}
+
+	void operator()( const tbb::blocked_range<size_t>& r ) const {
+		for( size_t i=r.begin(); i!=r.end(); ++i ) {
+			const T *row0 = A.origin + 2 * i * A.strides[0];
+			modes2x2(row0, row0 + A.strides[0], A.shape[1], result.origin + i * result.strides[0]);
+		}
+	}
+};
+
+
+/**
+    ParallelCreateMaps4x4 class defines Body for TBB parallel_for that computes the hashmaps of the 2-downsample
+	of a 2-d image directly from its 4x4 blocks, so the hashmaps of the 1-downsample are never built.
+	It outputs the array of hashmaps and the 2-downsampled image.
+*/
+template <typename T, typename Histogram, typename Statistics = NoStatistics>
+class ParallelCreateMaps4x4 {
+	ArrayView<const T, 2> A;
+	ArrayView<Histogram, 2> hash_array;
+	typename HistogramArena<Histogram>::type *arena;
+	ArrayView<T, 2> result;
+	Statistics statistics;
+
+public:
+	ParallelCreateMaps4x4(const ArrayView<const T, 2> &A, const ArrayView<Histogram, 2> &hash_array, 
+			typename HistogramArena<Histogram>::type *arena, const ArrayView<T, 2> &result, 
+			const Statistics &statistics = Statistics())
+		: A(A), hash_array(hash_array), arena(arena), result(result), statistics(statistics) {}
+
+	void operator()( const tbb::blocked_range<size_t>& r ) const {
+		for( size_t i=r.begin(); i!=r.end(); ++i ) {
+			std::array<size_t, 2> cell = {{i / hash_array.shape[1], i % hash_array.shape[1]}};
+			const T *first = A.origin + 4 * cell[0] * A.strides[0] + 4 * cell[1] * A.strides[1];
+
+			std::array<T, 16> block;
+			for (std::size_t y = 0; y != 4; ++y) {
+				for (std::size_t x = 0; x != 4; ++x) {
+					block[4 * y + x] = first[y * A.strides[0] + x * A.strides[1]];
+				}
+			}
+			T mode = createMap(block, hash_array(cell), *arena);
+			if (result.origin) {
+				result(cell) = mode;
+			}
+			statistics(hash_array(cell), cell);
+		}
+	}
+};
+
+
+/**
+	Tag type for the Histogram template parameter of computeDownsamplesParallel(..) and computeDownsamples(..).
+	It selects the histogram representation at run time from the smallest and largest pixel values of the input:
+	DenseHistogram<T, 16> or DenseHistogram<T, 64> for small non-negative label alphabets and CompactHistogram<T> for 
+	everything else. All of them produce exactly the same downsamples.
+	Images that are mostly uniform regions (segmentations, class maps) use CompactHistogram<T> even for small
+	alphabets: a uniform cell is a single inline entry and merging uniform children is O(1), while a dense histogram
+	is cleared and added bin by bin for every cell (2048x2048, 16 labels in uniform regions: compact 1.9x faster 
+	than dense; with 1/16 of the pixels random both take the same time, so compact is picked above 85% uniform blocks).
+	Wider dense histograms are not picked automatically: with 256 bins the level-1 array alone is 
+	256 bytes per input pixel and writing it costs more than hashing (measured on 2048x2048 uint16 images: 
+	16 bins 14x and 64 bins 7x faster than BasicHashMap<T>, 256 bins 1.6x faster at 200 labels 
+	but up to 2x slower with only a few labels).
+*/
+struct AutoHistogram {};
+
+
+/**
+	Returns the smallest and the largest element of A.
+	Complexity: O(N / n_cores) when parallel is true
+*/
+template <typename T, std::size_t NumDims>
+std::pair<T, T> valueRange(const ArrayNd<T, NumDims> &A, bool parallel) {
+	const T *data = A.data();
+	if (!parallel) {
+		auto range = std::minmax_element(data, data + A.num_elements());
+		return std::make_pair(*range.first, *range.second);
+	}
+	return tbb::parallel_reduce(tbb::blocked_range<size_t>(0, A.num_elements()),
+		std::make_pair(std::numeric_limits<T>::max(), std::numeric_limits<T>::lowest()),
+		[data](const tbb::blocked_range<size_t> &r, std::pair<T, T> value) {
+			auto range = std::minmax_element(data + r.begin(), data + r.end());
+			return std::make_pair(std::min(value.first, *range.first), std::max(value.second, *range.second));
+		},
+		[](std::pair<T, T> a, std::pair<T, T> b) {
+			return std::make_pair(std::min(a.first, b.first), std::max(a.second, b.second));
+		});
+}
+
+
+/**
+	Returns the share of uniform 2x2..x2 blocks (all pixels have the same value) in A,
+	estimated from num_samples blocks spread over the whole array.
+	Complexity: O(num_samples)
+*/
+template <typename T, std::size_t NumDims>
+double uniformBlockShare(const ArrayNd<T, NumDims> &A, size_t num_samples = 4096) {
+	std::array<size_t, NumDims> shape;
+	std::copy(A.shape(), A.shape() + NumDims, shape.begin());
+	size_t num_blocks = product(halfExtents(A));
+	if (num_blocks == 0) {
+		return 0;
+	}
+	num_samples = std::min(num_samples, num_blocks);
+
+	ArrayView<const T, NumDims> view = makeView(A);
+	std::array<index, (std::size_t(1) << NumDims)> offsets = blockOffsets<NumDims>(view.strides.data());
+	size_t uniform = 0;
+	for (size_t i = 0; i != num_samples; ++i) {
+		/// golden ratio sequence, so the samples do not line up with rows or columns
+		size_t block = (size_t)((double)i * 0.6180339887498949 * num_blocks) % num_blocks;
+		const T *first = &view(getIndices<NumDims>(block, shape));
+		bool same = true;
+		for (std::size_t j = 1; j != offsets.size(); ++j) {
+			same = same && first[offsets[j]] == first[0];
+		}
+		uniform += same;
+	}
+	return (double)uniform / num_samples;
+}
+
+
+/**
+	Runs body over the blocks [0, n) with tbb::parallel_for (parallel = true) or in the calling thread.
+*/
+template <typename Body>
+void forEachBlock(size_t n, const Body &body, bool parallel) {
+	if (parallel) {
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, n), body);
+	}
+	else {
+		body(tbb::blocked_range<size_t>(0, n));
+	}
+}
+
+
+/**
+	Double buffered storage for the levels of hashmaps. Level l+1 is built from level l into the other buffer, 
+	which still holds level l-1 (consumed by then) and is large enough to hold level l+1 without reallocating.
+	After each level the buffers are swapped, the hashmaps are never copied.
+	Each buffer has its own memory arena (see HistogramArena), the arena of a level is reset as soon as 
+	the next level has been built from it.
+	profile receives the hooks of the engine for every level it builds (see NoProfile).
+*/
+template <typename Histogram, typename Profile = NoProfile>
+struct HistogramLevels {
+	std::vector<Histogram> buffers[2];
+	typename HistogramArena<Histogram>::type arenas[2];
+	int current;
+	Profile profile;
+
+	explicit HistogramLevels(const Profile &profile = Profile()) : current(0), profile(profile) {}
+
+	/**
+		Prepares the other buffer for a level of n hashmaps and returns it.
+	*/
+	std::vector<Histogram> &next(size_t n) {
+		std::vector<Histogram> &output = buffers[1 - current];
+		output.clear();
+		output.resize(n);
+		return output;
+	}
+
+	/**
+		Makes the level built with next(..) the current one and releases the memory of the previous level.
+	*/
+	void swap() {
+		arenas[current].reset();
+		current = 1 - current;
+	}
+};
+
+
+/**
+	Builds the next level of the pyramid from the current level of hashmaps in levels.
+	Parameters:
+		levels - levels of hashmaps, levels.buffers[levels.current] holds the level that is merged
+		level_extents - extents of that level
+		result - output, the downsampled image (half the extents of the level)
+		parallel - run the loop with tbb::parallel_for (true) or in the calling thread (false)
+	Returns the extents of the new level.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+std::array<size_t, NumDims> mergeLevel(HistogramLevels<Histogram, Profile> &levels, const std::array<size_t, NumDims> &level_extents, 
+									   const ArrayView<T, NumDims> &result, bool parallel) {
+
+	std::array<size_t, NumDims> extents = halfExtents(level_extents);
+	assert(result.shape == extents);
+	levels.profile.beginLevel(extents, "merge");
+	std::vector<Histogram> &output = levels.next(product(extents));
+
+	/** 
+		Parallel loop.
+		Given an array of hashmaps it divides the array into blocks of size 2x2..x2.
+		In each iteration of the loop the function merges all hash maps in a block into a single hash map
+		summing values for same keys. 
+		It outputs the next level of hashmaps and the downsampled image.
+	*/
+	ParallelMergeMaps<T, NumDims, Histogram, typename Profile::Statistics> parallelMergeMaps(
+		makeView(levels.buffers[levels.current].data(), level_extents), makeView(output.data(), extents), 
+		&levels.arenas[1 - levels.current], result, levels.profile.statistics());
+	forEachBlock(result.num_elements(), levels.profile.wrap(parallelMergeMaps), parallel);
+
+	/// histograms of the previous level are not needed anymore, release them all at once
+	levels.swap();
+	levels.profile.endLevel();
+	return extents;
+}
+
+
+/**
+	mergeLevel(..) that appends the downsampled image to results (enough capacity must be reserved).
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+std::array<size_t, NumDims> mergeLevel(HistogramLevels<Histogram, Profile> &levels, const std::array<size_t, NumDims> &level_extents, 
+									   std::vector<ArrayNd<T, NumDims> > &results, bool parallel) {
+	assert(results.size() < results.capacity());
+	results.emplace_back(halfExtents(level_extents));
+	return mergeLevel(levels, level_extents, makeView(results.back()), parallel);
+}
+
+
+/**
+	Builds the coarse levels of the pyramid from the current level of hashmaps in levels.
+	Parameters:
+		levels - levels of hashmaps, levels.buffers[levels.current] holds the level the merging starts from
+		level_extents - extents of that level
+		results - output, views of the downsampled images (the first one has half the extents of the level),
+			views with a null origin are levels that are merged but not stored
+		num_levels - number of levels to build, all the remaining ones by default
+		parallel - run the loops with tbb::parallel_for (true) or in the calling thread (false)
+	Returns the extents of the last level built.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+std::array<size_t, NumDims> mergeLevels(HistogramLevels<Histogram, Profile> &levels, std::array<size_t, NumDims> level_extents, 
+										const ArrayView<T, NumDims> *results, std::size_t num_levels, bool parallel) {
+
+	/// Note that each level of hashmaps is smaller than the previous one by the factor of 2 along each dimention
+	for (std::size_t l = 0; l != num_levels; ++l) {
+		level_extents = mergeLevel(levels, level_extents, results[l], parallel);
+	}
+	return level_extents;
+}
+
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+void mergeLevels(HistogramLevels<Histogram, Profile> &levels, std::array<size_t, NumDims> level_extents, 
+				 const ArrayView<T, NumDims> *results, bool parallel) {
+	mergeLevels(levels, level_extents, results, numDownsamples(level_extents), parallel);
+}
+
+
+/**
+	mergeLevels(..) that appends the downsampled images to results (enough capacity must be reserved).
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+void mergeLevels(HistogramLevels<Histogram, Profile> &levels, std::array<size_t, NumDims> level_extents, 
+				 std::vector<ArrayNd<T, NumDims> > &results, bool parallel) {
+	while (*std::min_element(level_extents.begin(), level_extents.end()) >= 2) {
+		level_extents = mergeLevel(levels, level_extents, results, parallel);
+	}
+}
+
+
+/**
+	Builds the first level of the pyramid: the 1-downsample of A (into results[0], unless its origin is null) 
+	and its hashmaps (levels.buffers[levels.current]).
+	last is the last level that is needed (at least 1).
+	Returns the level whose hashmaps are in levels (0 if none were built).
+	The last parameter tells whether the 2-d path (below) can be used.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+std::size_t createFirstLevels(const ArrayNd<T, NumDims> &A, HistogramLevels<Histogram, Profile> &levels, 
+							  const ArrayView<T, NumDims> *results, std::size_t, bool parallel, std::false_type) {
+	std::array<size_t, NumDims> extents = halfExtents(A);
+	levels.profile.beginLevel(extents, "create");
+	std::vector<Histogram> &hashMapArray = levels.next(product(extents));
+
+	/** 
+		Parallel loop.
+		Given an original array A it divides the array into blocks of size 2x2..x2, 
+		In each iteration of the loop it computes a hashmap for a block 
+		where a hushmap contains the number of occurances of each element in the block. 
+		It outputs hashMapArray (array of hashmaps) and the 1-downsampled image (written directly into results).
+	*/
+	ParallelCreateMaps<T, NumDims, Histogram, typename Profile::Statistics> parallelCreateMaps(makeView(A), 
+		makeView(hashMapArray.data(), extents), &levels.arenas[1 - levels.current], results[0], levels.profile.statistics());
+	forEachBlock(results[0].num_elements(), levels.profile.wrap(parallelCreateMaps), parallel);
+	levels.swap();
+	levels.profile.endLevel();
+	return 1;
+}
+
+
+/**
+	Computes the 1-downsample of a 2-d image with the SIMD kernel of its pixel type (see modes2x2(..)),
+	only for pixel types that have one (HasModeKernel<T>).
+*/
+template <typename T, typename Profile>
+void computeModes2x2(const ArrayView<const T, 2> &A, const ArrayView<T, 2> &result, bool parallel, Profile &profile) {
+	profile.beginLevel(result.shape, "simd2x2");
+	forEachBlock(result.shape[0], profile.wrap(ParallelModes2x2<T>(A, result)), parallel);
+	profile.endLevel();
+}
+
+
+/**
+	Tells whether the 2-d path of createFirstLevels(..) can be taken: the 1-downsample is not wanted (result has a null origin),
+	or the pixel type has a SIMD kernel and the rows of A are contiguous.
+*/
+template <typename T>
+bool canUseModes2x2(const ArrayView<const T, 2> &A, const ArrayView<T, 2> &result) {
+	return !result.origin || (HasModeKernel<T>::value && A.strides[1] == 1);
+}
+
+
+/**
+	Second step of the 2-d path of createFirstLevels(..): the hashmaps of the 2-downsample (and the 2-downsample itself,
+	into results[1]) built directly from the 4x4 blocks of A.
+	Returns the level whose hashmaps are in levels: 2 (or 0 when the 1-downsample is the last level needed).
+*/
+template <typename T, typename Histogram, typename Profile>
+std::size_t createLevels4x4(const ArrayNd<T, 2> &A, HistogramLevels<Histogram, Profile> &levels, 
+							const ArrayView<T, 2> *results, std::size_t last, bool parallel) {
+	std::array<size_t, 2> extents = halfExtents(A);
+	if (last == 1 || std::min(extents[0], extents[1]) < 2) {
+		return 0;
+	}
+
+	extents = halfExtents(extents);
+	levels.profile.beginLevel(extents, "create4x4");
+	std::vector<Histogram> &hashMapArray = levels.next(product(extents));
+	ParallelCreateMaps4x4<T, Histogram, typename Profile::Statistics> parallelCreateMaps(makeView(A), makeView(hashMapArray.data(), extents), 
+		&levels.arenas[1 - levels.current], results[1], levels.profile.statistics());
+	forEachBlock(results[1].num_elements(), levels.profile.wrap(parallelCreateMaps), parallel);
+	levels.swap();
+	levels.profile.endLevel();
+	return 2;
+}
+
+
+/**
+	2-d version of createFirstLevels(..).
+	No hashmaps are built for the 1-downsample: it is computed with the SIMD kernel of the pixel type 
+	(see modes2x2(..)) and the hashmaps of the 2-downsample are built directly from the 4x4 blocks of A 
+	(see createLevels4x4(..)). 
+	Building, writing and reading back the hashmaps of the largest level was most of the time of the whole pyramid.
+	When the 1-downsample is not wanted (results[0].origin is null) the same 4x4 path is taken for every pixel type.
+	Returns the level whose hashmaps are in levels: 2 (or 0 when the 1-downsample is the last level needed).
+*/
+template <typename T, typename Histogram, typename Profile>
+std::size_t createFirstLevels(const ArrayNd<T, 2> &A, HistogramLevels<Histogram, Profile> &levels, 
+							  const ArrayView<T, 2> *results, std::size_t last, bool parallel, std::true_type) {
+	ArrayView<const T, 2> view = makeView(A);
+	if (!canUseModes2x2(view, results[0])) {
+		return createFirstLevels(A, levels, results, last, parallel, std::false_type());
+	}
+
+	if constexpr (HasModeKernel<T>::value) {
+		if (results[0].origin) {
+			computeModes2x2(view, results[0], parallel, levels.profile);
+		}
+	}
+	return createLevels4x4(A, levels, results, last, parallel);
+}
+
+
+/**
+	Returns the extents of the l-downsample of A.
+*/
+template <typename T, std::size_t NumDims>
+std::array<size_t, NumDims> levelExtents(const ArrayNd<T, NumDims> &A, std::size_t l) {
+	std::array<size_t, NumDims> extents;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		extents[k] = A.shape()[k] >> l;
+	}
+	return extents;
+}
+
+
+/**
+	The downsampling engine shared by computeDownsamplesParallel(..) and computeDownsamples(..).
+	Builds levels 1..last of the pyramid of A, the levels before the wanted ones are built as hashmaps only.
+	Parameters:	
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - output, results[l - 1] is a view of the l-downsampling of A for l = 1..last, 
+			levels that are not wanted have views with a null origin
+		last - the last level to build (at most numDownsamples(A))
+		parallel - run the loops with tbb::parallel_for (true) or in the calling thread (false)
+		levels - storage for the levels of hashmaps, its buffers and arenas are reused when it is passed to
+			several calls (see computeDownsamplesBatch(..))
+	Returns the level whose hashmaps are left in levels (0 if none), see LazyPyramid.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+std::size_t buildLevels(const ArrayNd<T, NumDims> &A, const ArrayView<T, NumDims> *results, std::size_t last, bool parallel, 
+						HistogramLevels<Histogram, Profile> &levels) {
+
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		assert((A.shape()[k] & (A.shape()[k] - 1)) == 0 && "extents of A must be powers of 2");
+	}
+	assert(last <= numDownsamples(A));
+	if (last == 0) {
+		return 0;
+	}
+
+	std::size_t level = createFirstLevels(A, levels, results, last, parallel, std::integral_constant<bool, NumDims == 2>());
+	if (level == 0) {
+		return 0;
+	}
+	mergeLevels(levels, levelExtents(A, level), results + level, last - level, parallel);
+	return last;
+}
+
+
+/**
+	buildLevels(..) of the whole pyramid, results has numDownsamples(A) views.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+void buildPyramid(const ArrayNd<T, NumDims> &A, const ArrayView<T, NumDims> *results, bool parallel, 
+				  HistogramLevels<Histogram, Profile> &levels) {
+	buildLevels(A, results, numDownsamples(A), parallel, levels);
+}
+
+
+/**
+	Range of levels first..last of a pyramid (level l is the l-downsample, 1 is the finest).
+	LevelRange() is the whole pyramid, LevelRange(3, 5) levels 3 to 5 and 
+	LevelRange(LevelRange::coarsest) the coarsest level only.
+*/
+struct LevelRange {
+	static const std::size_t coarsest = std::size_t(-1);
+
+	std::size_t first;
+	std::size_t last;
+
+	LevelRange(std::size_t first = 1, std::size_t last = coarsest) : first(first), last(last) {
+		assert(first >= 1 && "levels are numbered from 1");
+	}
+
+	/**
+		Returns the range with coarsest replaced and last clamped for a pyramid of num_levels levels,
+		it is empty if none of the wanted levels exists.
+	*/
+	LevelRange resolve(std::size_t num_levels) const {
+		return LevelRange(first == coarsest ? std::max(num_levels, std::size_t(1)) : first, std::min(last, num_levels));
+	}
+
+	std::size_t size() const {
+		return first <= last ? last - first + 1 : 0;
+	}
+};
+
+
+/**
+	buildPyramid(..) that appends the levels of range to a vector of arrays (the first one is level range.first).
+	The engine stops after range.last and the levels before range.first are not stored.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+void buildPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, LevelRange range, bool parallel, 
+				  HistogramLevels<Histogram, Profile> &levels) {
+
+	range = range.resolve(numDownsamples(A));
+	if (range.size() == 0) {
+		return;
+	}
+
+	/** 
+		All output images are constructed in place at the end of results before the engine runs, so the vector 
+		must not reallocate (boost::multi_array has no move constructor, reallocation would copy every level).
+	*/
+	results.reserve(results.size() + range.size());
+	std::vector<ArrayView<T, NumDims> > views;
+	views.reserve(range.last);
+	for (std::size_t l = 1; l <= range.last; ++l) {
+		if (l < range.first) {
+			views.push_back(makeView((T *)0, levelExtents(A, l)));
+		}
+		else {
+			results.emplace_back(levelExtents(A, l));
+			views.push_back(makeView(results.back()));
+		}
+	}
+	buildLevels(A, views.data(), range.last, parallel, levels);
+}
+
+
+/**
+	buildPyramid(..) that appends the downsamples to a vector of arrays.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+void buildPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, bool parallel, 
+				  HistogramLevels<Histogram, Profile> &levels) {
+	buildPyramid(A, results, LevelRange(), parallel, levels);
+}
+
+
+/**
+	buildPyramid(..) that writes the downsamples into a PyramidBuffer (laid out for A first).
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Profile>
+void buildPyramid(const ArrayNd<T, NumDims> &A, PyramidBuffer<T, NumDims> &results, bool parallel, 
+				  HistogramLevels<Histogram, Profile> &levels) {
+	std::array<size_t, NumDims> extents{};
+	std::copy(A.shape(), A.shape() + NumDims, extents.begin());
+	results.reshape(extents);
+	buildPyramid(A, results.levels(), parallel, levels);
+}
+
+
+/**
+	buildPyramid(..) with its own levels of hashmaps, for a vector of arrays or a PyramidBuffer (Results).
+	The last (unnamed) parameter selects the Histogram type, see AutoHistogram.
+*/
+template <typename T, std::size_t NumDims, typename Results, typename Histogram>
+void buildPyramid(const ArrayNd<T, NumDims> &A, Results &results, bool parallel, Histogram *) {
+	HistogramLevels<Histogram> levels;
+	buildPyramid(A, results, parallel, levels);
+}
+
+
+/**
+	buildPyramid(..) of a range of levels with its own levels of hashmaps.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, LevelRange range, bool parallel, 
+				  Histogram *) {
+	HistogramLevels<Histogram> levels;
+	buildPyramid(A, results, range, parallel, levels);
+}
+
+
+/**
+	Returns true if the labels range.first..range.second fit into a dense histogram of withDenseHistogram(..).
+	Dense histograms index their bins with the labels, so negative labels never fit.
+*/
+template <typename T>
+bool fitsDenseHistogram(const std::pair<T, T> &range) {
+	return !(range.first < T(0)) && range.second < 64;
+}
+
+
+/**
+	Calls function(histogram) with a null pointer to the smallest dense histogram that can hold 
+	the labels range.first..range.second, or to Fallback if they do not fit (see fitsDenseHistogram(..)).
+*/
+template <typename Fallback, typename T, typename Function>
+void withDenseHistogram(const std::pair<T, T> &range, Function function) {
+	if (!fitsDenseHistogram(range)) {
+		function((Fallback *)0);
+	}
+	else if (range.second < 16) {
+		function((DenseHistogram<T, 16> *)0);
+	}
+	else {
+		function((DenseHistogram<T, 64> *)0);
+	}
+}
+
+
+/**
+	Calls function(histogram) with a null pointer to the smallest dense histogram that can hold 
+	every pixel value of A, or to CompactHistogram<T> for mostly uniform images, large and negative labels (see AutoHistogram).
+*/
+template <typename T, std::size_t NumDims, typename Function>
+void withAutoHistogram(const ArrayNd<T, NumDims> &A, bool parallel, Function function) {
+	if (A.num_elements() == 0) {
+		return;
+	}
+
+	/// mostly uniform images go to CompactHistogram<T> even if their labels fit into a dense histogram
+	std::pair<T, T> range = valueRange(A, parallel);
+	if (fitsDenseHistogram(range) && uniformBlockShare(A) > 0.85) {
+		function((CompactHistogram<T> *)0);
+	}
+	else {
+		withDenseHistogram<CompactHistogram<T> >(range, function);
+	}
+}
+
+
+/**
+	AutoHistogram version of buildPyramid(..).
+*/
+template <typename T, std::size_t NumDims, typename Results>
+void buildPyramid(const ArrayNd<T, NumDims> &A, Results &results, bool parallel, AutoHistogram *) {
+	withAutoHistogram(A, parallel, [&](auto *histogram) {
+		buildPyramid(A, results, parallel, histogram);
+	});
+}
+
+template <typename T, std::size_t NumDims>
+void buildPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, LevelRange range, bool parallel, 
+				  AutoHistogram *) {
+	withAutoHistogram(A, parallel, [&](auto *histogram) {
+		buildPyramid(A, results, range, parallel, histogram);
+	});
+}
+
+
+/**
+    The function computes block downsampling of an original n-dimentional array using modal values.
+	Parameters:	
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - Output vector contains all l-downsamplings of the original image.
+
+	The whole pyramid is built in a single pass over A: for a 3-d volume each output voxel is the mode
+	of a 2x2x2 block, for a 4-d array of a 2x2x2x2 block, and so on.
+
+	The Histogram template parameter chooses how pixel values are counted. By default (AutoHistogram)
+	it is chosen from the range of pixel values; callers that know their data can force
+	BasicHashMap<T>, CompactHistogram<T> or DenseHistogram<T, NumBins> (then all pixel values must be less than NumBins).
+
+	Time complexity: O(N * num_downsamples / n_cores), where N is the total number of elements in original array A,
+		nd = min(L1, L2 ..., Ld) is the total number of possible downsamplings 
+		and n_cores is the number of available processing cores on the system running the algorithm
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesParallel(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results) {
+	buildPyramid(A, results, true, (Histogram *)0);
+}
+
+
+/**
+    Single threaded version of computeDownsamplesParallel<T, NumDims>(..) function.
+
+	Worst time complexity: O(N * num_downsamples), where N is the total number of elements in original array A and
+		nd = min(L1, L2 ..., Ld) is the total number of possible downsamplings 
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamples(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results) {
+	buildPyramid(A, results, false, (Histogram *)0);
+}
+
+
+/**
+	computeDownsamplesParallel(..) that writes all downsamples into a single buffer (see PyramidBuffer).
+	results[l] is a view of the (l+1)-downsample. Reusing results for images of the same size 
+	costs no allocations for the output.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesParallel(const ArrayNd<T, NumDims> &A, PyramidBuffer<T, NumDims> &results) {
+	buildPyramid(A, results, true, (Histogram *)0);
+}
+
+
+/**
+	Single threaded version of computeDownsamplesParallel(..) with a PyramidBuffer.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamples(const ArrayNd<T, NumDims> &A, PyramidBuffer<T, NumDims> &results) {
+	buildPyramid(A, results, false, (Histogram *)0);
+}
+
+
+/**
+	computeDownsamplesParallel(..) of the levels range.first..range.last only, results[0] is level range.first.
+	Levels before the range are built as hashmaps only (for 2-d images the hashmaps of level 2 are built 
+	straight from 4x4 blocks of A when level 1 is not wanted) and nothing is built after the range.
+	E.g. LevelRange(3, 5) or LevelRange(LevelRange::coarsest) for a thumbnail; levels that do not exist are skipped.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesParallel(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, LevelRange range) {
+	buildPyramid(A, results, range, true, (Histogram *)0);
+}
+
+
+/**
+	Single threaded version of computeDownsamplesParallel(..) with a LevelRange.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamples(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, LevelRange range) {
+	buildPyramid(A, results, range, false, (Histogram *)0);
+}
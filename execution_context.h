@@ -0,0 +1,258 @@
+/**
+	Downsampling assignment
+
+	execution_context.h
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <vector>
+#include "tbb/info.h"
+#include "tbb/task_arena.h"
+#include "pyramid_buffer.h"
+#include "shard_downsampling.h"
+
+
+/**
+	Where and on how many threads computeDownsamplesParallel(..) runs.
+
+	By default the engine runs on the global TBB pool, as many threads as the machine has.
+	A context confines the run to a thread cap (an arena of max_threads threads made for the run) or to an arena
+	of the caller, e.g. one shared by all downsampling jobs of a service.
+	With numa = true the image is cut into one partition per NUMA node (see computeDownsamplesNuma(..)),
+	each built by an arena bound to its node, so the histograms of a partition are allocated and written on its node.
+*/
+struct ExecutionContext {
+	int max_threads;                              // most threads the run uses, 0 for no cap (split between the partitions with numa)
+	tbb::task_arena *arena;                       // arena to run in (not owned), null for none; not used with numa
+	bool numa;                                    // one partition and arena per NUMA node
+	std::vector<tbb::numa_node_id> numa_nodes;    // nodes to use, all nodes of the machine (tbb::info::numa_nodes()) if empty
+
+	explicit ExecutionContext(int max_threads = 0, bool numa = false) : max_threads(max_threads), arena(0), numa(numa) {}
+	explicit ExecutionContext(tbb::task_arena &arena) : max_threads(0), arena(&arena), numa(false) {}
+};
+
+
+/**
+	Returns the NUMA nodes a context runs on (a single tbb::task_arena::automatic node on machines without NUMA
+	or when TBB cannot read the topology).
+*/
+inline std::vector<tbb::numa_node_id> numaNodes(const ExecutionContext &context) {
+	return context.numa_nodes.empty() ? tbb::info::numa_nodes() : context.numa_nodes;
+}
+
+
+/**
+	Calls function() in the arena of context, or in an arena of context.max_threads threads, or in the calling thread.
+*/
+template <typename Function>
+void executeIn(const ExecutionContext &context, const Function &function) {
+	if (context.arena) {
+		context.arena->execute(function);
+	}
+	else if (context.max_threads > 0) {
+		tbb::task_arena arena(context.max_threads);
+		arena.execute(function);
+	}
+	else {
+		function();
+	}
+}
+
+
+/**
+	Returns the number of partitions of an image between num_nodes NUMA nodes: the largest power of 2
+	that is at most num_nodes and leaves partitions at least 2 pixels thick along dimention 0.
+*/
+template <std::size_t NumDims>
+size_t numaPartitions(const std::array<size_t, NumDims> &image_extents, size_t num_nodes) {
+	size_t partitions = 1;
+	while (partitions * 2 <= num_nodes && image_extents[0] / (partitions * 2) >= 2) {
+		partitions *= 2;
+	}
+	return partitions;
+}
+
+
+/**
+	Returns the number of partitions of an image in a context: one per NUMA node of the context, but no more
+	than its thread cap, as every partition is built by an arena of at least one thread and all arenas run at once.
+*/
+template <std::size_t NumDims>
+size_t numaPartitions(const std::array<size_t, NumDims> &image_extents, const ExecutionContext &context) {
+	size_t num_nodes = numaNodes(context).size();
+	if (context.max_threads > 0) {
+		num_nodes = std::min(num_nodes, (size_t)context.max_threads);
+	}
+	return numaPartitions(image_extents, num_nodes);
+}
+
+
+/**
+	NUMA engine of computeDownsamplesNuma(..) for a given Histogram type.
+	results has a view for every level of the image.
+*/
+template <typename T, std::size_t NumDims, typename Histogram, typename Load>
+void buildNumaPyramid(const std::array<size_t, NumDims> &image_extents, const Load &load, const ArrayView<T, NumDims> *results,
+					  const ExecutionContext &context, Histogram *) {
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		assert((image_extents[k] & (image_extents[k] - 1)) == 0 && "extents of the image must be powers of 2");
+	}
+	std::size_t num_levels = numDownsamples(image_extents);
+	if (num_levels == 0) {
+		return;
+	}
+
+	/// partitions are slabs along dimention 0, so every partition of every level is a contiguous range of its level
+	std::vector<tbb::numa_node_id> nodes = numaNodes(context);
+	size_t num_partitions = numaPartitions(image_extents, context);
+	std::array<size_t, NumDims> extents = image_extents;
+	extents[0] /= num_partitions;
+
+	std::vector<ShardRoots<T, NumDims> > roots(num_partitions);
+	std::vector<tbb::task_arena> arenas(num_partitions);
+	for (size_t p = 0; p != num_partitions; ++p) {
+		/// the thread cap is split between the arenas, the first ones get the remainder
+		int threads = tbb::task_arena::automatic;
+		if (context.max_threads > 0) {
+			threads = context.max_threads / (int)num_partitions + ((int)p < context.max_threads % (int)num_partitions);
+		}
+		/// no slot is reserved for the calling thread, it never enters the arenas
+		arenas[p].initialize(tbb::task_arena::constraints(nodes[p], threads), 0);
+	}
+
+	/**
+		Each partition is one task enqueued into the arena of its node: the partition of the input is allocated
+		and loaded, and its levels are built, only by the threads of the node. The calling thread waits outside
+		of the arenas, so it cannot take the task and first touch the memory of the partition on its own node.
+	*/
+	std::mutex mutex;
+	std::condition_variable partition_done;
+	size_t num_pending = num_partitions;   // guarded by mutex, as is error
+	std::exception_ptr error;
+	for (size_t p = 0; p != num_partitions; ++p) {
+		arenas[p].enqueue([&, p] {
+			try {
+				ShardRoots<T, NumDims> &partition_roots = roots[p];
+				partition_roots.image_extents = image_extents;
+				partition_roots.corner = std::array<size_t, NumDims>();
+				partition_roots.corner[0] = p * extents[0];
+				partition_roots.extents = extents;
+				partition_roots.level = numDownsamples(extents);
+
+				ArrayNd<T, NumDims> partition(extents);
+				load(partition_roots.corner, partition);
+
+				std::vector<ArrayView<T, NumDims> > views;
+				for (std::size_t l = 1; l <= partition_roots.level; ++l) {
+					std::array<size_t, NumDims> cell = partition_roots.corner;
+					cell[0] >>= l;
+					views.push_back(results[l - 1].subView(cell, levelExtents(partition, l)));
+				}
+				buildShardLevels(partition, views.data(), partition_roots, true, (Histogram *)0);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--num_pending == 0) {
+				partition_done.notify_one();
+			}
+		});
+	}
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		partition_done.wait(lock, [&] { return num_pending == 0; });
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
+	/// the levels above the partitions are small, they are merged in the calling thread
+	std::vector<ArrayNd<T, NumDims> > coarse;
+	mergeShards(roots, coarse, false);
+	for (std::size_t l = 0; l != coarse.size(); ++l) {
+		const ArrayView<T, NumDims> &result = results[roots[0].level + l];
+		std::copy(coarse[l].data(), coarse[l].data() + coarse[l].num_elements(), result.origin);
+	}
+}
+
+
+/**
+	Returns views of all levels of the pyramid of an image in results (allocating them).
+	The levels of a PyramidBuffer are not initialized, so their memory is first touched by the node that builds them.
+*/
+template <typename T, std::size_t NumDims>
+std::vector<ArrayView<T, NumDims> > pyramidViews(const std::array<size_t, NumDims> &image_extents, std::vector<ArrayNd<T, NumDims> > &results) {
+	std::size_t num_levels = numDownsamples(image_extents);
+	results.reserve(results.size() + num_levels);
+	std::vector<ArrayView<T, NumDims> > views;
+	std::array<size_t, NumDims> extents = image_extents;
+	for (std::size_t l = 1; l <= num_levels; ++l) {
+		extents = halfExtents(extents);
+		results.emplace_back(extents);
+		views.push_back(makeView(results.back()));
+	}
+	return views;
+}
+
+template <typename T, std::size_t NumDims>
+std::vector<ArrayView<T, NumDims> > pyramidViews(const std::array<size_t, NumDims> &image_extents, PyramidBuffer<T, NumDims> &results) {
+	results.reshape(image_extents);
+	return std::vector<ArrayView<T, NumDims> >(results.levels(), results.levels() + results.size());
+}
+
+
+/**
+	NUMA aware computeDownsamplesParallel(..) for images that are loaded by partitions (e.g. read from a file).
+	The image is cut along dimention 0 into one partition per NUMA node of context (see numaPartitions(..)).
+	The arena of each node allocates its partition, calls load(corner, partition) to fill it, and builds
+	its levels, writing them into results; the few levels above the partitions are merged from their histograms
+	(as in mergeShards(..)). With a PyramidBuffer the levels are first touched by the node that writes them,
+	a vector of arrays is initialized by the calling thread.
+	Parameters:
+		image_extents - extents of the image (powers of 2)
+		load - load(corner, partition) fills partition (ArrayNd<T, NumDims>&) with the pixels of the image from corner on
+		results - Output, a vector of arrays (appended to) or a PyramidBuffer
+		context - NUMA nodes and thread cap, see ExecutionContext
+	The result is that of computeDownsamplesParallel(..) on the whole image.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram, typename Load, typename Results>
+void computeDownsamplesNuma(const std::array<size_t, NumDims> &image_extents, const Load &load, Results &results,
+							const ExecutionContext &context) {
+	std::vector<ArrayView<T, NumDims> > views = pyramidViews(image_extents, results);
+	buildNumaPyramid(image_extents, load, views.data(), context, (Histogram *)0);
+}
+
+
+/**
+	computeDownsamplesParallel(..) in an execution context (a thread cap, an arena of the caller or NUMA nodes),
+	results is a vector of arrays or a PyramidBuffer.
+	With context.numa on a machine with several nodes each node copies its partition of A into memory of the node first
+	(one pass over A), callers that load the image themselves should use computeDownsamplesNuma(..) instead.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram, typename Results>
+void computeDownsamplesParallel(const ArrayNd<T, NumDims> &A, Results &results, const ExecutionContext &context) {
+	std::array<size_t, NumDims> image_extents;
+	std::copy(A.shape(), A.shape() + NumDims, image_extents.begin());
+	if (!context.numa || numaPartitions(image_extents, context) == 1) {
+		executeIn(context, [&] {
+			computeDownsamplesParallel<T, NumDims, Histogram>(A, results);
+		});
+		return;
+	}
+
+	computeDownsamplesNuma<T, NumDims, Histogram>(image_extents, [&](const std::array<size_t, NumDims> &corner, ArrayNd<T, NumDims> &partition) {
+		size_t row_size = partition.num_elements() / partition.shape()[0];
+		const T *first = A.data() + corner[0] * row_size;
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, partition.shape()[0]), [&](const tbb::blocked_range<size_t> &r) {
+			std::copy(first + r.begin() * row_size, first + r.end() * row_size, partition.data() + r.begin() * row_size);
+		});
+	}, results, context);
+}
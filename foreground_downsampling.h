@@ -0,0 +1,498 @@
+/**
+	Downsampling assignment
+
+	foreground_downsampling.h
+*/
+
+#pragma once
+
+#include <initializer_list>
+#include "downsampling.h"
+
+
+/**
+	Labels that are not counted by computeDownsamplesForeground(..) (e.g. the background label 0 of a segmentation).
+	A block with no other label gets background(), the first of them.
+*/
+template <typename T>
+struct IgnoredLabels {
+	std::vector<T> labels;
+
+	IgnoredLabels(T label) : labels(1, label) {}
+
+	IgnoredLabels(std::initializer_list<T> labels) : labels(labels) {
+		assert(!this->labels.empty() && "at least one label must be ignored");
+	}
+
+	bool contains(T value) const {
+		for (std::size_t i = 0; i != labels.size(); ++i) {
+			if (value == labels[i]) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	T background() const {
+		return labels[0];
+	}
+};
+
+
+/**
+	Returns the default tile extent of computeDownsamplesForeground(..): tiles of about 2^10 pixels
+	(32x32 for 2-d images, 8x8x8 for volumes). Smaller tiles skip more background, larger ones cost less per tile.
+*/
+template <std::size_t NumDims>
+size_t defaultForegroundTileSize() {
+	return size_t(1) << (10 / NumDims);
+}
+
+
+/**
+	Sparse list of the tiles of an image that contain foreground, i.e. at least one pixel that is not ignored.
+	The other tiles are skipped by computeDownsamplesForeground(..) at every level.
+*/
+template <std::size_t NumDims>
+struct ForegroundTiles {
+	std::array<size_t, NumDims> tile_extents;   // extents of a tile (the tile size, or the image extent if it is smaller)
+	std::array<size_t, NumDims> num_tiles;      // number of tiles along each dimention
+	std::vector<size_t> tiles;                  // linear indices (c order) of the tiles with foreground, increasing
+
+	/**
+		Tiles of tile_size^NumDims pixels over an image with the given extents (powers of 2), none of them listed yet.
+	*/
+	ForegroundTiles(const std::array<size_t, NumDims> &image_extents, size_t tile_size) {
+		assert(tile_size >= 2 && (tile_size & (tile_size - 1)) == 0 && "tile size must be a power of 2");
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			tile_extents[k] = std::min(tile_size, image_extents[k]);
+			num_tiles[k] = image_extents[k] / tile_extents[k];
+		}
+	}
+
+	/**
+		Index of the first pixel of tile t.
+	*/
+	std::array<size_t, NumDims> corner(size_t t) const {
+		std::array<size_t, NumDims> result = unflatten(t, num_tiles);
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			result[k] *= tile_extents[k];
+		}
+		return result;
+	}
+};
+
+
+/**
+	Calls function(row, stride, length) for the rows (along the last dimention) of the sub-array of A
+	with the given corner and extents, until it returns false. Returns false if it was stopped.
+*/
+template <typename T, std::size_t NumDims, typename Function>
+bool forEachRow(const ArrayView<const T, NumDims> &A, const std::array<size_t, NumDims> &corner,
+				const std::array<size_t, NumDims> &extents, Function function) {
+	std::array<size_t, NumDims> row_extents = extents;
+	row_extents[NumDims - 1] = 1;
+	for (size_t r = 0; r != product(row_extents); ++r) {
+		std::array<size_t, NumDims> indices = unflatten(r, row_extents);
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			indices[k] += corner[k];
+		}
+		if (!function(&A(indices), A.strides[NumDims - 1], extents[NumDims - 1])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+	Returns true if the sub-array of A with the given corner and extents has a pixel that is not ignored.
+	Stops at the first such pixel, so only background regions are read completely.
+*/
+template <typename T, std::size_t NumDims>
+bool hasForeground(const ArrayView<const T, NumDims> &A, const std::array<size_t, NumDims> &corner,
+				   const std::array<size_t, NumDims> &extents, const IgnoredLabels<T> &ignored) {
+	return !forEachRow(A, corner, extents, [&](const T *row, index stride, size_t length) {
+		for (size_t x = 0; x != length; ++x) {
+			if (!ignored.contains(row[x * stride])) {
+				return false;
+			}
+		}
+		return true;
+	});
+}
+
+
+/**
+	Finds the tiles of A that contain foreground (a parallel scan that compares every pixel of the background tiles once).
+	Callers that already know where the foreground is (e.g. from the tiles of the previous frame or a region of interest)
+	can fill ForegroundTiles themselves, then the pixels of the other tiles are never read.
+*/
+template <typename T, std::size_t NumDims>
+ForegroundTiles<NumDims> findForegroundTiles(const ArrayNd<T, NumDims> &A, const IgnoredLabels<T> &ignored,
+											 size_t tile_size = defaultForegroundTileSize<NumDims>()) {
+	std::array<size_t, NumDims> extents;
+	std::copy(A.shape(), A.shape() + NumDims, extents.begin());
+	ForegroundTiles<NumDims> result(extents, tile_size);
+
+	ArrayView<const T, NumDims> view = makeView(A);
+	std::vector<char> occupied(product(result.num_tiles));
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, occupied.size()), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t t = r.begin(); t != r.end(); ++t) {
+			occupied[t] = hasForeground(view, result.corner(t), result.tile_extents, ignored);
+		}
+	});
+
+	for (size_t t = 0; t != occupied.size(); ++t) {
+		if (occupied[t]) {
+			result.tiles.push_back(t);
+		}
+	}
+	return result;
+}
+
+
+/**
+	Builds the histograms of the cells [begin, end) of the 1-downsample of A from the pixels that are not ignored.
+	Parameters:
+		A - the image (or a tile of it)
+		ignored - labels that are not counted
+		output - output, histograms of the 1-downsample of A
+		flags - output, flags(cell) is 0 if the block of the cell has no foreground (its histogram is empty)
+		result - output, modes of the cells with foreground (the other cells are not written)
+	Histogram needs addCount(..) and findMode(..) (BasicHashMap<T>, DenseHistogram<T, NumBins>).
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void createForegroundMaps(const ArrayView<const T, NumDims> &A, const IgnoredLabels<T> &ignored, const ArrayView<Histogram, NumDims> &output,
+						  const ArrayView<char, NumDims> &flags, const ArrayView<T, NumDims> &result, size_t begin, size_t end) {
+	const std::size_t BlockSize = std::size_t(1) << NumDims;
+	std::array<index, BlockSize> offsets = blockOffsets<NumDims>(A.strides.data());
+
+	for (size_t i = begin; i != end; ++i) {
+		std::array<size_t, NumDims> corner = getIndices<NumDims>(i, A.shape);
+		std::array<size_t, NumDims> cell = halfExtents(corner);
+		const T *first = &A(corner);
+
+		Histogram &hist = output(cell);
+		hist = Histogram();
+		bool any = false;
+		for (std::size_t j = 0; j != BlockSize; ++j) {
+			T value = first[offsets[j]];
+			if (!ignored.contains(value)) {
+				addCount(hist, value, 1);
+				any = true;
+			}
+		}
+
+		flags(cell) = any;
+		if (any) {
+			result(cell) = findMode(hist);
+		}
+	}
+}
+
+
+/**
+	Merges the histograms of the cells [begin, end) of the next level, skipping blocks without foreground.
+	Parameters as for createForegroundMaps(..), input and input_flags are the histograms and flags of the level that is merged.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void mergeForegroundMaps(const ArrayView<Histogram, NumDims> &input, const ArrayView<char, NumDims> &input_flags,
+						 const ArrayView<Histogram, NumDims> &output, const ArrayView<char, NumDims> &flags,
+						 const ArrayView<T, NumDims> &result, size_t begin, size_t end) {
+	const std::size_t BlockSize = std::size_t(1) << NumDims;
+	std::array<index, BlockSize> offsets = blockOffsets<NumDims>(input.strides.data());
+	std::array<index, BlockSize> flag_offsets = blockOffsets<NumDims>(input_flags.strides.data());
+
+	for (size_t i = begin; i != end; ++i) {
+		std::array<size_t, NumDims> corner = getIndices<NumDims>(i, input.shape);
+		std::array<size_t, NumDims> cell = halfExtents(corner);
+
+		const char *first_flag = &input_flags(corner);
+		bool any = false;
+		for (std::size_t j = 0; j != BlockSize; ++j) {
+			any = any || first_flag[flag_offsets[j]];
+		}
+
+		flags(cell) = any;
+		if (!any) {
+			output(cell) = Histogram();
+			continue;
+		}
+
+		/// children without foreground have empty histograms
+		Histogram *first = &input(corner);
+		std::array<Histogram *, BlockSize> block;
+		for (std::size_t j = 0; j != BlockSize; ++j) {
+			block[j] = first + offsets[j];
+		}
+		result(cell) = mergeMaps(block, output(cell));
+	}
+}
+
+
+/**
+	Sparse level of computeDownsamplesForeground(..): the histograms of the cells that have a tile with foreground
+	below them. Cells of background tiles are not stored.
+*/
+template <typename Histogram>
+struct ForegroundCells {
+	std::vector<size_t> cells;           // linear indices (c order) of the cells in the level
+	std::vector<Histogram> histograms;   // histograms[i] is the histogram of cells[i]
+	std::vector<char> flags;             // flags[i] is 0 if cells[i] has no foreground (its histogram is empty)
+};
+
+
+/**
+	Merges the sparse level input with the given extents into the next level, output.
+	Only the parents of the stored cells are created, children that are not stored count as background.
+	result is the next level of the downsamples, only the cells with foreground are written.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void mergeForegroundCells(ForegroundCells<Histogram> &input, const std::array<size_t, NumDims> &extents,
+						  ForegroundCells<Histogram> &output, const ArrayView<T, NumDims> &result) {
+	const std::size_t BlockSize = std::size_t(1) << NumDims;
+	std::array<size_t, NumDims> parent_extents = halfExtents(extents);
+
+	/// (parent cell, position of the child in its block, position of the child in input), grouped by parent
+	std::vector<std::array<size_t, 3> > children(input.cells.size());
+	forEachBlock(children.size(), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(); i != r.end(); ++i) {
+			std::array<size_t, NumDims> child = unflatten(input.cells[i], extents);
+			size_t parent = 0, j = 0;
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				parent = parent * parent_extents[k] + child[k] / 2;
+				j = j * 2 + child[k] % 2;
+			}
+			children[i] = std::array<size_t, 3>{{parent, j, i}};
+		}
+	}, true);
+	std::sort(children.begin(), children.end());
+
+	std::vector<size_t> starts;
+	output.cells.clear();
+	for (size_t i = 0; i != children.size(); ++i) {
+		if (i == 0 || children[i][0] != children[i - 1][0]) {
+			starts.push_back(i);
+			output.cells.push_back(children[i][0]);
+		}
+	}
+	starts.push_back(children.size());
+	output.histograms.assign(output.cells.size(), Histogram());
+	output.flags.assign(output.cells.size(), 0);
+
+	forEachBlock(output.cells.size(), [&](const tbb::blocked_range<size_t> &r) {
+		/// children that are not stored have empty histograms
+		Histogram empty = Histogram();
+		for (size_t p = r.begin(); p != r.end(); ++p) {
+			std::array<Histogram *, BlockSize> block;
+			block.fill(&empty);
+			bool any = false;
+			for (size_t i = starts[p]; i != starts[p + 1]; ++i) {
+				size_t child = children[i][2];
+				if (input.flags[child]) {
+					block[children[i][1]] = &input.histograms[child];
+					any = true;
+				}
+			}
+
+			output.flags[p] = any;
+			if (any) {
+				result(unflatten(output.cells[p], parent_extents)) = mergeMaps(block, output.histograms[p]);
+			}
+		}
+	}, true);
+}
+
+
+/**
+	Per thread storage of computeDownsamplesForeground(..): the histograms and flags of the levels of a tile.
+*/
+template <typename Histogram>
+struct ForegroundTileLevels {
+	std::vector<Histogram> buffers[2];
+	std::vector<char> flags[2];
+};
+
+
+/**
+	computeDownsamplesForeground(..) engine for a given Histogram type.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildForegroundPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, const IgnoredLabels<T> &ignored,
+							const ForegroundTiles<NumDims> &tiles) {
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		assert((A.shape()[k] & (A.shape()[k] - 1)) == 0 && "extents of A must be powers of 2");
+		assert(tiles.tile_extents[k] * tiles.num_tiles[k] == A.shape()[k] && "the tiles do not cover the image");
+	}
+
+	std::size_t num_levels = numDownsamples(A);
+	if (num_levels == 0) {
+		return;
+	}
+
+	/// every cell is background until a tile with foreground writes it
+	results.reserve(results.size() + num_levels);
+	std::vector<ArrayView<T, NumDims> > views;
+	for (std::size_t l = 1; l <= num_levels; ++l) {
+		results.emplace_back(levelExtents(A, l));
+		if (ignored.background() != T()) {
+			std::fill(results.back().data(), results.back().data() + results.back().num_elements(), ignored.background());
+		}
+		views.push_back(makeView(results.back()));
+	}
+
+	/// histograms and flags of the last level computed within tiles, a block of root_block cells for each tile with foreground
+	std::size_t tile_levels = numDownsamples(tiles.tile_extents);
+	std::array<size_t, NumDims> root_extents = levelExtents(A, tile_levels);
+	std::array<size_t, NumDims> root_block;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		root_block[k] = tiles.tile_extents[k] >> tile_levels;
+	}
+	ForegroundCells<Histogram> roots;
+	roots.cells.resize(tiles.tiles.size() * product(root_block));
+	roots.histograms.resize(roots.cells.size());
+	roots.flags.resize(roots.cells.size());
+
+	/**
+		Parallel loop over the tiles with foreground only, each one is taken through levels 1..tile_levels
+		(as in computeDownsamplesTiled(..)).
+	*/
+	ArrayView<const T, NumDims> image = makeView(A);
+	PerThread<ForegroundTileLevels<Histogram> > tile_levels_storage;
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles.tiles.size(), 1), [&](const tbb::blocked_range<size_t> &r) {
+		ForegroundTileLevels<Histogram> &levels = tile_levels_storage.local();
+
+		for (size_t t = r.begin(); t != r.end(); ++t) {
+			std::array<size_t, NumDims> corner = tiles.corner(tiles.tiles[t]);
+			std::array<size_t, NumDims> extents = tiles.tile_extents;
+
+			ArrayView<Histogram, NumDims> input;
+			ArrayView<char, NumDims> input_flags;
+			for (std::size_t l = 1; l <= tile_levels; ++l) {
+				std::array<size_t, NumDims> parent_extents = halfExtents(extents);
+				std::array<size_t, NumDims> cell = corner;
+				for (std::size_t k = 0; k != NumDims; ++k) {
+					cell[k] >>= l;
+				}
+
+				ArrayView<Histogram, NumDims> output = makeView(roots.histograms.data() + t * product(root_block), root_block);
+				ArrayView<char, NumDims> output_flags = makeView(roots.flags.data() + t * product(root_block), root_block);
+				if (l == tile_levels) {
+					for (size_t j = 0; j != product(root_block); ++j) {
+						std::array<size_t, NumDims> root = unflatten(j, root_block);
+						size_t linear = 0;
+						for (std::size_t k = 0; k != NumDims; ++k) {
+							linear = linear * root_extents[k] + cell[k] + root[k];
+						}
+						roots.cells[t * product(root_block) + j] = linear;
+					}
+				}
+				else {
+					levels.buffers[l % 2].resize(product(parent_extents));
+					levels.flags[l % 2].resize(product(parent_extents));
+					output = makeView(levels.buffers[l % 2].data(), parent_extents);
+					output_flags = makeView(levels.flags[l % 2].data(), parent_extents);
+				}
+
+				ArrayView<T, NumDims> result = views[l - 1].subView(cell, parent_extents);
+				if (l == 1) {
+					createForegroundMaps(image.subView(corner, extents), ignored, output, output_flags, result, 0, product(parent_extents));
+				}
+				else {
+					mergeForegroundMaps(input, input_flags, output, output_flags, result, 0, product(parent_extents));
+				}
+
+				input = output;
+				input_flags = output_flags;
+				extents = parent_extents;
+			}
+		}
+	});
+
+	/// the coarse levels are merged breadth first from the tile roots, only the cells above tiles with foreground are stored
+	ForegroundCells<Histogram> buffers[2];
+	buffers[tile_levels % 2] = std::move(roots);
+	for (std::size_t l = tile_levels + 1; l <= num_levels; ++l) {
+		mergeForegroundCells(buffers[(l - 1) % 2], levelExtents(A, l - 1), buffers[l % 2], views[l - 1]);
+	}
+}
+
+
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildForegroundPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, const IgnoredLabels<T> &ignored,
+							const ForegroundTiles<NumDims> &tiles, Histogram *) {
+	buildForegroundPyramid<T, NumDims, Histogram>(A, results, ignored, tiles);
+}
+
+
+/**
+	AutoHistogram version of buildForegroundPyramid(..): DenseHistogram<T, 16> or DenseHistogram<T, 64> if the smallest
+	and largest labels of the foreground tiles allow it, BasicHashMap<T> otherwise (see withDenseHistogram(..)).
+	Only the foreground tiles are read to find them.
+*/
+template <typename T, std::size_t NumDims>
+void buildForegroundPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, const IgnoredLabels<T> &ignored,
+							const ForegroundTiles<NumDims> &tiles, AutoHistogram *) {
+	ArrayView<const T, NumDims> image = makeView(A);
+	/// every range starts as (0, 0), which does not change the choice below
+	PerThread<std::pair<T, T> > ranges;
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles.tiles.size(), 1), [&](const tbb::blocked_range<size_t> &r) {
+		std::pair<T, T> &range = ranges.local();
+		for (size_t t = r.begin(); t != r.end(); ++t) {
+			forEachRow(image, tiles.corner(tiles.tiles[t]), tiles.tile_extents, [&](const T *row, index stride, size_t length) {
+				for (size_t x = 0; x != length; ++x) {
+					T value = row[x * stride];
+					if ((value < range.first || value > range.second) && !ignored.contains(value)) {
+						range.first = std::min(range.first, value);
+						range.second = std::max(range.second, value);
+					}
+				}
+				return true;
+			});
+		}
+	});
+
+	std::pair<T, T> range(T(0), T(0));
+	for (std::size_t i = 0; i != ranges.size(); ++i) {
+		range.first = std::min(range.first, ranges[i].first);
+		range.second = std::max(range.second, ranges[i].second);
+	}
+
+	withDenseHistogram<BasicHashMap<T> >(range, [&](auto *histogram) {
+		buildForegroundPyramid(A, results, ignored, tiles, histogram);
+	});
+}
+
+
+/**
+    Version of computeDownsamplesParallel(..) where the labels in ignored (e.g. the background of a segmentation)
+	are not counted: every block gets the mode of its other labels, or ignored.background() if it has none.
+
+	The image is cut into tiles and only the tiles with foreground (see ForegroundTiles) are processed: their levels
+	are built depth first as in computeDownsamplesTiled(..), counting only pixels that are not ignored. Background tiles
+	get no histograms at any level and their pixels are not read after the scan that finds them
+	(not at all when the caller passes the tiles). The coarse levels above the tiles only store the cells that have
+	a tile with foreground below them (see ForegroundCells). So the cost and the memory for histograms scale with
+	the foreground area instead of the image area.
+	When none of the labels of the image is ignored the result is the same as computeDownsamplesParallel(..).
+
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - Output vector contains all l-downsamplings of the original image.
+		ignored - the labels that are not counted
+		tiles - the tiles with foreground, found with findForegroundTiles(..) if null
+	By default (AutoHistogram) the histograms are dense for small labels and hashmaps otherwise. Histogram needs
+	addCount(..), findMode(..) and mergeMaps(..) without an arena: BasicHashMap<T> or DenseHistogram<T, NumBins>
+	(then all labels that are not ignored must be less than NumBins), not CompactHistogram<T>.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesForeground(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results,
+								  const IgnoredLabels<T> &ignored, const ForegroundTiles<NumDims> *tiles = 0) {
+	if (tiles) {
+		buildForegroundPyramid(A, results, ignored, *tiles, (Histogram *)0);
+	}
+	else {
+		buildForegroundPyramid(A, results, ignored, findForegroundTiles(A, ignored), (Histogram *)0);
+	}
+}
@@ -0,0 +1,218 @@
+/**
+	Downsampling assignment
+
+	heavy_hitters_histogram.h
+*/
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include "compact_histogram.h"
+
+
+/**
+	Approximate histogram of fixed size: a heavy hitters summary with at most K (label, count) pairs.
+
+	Exact histograms of coarse levels hold every distinct label of a large region, so for high-cardinality
+	segmentations their memory and merge time grow with the label entropy. The summary keeps only the
+	K labels with the largest counts, every cell takes sizeof(HeavyHitters<T, K>) bytes no matter what the data is,
+	and merging 2^ndims summaries costs O(K * 2^ndims).
+
+	It is a variant of the Misra-Gries summary: when more than K labels are left after a merge, the labels
+	beyond the K largest are dropped and the (K+1)-th largest count is added to the error (Misra-Gries would also
+	subtract it from the remaining counts, which can leave a summary without any label to return as the mode).
+	Like for Misra-Gries the error of a cell is at most (number of pixels of the cell) / (K+1) per level of merging.
+
+	Guarantee: every stored count is at most `error` smaller than the true number of occurances of its label
+	(counts are never overestimated), and a label that is not stored occurs at most `error` times.
+	So the true count of the returned mode is at most `error` smaller than the count of the exact mode.
+	error is 0 while no more than K distinct labels have been seen, then the summary is exact.
+
+	Entries are sorted by label, like CompactHistogram<T>, so summaries are merged with a linear k-way merge.
+*/
+template <typename T, std::size_t K>
+struct HeavyHitters {
+	static_assert(K >= 1, "a heavy hitters summary must keep at least one label to return as the mode");
+	static const std::size_t capacity = K;
+
+	unsigned int size;
+	unsigned int error;
+	std::array<LabelCount<T>, K> entries;
+
+	HeavyHitters() : size(0), error(0) {}
+};
+
+
+/**
+	Reduces n entries (sorted by label) to the K entries with the largest counts, ties are broken in favour of
+	smaller labels like isBetterMode(..) does. The order of entries is kept.
+	Any label that is dropped has a count of at most the (K+1)-th largest count, which is added to error.
+	Parameters:
+		entries - entries sorted by label, the first entries are overwritten with the remaining ones
+		n - number of entries
+		counts - scratch buffer of n counts
+		error - error of the entries, increased by the count of the largest label that is dropped
+	Returns the number of remaining entries.
+	Complexity: O(n)
+*/
+template <typename T, std::size_t K>
+std::size_t reduceHeavyHitters(LabelCount<T> *entries, std::size_t n, unsigned int *counts, unsigned int &error) {
+	if (n <= K) {
+		return n;
+	}
+
+	for (std::size_t i = 0; i != n; ++i) {
+		counts[i] = entries[i].count;
+	}
+	std::nth_element(counts, counts + K, counts + n, std::greater<unsigned int>());
+	unsigned int threshold = counts[K];
+
+	/// all entries above the threshold fit, the free places go to the smallest labels at the threshold
+	std::size_t above = 0;
+	for (std::size_t i = 0; i != n; ++i) {
+		above += entries[i].count > threshold;
+	}
+	std::size_t ties = K - above;
+
+	std::size_t m = 0;
+	for (std::size_t i = 0; i != n; ++i) {
+		bool keep = entries[i].count > threshold;
+		if (entries[i].count == threshold && ties != 0) {
+			keep = true;
+			--ties;
+		}
+		if (keep) {
+			entries[m++] = entries[i];
+		}
+	}
+	error += threshold;
+	return m;
+}
+
+
+/**
+	Returns the label with the largest count (see isBetterMode(..) for how ties are broken).
+*/
+template <typename T>
+T findHeavyHittersMode(const LabelCount<T> *entries, std::size_t n) {
+	T mode = entries[0].label;
+	unsigned int max_num_occurances = entries[0].count;
+	for (std::size_t i = 1; i != n; ++i) {
+		if (isBetterMode(entries[i].label, entries[i].count, mode, max_num_occurances)) {
+			mode = entries[i].label;
+			max_num_occurances = entries[i].count;
+		}
+	}
+	return mode;
+}
+
+
+/**
+	Fills hist with n entries sorted by label (n may be larger than K, counts is a scratch buffer of n counts).
+	Returns the mode of the entries that were kept.
+*/
+template <typename T, std::size_t K>
+T assignHeavyHitters(LabelCount<T> *entries, std::size_t n, unsigned int *counts, unsigned int error, HeavyHitters<T, K> &hist) {
+	n = reduceHeavyHitters<T, K>(entries, n, counts, error);
+	std::copy(entries, entries + n, hist.entries.begin());
+	hist.size = (unsigned int)n;
+	hist.error = error;
+	return findHeavyHittersMode(hist.entries.data(), n);
+}
+
+
+/**
+    Heavy hitters version of createMap(..).
+	Complexity: O(BlockSize^2), the block is sorted with insertion sort
+*/
+template <typename T, std::size_t BlockSize, std::size_t K>
+T createMap(const std::array<T, BlockSize> &block, HeavyHitters<T, K> &hist) {
+	std::array<T, BlockSize> sorted = block;
+	for (std::size_t i = 1; i != BlockSize; ++i) {
+		T value = sorted[i];
+		std::size_t j = i;
+		for (; j != 0 && value < sorted[j - 1]; --j) {
+			sorted[j] = sorted[j - 1];
+		}
+		sorted[j] = value;
+	}
+
+	std::array<LabelCount<T>, BlockSize> entries;
+	std::size_t n = 0;
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		if (n != 0 && entries[n - 1].label == sorted[i]) {
+			++entries[n - 1].count;
+		}
+		else {
+			entries[n].label = sorted[i];
+			entries[n].count = 1;
+			++n;
+		}
+	}
+	std::array<unsigned int, BlockSize> counts;
+	return assignHeavyHitters(entries.data(), n, counts.data(), 0, hist);
+}
+
+
+/**
+    Heavy hitters version of mergeMaps(..): the summaries are added with a k-way merge (see CompactHistogram<T>)
+	and reduced back to K entries. The errors of the children add up.
+	Complexity: O(K * BlockSize^2)
+*/
+template <typename T, std::size_t BlockSize, std::size_t K>
+T mergeMaps(const std::array<HeavyHitters<T, K> *, BlockSize> &maps, HeavyHitters<T, K> &output_map) {
+	std::array<const LabelCount<T> *, BlockSize> heads;
+	std::array<const LabelCount<T> *, BlockSize> ends;
+	unsigned int error = 0;
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		heads[i] = maps[i]->entries.data();
+		ends[i] = heads[i] + maps[i]->size;
+		error += maps[i]->error;
+	}
+
+	std::array<LabelCount<T>, K * BlockSize> merged;
+	std::size_t n = 0;
+	while (true) {
+		bool found = false;
+		T label = T();
+		for (std::size_t i = 0; i != BlockSize; ++i) {
+			if (heads[i] != ends[i] && (!found || heads[i]->label < label)) {
+				label = heads[i]->label;
+				found = true;
+			}
+		}
+		if (!found) {
+			break;
+		}
+
+		unsigned int count = 0;
+		for (std::size_t i = 0; i != BlockSize; ++i) {
+			if (heads[i] != ends[i] && heads[i]->label == label) {
+				count += heads[i]->count;
+				++heads[i];
+			}
+		}
+		merged[n].label = label;
+		merged[n].count = count;
+		++n;
+	}
+
+	std::array<unsigned int, K * BlockSize> counts;
+	return assignHeavyHitters(merged.data(), n, counts.data(), error, output_map);
+}
+
+
+/**
+	Converts an exact histogram into a summary (used where the pyramid switches from exact to approximate histograms).
+	Returns the mode of the summary.
+*/
+template <typename T, std::size_t InlineCapacity, std::size_t K>
+T convertMap(const CompactHistogram<T, InlineCapacity> &exact, HeavyHitters<T, K> &hist, 
+			 std::vector<LabelCount<T> > &scratch, std::vector<unsigned int> &counts) {
+	scratch.assign(exact.begin(), exact.end());
+	counts.resize(scratch.size());
+	return assignHeavyHitters(scratch.data(), scratch.size(), counts.data(), 0, hist);
+}
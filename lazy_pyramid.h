@@ -0,0 +1,134 @@
+/**
+	Downsampling assignment
+
+	lazy_pyramid.h
+*/
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include "downsampling.h"
+
+
+/**
+	Pyramid of an image whose levels are computed when they are first accessed.
+
+	level(l) of a level that was not computed yet builds it with the engine of computeDownsamplesParallel(..),
+	storing only level l. The hashmaps of the deepest level built so far are kept, so accessing levels
+	in increasing order (e.g. level 3, then 5) merges on from there and A is read only once; a level finer
+	than that is built from A again. Nothing is computed for levels that are never accessed, A is not read
+	before the first level(..) (also not to pick the histogram type of AutoHistogram).
+	level(..) may be called from several threads, the levels are built one at a time.
+
+	The image must outlive the pyramid. Histogram is chosen as in computeDownsamplesParallel(..).
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+class LazyPyramid {
+	/**
+		Builds levels with the histogram type chosen for the image (the type is known only at run time for AutoHistogram).
+	*/
+	struct Builder {
+		virtual ~Builder() {}
+		virtual void build(const ArrayView<T, NumDims> *results, std::size_t level) = 0;
+	};
+
+	template <typename LevelsHistogram>
+	struct TypedBuilder : Builder {
+		const ArrayNd<T, NumDims> &A;
+		bool parallel;
+		HistogramLevels<LevelsHistogram> levels;
+		std::size_t frontier;   // level whose hashmaps are in levels, 0 if none
+
+		TypedBuilder(const ArrayNd<T, NumDims> &A, bool parallel) : A(A), parallel(parallel), frontier(0) {}
+
+		void build(const ArrayView<T, NumDims> *results, std::size_t level) {
+			if (frontier != 0 && level > frontier) {
+				mergeLevels(levels, levelExtents(A, frontier), results + frontier, level - frontier, parallel);
+				frontier = level;
+			}
+			else if (frontier == 0) {
+				frontier = buildLevels(A, results, level, parallel, levels);
+			}
+			else {
+				/// finer than the hashmaps that are kept, start over from A without losing them
+				HistogramLevels<LevelsHistogram> scratch;
+				buildLevels(A, results, level, parallel, scratch);
+			}
+		}
+	};
+
+	const ArrayNd<T, NumDims> &A;
+	bool parallel;
+	std::unique_ptr<Builder> builder;   // created by the first level(..)
+	std::vector<std::unique_ptr<ArrayNd<T, NumDims> > > computed;   // computed[l - 1] is level l once it is built
+	std::mutex mutex;
+
+	LazyPyramid(const LazyPyramid &);
+	LazyPyramid &operator=(const LazyPyramid &);
+
+	template <typename LevelsHistogram>
+	void createBuilder(LevelsHistogram *) {
+		builder.reset(new TypedBuilder<LevelsHistogram>(A, parallel));
+	}
+
+	void createBuilder(AutoHistogram *) {
+		withAutoHistogram(A, parallel, [&](auto *histogram) {
+			createBuilder(histogram);
+		});
+	}
+
+public:
+	/**
+		Constructor parameters:
+			A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+			parallel - build the levels with tbb::parallel_for (true) or in the calling thread (false)
+	*/
+	explicit LazyPyramid(const ArrayNd<T, NumDims> &A, bool parallel = true) : A(A), parallel(parallel), computed(numDownsamples(A)) {}
+
+	/**
+		Number of levels, numDownsamples(A).
+	*/
+	std::size_t size() const {
+		return computed.size();
+	}
+
+	/**
+		Returns true if level l was built already.
+	*/
+	bool isComputed(std::size_t l) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return computed[l - 1] != 0;
+	}
+
+	/**
+		Returns the l-downsample of A (1 <= l <= size()), building it first if needed.
+	*/
+	const ArrayNd<T, NumDims> &level(std::size_t l) {
+		assert(l >= 1 && l <= computed.size());
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!computed[l - 1]) {
+			if (!builder) {
+				createBuilder((Histogram *)0);
+			}
+			std::unique_ptr<ArrayNd<T, NumDims> > output(new ArrayNd<T, NumDims>(levelExtents(A, l)));
+
+			std::vector<ArrayView<T, NumDims> > views;
+			for (std::size_t k = 1; k != l; ++k) {
+				views.push_back(makeView((T *)0, levelExtents(A, k)));
+			}
+			views.push_back(makeView(*output));
+			builder->build(views.data(), l);
+
+			computed[l - 1] = std::move(output);
+		}
+		return *computed[l - 1];
+	}
+
+	/**
+		Returns the coarsest level.
+	*/
+	const ArrayNd<T, NumDims> &coarsest() {
+		return level(size());
+	}
+};
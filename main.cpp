@@ -5,12 +5,64 @@
 	Author: Alexey Imaev, 2014
 */
 
+#include <string>
 #include "downsampling.h"
 
 void test1();
 void test2();
+void test3();
+void test5();
+void test6();
+void test7();
+void test8();
+void test9();
+void test10();
+void test11();
+void test12();
+void test13();
+void test14();
+void test15();
+void test16();
+void test17();
+void test18();
+void test19();
+void test20();
+void test21();
+void test22();
+void test23();
+void test24();
+void test25();
+int test24Worker(int argc, char *argv[]);
+
+int main(int argc, char *argv[]) {
+	/// test24 runs its worker processes with this binary
+	if (argc > 1 && std::string(argv[1]) == "--test24-worker") {
+		return test24Worker(argc, argv);
+	}
 
-void main() {
 	//test1();
 	test2();
+	test3();
+	test5();
+	test6();
+	test7();
+	test8();
+	test9();
+	test10();
+	test11();
+	test12();
+	test13();
+	test14();
+	test15();
+	test16();
+	test17();
+	test18();
+	test19();
+	test20();
+	test21();
+	test22();
+	test23();
+	test24();
+	test25();
+	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,102 @@
+/**
+	Downsampling assignment
+
+	mapped_file.cpp
+*/
+
+#include "mapped_file.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+	Throws std::runtime_error describing the last system error.
+*/
+static void throwError(const string &what, const string &path) {
+	throw runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+MappedFile::MappedFile(const string &path, Mode mode, size_t size)
+	: path(path), fd(-1), address(0), length(0) {
+
+	int flags = mode == READ ? O_RDONLY : mode == CREATE ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR;
+	fd = open(path.c_str(), flags, 0644);
+	if (fd < 0) {
+		throwError("cannot open", path);
+	}
+
+	if (mode == CREATE) {
+		if (ftruncate(fd, (off_t)size) != 0) {
+			close(fd);
+			throwError("cannot resize", path);
+		}
+		length = size;
+	}
+	else {
+		struct stat st;
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			throwError("cannot stat", path);
+		}
+		length = (size_t)st.st_size;
+	}
+
+	if (length != 0) {
+		int protection = mode == READ ? PROT_READ : PROT_READ | PROT_WRITE;
+		void *p = mmap(0, length, protection, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			throwError("cannot map", path);
+		}
+		address = (char *)p;
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (address != 0) {
+		munmap(address, length);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+size_t MappedFile::pageSize() {
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/**
+	Returns the page aligned sub-range of [offset, offset + n), or an empty range.
+*/
+static void pageRange(size_t offset, size_t n, size_t length, size_t &begin, size_t &end) {
+	size_t page = MappedFile::pageSize();
+	begin = (offset + page - 1) / page * page;
+	end = min(offset + n, length);
+	end = end == length ? end : end / page * page;
+	if (end < begin) {
+		end = begin;
+	}
+}
+
+void MappedFile::release(size_t offset, size_t n) {
+	size_t begin, end;
+	pageRange(offset, n, length, begin, end);
+	if (end > begin) {
+		madvise(address + begin, end - begin, MADV_DONTNEED);
+	}
+}
+
+void MappedFile::flush(size_t offset, size_t n) {
+	size_t page = MappedFile::pageSize();
+	size_t begin = offset / page * page;
+	size_t end = min(offset + n, length);
+	if (end > begin) {
+		msync(address + begin, end - begin, MS_ASYNC);
+	}
+}
@@ -0,0 +1,65 @@
+/**
+	Downsampling assignment
+
+	mapped_file.h
+*/
+
+#pragma once
+#include <cstddef>
+#include <string>
+
+
+/**
+	A file mapped into memory (POSIX mmap). 
+	The file is unmapped and closed by the destructor. Errors are reported with std::runtime_error.
+*/
+class MappedFile {
+	std::string path;
+	int fd;
+	char *address;
+	size_t length;
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+public:
+	enum Mode {
+		READ,     // map an existing file read-only
+		CREATE,   // create (or truncate) a file of the given size and map it read-write
+		UPDATE    // map an existing file read-write
+	};
+
+	/**
+		Constructor parameters:
+			path - path of the file
+			mode - see Mode
+			size - size of the file in bytes, only used with CREATE
+	*/
+	MappedFile(const std::string &path, Mode mode, size_t size = 0);
+	~MappedFile();
+
+	char *data() const {
+		return address;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+	/**
+		Size of a memory page in bytes.
+	*/
+	static size_t pageSize();
+
+	/**
+		Tells the OS that bytes [offset, offset + n) of the mapping are not needed anymore, so their pages 
+		can be dropped from memory of the process (written pages stay in the page cache and go to the file).
+		Only whole pages inside the range are released.
+	*/
+	void release(size_t offset, size_t n);
+
+	/**
+		Schedules writing bytes [offset, offset + n) of the mapping to the file.
+	*/
+	void flush(size_t offset, size_t n);
+};
@@ -0,0 +1,357 @@
+/**
+	Downsampling assignment
+
+	morton_downsampling.h
+*/
+
+#pragma once
+
+#include "downsampling.h"
+
+
+/**
+	Z-order (Morton) layout of an array of size 2^L1 x 2^L2 x ... x 2^Ld.
+
+	The array is cut into a row-major grid of roots, cubes of 2^side_bits pixels along each dimention
+	(side_bits = min(L1, ..., Ld)). Within a root the bits of the indices are interleaved: bit b of the index
+	along dimention k is bit b * NumDims + NumDims - 1 - k of the offset. So the 2^NumDims pixels of a block are
+	contiguous, and so are the blocks of any coarser block, up to the roots. The layout of the l-downsample of
+	the array has the same roots with side_bits - l, so cell i of a level has cells 2^NumDims * i .. 2^NumDims * i + 2^NumDims - 1
+	of the finer level as children, and a range of cells covers compact squares (cubes) of the image.
+*/
+template <std::size_t NumDims>
+struct MortonLayout {
+	std::array<size_t, NumDims> extents;
+	std::size_t side_bits;
+	std::array<size_t, NumDims> num_roots;
+	size_t root_volume;
+
+	MortonLayout() : side_bits(0), root_volume(1) {
+		extents.fill(0);
+		num_roots.fill(0);
+	}
+
+	explicit MortonLayout(const std::array<size_t, NumDims> &extents)
+		: extents(extents), side_bits(numDownsamples(extents)), root_volume(size_t(1) << (side_bits * NumDims)) {
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			assert((extents[k] & (extents[k] - 1)) == 0 && "extents must be powers of 2");
+			num_roots[k] = extents[k] >> side_bits;
+		}
+	}
+
+	/**
+		Spreads the bits of coordinate (less than 2^side_bits) to the bits of dimention k in an offset within a root.
+	*/
+	size_t dilate(std::size_t k, size_t coordinate) const {
+		size_t result = 0;
+		for (std::size_t b = 0; b != side_bits; ++b) {
+			result |= ((coordinate >> b) & 1) << (b * NumDims + NumDims - 1 - k);
+		}
+		return result;
+	}
+
+	/**
+		Returns the offset of the element with the given indices.
+	*/
+	size_t offset(const std::array<size_t, NumDims> &indices) const {
+		size_t root = 0, code = 0;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			root = root * num_roots[k] + (indices[k] >> side_bits);
+			code |= dilate(k, indices[k] & ((size_t(1) << side_bits) - 1));
+		}
+		return root * root_volume + code;
+	}
+
+	/**
+		Writes the offsets of the extents[NumDims - 1] elements of a row (along the last dimention) to offsets.
+		row[NumDims - 1] is ignored. Costs O(side_bits) per row and O(1) per element: the offsets along the row
+		are incremented in their dilated form.
+	*/
+	void rowOffsets(const std::array<size_t, NumDims> &row, size_t *offsets) const {
+		const std::size_t last = NumDims - 1;
+		size_t root = 0, code = 0;
+		for (std::size_t k = 0; k != last; ++k) {
+			root = root * num_roots[k] + (row[k] >> side_bits);
+			code |= dilate(k, row[k] & ((size_t(1) << side_bits) - 1));
+		}
+		root *= num_roots[last];
+
+		const size_t side = size_t(1) << side_bits;
+		const size_t mask = dilate(last, side - 1);
+		for (size_t x0 = 0; x0 < extents[last]; x0 += side) {
+			size_t base = (root + (x0 >> side_bits)) * root_volume + code;
+			size_t dx = 0;
+			for (size_t x = 0; x != side; ++x) {
+				offsets[x0 + x] = base + dx;
+				dx = (dx - mask) & mask;
+			}
+		}
+	}
+};
+
+
+/**
+	Array stored in the Z-order layout (see MortonLayout).
+*/
+template <typename T, std::size_t NumDims>
+struct MortonArray {
+	MortonLayout<NumDims> layout;
+	std::vector<T> data;
+
+	MortonArray() {}
+
+	explicit MortonArray(const std::array<size_t, NumDims> &extents) : layout(extents), data(product(extents)) {}
+
+	T &operator()(const std::array<size_t, NumDims> &indices) {
+		return data[layout.offset(indices)];
+	}
+
+	const T &operator()(const std::array<size_t, NumDims> &indices) const {
+		return data[layout.offset(indices)];
+	}
+};
+
+
+/**
+	Calls function(row, offsets) for every row (along the last dimention) of an array with the given layout:
+	row holds the indices of the first element of the row, offsets the Morton offsets of its elements.
+*/
+template <std::size_t NumDims, typename Function>
+void forEachMortonRow(const MortonLayout<NumDims> &layout, bool parallel, Function function) {
+	std::array<size_t, NumDims> row_extents = layout.extents;
+	row_extents[NumDims - 1] = 1;
+	forEachBlock(product(row_extents), [&](const tbb::blocked_range<size_t> &r) {
+		std::vector<size_t> offsets(layout.extents[NumDims - 1]);
+		for (size_t i = r.begin(); i != r.end(); ++i) {
+			std::array<size_t, NumDims> row = unflatten(i, row_extents);
+			layout.rowOffsets(row, offsets.data());
+			function(row, offsets.data());
+		}
+	}, parallel);
+}
+
+
+/**
+	Copies the row-major array A to the Z-order array output (resized to the extents of A).
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld
+		output - output, A in the Z-order layout
+		parallel - copy the rows with tbb::parallel_for (true) or in the calling thread (false)
+*/
+template <typename T, std::size_t NumDims>
+void toMorton(const ArrayNd<T, NumDims> &A, MortonArray<T, NumDims> &output, bool parallel = true) {
+	std::array<size_t, NumDims> extents{};
+	std::copy(A.shape(), A.shape() + NumDims, extents.begin());
+	if (output.layout.extents != extents) {
+		output = MortonArray<T, NumDims>(extents);
+	}
+
+	ArrayView<const T, NumDims> view = makeView(A);
+	T *data = output.data.data();
+	forEachMortonRow(output.layout, parallel, [&](const std::array<size_t, NumDims> &row, const size_t *offsets) {
+		const T *first = &view(row);
+		for (size_t x = 0; x != extents[NumDims - 1]; ++x) {
+			data[offsets[x]] = first[x * view.strides[NumDims - 1]];
+		}
+	});
+}
+
+
+/**
+	Copies the Z-order array A to the row-major array output (resized to the extents of A if needed).
+*/
+template <typename T, std::size_t NumDims>
+void fromMorton(const MortonArray<T, NumDims> &A, ArrayNd<T, NumDims> &output, bool parallel = true) {
+	const std::array<size_t, NumDims> &extents = A.layout.extents;
+	if (!std::equal(extents.begin(), extents.end(), output.shape())) {
+		output.resize(extents);
+	}
+
+	ArrayView<T, NumDims> view = makeView(output);
+	const T *data = A.data.data();
+	forEachMortonRow(A.layout, parallel, [&](const std::array<size_t, NumDims> &row, const size_t *offsets) {
+		T *first = &view(row);
+		for (size_t x = 0; x != extents[NumDims - 1]; ++x) {
+			first[x * view.strides[NumDims - 1]] = data[offsets[x]];
+		}
+	});
+}
+
+
+/**
+	Builds level 1 of a Z-order pyramid and its histograms (generic version, any number of dimentions).
+	The 2^NumDims pixels of block i are the consecutive pixels from 2^NumDims * i.
+	Returns the level of the histograms in levels (0 if A cannot be downsampled).
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+std::size_t createMortonFirstLevels(const MortonArray<T, NumDims> &A, std::vector<MortonArray<T, NumDims> > &results,
+									HistogramLevels<Histogram> &levels, bool parallel, std::false_type) {
+	const std::size_t BlockSize = std::size_t(1) << NumDims;
+	if (A.layout.side_bits == 0) {
+		return 0;
+	}
+
+	results.emplace_back(halfExtents(A.layout.extents));
+	T *result = results.back().data.data();
+	size_t n = results.back().data.size();
+	Histogram *output = levels.next(n).data();
+	typename HistogramArena<Histogram>::type *arena = &levels.arenas[1 - levels.current];
+	const T *pixels = A.data.data();
+	forEachBlock(n, [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(); i != r.end(); ++i) {
+			std::array<T, BlockSize> block;
+			std::copy(pixels + i * BlockSize, pixels + (i + 1) * BlockSize, block.begin());
+			result[i] = createMap(block, output[i], *arena);
+		}
+	}, parallel);
+	levels.swap();
+	return 1;
+}
+
+
+/**
+	2-d version of createMortonFirstLevels(..) for pixel types with a SIMD mode kernel, like createFirstLevels(..)
+	for row-major images: level 1 is computed with modes2x2(..) and no histograms, the histograms of level 2
+	are built straight from the 16 consecutive pixels of each 4x4 block.
+	Returns the level of the histograms in levels.
+*/
+template <typename T, typename Histogram>
+std::size_t createMortonFirstLevels(const MortonArray<T, 2> &A, std::vector<MortonArray<T, 2> > &results,
+									HistogramLevels<Histogram> &levels, bool parallel, std::true_type) {
+	if (A.layout.side_bits < 2) {
+		return createMortonFirstLevels(A, results, levels, parallel, std::false_type());
+	}
+
+	/// block i is pixels 4i (top left), 4i + 1 (top right), 4i + 2 and 4i + 3 (bottom), the kernel wants two rows
+	const size_t Chunk = 256;
+	results.emplace_back(halfExtents(A.layout.extents));
+	T *modes = results.back().data.data();
+	const T *pixels = A.data.data();
+	forEachBlock(results.back().data.size() / Chunk + 1, [&](const tbb::blocked_range<size_t> &r) {
+		std::array<T, 2 * Chunk> row0, row1;
+		size_t end = std::min(r.end() * Chunk, results.back().data.size());
+		for (size_t first = r.begin() * Chunk; first < end; first += Chunk) {
+			size_t count = std::min(Chunk, end - first);
+			for (size_t j = 0; j != count; ++j) {
+				const T *block = pixels + 4 * (first + j);
+				row0[2 * j] = block[0];
+				row0[2 * j + 1] = block[1];
+				row1[2 * j] = block[2];
+				row1[2 * j + 1] = block[3];
+			}
+			modes2x2(row0.data(), row1.data(), 2 * count, modes + first);
+		}
+	}, parallel);
+
+	results.emplace_back(halfExtents(halfExtents(A.layout.extents)));
+	T *result = results.back().data.data();
+	size_t n = results.back().data.size();
+	Histogram *output = levels.next(n).data();
+	typename HistogramArena<Histogram>::type *arena = &levels.arenas[1 - levels.current];
+	forEachBlock(n, [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t i = r.begin(); i != r.end(); ++i) {
+			std::array<T, 16> block;
+			std::copy(pixels + i * 16, pixels + (i + 1) * 16, block.begin());
+			result[i] = createMap(block, output[i], *arena);
+		}
+	}, parallel);
+	levels.swap();
+	return 2;
+}
+
+
+/**
+	computeDownsamplesMorton(..) engine for a given Histogram type, on Z-order arrays.
+	The children of cell i are the 2^NumDims consecutive pixels (histograms) from 2^NumDims * i, so there is
+	no index math or gathering from distant rows: a chunk of the loop reads one contiguous range of the
+	previous level and writes one contiguous range of histograms and modes.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildMortonPyramid(const MortonArray<T, NumDims> &A, std::vector<MortonArray<T, NumDims> > &results, bool parallel, Histogram *) {
+	const std::size_t BlockSize = std::size_t(1) << NumDims;
+	std::size_t num_levels = A.layout.side_bits;
+	results.reserve(results.size() + num_levels);
+
+	HistogramLevels<Histogram> levels;
+	std::size_t first = createMortonFirstLevels(A, results, levels, parallel,
+		std::integral_constant<bool, NumDims == 2 && HasModeKernel<T>::value>());
+
+	for (std::size_t l = first + 1; l <= num_levels; ++l) {
+		results.emplace_back(halfExtents(results.back().layout.extents));
+		T *result = results.back().data.data();
+
+		size_t n = results.back().data.size();
+		Histogram *input = levels.buffers[levels.current].data();
+		Histogram *output = levels.next(n).data();
+		typename HistogramArena<Histogram>::type *arena = &levels.arenas[1 - levels.current];
+		forEachBlock(n, [&](const tbb::blocked_range<size_t> &r) {
+			for (size_t i = r.begin(); i != r.end(); ++i) {
+				std::array<Histogram *, BlockSize> block;
+				for (std::size_t j = 0; j != BlockSize; ++j) {
+					block[j] = input + i * BlockSize + j;
+				}
+				result[i] = mergeMaps(block, output[i], *arena);
+			}
+		}, parallel);
+		levels.swap();
+	}
+}
+
+
+/**
+	Row-major version of buildMortonPyramid(..): A is converted to the Z-order layout, the levels are built
+	in it and converted back, each conversion a parallel pass.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildMortonPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, bool parallel, Histogram *histogram) {
+	MortonArray<T, NumDims> input;
+	toMorton(A, input, parallel);
+
+	std::vector<MortonArray<T, NumDims> > levels;
+	buildMortonPyramid(input, levels, parallel, histogram);
+
+	results.reserve(results.size() + levels.size());
+	for (std::size_t l = 0; l != levels.size(); ++l) {
+		results.emplace_back(levels[l].layout.extents);
+		fromMorton(levels[l], results.back(), parallel);
+	}
+}
+
+
+template <typename T, std::size_t NumDims>
+void buildMortonPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, bool parallel, AutoHistogram *) {
+	withAutoHistogram(A, parallel, [&](auto *histogram) {
+		buildMortonPyramid(A, results, parallel, histogram);
+	});
+}
+
+
+/**
+    Version of computeDownsamplesParallel(..) that builds the levels in the Z-order layout (see MortonLayout).
+
+	In the row-major engine the 2^NumDims children of a cell are in different rows, far apart in memory
+	for large images, and consecutive cells of a chunk of the loop gather from as many distant rows.
+	In the Z-order layout the children are contiguous at every level, for the image, the histograms
+	and the modes, and each chunk of the loop covers a compact square of the image.
+	The image is converted to the layout and the levels back to row-major in parallel passes;
+	callers that keep their data in Z-order can use the MortonArray version and skip both.
+	The results are bit-identical to computeDownsamplesParallel(..) with the same Histogram.
+
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - Output vector contains all l-downsamplings of the original image.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesMorton(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results) {
+	buildMortonPyramid(A, results, true, (Histogram *)0);
+}
+
+
+/**
+	computeDownsamplesMorton(..) for an image in the Z-order layout, the levels are appended in the same layout.
+	Histogram must be given (AutoHistogram needs a row-major image), by default CompactHistogram<T>.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = CompactHistogram<T> >
+void computeDownsamplesMorton(const MortonArray<T, NumDims> &A, std::vector<MortonArray<T, NumDims> > &results) {
+	buildMortonPyramid(A, results, true, (Histogram *)0);
+}
@@ -0,0 +1,321 @@
+/**
+	Downsampling assignment
+
+	persistent_pyramid.h
+*/
+
+#pragma once
+
+#include <unordered_map>
+#include "downsampling.h"
+
+
+/**
+	A pyramid that keeps the histograms of all its levels, so that edits of the image can be applied
+	without recomputing the whole pyramid.
+
+	computeDownsamplesParallel(..) consumes every level of hashmaps to build the next one. Here the hashmap
+	of a cell of level l always holds the counts of all pixels below it, so when a pixel changes from a to b
+	the counts of its ancestors are updated in place (a - 1, b + 1), one cell per level.
+	The mode of an ancestor is recomputed only if its counts changed, and it needs a full scan
+	of the histogram only if the count of its current mode went down.
+
+	The histograms of all levels form a quadtree (an octree for volumes) over the image, so the pyramid
+	also answers queries about arbitrary regions: countLabel(..), regionHistogram(..) and regionMode(..)
+	merge the histograms of the few aligned blocks that cover the region instead of scanning its pixels.
+
+	Histogram must provide createMap(..), findMode(..), addMap(..), addCount(..) and countOf(..):
+	BasicHashMap<T> (the default) and DenseHistogram<T, NumBins> (when all labels are less than NumBins) do.
+
+	Memory: a copy of the image, the downsamples and the histograms of all levels
+	(the histograms of the levels below level l hold every pixel once, so they take about as much memory
+	as the level-1 histograms alone times the number of levels).
+*/
+template <typename T, std::size_t NumDims, typename Histogram = BasicHashMap<T> >
+class PersistentPyramid {
+	ArrayNd<T, NumDims> A;
+	std::vector<ArrayNd<T, NumDims> > results;
+	std::vector<std::vector<Histogram> > histograms;   // histograms[l - 1] are the histograms of level l (row-major)
+
+	/**
+		Mode of a cell while an edit is applied: the current mode and its count.
+		rescan is set when the count of the mode went down, from then on any label may be the mode
+		(including ones the edit did not touch) and the histogram has to be scanned.
+	*/
+	struct ModeUpdate {
+		T mode;
+		unsigned int count;
+		bool rescan;
+	};
+
+	/**
+		A pixel changed by an edit.
+	*/
+	struct Change {
+		std::array<size_t, NumDims> indices;
+		T old_value;
+		T new_value;
+	};
+
+	/**
+		Returns the row-major offset of the cell with the given indices in an array with the given extents.
+	*/
+	static size_t cellOffset(const std::array<size_t, NumDims> &indices, const boost::multi_array_types::size_type *extents) {
+		size_t offset = 0;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			offset = offset * extents[k] + indices[k];
+		}
+		return offset;
+	}
+
+public:
+	/**
+		Builds the pyramid of image A (A is copied).
+		Complexity: O(N * num_downsamples / n_cores), like computeDownsamplesParallel(..)
+	*/
+	explicit PersistentPyramid(const ArrayNd<T, NumDims> &image) : A(image) {
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			assert((A.shape()[k] & (A.shape()[k] - 1)) == 0 && "extents of A must be powers of 2");
+		}
+
+		std::size_t num_levels = numDownsamples(A);
+		results.reserve(num_levels);
+		histograms.resize(num_levels);
+		if (num_levels == 0) {
+			return;
+		}
+
+		/// level 1 from the pixels, the same loop body as computeDownsamplesParallel(..)
+		std::array<size_t, NumDims> extents = halfExtents(A);
+		histograms[0].resize(product(extents));
+		results.emplace_back(extents);
+		NoArena arena;
+		ParallelCreateMaps<T, NumDims, Histogram> parallelCreateMaps(makeView(image), makeView(histograms[0].data(), extents),
+			&arena, makeView(results.back()));
+		forEachBlock(product(extents), parallelCreateMaps, true);
+
+		/// coarser levels, the children are added to the parents instead of being consumed by mergeMaps(..)
+		for (std::size_t l = 2; l <= num_levels; ++l) {
+			std::array<size_t, NumDims> child_extents = extents;
+			extents = halfExtents(extents);
+			histograms[l - 1].resize(product(extents));
+			results.emplace_back(extents);
+
+			ArrayView<const Histogram, NumDims> children = makeView((const Histogram *)histograms[l - 2].data(), child_extents);
+			ArrayView<Histogram, NumDims> parents = makeView(histograms[l - 1].data(), extents);
+			ArrayView<T, NumDims> result = makeView(results.back());
+			std::array<index, (std::size_t(1) << NumDims)> offsets = blockOffsets<NumDims>(children.strides.data());
+
+			tbb::parallel_for(tbb::blocked_range<size_t>(0, product(extents)), [&](const tbb::blocked_range<size_t> &r) {
+				for (size_t i = r.begin(); i != r.end(); ++i) {
+					std::array<size_t, NumDims> corner = getIndices<NumDims>(i, child_extents);
+					std::array<size_t, NumDims> cell = halfExtents(corner);
+					const Histogram *first = &children(corner);
+					Histogram &parent = parents(cell);
+					for (std::size_t j = 0; j != offsets.size(); ++j) {
+						addMap(first[offsets[j]], parent);
+					}
+					result(cell) = findMode(parent);
+				}
+			});
+		}
+	}
+
+	/**
+		Returns the image.
+	*/
+	const ArrayNd<T, NumDims> &image() const {
+		return A;
+	}
+
+	/**
+		Returns all l-downsamplings of the image (the same as computeDownsamplesParallel(..) would return).
+	*/
+	const std::vector<ArrayNd<T, NumDims> > &downsamples() const {
+		return results;
+	}
+
+	/**
+		Replaces the pixels of the rectangle starting at `corner` with patch and updates the downsamples.
+		Parameters:
+			corner - index of the first pixel of the edited region
+			patch - new pixel values of the region, its extents are the extents of the region
+		Complexity: O(M * num_downsamples), where M is the number of pixels in patch,
+			plus a histogram scan for the cells whose mode lost pixels
+	*/
+	void update(const std::array<size_t, NumDims> &corner, const ArrayNd<T, NumDims> &patch) {
+		std::array<size_t, NumDims> patch_extents;
+		std::copy(patch.shape(), patch.shape() + NumDims, patch_extents.begin());
+
+		std::vector<Change> changes;
+		for (size_t i = 0; i != patch.num_elements(); ++i) {
+			Change change;
+			change.indices = unflatten(i, patch_extents);
+			change.new_value = patch(change.indices);
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				change.indices[k] += corner[k];
+				assert(change.indices[k] < A.shape()[k] && "patch does not fit into the image");
+			}
+			change.old_value = A(change.indices);
+			if (change.old_value != change.new_value) {
+				A(change.indices) = change.new_value;
+				changes.push_back(change);
+			}
+		}
+
+		/// walk up the levels, at each level every changed pixel updates the counts of its ancestor
+		std::unordered_map<size_t, ModeUpdate> updates;
+		for (std::size_t l = 1; l <= results.size() && !changes.empty(); ++l) {
+			std::vector<Histogram> &level = histograms[l - 1];
+			ArrayNd<T, NumDims> &result = results[l - 1];
+			updates.clear();
+
+			for (size_t c = 0; c != changes.size(); ++c) {
+				Change &change = changes[c];
+				change.indices = halfExtents(change.indices);
+				size_t offset = cellOffset(change.indices, result.shape());
+				Histogram &hist = level[offset];
+
+				typename std::unordered_map<size_t, ModeUpdate>::iterator it = updates.find(offset);
+				if (it == updates.end()) {
+					ModeUpdate update;
+					update.mode = result(change.indices);
+					update.count = countOf(hist, update.mode);
+					update.rescan = false;
+					it = updates.insert(std::make_pair(offset, update)).first;
+				}
+				ModeUpdate &update = it->second;
+
+				unsigned int old_count = addCount(hist, change.old_value, -1);
+				if (change.old_value == update.mode) {
+					update.count = old_count;
+					update.rescan = true;
+				}
+
+				unsigned int new_count = addCount(hist, change.new_value, 1);
+				if (change.new_value == update.mode) {
+					update.count = new_count;
+				}
+				else if (!update.rescan && isBetterMode(change.new_value, new_count, update.mode, update.count)) {
+					update.mode = change.new_value;
+					update.count = new_count;
+				}
+			}
+
+			/// recompute the modes of the cells whose counts changed
+			for (typename std::unordered_map<size_t, ModeUpdate>::const_iterator it = updates.begin(); it != updates.end(); ++it) {
+				result.data()[it->first] = it->second.rescan ? findMode(level[it->first]) : it->second.mode;
+			}
+		}
+	}
+
+
+	/**
+		Calls block(hist) for the histograms and pixel(value) for the pixels that exactly cover 
+		the region [lo, hi) of the image, using the largest aligned blocks that fit into the region.
+		The quadtree (octree, ...) is descended from the coarsest level, cells inside the region are taken whole,
+		cells outside of it are skipped and only the cells crossing its boundary are split.
+		Complexity: O(number of cells crossing the boundary of the region), that is O(perimeter * num_downsamples)
+		for a 2-d rectangle instead of O(area)
+	*/
+	template <typename BlockFunction, typename PixelFunction>
+	void forEachAlignedBlock(const std::array<size_t, NumDims> &lo, const std::array<size_t, NumDims> &hi,
+							 BlockFunction &block, PixelFunction &pixel) const {
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			assert(lo[k] <= hi[k] && hi[k] <= A.shape()[k] && "region does not fit into the image");
+		}
+
+		std::size_t level = results.size();
+		std::array<size_t, NumDims> extents;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			extents[k] = A.shape()[k] >> level;
+		}
+
+		for (size_t i = 0; i != product(extents); ++i) {
+			visitCell(level, unflatten(i, extents), lo, hi, block, pixel);
+		}
+	}
+
+
+	/**
+		Returns the number of pixels with value label in the region of the image with the first pixel at corner 
+		and the given extents.
+		Complexity: see forEachAlignedBlock(..), one countOf(..) per block
+	*/
+	unsigned int countLabel(const std::array<size_t, NumDims> &corner, const std::array<size_t, NumDims> &extents, T label) const {
+		unsigned int count = 0;
+		auto block = [&](const Histogram &hist) { count += countOf(hist, label); };
+		auto pixel = [&](T value) { count += value == label; };
+		forEachAlignedBlock(corner, regionEnd(corner, extents), block, pixel);
+		return count;
+	}
+
+
+	/**
+		Fills hist with the histogram of the region of the image with the first pixel at corner and the given extents.
+		Only the histograms of the blocks covering the region are merged.
+	*/
+	void regionHistogram(const std::array<size_t, NumDims> &corner, const std::array<size_t, NumDims> &extents, Histogram &hist) const {
+		hist = Histogram();
+		auto block = [&](const Histogram &child) { addMap(child, hist); };
+		auto pixel = [&](T value) { addCount(hist, value, 1); };
+		forEachAlignedBlock(corner, regionEnd(corner, extents), block, pixel);
+	}
+
+
+	/**
+		Returns the mode of the region of the image with the first pixel at corner and the given extents
+		(ties are broken like everywhere else, see isBetterMode(..)). The region must not be empty and must fit into the image.
+	*/
+	T regionMode(const std::array<size_t, NumDims> &corner, const std::array<size_t, NumDims> &extents) const {
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			assert(extents[k] != 0 && "the region of regionMode(..) must not be empty");
+			assert(corner[k] <= A.shape()[k] && extents[k] <= A.shape()[k] - corner[k] && "region does not fit into the image");
+		}
+		Histogram hist;
+		regionHistogram(corner, extents, hist);
+		return findMode(hist);
+	}
+
+private:
+	static std::array<size_t, NumDims> regionEnd(const std::array<size_t, NumDims> &corner, const std::array<size_t, NumDims> &extents) {
+		std::array<size_t, NumDims> end;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			end[k] = corner[k] + extents[k];
+		}
+		return end;
+	}
+
+	/**
+		forEachAlignedBlock(..) for the cell with the given indices of a level (level 0 are the pixels).
+	*/
+	template <typename BlockFunction, typename PixelFunction>
+	void visitCell(std::size_t level, const std::array<size_t, NumDims> &cell, const std::array<size_t, NumDims> &lo, 
+				   const std::array<size_t, NumDims> &hi, BlockFunction &block, PixelFunction &pixel) const {
+		bool inside = true;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			size_t begin = cell[k] << level;
+			size_t end = (cell[k] + 1) << level;
+			if (end <= lo[k] || begin >= hi[k]) {
+				return;
+			}
+			inside = inside && begin >= lo[k] && end <= hi[k];
+		}
+
+		if (level == 0) {
+			pixel(A(cell));
+		}
+		else if (inside) {
+			block(histograms[level - 1][cellOffset(cell, results[level - 1].shape())]);
+		}
+		else {
+			std::array<size_t, NumDims> child;
+			for (std::size_t j = 0; j != (std::size_t(1) << NumDims); ++j) {
+				for (std::size_t k = 0; k != NumDims; ++k) {
+					child[k] = cell[k] * 2 + ((j >> (NumDims - 1 - k)) & 1);
+				}
+				visitCell(level - 1, child, lo, hi, block, pixel);
+			}
+		}
+	}
+};
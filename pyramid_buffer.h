@@ -0,0 +1,131 @@
+/**
+	Downsampling assignment
+
+	pyramid_buffer.h
+*/
+
+#pragma once
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "utilities.h"
+
+
+/**
+	Output container for all downsamples of an image in a single contiguous buffer.
+
+	std::vector<ArrayNd<T, NumDims> > allocates every level separately. Here the size of the whole pyramid
+	is computed up front (see requiredSize(..)), the levels are stored one after the other (level 1 first,
+	each in c order) and exposed as views, the engine writes the modes straight into the buffer.
+	The buffer is owned by the container or supplied by the caller (e.g. memory mapped with huge pages);
+	reshape(..) for an image that fits into the buffer does not allocate, so a container reused for images
+	of the same size costs no allocations after the first one.
+*/
+template <typename T, std::size_t NumDims>
+class PyramidBuffer {
+	std::unique_ptr<T[]> storage;   // owned memory, empty if the caller supplied the buffer
+	T *buffer;
+	size_t capacity;                // number of elements of buffer
+	bool owned;
+	std::vector<ArrayView<T, NumDims> > views;
+	size_t num_levels;
+
+	PyramidBuffer(const PyramidBuffer &);
+	PyramidBuffer &operator=(const PyramidBuffer &);
+
+public:
+	/**
+		Empty container that allocates (and grows) its own buffer.
+	*/
+	PyramidBuffer() : buffer(0), capacity(0), owned(true), num_levels(0) {}
+
+	/**
+		Container that stores the pyramid in a buffer of the caller (which must outlive the container).
+		reshape(..) throws std::length_error for images whose pyramid does not fit into capacity elements.
+	*/
+	PyramidBuffer(T *buffer, size_t capacity) : buffer(buffer), capacity(capacity), owned(false), num_levels(0) {}
+
+	/**
+		Returns the number of elements of all downsamples of an image with the given extents.
+	*/
+	static size_t requiredSize(std::array<size_t, NumDims> extents) {
+		size_t n = 0;
+		while (*std::min_element(extents.begin(), extents.end()) >= 2) {
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				extents[k] /= 2;
+			}
+			n += product(extents);
+		}
+		return n;
+	}
+
+	/**
+		Lays out the levels of the pyramid of an image with the given extents (powers of 2).
+		The previous contents are lost, the buffer grows only if it is too small.
+	*/
+	void reshape(const std::array<size_t, NumDims> &image_extents) {
+		size_t n = requiredSize(image_extents);
+		if (n > capacity) {
+			if (!owned) {
+				throw std::length_error("pyramid does not fit into the buffer");
+			}
+			storage.reset(new T[n]);
+			buffer = storage.get();
+			capacity = n;
+		}
+
+		views.clear();
+		std::array<size_t, NumDims> extents = image_extents;
+		T *origin = buffer;
+		while (*std::min_element(extents.begin(), extents.end()) >= 2) {
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				extents[k] /= 2;
+			}
+			views.push_back(makeView(origin, extents));
+			origin += product(extents);
+		}
+		num_levels = views.size();
+	}
+
+	/**
+		Number of levels.
+	*/
+	size_t size() const {
+		return num_levels;
+	}
+
+	/**
+		View of the (l+1)-downsample, like results[l] of computeDownsamplesParallel(..).
+	*/
+	const ArrayView<T, NumDims> &operator[](size_t l) const {
+		return views[l];
+	}
+
+	/**
+		Views of all levels, level 1 first.
+	*/
+	const ArrayView<T, NumDims> *levels() const {
+		return views.data();
+	}
+
+	/**
+		The (l+1)-downsample as a boost array that does not own its elements.
+	*/
+	boost::multi_array_ref<T, NumDims> level(size_t l) const {
+		std::array<size_t, NumDims> extents = views[l].shape;
+		return boost::multi_array_ref<T, NumDims>(views[l].origin, extents);
+	}
+
+	/**
+		Address of the first element of level 1 and the number of elements of all levels.
+	*/
+	T *data() const {
+		return buffer;
+	}
+
+	size_t num_elements() const {
+		return num_levels == 0 ? 0 : (size_t)(views[num_levels - 1].origin - buffer) + views[num_levels - 1].num_elements();
+	}
+};
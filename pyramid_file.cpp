@@ -0,0 +1,251 @@
+/**
+	Downsampling assignment
+
+	pyramid_file.cpp
+*/
+
+#include "pyramid_file.h"
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char pyramid_magic[8] = {'D', 'S', 'P', 'Y', 'R', 'A', 'M', '1'};
+
+/**
+	Throws std::runtime_error describing the last system error.
+	(<cstring> is not included for strerror(..): its index(..) clashes with the `index` typedef of utilities.h.)
+*/
+static void throwError(const string &what, const string &path) {
+	throw runtime_error(what + " " + path + ": " + generic_category().message(errno));
+}
+
+FileHandle::~FileHandle() {
+	close();
+}
+
+void FileHandle::reset(int new_fd) {
+	close();
+	fd = new_fd;
+}
+
+int FileHandle::close() {
+	int result = 0;
+	if (fd >= 0) {
+		result = ::close(fd);
+		fd = -1;
+	}
+	return result;
+}
+
+size_t PyramidLayout::numChunks(size_t level) const {
+	size_t n = 1;
+	for (size_t k = 0; k != num_dims; ++k) {
+		n *= numChunks(level, k);
+	}
+	return n;
+}
+
+size_t PyramidLayout::chunkNumber(size_t level, const size_t *chunk_indices) const {
+	size_t chunk = 0;
+	for (size_t k = 0; k != num_dims; ++k) {
+		assert(chunk_indices[k] < numChunks(level, k));
+		chunk = chunk * numChunks(level, k) + chunk_indices[k];
+	}
+	return chunk;
+}
+
+/**
+	Size of the header (everything before the chunk index) of a pyramid file.
+*/
+static size_t headerSize(const PyramidLayout &layout) {
+	return sizeof(pyramid_magic) + 4 * sizeof(uint32_t) + layout.numLevels() * 2 * layout.num_dims * sizeof(uint64_t);
+}
+
+/**
+	Returns the index of the first chunk of every level (and the total number of chunks as the last element).
+*/
+static vector<size_t> firstChunks(const PyramidLayout &layout) {
+	vector<size_t> first_chunk(1, 0);
+	for (size_t l = 0; l != layout.numLevels(); ++l) {
+		first_chunk.push_back(first_chunk.back() + layout.numChunks(l));
+	}
+	return first_chunk;
+}
+
+/**
+	Writes n bytes at offset, handling partial writes.
+*/
+static void writeBytes(int fd, const string &path, uint64_t offset, const char *bytes, size_t n) {
+	while (n != 0) {
+		ssize_t written = pwrite(fd, bytes, n, (off_t)offset);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throwError("cannot write", path);
+		}
+		bytes += written;
+		offset += written;
+		n -= written;
+	}
+}
+
+
+PyramidWriter::PyramidWriter(const string &path, const PyramidLayout &layout)
+	: path(path), layout(layout), first_chunk(firstChunks(layout)), chunk_index(2 * first_chunk.back(), 0) {
+
+	fd.reset(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+	if (fd.get() < 0) {
+		throwError("cannot create", path);
+	}
+	end = headerSize(layout) + chunk_index.size() * sizeof(uint64_t);
+}
+
+void PyramidWriter::writeChunk(size_t level, size_t chunk, const vector<char> &bytes) {
+	uint64_t offset = end.fetch_add(bytes.size());
+	writeBytes(fd.get(), path, offset, bytes.data(), bytes.size());
+
+	size_t i = first_chunk[level] + chunk;
+	chunk_index[2 * i] = offset;
+	chunk_index[2 * i + 1] = bytes.size();
+}
+
+void PyramidWriter::close() {
+	vector<char> header(pyramid_magic, pyramid_magic + sizeof(pyramid_magic));
+	appendBytes(header, (uint32_t)layout.num_dims);
+	appendBytes(header, (uint32_t)layout.pixel_size);
+	appendBytes(header, (uint32_t)layout.numLevels());
+	appendBytes(header, (uint32_t)0);
+	for (size_t l = 0; l != layout.numLevels(); ++l) {
+		for (size_t k = 0; k != layout.num_dims; ++k) {
+			appendBytes(header, layout.shapes[l][k]);
+		}
+		for (size_t k = 0; k != layout.num_dims; ++k) {
+			appendBytes(header, layout.chunk_shapes[l][k]);
+		}
+	}
+	header.insert(header.end(), (const char *)chunk_index.data(), (const char *)(chunk_index.data() + chunk_index.size()));
+
+	writeBytes(fd.get(), path, 0, header.data(), header.size());
+	if (fd.close() != 0) {
+		throwError("cannot close", path);
+	}
+}
+
+
+PyramidReader::PyramidReader(const string &path) : path(path) {
+	fd.reset(open(path.c_str(), O_RDONLY));
+	if (fd.get() < 0) {
+		throwError("cannot open", path);
+	}
+	readHeader();
+}
+
+/**
+	Reads the header and the chunk index. Every field is checked against the size of the file
+	before it is used to size a read, and the shapes against each other (every level halves the previous one,
+	chunks fit into their level and have at most PyramidLayout::max_chunk_elements pixels),
+	a corrupt file throws std::runtime_error.
+*/
+void PyramidReader::readHeader() {
+	struct stat status;
+	if (fstat(fd.get(), &status) != 0) {
+		throwError("cannot read", path);
+	}
+	uint64_t file_size = (uint64_t)status.st_size;
+
+	char magic[sizeof(pyramid_magic)];
+	uint32_t fields[4];
+	if (file_size < sizeof(magic) + sizeof(fields)) {
+		throw runtime_error("not a pyramid file: " + path);
+	}
+	readBytes(0, sizeof(magic), magic);
+	if (!equal(magic, magic + sizeof(magic), pyramid_magic)) {
+		throw runtime_error("not a pyramid file: " + path);
+	}
+	readBytes(sizeof(magic), sizeof(fields), (char *)fields);
+	layout.num_dims = fields[0];
+	layout.pixel_size = fields[1];
+	uint64_t num_levels = fields[2];
+	if (layout.num_dims == 0 || layout.num_dims > 64 || layout.pixel_size == 0 || layout.pixel_size > 8 || num_levels > 64) {
+		throw runtime_error("corrupt pyramid file header: " + path);
+	}
+
+	vector<uint64_t> shapes(num_levels * 2 * layout.num_dims);
+	if (file_size < sizeof(magic) + sizeof(fields) + shapes.size() * sizeof(uint64_t)) {
+		throw runtime_error("truncated pyramid file: " + path);
+	}
+	readBytes(sizeof(magic) + sizeof(fields), shapes.size() * sizeof(uint64_t), (char *)shapes.data());
+	for (size_t l = 0; l != num_levels; ++l) {
+		vector<uint64_t>::const_iterator level = shapes.begin() + l * 2 * layout.num_dims;
+		layout.shapes.push_back(vector<uint64_t>(level, level + layout.num_dims));
+		layout.chunk_shapes.push_back(vector<uint64_t>(level + layout.num_dims, level + 2 * layout.num_dims));
+		uint64_t chunk_elements = 1;
+		for (size_t k = 0; k != layout.num_dims; ++k) {
+			uint64_t shape = layout.shapes[l][k];
+			uint64_t chunk_shape = layout.chunk_shapes[l][k];
+			if (shape == 0 || chunk_shape == 0 || chunk_shape > shape || (l != 0 && shape != layout.shapes[l - 1][k] / 2)
+				|| chunk_elements > PyramidLayout::max_chunk_elements / chunk_shape) {
+				throw runtime_error("corrupt pyramid file header: " + path);
+			}
+			chunk_elements *= chunk_shape;
+		}
+	}
+
+	/// every chunk has an entry of 16 bytes in the index, so the file bounds the number of chunks
+	size_t num_chunks = 0;
+	for (size_t l = 0; l != num_levels; ++l) {
+		size_t level_chunks = 1;
+		for (size_t k = 0; k != layout.num_dims; ++k) {
+			level_chunks *= layout.numChunks(l, k);
+			if (level_chunks > file_size / (2 * sizeof(uint64_t))) {
+				throw runtime_error("corrupt pyramid file header: " + path);
+			}
+		}
+		num_chunks += level_chunks;
+	}
+	if (file_size < headerSize(layout) || (file_size - headerSize(layout)) / (2 * sizeof(uint64_t)) < num_chunks) {
+		throw runtime_error("truncated pyramid file: " + path);
+	}
+
+	first_chunk = firstChunks(layout);
+	chunk_index.resize(2 * first_chunk.back());
+	readBytes(headerSize(layout), chunk_index.size() * sizeof(uint64_t), (char *)chunk_index.data());
+	for (size_t i = 0; i != first_chunk.back(); ++i) {
+		if (chunk_index[2 * i] > file_size || chunk_index[2 * i + 1] > file_size - chunk_index[2 * i]) {
+			throw runtime_error("corrupt pyramid file chunk index: " + path);
+		}
+	}
+}
+
+void PyramidReader::readBytes(uint64_t offset, size_t n, char *bytes) const {
+	while (n != 0) {
+		ssize_t count = pread(fd.get(), bytes, n, (off_t)offset);
+		if (count < 0 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			if (count == 0) {
+				errno = EIO;
+			}
+			throwError("cannot read", path);
+		}
+		bytes += count;
+		offset += count;
+		n -= count;
+	}
+}
+
+void PyramidReader::readChunkBytes(size_t level, size_t chunk, vector<char> &bytes) const {
+	if (level >= layout.numLevels() || chunk >= layout.numChunks(level)) {
+		throw runtime_error("no such chunk in the pyramid file " + path);
+	}
+	size_t i = first_chunk[level] + chunk;
+	bytes.resize(chunk_index[2 * i + 1]);
+	readBytes(chunk_index[2 * i], bytes.size(), bytes.data());
+}
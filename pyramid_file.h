@@ -0,0 +1,456 @@
+/**
+	Downsampling assignment
+
+	pyramid_file.h
+*/
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "utilities.h"
+#include "tbb/parallel_for.h"
+
+
+/**
+	Pyramid file format.
+
+	The file stores the levels of a pyramid (level 0 is usually the original image), each level cut into
+	a grid of chunks that can be read independently:
+
+		char     magic[8]                      "DSPYRAM1"
+		uint32   num_dims, pixel_size, num_levels, reserved
+		uint64   shape[num_dims], chunk_shape[num_dims]    for every level
+		uint64   offset, size                              for every chunk of every level (row-major chunk grid)
+		...      chunk data
+
+	Every chunk starts with its encoding (see ChunkEncoding). Numbers are stored in the byte order of the machine.
+	Chunks along the far edges of a level are smaller when the chunk shape does not divide the level shape.
+*/
+enum ChunkEncoding {
+	RAW_CHUNK = 0,       // pixel values, row-major
+	PALETTE_CHUNK = 1    // sorted distinct values of the chunk followed by bit-packed indices into them
+};
+
+
+/**
+	Shapes of the levels of a pyramid file and of their chunks.
+*/
+struct PyramidLayout {
+	static const uint64_t max_chunk_elements = uint64_t(1) << 28;   // limit of the pixels of a chunk, checked by the reader
+
+	std::size_t num_dims;
+	std::size_t pixel_size;                             // sizeof(T)
+	std::vector<std::vector<uint64_t> > shapes;         // shape of every level
+	std::vector<std::vector<uint64_t> > chunk_shapes;   // shape of a chunk of every level
+
+	size_t numLevels() const {
+		return shapes.size();
+	}
+
+	/**
+		Returns the number of chunks of a level along dimention k.
+	*/
+	size_t numChunks(size_t level, size_t k) const {
+		return (size_t)((shapes[level][k] + chunk_shapes[level][k] - 1) / chunk_shapes[level][k]);
+	}
+
+	/**
+		Returns the number of chunks of a level.
+	*/
+	size_t numChunks(size_t level) const;
+
+	/**
+		Returns the position of the chunk with n-dimentional index chunk_indices in the row-major chunk grid of a level.
+	*/
+	size_t chunkNumber(size_t level, const size_t *chunk_indices) const;
+};
+
+
+/**
+	Owns a file descriptor and closes it when destroyed, also when a constructor throws after opening the file.
+*/
+class FileHandle {
+	int fd;
+
+	FileHandle(const FileHandle &);
+	FileHandle &operator=(const FileHandle &);
+
+public:
+	explicit FileHandle(int fd = -1) : fd(fd) {}
+	~FileHandle();
+
+	int get() const {
+		return fd;
+	}
+
+	/**
+		Closes the file (if it is open) and takes ownership of new_fd.
+	*/
+	void reset(int new_fd);
+
+	/**
+		Closes the file (if it is open), returns the result of ::close(..).
+	*/
+	int close();
+};
+
+
+/**
+	Writes a pyramid file. writeChunk(..) can be called by many threads at once: each call appends
+	its chunk at the end of the file (the place is reserved with an atomic counter) and fills its own entry
+	of the chunk index, which is written by close().
+	Errors are reported with std::runtime_error.
+*/
+class PyramidWriter {
+	std::string path;
+	FileHandle fd;
+	PyramidLayout layout;
+	std::vector<size_t> first_chunk;       // index of the first chunk of every level in chunk_index
+	std::vector<uint64_t> chunk_index;     // offset, size of every chunk
+	std::atomic<uint64_t> end;             // end of the data written so far
+
+	PyramidWriter(const PyramidWriter &);
+	PyramidWriter &operator=(const PyramidWriter &);
+
+public:
+	PyramidWriter(const std::string &path, const PyramidLayout &layout);
+
+	/**
+		Writes the encoded chunk number `chunk` of a level (see PyramidLayout::chunkNumber(..)).
+	*/
+	void writeChunk(size_t level, size_t chunk, const std::vector<char> &bytes);
+
+	/**
+		Writes the chunk index and closes the file.
+	*/
+	void close();
+};
+
+
+/**
+	Reads chunks of a pyramid file. Opening a file only reads its header and chunk index,
+	readChunk(..) reads a single chunk, so a viewer can open a large pyramid instantly.
+	Reading is thread safe. Errors are reported with std::runtime_error, including files
+	whose header or chunks are corrupt and requests for chunks that the file does not have.
+*/
+class PyramidReader {
+	std::string path;
+	FileHandle fd;
+	PyramidLayout layout;
+	std::vector<size_t> first_chunk;
+	std::vector<uint64_t> chunk_index;
+
+	PyramidReader(const PyramidReader &);
+	PyramidReader &operator=(const PyramidReader &);
+
+	void readBytes(uint64_t offset, size_t n, char *bytes) const;
+	void readHeader();
+
+public:
+	explicit PyramidReader(const std::string &path);
+
+	const PyramidLayout &getLayout() const {
+		return layout;
+	}
+
+	/**
+		Reads the encoded chunk number `chunk` of a level.
+	*/
+	void readChunkBytes(size_t level, size_t chunk, std::vector<char> &bytes) const;
+
+	/**
+		Reads and decodes the chunk with n-dimentional index chunk_indices of a level.
+		chunk is resized to the extents of the chunk. T and NumDims must match the file (std::runtime_error otherwise).
+	*/
+	template <typename T, std::size_t NumDims>
+	void readChunk(size_t level, const std::array<size_t, NumDims> &chunk_indices, ArrayNd<T, NumDims> &chunk) const;
+};
+
+
+/**
+	Returns the default chunk extent (along each dimention) of a pyramid file: 256x256 chunks for images,
+	32x32x32 for volumes.
+*/
+template <std::size_t NumDims>
+size_t defaultChunkSize() {
+	return size_t(1) << (16 / NumDims);
+}
+
+
+/**
+	Appends the bytes of value to bytes.
+*/
+template <typename Value>
+void appendBytes(std::vector<char> &bytes, const Value &value) {
+	const char *p = (const char *)&value;
+	bytes.insert(bytes.end(), p, p + sizeof(Value));
+}
+
+
+/**
+	Reads a value stored by appendBytes(..) at bytes[offset] and advances offset.
+*/
+template <typename Value>
+Value takeBytes(const std::vector<char> &bytes, size_t &offset) {
+	Value value;
+	assert(offset + sizeof(Value) <= bytes.size());
+	std::copy(bytes.begin() + offset, bytes.begin() + offset + sizeof(Value), (char *)&value);
+	offset += sizeof(Value);
+	return value;
+}
+
+
+/**
+	Returns the number of bits needed to store indices 0..n-1 (0 for n = 1).
+*/
+inline unsigned int indexBits(size_t n) {
+	unsigned int bits = 0;
+	while (((size_t)1 << bits) < n) {
+		++bits;
+	}
+	return bits;
+}
+
+
+/**
+	Encodes a chunk of a level.
+	Label images have few distinct values per chunk, so with compress = true the chunk is stored as its
+	palette (the sorted distinct values) plus the index of every pixel into the palette packed into
+	ceil(log2(palette size)) bits, e.g. 2 bits per pixel for 4 labels and 0 bits for a uniform chunk.
+	A chunk is stored raw when the palette would not make it smaller.
+	Parameters:
+		chunk - pixels of the chunk
+		compress - allow PALETTE_CHUNK
+		pixels, palette - scratch buffers
+		bytes - Output, the encoded chunk
+*/
+template <typename T, std::size_t NumDims>
+void encodeChunk(const ArrayView<const T, NumDims> &chunk, bool compress, std::vector<T> &pixels, std::vector<T> &palette, 
+				 std::vector<char> &bytes) {
+	size_t n = chunk.num_elements();
+	bytes.clear();
+
+	/// pixels in row-major order, gathered through the strides of the view
+	pixels.resize(n);
+	for (size_t i = 0; i != n; ++i) {
+		pixels[i] = chunk(unflatten(i, chunk.shape));
+	}
+	palette.assign(pixels.begin(), pixels.end());
+
+	std::sort(palette.begin(), palette.end());
+	palette.erase(std::unique(palette.begin(), palette.end()), palette.end());
+
+	unsigned int bits = indexBits(palette.size());
+	size_t packed_words = (n * bits + 63) / 64;
+	size_t palette_bytes = sizeof(uint32_t) + palette.size() * sizeof(T) + 1 + packed_words * sizeof(uint64_t);
+
+	if (!compress || palette_bytes >= n * sizeof(T)) {
+		bytes.push_back((char)RAW_CHUNK);
+		bytes.insert(bytes.end(), (const char *)pixels.data(), (const char *)(pixels.data() + n));
+		return;
+	}
+
+	bytes.push_back((char)PALETTE_CHUNK);
+	appendBytes(bytes, (uint32_t)palette.size());
+	bytes.insert(bytes.end(), (const char *)palette.data(), (const char *)(palette.data() + palette.size()));
+	bytes.push_back((char)bits);
+
+	std::vector<uint64_t> packed(packed_words, 0);
+	for (size_t i = 0; i != n && bits != 0; ++i) {
+		uint64_t value = std::lower_bound(palette.begin(), palette.end(), pixels[i]) - palette.begin();
+		size_t bit = i * bits;
+		packed[bit / 64] |= value << (bit % 64);
+		if (bit % 64 + bits > 64) {
+			packed[bit / 64 + 1] |= value >> (64 - bit % 64);
+		}
+	}
+	bytes.insert(bytes.end(), (const char *)packed.data(), (const char *)(packed.data() + packed.size()));
+}
+
+
+/**
+	Decodes a chunk written by encodeChunk(..) into chunk, which is resized to extents.
+	Throws std::runtime_error if bytes is not a valid encoding of a chunk of that size. The size of the
+	encoding is checked before chunk is resized.
+*/
+template <typename T, std::size_t NumDims>
+void decodeChunk(const std::vector<char> &bytes, const std::array<size_t, NumDims> &extents, ArrayNd<T, NumDims> &chunk) {
+	size_t n = 1;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		if (extents[k] != 0 && n > std::numeric_limits<size_t>::max() / extents[k]) {
+			throw std::runtime_error("corrupt pyramid chunk: too many pixels");
+		}
+		n *= extents[k];
+	}
+	size_t offset = 1;
+
+	if (!bytes.empty() && bytes[0] == RAW_CHUNK) {
+		if ((bytes.size() - 1) % sizeof(T) != 0 || (bytes.size() - 1) / sizeof(T) != n) {
+			throw std::runtime_error("corrupt pyramid chunk: wrong size");
+		}
+		chunk.resize(extents);
+		std::copy(bytes.begin() + 1, bytes.end(), (char *)chunk.data());
+		return;
+	}
+	if (bytes.empty() || bytes[0] != PALETTE_CHUNK || bytes.size() < offset + sizeof(uint32_t)) {
+		throw std::runtime_error("corrupt pyramid chunk: unknown encoding");
+	}
+
+	size_t palette_size = takeBytes<uint32_t>(bytes, offset);
+	if (palette_size == 0 || (bytes.size() - offset) / sizeof(T) < palette_size || bytes.size() - offset - palette_size * sizeof(T) < 1) {
+		throw std::runtime_error("corrupt pyramid chunk: truncated palette");
+	}
+	std::vector<T> palette(palette_size);
+	for (size_t i = 0; i != palette_size; ++i) {
+		palette[i] = takeBytes<T>(bytes, offset);
+	}
+	unsigned int bits = (unsigned char)bytes[offset++];
+	if (bits > 64) {
+		throw std::runtime_error("corrupt pyramid chunk: bad index width");
+	}
+	uint64_t mask = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+
+	/// ceil(n * bits / 64) words, without overflowing n * bits
+	size_t packed_words = n / 64 * bits + (n % 64 * bits + 63) / 64;
+	if ((bytes.size() - offset) % sizeof(uint64_t) != 0 || (bytes.size() - offset) / sizeof(uint64_t) != packed_words) {
+		throw std::runtime_error("corrupt pyramid chunk: wrong size");
+	}
+	std::vector<uint64_t> packed(packed_words);
+	std::copy(bytes.begin() + offset, bytes.end(), (char *)packed.data());
+
+	chunk.resize(extents);
+	T *pixels = chunk.data();
+	for (size_t i = 0; i != n; ++i) {
+		size_t bit = i * bits;
+		uint64_t value = 0;
+		if (bits != 0) {
+			value = packed[bit / 64] >> (bit % 64);
+			if (bit % 64 + bits > 64) {
+				value |= packed[bit / 64 + 1] << (64 - bit % 64);
+			}
+		}
+		value &= mask;
+		if (value >= palette_size) {
+			throw std::runtime_error("corrupt pyramid chunk: index out of the palette");
+		}
+		pixels[i] = palette[value];
+	}
+}
+
+
+template <typename T, std::size_t NumDims>
+void PyramidReader::readChunk(size_t level, const std::array<size_t, NumDims> &chunk_indices, ArrayNd<T, NumDims> &chunk) const {
+	if (NumDims != layout.num_dims || sizeof(T) != layout.pixel_size) {
+		throw std::runtime_error("pixel type or number of dimentions does not match the pyramid file " + path);
+	}
+	if (level >= layout.numLevels()) {
+		throw std::runtime_error("no such level in the pyramid file " + path);
+	}
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		if (chunk_indices[k] >= layout.numChunks(level, k)) {
+			throw std::runtime_error("no such chunk in the pyramid file " + path);
+		}
+	}
+
+	std::array<size_t, NumDims> extents;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		uint64_t corner = chunk_indices[k] * layout.chunk_shapes[level][k];
+		extents[k] = (size_t)std::min(layout.chunk_shapes[level][k], layout.shapes[level][k] - corner);
+	}
+
+	std::vector<char> bytes;
+	readChunkBytes(level, layout.chunkNumber(level, chunk_indices.data()), bytes);
+	decodeChunk(bytes, extents, chunk);
+}
+
+
+/**
+	Writes the levels of a pyramid to a pyramid file.
+	All chunks of all levels are encoded and written by one parallel loop, each chunk is written
+	as soon as the task that encoded it finishes.
+	Parameters:
+		path - the file
+		levels - views of the levels (level 0 first), std::invalid_argument is thrown unless they
+			have no zero extents and every level halves the previous one, as PyramidReader requires
+		chunk_size - extent of a chunk along each dimention (levels smaller than that are one chunk),
+			std::invalid_argument is thrown if it is 0 and std::length_error if a chunk has more than
+			PyramidLayout::max_chunk_elements pixels (all checks are done before the file is created)
+		compress - allow palette encoding of chunks (see encodeChunk(..))
+*/
+template <typename T, std::size_t NumDims>
+void writePyramidLevels(const std::string &path, const std::vector<ArrayView<const T, NumDims> > &levels,
+						size_t chunk_size, bool compress) {
+	if (chunk_size == 0) {
+		throw std::invalid_argument("the chunks of a pyramid file must not be empty");
+	}
+	PyramidLayout layout;
+	layout.num_dims = NumDims;
+	layout.pixel_size = sizeof(T);
+	std::vector<size_t> first_chunk(1, 0);
+	for (size_t l = 0; l != levels.size(); ++l) {
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			if (levels[l].shape[k] == 0 || (l != 0 && levels[l].shape[k] != levels[l - 1].shape[k] / 2)) {
+				throw std::invalid_argument("every level of a pyramid file must be non-empty and half the previous one");
+			}
+		}
+		layout.shapes.push_back(std::vector<uint64_t>(levels[l].shape.begin(), levels[l].shape.end()));
+		layout.chunk_shapes.push_back(std::vector<uint64_t>(NumDims));
+		uint64_t chunk_elements = 1;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			layout.chunk_shapes[l][k] = std::min(chunk_size, levels[l].shape[k]);
+			if (chunk_elements > PyramidLayout::max_chunk_elements / layout.chunk_shapes[l][k]) {
+				throw std::length_error("chunks of the pyramid file are too large");
+			}
+			chunk_elements *= layout.chunk_shapes[l][k];
+		}
+		first_chunk.push_back(first_chunk.back() + layout.numChunks(l));
+	}
+
+	PyramidWriter writer(path, layout);
+
+	/// parallel loop over the chunks of all levels
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, first_chunk.back(), 1), [&](const tbb::blocked_range<size_t> &r) {
+		std::vector<T> pixels;
+		std::vector<T> palette;
+		std::vector<char> bytes;
+		for (size_t c = r.begin(); c != r.end(); ++c) {
+			size_t level = std::upper_bound(first_chunk.begin(), first_chunk.end(), c) - first_chunk.begin() - 1;
+			size_t chunk = c - first_chunk[level];
+
+			std::array<size_t, NumDims> num_chunks;
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				num_chunks[k] = layout.numChunks(level, k);
+			}
+			std::array<size_t, NumDims> corner = unflatten(chunk, num_chunks);
+			std::array<size_t, NumDims> extents;
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				corner[k] *= (size_t)layout.chunk_shapes[level][k];
+				extents[k] = std::min((size_t)layout.chunk_shapes[level][k], levels[level].shape[k] - corner[k]);
+			}
+
+			encodeChunk(levels[level].subView(corner, extents), compress, pixels, palette, bytes);
+			writer.writeChunk(level, chunk, bytes);
+		}
+	});
+
+	writer.close();
+}
+
+
+/**
+	Writes an image and its downsamples (see computeDownsamplesParallel(..)) to a pyramid file,
+	A is level 0 and results[l - 1] is level l.
+*/
+template <typename T, std::size_t NumDims>
+void writePyramid(const std::string &path, const ArrayNd<T, NumDims> &A, const std::vector<ArrayNd<T, NumDims> > &results,
+				  size_t chunk_size = defaultChunkSize<NumDims>(), bool compress = true) {
+	std::vector<ArrayView<const T, NumDims> > levels(1, makeView(A));
+	for (size_t l = 0; l != results.size(); ++l) {
+		levels.push_back(makeView(results[l]));
+	}
+	writePyramidLevels(path, levels, chunk_size, compress);
+}
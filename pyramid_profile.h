@@ -0,0 +1,339 @@
+/**
+	Downsampling assignment
+
+	pyramid_profile.h
+*/
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include "downsampling.h"
+
+
+/**
+	What happened at one level of a profiled run (see PyramidProfile).
+*/
+struct LevelProfile {
+	std::size_t level;           // 1 is the 1-downsample
+	std::string path;            // how the level was built: "simd2x2" (modes only, no histograms), "create4x4", "create" or "merge"
+	size_t cells;                // number of cells of the level
+	double seconds;              // wall time
+	size_t tasks;                // number of chunks the loop over the cells was split into
+	size_t histograms;           // number of histograms built (0 for "simd2x2")
+	unsigned int min_entries;    // smallest, mean and largest number of labels of a histogram
+	double mean_entries;
+	unsigned int max_entries;
+	double uniform_share;        // share of the histograms with a single label (uniform blocks)
+	size_t histogram_bytes;      // memory of the histograms of the level: the array, the hashmap nodes and spilled entries (estimated)
+};
+
+
+/**
+	Statistics of a run of computeDownsamplesParallel(..) or computeDownsamples(..) with a PyramidProfile:
+	where the time and the memory go, level by level. writeJson(..) exports it.
+*/
+struct PyramidProfile {
+	std::vector<size_t> extents;               // extents of the image
+	std::string histogram;                     // the histogram type that was used, see histogramName(..)
+	bool parallel;
+	int threads;                               // threads of the task arena
+	double select_seconds;                     // time spent choosing the histogram type (AutoHistogram)
+	double total_seconds;                      // wall time of the whole run
+	size_t peak_histogram_bytes;               // largest memory of two consecutive levels of histograms (both are alive while merging)
+	std::vector<double> thread_busy_seconds;   // time each thread spent in the loops of the engine
+	std::vector<LevelProfile> levels;
+
+	PyramidProfile() : parallel(true), threads(0), select_seconds(0), total_seconds(0), peak_histogram_bytes(0) {}
+};
+
+
+/**
+	Short names of the histogram types, for PyramidProfile::histogram.
+*/
+template <typename Histogram>
+inline std::string histogramName(Histogram *) {
+	return "custom";
+}
+
+template <typename T>
+inline std::string histogramName(BasicHashMap<T> *) {
+	return "hashmap";
+}
+
+template <typename T, std::size_t NumBins>
+inline std::string histogramName(DenseHistogram<T, NumBins> *) {
+	return "dense" + std::to_string(NumBins);
+}
+
+template <typename T, std::size_t InlineCapacity>
+inline std::string histogramName(CompactHistogram<T, InlineCapacity> *) {
+	return "compact";
+}
+
+
+/**
+	Estimate of the heap memory a histogram owns besides its own sizeof (nothing for fixed size histograms).
+*/
+template <typename Histogram>
+inline size_t histogramHeapBytes(const Histogram &) {
+	return 0;
+}
+
+/// the bucket array and a node per label (the label, the count and the links of the node)
+template <typename T>
+inline size_t histogramHeapBytes(const BasicHashMap<T> &hist) {
+	return hist.bucket_count() * sizeof(void *) + hist.size() * (sizeof(typename BasicHashMap<T>::value_type) + 2 * sizeof(void *));
+}
+
+/// entries that do not fit inline are in the arena
+template <typename T, std::size_t InlineCapacity>
+inline size_t histogramHeapBytes(const CompactHistogram<T, InlineCapacity> &hist) {
+	return hist.size > InlineCapacity ? hist.size * sizeof(LabelCount<T>) : 0;
+}
+
+
+/**
+	Profile parameter of HistogramLevels that records a PyramidProfile (see NoProfile for the hooks).
+	Every thread counts in its own slot, the slots are summed when a level ends.
+*/
+class PyramidRecorder {
+	/**
+		Counters of one thread for the current level, busy time for the whole run.
+	*/
+	struct Counters {
+		size_t tasks;
+		size_t histograms;
+		unsigned int min_entries;
+		unsigned int max_entries;
+		size_t entries;
+		size_t uniform;
+		size_t heap_bytes;
+		double busy_seconds;
+
+		Counters() : tasks(0), histograms(0), min_entries(~0u), max_entries(0), entries(0), uniform(0), heap_bytes(0), busy_seconds(0) {}
+	};
+
+	PyramidProfile *profile;
+	std::shared_ptr<PerThread<Counters> > counters;
+	std::size_t input_level_bits;   // log2 of the first extent of the image
+	std::size_t histogram_size;     // sizeof(Histogram)
+	std::chrono::steady_clock::time_point level_start;
+	size_t previous_bytes;          // histogram memory of the previous level
+
+	static std::size_t log2(size_t n) {
+		std::size_t bits = 0;
+		while ((n >>= 1) != 0) {
+			++bits;
+		}
+		return bits;
+	}
+
+public:
+	/**
+		Statistics parameter of ParallelCreateMaps and ParallelMergeMaps: sizes of the histograms.
+	*/
+	class Statistics {
+		PerThread<Counters> *counters;
+
+	public:
+		explicit Statistics(PerThread<Counters> *counters) : counters(counters) {}
+
+		template <typename Histogram, std::size_t NumDims>
+		void operator()(const Histogram &hist, const std::array<size_t, NumDims> &) const {
+			Counters &local = counters->local();
+			unsigned int entries = 0;
+			forEachCount(hist, [&](auto, unsigned int) { ++entries; });
+
+			++local.histograms;
+			local.entries += entries;
+			local.min_entries = std::min(local.min_entries, entries);
+			local.max_entries = std::max(local.max_entries, entries);
+			local.uniform += entries == 1;
+			local.heap_bytes += histogramHeapBytes(hist);
+		}
+	};
+
+	/**
+		Body of the loops of the engine that counts the chunks and the time each thread spends in them.
+	*/
+	template <typename Body>
+	class TimedBody {
+		Body body;
+		PerThread<Counters> *counters;
+
+	public:
+		TimedBody(const Body &body, PerThread<Counters> *counters) : body(body), counters(counters) {}
+
+		void operator()(const tbb::blocked_range<size_t> &r) const {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			body(r);
+			Counters &local = counters->local();
+			++local.tasks;
+			local.busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+	};
+
+	/**
+		Records into profile (its levels and thread times are appended), for an image with the given first extent.
+	*/
+	PyramidRecorder(PyramidProfile *profile, size_t first_extent, std::size_t histogram_size)
+		: profile(profile), counters(new PerThread<Counters>()), input_level_bits(log2(first_extent)),
+		  histogram_size(histogram_size), previous_bytes(0) {}
+
+	template <std::size_t NumDims>
+	void beginLevel(const std::array<size_t, NumDims> &extents, const char *path) {
+		LevelProfile level = LevelProfile();
+		level.level = input_level_bits - log2(extents[0]);
+		level.path = path;
+		level.cells = product(extents);
+		profile->levels.push_back(level);
+
+		for (std::size_t i = 0; i != counters->size(); ++i) {
+			double busy_seconds = (*counters)[i].busy_seconds;
+			(*counters)[i] = Counters();
+			(*counters)[i].busy_seconds = busy_seconds;
+		}
+		level_start = std::chrono::steady_clock::now();
+	}
+
+	void endLevel() {
+		LevelProfile &level = profile->levels.back();
+		level.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - level_start).count();
+
+		Counters total;
+		for (std::size_t i = 0; i != counters->size(); ++i) {
+			const Counters &local = (*counters)[i];
+			total.tasks += local.tasks;
+			total.histograms += local.histograms;
+			total.entries += local.entries;
+			total.uniform += local.uniform;
+			total.heap_bytes += local.heap_bytes;
+			total.min_entries = std::min(total.min_entries, local.min_entries);
+			total.max_entries = std::max(total.max_entries, local.max_entries);
+		}
+
+		level.tasks = total.tasks;
+		level.histograms = total.histograms;
+		if (total.histograms != 0) {
+			level.min_entries = total.min_entries;
+			level.max_entries = total.max_entries;
+			level.mean_entries = (double)total.entries / total.histograms;
+			level.uniform_share = (double)total.uniform / total.histograms;
+			level.histogram_bytes = total.histograms * histogram_size + total.heap_bytes;
+		}
+		profile->peak_histogram_bytes = std::max(profile->peak_histogram_bytes, previous_bytes + level.histogram_bytes);
+		previous_bytes = level.histogram_bytes;
+	}
+
+	Statistics statistics() const {
+		return Statistics(counters.get());
+	}
+
+	template <typename Body>
+	TimedBody<Body> wrap(const Body &body) const {
+		return TimedBody<Body>(body, counters.get());
+	}
+
+	/**
+		Busy time of each thread over the whole run.
+	*/
+	std::vector<double> threadBusySeconds() const {
+		std::vector<double> result;
+		for (std::size_t i = 0; i != counters->size(); ++i) {
+			result.push_back((*counters)[i].busy_seconds);
+		}
+		return result;
+	}
+};
+
+
+/**
+	buildPyramid(..) that records profile, for a given Histogram type.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildProfiledPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, bool parallel,
+						  PyramidProfile &profile, Histogram *histogram) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	profile.histogram = histogramName(histogram);
+	HistogramLevels<Histogram, PyramidRecorder> levels(PyramidRecorder(&profile, A.shape()[0], sizeof(Histogram)));
+	buildPyramid(A, results, parallel, levels);
+	profile.total_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	profile.thread_busy_seconds = levels.profile.threadBusySeconds();
+}
+
+
+template <typename T, std::size_t NumDims>
+void buildProfiledPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, bool parallel,
+						  PyramidProfile &profile, AutoHistogram *) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	withAutoHistogram(A, parallel, [&](auto *histogram) {
+		profile.select_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		profile.total_seconds = profile.select_seconds;
+		buildProfiledPyramid(A, results, parallel, profile, histogram);
+	});
+}
+
+
+/**
+    computeDownsamplesParallel(..) that records where the time and the memory go into profile (see PyramidProfile):
+	wall time, chunks and histogram sizes of every level, busy time of every thread and the choice of histogram.
+	The engine is the same: without a profile its hooks are empty (NoProfile) and cost nothing.
+	With one every chunk of a loop reads the clock twice and every histogram is walked once more to count its labels.
+
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - Output vector contains all l-downsamplings of the original image.
+		profile - Output, the statistics of the run (replaced)
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesParallel(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, PyramidProfile &profile) {
+	profile = PyramidProfile();
+	profile.extents.assign(A.shape(), A.shape() + NumDims);
+	profile.threads = tbb::this_task_arena::max_concurrency();
+	buildProfiledPyramid(A, results, true, profile, (Histogram *)0);
+}
+
+
+/**
+	Single threaded version of computeDownsamplesParallel(..) with a profile.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamples(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, PyramidProfile &profile) {
+	profile = PyramidProfile();
+	profile.extents.assign(A.shape(), A.shape() + NumDims);
+	profile.parallel = false;
+	profile.threads = 1;
+	buildProfiledPyramid(A, results, false, profile, (Histogram *)0);
+}
+
+
+/**
+	Writes profile as a JSON object, e.g. for dashboards that flag inputs taking slow paths
+	(large hashmaps, few uniform blocks, one busy thread).
+*/
+inline void writeJson(std::ostream &out, const PyramidProfile &profile) {
+	out << "{\"extents\": [";
+	for (std::size_t k = 0; k != profile.extents.size(); ++k) {
+		out << (k ? ", " : "") << profile.extents[k];
+	}
+	out << "], \"histogram\": \"" << profile.histogram << "\", \"parallel\": " << (profile.parallel ? "true" : "false")
+		<< ", \"threads\": " << profile.threads << ", \"select_seconds\": " << profile.select_seconds
+		<< ", \"total_seconds\": " << profile.total_seconds << ", \"peak_histogram_bytes\": " << profile.peak_histogram_bytes
+		<< ", \"thread_busy_seconds\": [";
+	for (std::size_t i = 0; i != profile.thread_busy_seconds.size(); ++i) {
+		out << (i ? ", " : "") << profile.thread_busy_seconds[i];
+	}
+	out << "], \"levels\": [";
+	for (std::size_t l = 0; l != profile.levels.size(); ++l) {
+		const LevelProfile &level = profile.levels[l];
+		out << (l ? ", " : "") << "{\"level\": " << level.level << ", \"path\": \"" << level.path << "\", \"cells\": " << level.cells
+			<< ", \"seconds\": " << level.seconds << ", \"tasks\": " << level.tasks << ", \"histograms\": " << level.histograms
+			<< ", \"min_entries\": " << level.min_entries << ", \"mean_entries\": " << level.mean_entries
+			<< ", \"max_entries\": " << level.max_entries << ", \"uniform_share\": " << level.uniform_share
+			<< ", \"histogram_bytes\": " << level.histogram_bytes << "}";
+	}
+	out << "]}";
+}
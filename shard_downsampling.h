@@ -0,0 +1,439 @@
+/**
+	Downsampling assignment
+
+	shard_downsampling.h
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include "downsampling.h"
+#include "pyramid_file.h"
+
+
+/**
+	Sharded builds.
+
+	A large image can be split between several processes, each one owning a shard: an aligned sub-rectangle
+	of the image whose extents are powers of 2 and whose corner is a multiple of its extents, so every block
+	of every level up to numDownsamples(shard extents) lies inside a single shard.
+	computeShard(..) builds those levels of its shard and keeps the histograms of the last one (the roots of the shard),
+	which are written to a shard file. mergeShards(..) reads the roots of all shards and builds the coarse levels
+	of the whole image from them, exactly as a single computeDownsamplesParallel(..) run would.
+
+	Shard file format:
+
+		char     magic[8]                           "DSSHARD1"
+		uint32   num_dims, pixel_size, level, reserved
+		uint64   image_extents[num_dims], corner[num_dims], extents[num_dims]
+		uint64   num_histograms, num_entries
+		uint32   sizes[num_histograms]              number of labels of every root histogram (row-major)
+		T        labels[num_entries]                labels of all histograms, sorted within each histogram
+		uint32   counts[num_entries]                their counts
+
+	Numbers are stored in the byte order of the machine (as in pyramid files).
+	The labels are sorted, so a shard file does not depend on the histogram type it was built with.
+*/
+template <typename T, std::size_t NumDims>
+struct ShardRoots {
+	std::array<size_t, NumDims> image_extents;   // extents of the whole image
+	std::array<size_t, NumDims> corner;          // first pixel of the shard in the image
+	std::array<size_t, NumDims> extents;         // extents of the shard
+	std::size_t level;                           // level of the root histograms, numDownsamples(extents)
+	std::vector<uint32_t> sizes;
+	std::vector<T> labels;
+	std::vector<uint32_t> counts;
+
+	/**
+		Returns the extents of the level of root histograms of the shard.
+	*/
+	std::array<size_t, NumDims> rootExtents() const {
+		std::array<size_t, NumDims> root_extents;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			root_extents[k] = extents[k] >> level;
+		}
+		return root_extents;
+	}
+};
+
+
+/**
+	Stores a level of histograms in roots (sizes, labels and counts), the labels of every histogram sorted.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void storeShardRoots(const std::vector<Histogram> &histograms, ShardRoots<T, NumDims> &roots) {
+	roots.sizes.clear();
+	roots.labels.clear();
+	roots.counts.clear();
+	std::vector<std::pair<T, uint32_t> > entries;
+	for (size_t i = 0; i != histograms.size(); ++i) {
+		entries.clear();
+		forEachCount(histograms[i], [&](T label, unsigned int count) {
+			entries.push_back(std::make_pair(label, (uint32_t)count));
+		});
+		std::sort(entries.begin(), entries.end());
+		roots.sizes.push_back((uint32_t)entries.size());
+		for (size_t j = 0; j != entries.size(); ++j) {
+			roots.labels.push_back(entries[j].first);
+			roots.counts.push_back(entries[j].second);
+		}
+	}
+}
+
+
+/**
+	Checks the root histograms of a shard against its extents: one histogram per root, as many labels as counts,
+	the labels of every histogram strictly increasing and its counts summing to the 2^(level * NumDims) pixels
+	of a root block. Errors are reported with std::runtime_error.
+*/
+template <typename T, std::size_t NumDims>
+void checkShardRoots(const ShardRoots<T, NumDims> &roots) {
+	uint64_t total = 0;
+	for (size_t i = 0; i != roots.sizes.size(); ++i) {
+		total += roots.sizes[i];
+	}
+	if (roots.sizes.size() != product(roots.rootExtents()) || total != roots.labels.size() || roots.counts.size() != roots.labels.size()
+		|| roots.level * NumDims >= 64) {
+		throw std::runtime_error("the histograms of a shard do not match its roots");
+	}
+
+	uint64_t block_size = uint64_t(1) << (roots.level * NumDims);
+	size_t entry = 0;
+	for (size_t i = 0; i != roots.sizes.size(); ++i) {
+		uint64_t sum = 0;
+		for (size_t j = 0; j != roots.sizes[i]; ++j, ++entry) {
+			if ((j != 0 && !(roots.labels[entry - 1] < roots.labels[entry]))
+				|| roots.counts[entry] > (uint32_t)std::numeric_limits<int>::max()) {
+				throw std::runtime_error("corrupt histogram in the roots of a shard");
+			}
+			sum += roots.counts[entry];
+		}
+		if (sum != block_size) {
+			throw std::runtime_error("corrupt histogram in the roots of a shard");
+		}
+	}
+}
+
+
+/**
+	Returns true if a Histogram can count label: every label for histograms with keys,
+	labels in [0, NumBins) for DenseHistogram<T, NumBins>.
+*/
+template <typename T, typename Histogram>
+bool fitsHistogram(T, Histogram *) {
+	return true;
+}
+
+template <typename T, std::size_t NumBins>
+bool fitsHistogram(T label, DenseHistogram<T, NumBins> *) {
+	return !(label < T(0)) && (std::size_t)label < NumBins;
+}
+
+
+/**
+	Builds levels 1..roots.level of a shard into results and stores the histograms of the last one in roots.
+	The last (unnamed) parameter selects the Histogram type, see AutoHistogram.
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildShardLevels(const ArrayNd<T, NumDims> &shard, const ArrayView<T, NumDims> *results, ShardRoots<T, NumDims> &roots,
+					  bool parallel, Histogram *) {
+	HistogramLevels<Histogram> levels;
+	if (buildLevels(shard, results, roots.level, parallel, levels) != roots.level) {
+		/// the 2-d path builds no hashmaps when the 1-downsample is the last level, the generic one does
+		createFirstLevels(shard, levels, results, roots.level, parallel, std::false_type());
+	}
+	storeShardRoots(levels.buffers[levels.current], roots);
+}
+
+template <typename T, std::size_t NumDims>
+void buildShardLevels(const ArrayNd<T, NumDims> &shard, const ArrayView<T, NumDims> *results, ShardRoots<T, NumDims> &roots,
+					  bool parallel, AutoHistogram *) {
+	withAutoHistogram(shard, parallel, [&](auto *histogram) {
+		buildShardLevels(shard, results, roots, parallel, histogram);
+	});
+}
+
+
+/**
+	Shard mode of computeDownsamplesParallel(..), run by the process that owns a shard of a large image.
+	Parameters:
+		shard - the pixels of the shard, its extents are powers of 2 (at least 2)
+		corner - the first pixel of the shard in the image, a multiple of the extents of the shard
+		image_extents - extents of the whole image, powers of 2
+		results - Output, results[l - 1] is the l-downsampling of the shard for l = 1..numDownsamples(shard),
+			the part of level l of the image at corner / 2^l (see placeShardLevels(..))
+		roots - Output, the histograms of the last level, to be passed to mergeShards(..) (see writeShardFile(..))
+		parallel - run the loops with tbb::parallel_for (true) or in the calling thread (false)
+	The Histogram template parameter is that of computeDownsamplesParallel(..), it does not change the output.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeShard(const ArrayNd<T, NumDims> &shard, const std::array<size_t, NumDims> &corner,
+				  const std::array<size_t, NumDims> &image_extents, std::vector<ArrayNd<T, NumDims> > &results,
+				  ShardRoots<T, NumDims> &roots, bool parallel = true) {
+	roots.image_extents = image_extents;
+	roots.corner = corner;
+	std::copy(shard.shape(), shard.shape() + NumDims, roots.extents.begin());
+	roots.level = numDownsamples(shard);
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		assert((roots.extents[k] & (roots.extents[k] - 1)) == 0 && "extents of a shard must be powers of 2");
+		assert(corner[k] % roots.extents[k] == 0 && corner[k] + roots.extents[k] <= image_extents[k] && "the shard is not aligned");
+	}
+	assert(roots.level >= 1 && "a shard must be at least 2 pixels along every dimention");
+
+	results.reserve(results.size() + roots.level);
+	std::vector<ArrayView<T, NumDims> > views;
+	for (std::size_t l = 1; l <= roots.level; ++l) {
+		results.emplace_back(levelExtents(shard, l));
+		views.push_back(makeView(results.back()));
+	}
+	buildShardLevels(shard, views.data(), roots, parallel, (Histogram *)0);
+}
+
+
+/**
+	Copies the levels of a shard (see computeShard(..)) into the levels of the whole image,
+	results[l - 1] is level l of the image (it must have been allocated).
+*/
+template <typename T, std::size_t NumDims>
+void placeShardLevels(const std::vector<ArrayNd<T, NumDims> > &shard_results, const std::array<size_t, NumDims> &corner,
+					  std::vector<ArrayNd<T, NumDims> > &results) {
+	assert(shard_results.size() <= results.size());
+	for (std::size_t l = 1; l <= shard_results.size(); ++l) {
+		std::array<size_t, NumDims> cell = corner;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			cell[k] >>= l;
+		}
+		ArrayView<const T, NumDims> input = makeView(shard_results[l - 1]);
+		ArrayView<T, NumDims> output = makeView(results[l - 1]).subView(cell, input.shape);
+		for (size_t i = 0; i != input.num_elements(); ++i) {
+			std::array<size_t, NumDims> indices = unflatten(i, input.shape);
+			output(indices) = input(indices);
+		}
+	}
+}
+
+
+/**
+	Encodes roots in the shard file format.
+*/
+template <typename T, std::size_t NumDims>
+void encodeShardRoots(const ShardRoots<T, NumDims> &roots, std::vector<char> &bytes) {
+	static const char magic[8] = {'D', 'S', 'S', 'H', 'A', 'R', 'D', '1'};
+	bytes.assign(magic, magic + 8);
+	appendBytes(bytes, (uint32_t)NumDims);
+	appendBytes(bytes, (uint32_t)sizeof(T));
+	appendBytes(bytes, (uint32_t)roots.level);
+	appendBytes(bytes, (uint32_t)0);
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		appendBytes(bytes, (uint64_t)roots.image_extents[k]);
+	}
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		appendBytes(bytes, (uint64_t)roots.corner[k]);
+	}
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		appendBytes(bytes, (uint64_t)roots.extents[k]);
+	}
+	appendBytes(bytes, (uint64_t)roots.sizes.size());
+	appendBytes(bytes, (uint64_t)roots.labels.size());
+	const char *sizes = (const char *)roots.sizes.data();
+	bytes.insert(bytes.end(), sizes, sizes + roots.sizes.size() * sizeof(uint32_t));
+	const char *labels = (const char *)roots.labels.data();
+	bytes.insert(bytes.end(), labels, labels + roots.labels.size() * sizeof(T));
+	const char *counts = (const char *)roots.counts.data();
+	bytes.insert(bytes.end(), counts, counts + roots.counts.size() * sizeof(uint32_t));
+}
+
+
+/**
+	Decodes roots stored by encodeShardRoots(..). T and NumDims must match the file.
+	The level, the placement of the shard and the sizes of the arrays are checked before anything is allocated,
+	the histograms after they are read (see checkShardRoots(..)).
+	Errors are reported with std::runtime_error.
+*/
+template <typename T, std::size_t NumDims>
+void decodeShardRoots(const std::vector<char> &bytes, ShardRoots<T, NumDims> &roots) {
+	size_t header_size = 8 + 4 * sizeof(uint32_t) + (3 * NumDims + 2) * sizeof(uint64_t);
+	if (bytes.size() < header_size || std::string(bytes.begin(), bytes.begin() + 8) != "DSSHARD1") {
+		throw std::runtime_error("not a shard file");
+	}
+	size_t offset = 8;
+	uint32_t num_dims = takeBytes<uint32_t>(bytes, offset);
+	uint32_t pixel_size = takeBytes<uint32_t>(bytes, offset);
+	if (num_dims != NumDims || pixel_size != sizeof(T)) {
+		throw std::runtime_error("the shard file has a different pixel type or number of dimentions");
+	}
+	roots.level = takeBytes<uint32_t>(bytes, offset);
+	takeBytes<uint32_t>(bytes, offset);
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		roots.image_extents[k] = (size_t)takeBytes<uint64_t>(bytes, offset);
+	}
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		roots.corner[k] = (size_t)takeBytes<uint64_t>(bytes, offset);
+	}
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		roots.extents[k] = (size_t)takeBytes<uint64_t>(bytes, offset);
+	}
+	if (roots.level > 63 || roots.level != numDownsamples(roots.extents)) {
+		throw std::runtime_error("corrupt shard file: the roots are not at the last level of the shard");
+	}
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		if (roots.extents[k] == 0 || roots.extents[k] > roots.image_extents[k] || roots.corner[k] % roots.extents[k] != 0
+			|| roots.corner[k] > roots.image_extents[k] - roots.extents[k]) {
+			throw std::runtime_error("corrupt shard file: the shard is not aligned inside the image");
+		}
+		if ((roots.image_extents[k] & (roots.image_extents[k] - 1)) != 0) {
+			throw std::runtime_error("corrupt shard file: the extents of the image are not powers of 2");
+		}
+	}
+
+	/// num_histograms sizes and num_entries labels and counts, compared without overflowing
+	uint64_t num_histograms = takeBytes<uint64_t>(bytes, offset);
+	uint64_t num_entries = takeBytes<uint64_t>(bytes, offset);
+	size_t rest = bytes.size() - offset;
+	size_t entry_size = sizeof(T) + sizeof(uint32_t);
+	if (num_histograms > rest / sizeof(uint32_t)
+		|| (rest - num_histograms * sizeof(uint32_t)) % entry_size != 0
+		|| (rest - num_histograms * sizeof(uint32_t)) / entry_size != num_entries) {
+		throw std::runtime_error("truncated shard file");
+	}
+
+	roots.sizes.resize((size_t)num_histograms);
+	roots.labels.resize((size_t)num_entries);
+	roots.counts.resize((size_t)num_entries);
+	std::copy(bytes.begin() + offset, bytes.begin() + offset + roots.sizes.size() * sizeof(uint32_t), (char *)roots.sizes.data());
+	offset += roots.sizes.size() * sizeof(uint32_t);
+	std::copy(bytes.begin() + offset, bytes.begin() + offset + roots.labels.size() * sizeof(T), (char *)roots.labels.data());
+	offset += roots.labels.size() * sizeof(T);
+	std::copy(bytes.begin() + offset, bytes.begin() + offset + roots.counts.size() * sizeof(uint32_t), (char *)roots.counts.data());
+
+	checkShardRoots(roots);
+}
+
+
+/**
+	Writes roots to a shard file. Errors are reported with std::runtime_error.
+*/
+template <typename T, std::size_t NumDims>
+void writeShardFile(const std::string &path, const ShardRoots<T, NumDims> &roots) {
+	std::vector<char> bytes;
+	encodeShardRoots(roots, bytes);
+	std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+	file.write(bytes.data(), bytes.size());
+	file.close();
+	if (!file) {
+		throw std::runtime_error("cannot write " + path);
+	}
+}
+
+
+/**
+	Reads a shard file written by writeShardFile(..). Errors are reported with std::runtime_error.
+*/
+template <typename T, std::size_t NumDims>
+void readShardFile(const std::string &path, ShardRoots<T, NumDims> &roots) {
+	std::ifstream file(path.c_str(), std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("cannot open " + path);
+	}
+	std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (file.bad()) {
+		throw std::runtime_error("cannot read " + path);
+	}
+	decodeShardRoots(bytes, roots);
+}
+
+
+/**
+	Merge step of a sharded build: builds the levels of the image above the levels of its shards.
+	Parameters:
+		shards - the roots of all shards of the image (see computeShard(..)), in any order. The extents of the image
+			must be powers of 2, the shards must have the same extents, cover the image exactly, have valid histograms (see checkShardRoots(..)) and labels
+			that fit into Histogram, std::runtime_error is thrown otherwise.
+		results - Output, the levels level + 1..numDownsamples(image) of the image are appended to it,
+			level being the level of the roots of the shards
+		parallel - run the loops with tbb::parallel_for (true) or in the calling thread (false)
+	Together with the levels of the shards this is the pyramid computeDownsamplesParallel(..) builds for the whole image.
+	Histogram needs addCount(..): BasicHashMap<T> or DenseHistogram<T, NumBins> (shards with labels of NumBins or more are rejected).
+*/
+template <typename T, std::size_t NumDims, typename Histogram = BasicHashMap<T> >
+void mergeShards(const std::vector<ShardRoots<T, NumDims> > &shards, std::vector<ArrayNd<T, NumDims> > &results, bool parallel = true) {
+	if (shards.empty()) {
+		throw std::runtime_error("no shards to merge");
+	}
+
+	/// the shards must form a grid over the image, every cell of it filled once
+	const ShardRoots<T, NumDims> &first = shards[0];
+	std::array<size_t, NumDims> grid_extents;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		if (first.extents[k] == 0 || (first.extents[k] & (first.extents[k] - 1)) != 0 || first.image_extents[k] % first.extents[k] != 0) {
+			throw std::runtime_error("the shards do not divide the image");
+		}
+		if ((first.image_extents[k] & (first.image_extents[k] - 1)) != 0) {
+			throw std::runtime_error("the extents of the image are not powers of 2");
+		}
+		grid_extents[k] = first.image_extents[k] / first.extents[k];
+	}
+	if (first.level == 0 || first.level != numDownsamples(first.extents)) {
+		throw std::runtime_error("the roots of the shards are not at the last level of the shards");
+	}
+	std::vector<char> filled(product(grid_extents), 0);
+	for (size_t s = 0; s != shards.size(); ++s) {
+		if (shards[s].image_extents != first.image_extents || shards[s].extents != first.extents || shards[s].level != first.level) {
+			throw std::runtime_error("the shards are of different images or extents");
+		}
+		size_t cell = 0;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			if (shards[s].corner[k] % first.extents[k] != 0 || shards[s].corner[k] >= first.image_extents[k]) {
+				throw std::runtime_error("a shard is not aligned");
+			}
+			cell = cell * grid_extents[k] + shards[s].corner[k] / first.extents[k];
+		}
+		if (filled[cell]) {
+			throw std::runtime_error("two shards at the same place");
+		}
+		filled[cell] = 1;
+
+		checkShardRoots(shards[s]);
+		for (size_t entry = 0; entry != shards[s].labels.size(); ++entry) {
+			if (!fitsHistogram(shards[s].labels[entry], (Histogram *)0)) {
+				throw std::runtime_error("a label of a shard does not fit into the histogram of the merge");
+			}
+		}
+	}
+	if (shards.size() != filled.size()) {
+		throw std::runtime_error("the shards do not cover the image");
+	}
+
+	/// the roots of all shards are the level of the whole image the merging starts from
+	std::array<size_t, NumDims> level_extents;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		level_extents[k] = first.image_extents[k] >> first.level;
+	}
+	HistogramLevels<Histogram> levels;
+	ArrayView<Histogram, NumDims> roots = makeView(levels.next(product(level_extents)).data(), level_extents);
+	forEachBlock(shards.size(), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t s = r.begin(); s != r.end(); ++s) {
+			std::array<size_t, NumDims> cell = shards[s].corner;
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				cell[k] >>= first.level;
+			}
+			std::array<size_t, NumDims> root_extents = shards[s].rootExtents();
+			ArrayView<Histogram, NumDims> output = roots.subView(cell, root_extents);
+			size_t entry = 0;
+			for (size_t i = 0; i != shards[s].sizes.size(); ++i) {
+				Histogram &hist = output(unflatten(i, root_extents));
+				for (size_t j = 0; j != shards[s].sizes[i]; ++j, ++entry) {
+					addCount(hist, shards[s].labels[entry], (int)shards[s].counts[entry]);
+				}
+			}
+		}
+	}, parallel);
+	levels.swap();
+
+	results.reserve(results.size() + numDownsamples(level_extents));
+	mergeLevels(levels, level_extents, results, parallel);
+}
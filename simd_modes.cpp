@@ -0,0 +1,203 @@
+/**
+	Downsampling assignment
+
+	simd_modes.cpp
+*/
+
+#include "simd_modes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_MODES_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/**
+	Reference (scalar) version of modes2x2(..).
+*/
+template <typename T>
+static void modes2x2Scalar(const T *row0, const T *row1, size_t width, T *out) {
+	for (size_t j = 0; j + 1 < width; j += 2) {
+		T block[4] = {row0[j], row0[j + 1], row1[j], row1[j + 1]};
+		T mode = block[0];
+		unsigned int max_num_occurances = 0;
+		for (int i = 0; i != 4; ++i) {
+			unsigned int count = (block[i] == block[0]) + (block[i] == block[1]) + (block[i] == block[2]) + (block[i] == block[3]);
+			if (count > max_num_occurances || (count == max_num_occurances && block[i] < mode)) {
+				mode = block[i];
+				max_num_occurances = count;
+			}
+		}
+		out[j / 2] = mode;
+	}
+}
+
+
+#ifdef SIMD_MODES_X86
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace avx2 {
+
+struct Base {
+	typedef __m256i V;
+	static V andv(V a, V b) { return _mm256_and_si256(a, b); }
+	static V orv(V a, V b) { return _mm256_or_si256(a, b); }
+	static V andnot(V a, V b) { return _mm256_andnot_si256(a, b); }
+	static V blend(V a, V b, V mask) { return _mm256_blendv_epi8(a, b, mask); }
+	template <typename T> static V load(const T *p) { return _mm256_loadu_si256((const __m256i *)p); }
+	template <typename T> static void store(T *p, V v) { _mm256_storeu_si256((__m256i *)p, v); }
+};
+
+struct Ops8 : Base {
+	typedef uint8_t T;
+	static const size_t lanes = 32;
+	static V eq(V a, V b) { return _mm256_cmpeq_epi8(a, b); }
+	static V add(V a, V b) { return _mm256_add_epi8(a, b); }
+	static V gt(V a, V b) { return _mm256_cmpgt_epi8(a, b); }
+	static V minu(V a, V b) { return _mm256_min_epu8(a, b); }
+	static V swapPairs(V v) { return _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8)); }
+	static V packEven(V a, V b) {
+		V mask = _mm256_set1_epi16(0xFF);
+		return _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)), _MM_SHUFFLE(3, 1, 2, 0));
+	}
+};
+
+struct Ops16 : Base {
+	typedef uint16_t T;
+	static const size_t lanes = 16;
+	static V eq(V a, V b) { return _mm256_cmpeq_epi16(a, b); }
+	static V add(V a, V b) { return _mm256_add_epi16(a, b); }
+	static V gt(V a, V b) { return _mm256_cmpgt_epi16(a, b); }
+	static V minu(V a, V b) { return _mm256_min_epu16(a, b); }
+	static V swapPairs(V v) { return _mm256_or_si256(_mm256_slli_epi32(v, 16), _mm256_srli_epi32(v, 16)); }
+	static V packEven(V a, V b) {
+		V mask = _mm256_set1_epi32(0xFFFF);
+		return _mm256_permute4x64_epi64(_mm256_packus_epi32(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)), _MM_SHUFFLE(3, 1, 2, 0));
+	}
+};
+
+struct Ops32 : Base {
+	typedef uint32_t T;
+	static const size_t lanes = 8;
+	static V eq(V a, V b) { return _mm256_cmpeq_epi32(a, b); }
+	static V add(V a, V b) { return _mm256_add_epi32(a, b); }
+	static V gt(V a, V b) { return _mm256_cmpgt_epi32(a, b); }
+	static V minu(V a, V b) { return _mm256_min_epu32(a, b); }
+	static V swapPairs(V v) { return _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)); }
+	static V packEven(V a, V b) {
+		__m256 even = _mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(2, 0, 2, 0));
+		return _mm256_permute4x64_epi64(_mm256_castps_si256(even), _MM_SHUFFLE(3, 1, 2, 0));
+	}
+};
+
+#include "simd_modes_impl.h"
+
+} // namespace avx2
+
+#pragma GCC pop_options
+
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+
+namespace sse41 {
+
+struct Base {
+	typedef __m128i V;
+	static V andv(V a, V b) { return _mm_and_si128(a, b); }
+	static V orv(V a, V b) { return _mm_or_si128(a, b); }
+	static V andnot(V a, V b) { return _mm_andnot_si128(a, b); }
+	static V blend(V a, V b, V mask) { return _mm_blendv_epi8(a, b, mask); }
+	template <typename T> static V load(const T *p) { return _mm_loadu_si128((const __m128i *)p); }
+	template <typename T> static void store(T *p, V v) { _mm_storeu_si128((__m128i *)p, v); }
+};
+
+struct Ops8 : Base {
+	typedef uint8_t T;
+	static const size_t lanes = 16;
+	static V eq(V a, V b) { return _mm_cmpeq_epi8(a, b); }
+	static V add(V a, V b) { return _mm_add_epi8(a, b); }
+	static V gt(V a, V b) { return _mm_cmpgt_epi8(a, b); }
+	static V minu(V a, V b) { return _mm_min_epu8(a, b); }
+	static V swapPairs(V v) { return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); }
+	static V packEven(V a, V b) {
+		V mask = _mm_set1_epi16(0xFF);
+		return _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	}
+};
+
+struct Ops16 : Base {
+	typedef uint16_t T;
+	static const size_t lanes = 8;
+	static V eq(V a, V b) { return _mm_cmpeq_epi16(a, b); }
+	static V add(V a, V b) { return _mm_add_epi16(a, b); }
+	static V gt(V a, V b) { return _mm_cmpgt_epi16(a, b); }
+	static V minu(V a, V b) { return _mm_min_epu16(a, b); }
+	static V swapPairs(V v) { return _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16)); }
+	static V packEven(V a, V b) {
+		V mask = _mm_set1_epi32(0xFFFF);
+		return _mm_packus_epi32(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	}
+};
+
+struct Ops32 : Base {
+	typedef uint32_t T;
+	static const size_t lanes = 4;
+	static V eq(V a, V b) { return _mm_cmpeq_epi32(a, b); }
+	static V add(V a, V b) { return _mm_add_epi32(a, b); }
+	static V gt(V a, V b) { return _mm_cmpgt_epi32(a, b); }
+	static V minu(V a, V b) { return _mm_min_epu32(a, b); }
+	static V swapPairs(V v) { return _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)); }
+	static V packEven(V a, V b) {
+		return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+	}
+};
+
+#include "simd_modes_impl.h"
+
+} // namespace sse41
+
+#pragma GCC pop_options
+
+#endif // SIMD_MODES_X86
+
+
+SimdLevel bestSimdLevel() {
+#ifdef SIMD_MODES_X86
+	static const SimdLevel level = __builtin_cpu_supports("avx2") ? SIMD_AVX2 
+		: __builtin_cpu_supports("sse4.1") ? SIMD_SSE41 : SIMD_SCALAR;
+	return level;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+#ifdef SIMD_MODES_X86
+#define DISPATCH_MODES(Ops) \
+	if (level >= SIMD_AVX2) { avx2::ModeKernel<avx2::Ops>::rows(row0, row1, width, out); return; } \
+	if (level >= SIMD_SSE41) { sse41::ModeKernel<sse41::Ops>::rows(row0, row1, width, out); return; }
+#else
+#define DISPATCH_MODES(Ops)
+#endif
+
+void modes2x2(const uint8_t *row0, const uint8_t *row1, size_t width, uint8_t *out, SimdLevel level) {
+	DISPATCH_MODES(Ops8)
+	modes2x2Scalar(row0, row1, width, out);
+}
+
+void modes2x2(const uint16_t *row0, const uint16_t *row1, size_t width, uint16_t *out, SimdLevel level) {
+	DISPATCH_MODES(Ops16)
+	modes2x2Scalar(row0, row1, width, out);
+}
+
+void modes2x2(const uint32_t *row0, const uint32_t *row1, size_t width, uint32_t *out, SimdLevel level) {
+	DISPATCH_MODES(Ops32)
+	modes2x2Scalar(row0, row1, width, out);
+}
+
+void modes2x2(const uint64_t *row0, const uint64_t *row1, size_t width, uint64_t *out, SimdLevel) {
+	modes2x2Scalar(row0, row1, width, out);
+}
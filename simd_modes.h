@@ -0,0 +1,60 @@
+/**
+	Downsampling assignment
+
+	simd_modes.h
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+	Instruction sets of the 2x2 mode kernels, see modes2x2(..).
+*/
+enum SimdLevel {
+	SIMD_SCALAR = 0,
+	SIMD_SSE41 = 1,
+	SIMD_AVX2 = 2
+};
+
+
+/**
+	Returns the best instruction set supported by the CPU (detected once, at the first call).
+*/
+SimdLevel bestSimdLevel();
+
+
+/**
+	Computes the modes of the 2x2 blocks of two rows of an image: out[j] is the mode of
+	row0[2j], row0[2j+1], row1[2j], row1[2j+1] (ties go to the smaller value, like isBetterMode(..)).
+
+	Level 1 of a 2-d pyramid only needs the modes of 4 values, so no histogram is built: each value is compared
+	with the other three of its block and the best (count, value) pair is picked with compare/blend operations,
+	for 32 (uint8) to 8 (uint32) blocks per AVX2 instruction. The rows must be contiguous.
+
+	Parameters:
+		row0, row1 - two consecutive rows of the image
+		width - number of pixels in a row (even)
+		out - Output, width / 2 modes
+		level - instruction set, by default the best one the CPU supports (SIMD_SCALAR is the reference)
+	uint64 rows always use the scalar code (there is no unsigned 64-bit min before AVX-512).
+*/
+void modes2x2(const uint8_t *row0, const uint8_t *row1, size_t width, uint8_t *out, SimdLevel level = bestSimdLevel());
+void modes2x2(const uint16_t *row0, const uint16_t *row1, size_t width, uint16_t *out, SimdLevel level = bestSimdLevel());
+void modes2x2(const uint32_t *row0, const uint32_t *row1, size_t width, uint32_t *out, SimdLevel level = bestSimdLevel());
+void modes2x2(const uint64_t *row0, const uint64_t *row1, size_t width, uint64_t *out, SimdLevel level = bestSimdLevel());
+
+
+/**
+	HasModeKernel<T>::value is true for the pixel types modes2x2(..) is defined for.
+*/
+template <typename T>
+struct HasModeKernel {
+	static const bool value = false;
+};
+
+template <> struct HasModeKernel<uint8_t> { static const bool value = true; };
+template <> struct HasModeKernel<uint16_t> { static const bool value = true; };
+template <> struct HasModeKernel<uint32_t> { static const bool value = true; };
+template <> struct HasModeKernel<uint64_t> { static const bool value = true; };
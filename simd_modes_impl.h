@@ -0,0 +1,59 @@
+/**
+	Downsampling assignment
+
+	simd_modes_impl.h
+
+	The SIMD 2x2 mode kernel, written once for any vector type. simd_modes.cpp includes this file once per
+	instruction set, inside a namespace and a region compiled for that instruction set.
+	Ops provides the vector type V of pixels of type T, the number of lanes and the operations used below.
+*/
+
+template <typename Ops>
+struct ModeKernel {
+	typedef typename Ops::T T;
+	typedef typename Ops::V V;
+
+	/**
+		Lanes where x < y (unsigned).
+	*/
+	static V less(V x, V y) {
+		return Ops::andnot(Ops::eq(x, y), Ops::eq(Ops::minu(x, y), x));
+	}
+
+	/**
+		Replaces (a, ca) with (b, cb) in the lanes where b is the better mode candidate.
+		Counts are stored negated (each equal value adds a -1 mask), so b is better if cb < ca,
+		or if they are equal and b < a (the same order as isBetterMode(..)).
+	*/
+	static void select(V &a, V &ca, V b, V cb) {
+		V take_b = Ops::orv(Ops::gt(ca, cb), Ops::andv(Ops::eq(ca, cb), less(b, a)));
+		a = Ops::blend(a, b, take_b);
+		ca = Ops::blend(ca, cb, take_b);
+	}
+
+	/**
+		v holds pixels of row 0, w the pixels below them in row 1, so each pair of lanes (2j, 2j+1) of v and w
+		is a 2x2 block. Returns the mode of each block in both lanes of its pair.
+	*/
+	static V pairModes(V v, V w) {
+		V vs = Ops::swapPairs(v);
+		V ws = Ops::swapPairs(w);
+		V cv = Ops::add(Ops::add(Ops::eq(v, vs), Ops::eq(v, w)), Ops::eq(v, ws));
+		V cw = Ops::add(Ops::add(Ops::eq(w, ws), Ops::eq(w, v)), Ops::eq(w, vs));
+
+		/// best of the columns, then best of the two columns
+		select(v, cv, w, cw);
+		select(v, cv, Ops::swapPairs(v), Ops::swapPairs(cv));
+		return v;
+	}
+
+	static void rows(const T *row0, const T *row1, size_t width, T *out) {
+		size_t j = 0;
+		for (; j + 2 * Ops::lanes <= width; j += 2 * Ops::lanes) {
+			V first = pairModes(Ops::load(row0 + j), Ops::load(row1 + j));
+			V second = pairModes(Ops::load(row0 + j + Ops::lanes), Ops::load(row1 + j + Ops::lanes));
+			Ops::store(out + j / 2, Ops::packEven(first, second));
+		}
+		modes2x2Scalar(row0 + j, row1 + j, width - j, out + j / 2);
+	}
+};
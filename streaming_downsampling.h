@@ -0,0 +1,258 @@
+/**
+	Downsampling assignment
+
+	streaming_downsampling.h
+*/
+
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "downsampling.h"
+#include "mapped_file.h"
+
+
+/**
+	State of one level of the pyramid in computeDownsamplesStreaming(..):
+	rows of hashmaps that have been computed but not merged into the next level yet.
+	At most one row is carried over from one stripe to the next (when a stripe produced an odd number of rows).
+*/
+template <typename Histogram>
+struct StreamingLevel {
+	std::vector<Histogram> pending;                      // pending rows, row-major
+	size_t rows;                                         // number of pending rows
+	size_t width;                                        // number of hashmaps in a row
+	size_t rows_written;                                 // rows of the downsampled image written to the output file
+	size_t rows_flushed;                                 // rows of the output file flushed and released so far
+	typename HistogramArena<Histogram>::type arenas[2];
+	int current;                                         // arena of the pending rows
+	std::unique_ptr<MappedFile> output;
+
+	StreamingLevel() : rows(0), width(0), rows_written(0), rows_flushed(0), current(0) {}
+
+	/**
+		Appends n rows to pending and returns the view of the new rows.
+	*/
+	ArrayView<Histogram, 2> append(size_t n) {
+		pending.resize((rows + n) * width);
+		ArrayView<Histogram, 2> view = makeView(pending.data() + rows * width, std::array<size_t, 2>{{n, width}});
+		rows += n;
+		return view;
+	}
+
+	/**
+		Returns the view of the next n rows of the downsampled image in the output file.
+	*/
+	template <typename T>
+	ArrayView<T, 2> outputRows(size_t n) {
+		T *first = (T *)output->data() + rows_written * width;
+		rows_written += n;
+		return makeView(first, std::array<size_t, 2>{{n, width}});
+	}
+
+	/**
+		Writes back the output rows [rows_flushed, rows_written) and drops them from memory. The range starts at
+		the page holding the first of these rows, a page that also holds rows not written yet is kept until
+		a later call (or the last rows reach the end of the file).
+	*/
+	template <typename T>
+	void flushOutput() {
+		size_t row_bytes = width * sizeof(T);
+		size_t page = MappedFile::pageSize();
+		size_t begin = rows_flushed * row_bytes / page * page;
+		size_t end = rows_written * row_bytes;
+		output->flush(begin, end - begin);
+		output->release(begin, end - begin);
+		rows_flushed = rows_written;
+	}
+
+	/**
+		Drops the first `consumed` pending rows (they have been merged into the next level) and moves the remaining
+		ones to the front. Their memory is moved into the other arena, so the arena of the consumed rows can be reset.
+	*/
+	void consume(size_t consumed) {
+		int other = 1 - current;
+		for (size_t i = 0; i != (rows - consumed) * width; ++i) {
+			pending[i] = std::move(pending[consumed * width + i]);
+			relocateMap(pending[i], arenas[other]);
+		}
+		rows -= consumed;
+		pending.resize(rows * width);
+		arenas[current].reset();
+		current = other;
+	}
+};
+
+
+/**
+	Returns the name of the output file with the l-downsample written by computeDownsamplesStreaming(..).
+*/
+inline std::string streamingOutputPath(const std::string &output_prefix, size_t l) {
+	return output_prefix + "_level" + std::to_string(l) + ".raw";
+}
+
+
+/**
+	Drops the input bytes [released, end) from memory and moves released to the page holding end, so a page
+	shared with the next stripe is released by a later call. Stripes smaller than a page are released a page at
+	a time instead of never; end == input.size() releases the tail.
+*/
+inline void releaseInput(MappedFile &input, size_t &released, size_t end) {
+	size_t page = MappedFile::pageSize();
+	input.release(released, end - released);
+	released = end / page * page;
+}
+
+
+/**
+	Smallest and largest pixel values of a raw image file, read stripe by stripe (used to choose the histogram,
+	see AutoHistogram).
+*/
+template <typename T>
+std::pair<T, T> valueRange(MappedFile &input, size_t stripe_bytes) {
+	const T *data = (const T *)input.data();
+	size_t n = input.size() / sizeof(T);
+	size_t stripe = std::max(stripe_bytes / sizeof(T), (size_t)1);
+
+	std::pair<T, T> range(std::numeric_limits<T>::max(), std::numeric_limits<T>::lowest());
+	size_t released = 0;
+	for (size_t begin = 0; begin < n; begin += stripe) {
+		size_t end = std::min(begin + stripe, n);
+		range = tbb::parallel_reduce(tbb::blocked_range<size_t>(begin, end), range,
+			[data](const tbb::blocked_range<size_t> &r, std::pair<T, T> value) {
+				auto minmax = std::minmax_element(data + r.begin(), data + r.end());
+				return std::make_pair(std::min(value.first, *minmax.first), std::max(value.second, *minmax.second));
+			},
+			[](std::pair<T, T> a, std::pair<T, T> b) {
+				return std::make_pair(std::min(a.first, b.first), std::max(a.second, b.second));
+			});
+		releaseInput(input, released, end * sizeof(T));
+	}
+	releaseInput(input, released, input.size());
+	return range;
+}
+
+
+/**
+	Returns the number of rows of a stripe: the largest power of 2 such that a stripe of the input,
+	its hashmaps and its part of the output fit into memory_budget bytes (at least 2 rows, at most d1).
+	The budget counts histogram objects, hashmaps that hold many labels also use memory outside of them.
+*/
+template <typename T, typename Histogram>
+size_t stripeRows(size_t d1, size_t d2, size_t memory_budget) {
+	/// per input row: the pixels, a quarter of a row of hashmaps for level 1 and roughly as much for coarser levels,
+	/// and the output rows of all levels
+	size_t bytes_per_row = d2 * sizeof(T) + d2 / 2 * sizeof(Histogram) + d2 / 2 * sizeof(T);
+	size_t rows = 2;
+	while (rows * 2 <= d1 && rows * 2 * bytes_per_row <= memory_budget) {
+		rows *= 2;
+	}
+	return rows;
+}
+
+
+/**
+	computeDownsamplesStreaming(..) engine for a given Histogram type (see buildPyramid(..)).
+*/
+template <typename T, typename Histogram>
+void buildStreamingPyramid(MappedFile &input, size_t d1, size_t d2, const std::string &output_prefix,
+						   size_t memory_budget, Histogram *) {
+
+	assert((d1 & (d1 - 1)) == 0 && (d2 & (d2 - 1)) == 0 && "extents of the image must be powers of 2");
+
+	size_t num_levels = numDownsamples(std::array<size_t, 2>{{d1, d2}});
+	if (num_levels == 0) {
+		return;
+	}
+	size_t stripe = stripeRows<T, Histogram>(d1, d2, memory_budget);
+
+	/// levels[l] for l = 1..num_levels
+	std::vector<StreamingLevel<Histogram> > levels(num_levels + 1);
+	for (size_t l = 1; l <= num_levels; ++l) {
+		levels[l].width = d2 >> l;
+		levels[l].output.reset(new MappedFile(streamingOutputPath(output_prefix, l), MappedFile::CREATE,
+			(d1 >> l) * (d2 >> l) * sizeof(T)));
+	}
+
+	size_t released = 0;
+	for (size_t row = 0; row < d1; row += stripe) {
+
+		/// level 1 from the pixels of the stripe, the input is read straight from the mapping
+		ArrayView<const T, 2> pixels = makeView((const T *)input.data() + row * d2, std::array<size_t, 2>{{stripe, d2}});
+		StreamingLevel<Histogram> &first = levels[1];
+		ParallelCreateMaps<T, 2, Histogram> parallelCreateMaps(pixels, first.append(stripe / 2),
+			&first.arenas[first.current], first.template outputRows<T>(stripe / 2));
+		forEachBlock(stripe / 2 * first.width, parallelCreateMaps, true);
+		releaseInput(input, released, (row + stripe) * d2 * sizeof(T));
+
+		/// merge every complete pair of pending rows into the next level, as far as the stripe gets
+		for (size_t l = 1; l < num_levels; ++l) {
+			StreamingLevel<Histogram> &level = levels[l];
+			StreamingLevel<Histogram> &next = levels[l + 1];
+			size_t pairs = level.rows / 2;
+			if (pairs == 0) {
+				break;
+			}
+
+			ArrayView<Histogram, 2> input_rows = makeView(level.pending.data(), std::array<size_t, 2>{{pairs * 2, level.width}});
+			ParallelMergeMaps<T, 2, Histogram> parallelMergeMaps(input_rows, next.append(pairs),
+				&next.arenas[next.current], next.template outputRows<T>(pairs));
+			forEachBlock(pairs * next.width, parallelMergeMaps, true);
+
+			level.consume(pairs * 2);
+		}
+
+		/// the coarsest level is never merged further
+		levels[num_levels].consume(levels[num_levels].rows);
+
+		/// rows written by this stripe are final, write them back and drop them from memory
+		for (size_t l = 1; l <= num_levels; ++l) {
+			levels[l].template flushOutput<T>();
+		}
+	}
+	releaseInput(input, released, input.size());
+}
+
+
+/**
+	AutoHistogram version of buildStreamingPyramid(..). Note that choosing the histogram takes an extra pass over the input.
+*/
+template <typename T>
+void buildStreamingPyramid(MappedFile &input, size_t d1, size_t d2, const std::string &output_prefix,
+						   size_t memory_budget, AutoHistogram *) {
+	withDenseHistogram<CompactHistogram<T> >(valueRange<T>(input, memory_budget), [&](auto *histogram) {
+		buildStreamingPyramid<T>(input, d1, d2, output_prefix, memory_budget, histogram);
+	});
+}
+
+
+/**
+    Out-of-core version of computeDownsamplesParallel(..) for 2-dimentional images that do not fit into memory.
+
+	The input is a raw file of d1 x d2 pixels of type T (row-major, no header). It is memory-mapped and read
+	as horizontal stripes. Each l-downsample is written to its own memory-mapped raw file
+	(see streamingOutputPath(..)) as soon as its rows are final. Only the hashmaps of rows that have not been
+	merged into a coarser level yet are kept, at most one row per level between stripes.
+
+	Peak memory is bounded by memory_budget (it sets the number of rows of a stripe, see stripeRows(..))
+	rather than by the size of the image. The output files are identical to the images returned by
+	computeDownsamplesParallel(..).
+
+	Parameters:
+		input_path - raw input image
+		d1, d2 - size of the image, both powers of 2
+		output_prefix - the l-downsample is written to output_prefix + "_level<l>.raw"
+		memory_budget - approximate limit of memory used by the algorithm, in bytes
+	Throws std::runtime_error if the input file is smaller than d1 x d2 pixels.
+*/
+template <typename T, typename Histogram = AutoHistogram>
+void computeDownsamplesStreaming(const std::string &input_path, size_t d1, size_t d2, const std::string &output_prefix,
+								 size_t memory_budget) {
+	MappedFile input(input_path, MappedFile::READ);
+	if (input.size() < d1 * d2 * sizeof(T)) {
+		throw std::runtime_error("input file " + input_path + " is too small: expected " +
+			std::to_string(d1 * d2 * sizeof(T)) + " bytes, got " + std::to_string(input.size()));
+	}
+	buildStreamingPyramid<T>(input, d1, d2, output_prefix, memory_budget, (Histogram *)0);
+}
@@ -0,0 +1,100 @@
+/**
+	Downsampling assignment
+
+	synthetic_images.h
+*/
+
+#pragma once
+
+#include <cstdint>
+#include "downsampling.h"
+
+
+/**
+	Kinds of label images the benchmarks are run on (see syntheticImage(..)).
+*/
+enum ImageRegime {
+	FEW_LABELS,          // every pixel one of 8 labels at random
+	SEGMENTATION,        // piecewise constant regions (a Voronoi diagram of cells of about 64x64 pixels) with 4096 labels
+	NOISE,               // every pixel one of 2^20 labels at random, almost no block has a repeated label
+	MOSTLY_BACKGROUND,   // the regions of SEGMENTATION, 9 in 10 of them are background (label 0)
+	NUM_REGIMES
+};
+
+
+inline const char *regimeName(ImageRegime regime) {
+	static const char *names[NUM_REGIMES] = {"few_labels", "segmentation", "noise", "mostly_background"};
+	return names[regime];
+}
+
+
+/**
+	Hashes three numbers to 64 well mixed bits (the splitmix64 finalizer).
+	The synthetic images are hashes of the seed and the pixel indices, so they do not depend on
+	the order or the number of threads that generate them.
+*/
+inline uint64_t mixBits(uint64_t seed, uint64_t a, uint64_t b) {
+	uint64_t x = seed * 0x9E3779B97F4A7C15ull + a * 0xBF58476D1CE4E5B9ull + b * 0x94D049BB133111EBull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+
+/**
+	Returns the grid cell of the site nearest to pixel (y, x) in a Voronoi diagram with one site per cell
+	of a grid of cell_size pixels, at a position hashed from the cell (the label of a region is a hash of its cell).
+*/
+inline std::pair<uint64_t, uint64_t> nearestSite(uint64_t seed, size_t y, size_t x, size_t cell_size) {
+	int64_t cy = (int64_t)(y / cell_size), cx = (int64_t)(x / cell_size);
+	std::pair<uint64_t, uint64_t> nearest;
+	int64_t best = -1;
+	for (int64_t ny = cy - 1; ny <= cy + 1; ++ny) {
+		for (int64_t nx = cx - 1; nx <= cx + 1; ++nx) {
+			uint64_t h = mixBits(seed, (uint64_t)ny, (uint64_t)nx);
+			int64_t sy = ny * (int64_t)cell_size + (int64_t)(h % cell_size);
+			int64_t sx = nx * (int64_t)cell_size + (int64_t)((h >> 32) % cell_size);
+			int64_t d = (sy - (int64_t)y) * (sy - (int64_t)y) + (sx - (int64_t)x) * (sx - (int64_t)x);
+			if (best < 0 || d < best) {
+				best = d;
+				nearest = std::make_pair((uint64_t)ny, (uint64_t)nx);
+			}
+		}
+	}
+	return nearest;
+}
+
+
+/**
+	Generates a size x size label image of the given regime. The same seed gives the same image,
+	on any machine and with any number of threads (the rows are generated in parallel).
+*/
+inline UintArray2d syntheticImage(ImageRegime regime, size_t size, uint64_t seed) {
+	const size_t cell_size = 64;
+	UintArray2d A(boost::extents[size][size]);
+	unsigned int *data = A.data();
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, size), [&](const tbb::blocked_range<size_t> &r) {
+		for (size_t y = r.begin(); y != r.end(); ++y) {
+			unsigned int *row = data + y * size;
+			for (size_t x = 0; x != size; ++x) {
+				if (regime == FEW_LABELS) {
+					row[x] = (unsigned int)(mixBits(seed, y, x) % 8);
+				}
+				else if (regime == NOISE) {
+					row[x] = (unsigned int)(mixBits(seed, y, x) % (1u << 20));
+				}
+				else {
+					std::pair<uint64_t, uint64_t> site = nearestSite(seed, y, x, cell_size);
+					uint64_t h = mixBits(seed + 1, site.first, site.second);
+					if (regime == SEGMENTATION) {
+						row[x] = (unsigned int)(h % 4096);
+					}
+					else {
+						row[x] = h % 10 == 0 ? (unsigned int)(1 + (h >> 8) % 4095) : 0;
+					}
+				}
+			}
+		}
+	});
+	return A;
+}
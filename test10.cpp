@@ -0,0 +1,86 @@
+/**
+	Downsampling assignment 
+
+	test10.cpp
+*/
+
+#include <cstdlib>
+#include "approximate_downsampling.h"
+#include "persistent_pyramid.h"
+
+/**
+	Checks the error bounds of an approximate pyramid of A: for every cell the true count of the returned label
+	may be smaller than the count of the exact mode by no more than the reported error.
+*/
+static bool checkErrorBounds(const UintArray2d &A, const std::vector<UintArray2d> &results, const std::vector<UintArray2d> &errors) {
+	PersistentPyramid<unsigned int, 2> exact(A);
+
+	bool ok = results.size() == exact.downsamples().size() && errors.size() == results.size();
+	for (size_t l = 1; ok && l <= results.size(); ++l) {
+		std::array<size_t, 2> extents = {{(size_t)1 << l, (size_t)1 << l}};
+		for (size_t i = 0; i != results[l - 1].shape()[0]; ++i) {
+			for (size_t j = 0; j != results[l - 1].shape()[1]; ++j) {
+				std::array<size_t, 2> corner = {{i << l, j << l}};
+				unsigned int mode = exact.downsamples()[l - 1][i][j];
+				unsigned int approximate_mode = results[l - 1][i][j];
+				unsigned int mode_count = exact.countLabel(corner, extents, mode);
+				unsigned int approximate_count = exact.countLabel(corner, extents, approximate_mode);
+				ok = ok && approximate_count + errors[l - 1][i][j] >= mode_count
+					&& (errors[l - 1][i][j] != 0 || approximate_mode == mode);
+			}
+		}
+	}
+	return ok;
+}
+
+/**
+	Test harness for the approximate (heavy hitters) pyramid.
+*/
+void test10() {
+	int d1 = 128;
+	int d2 = 256;
+
+	/// A has large regions of one label with noise of many labels, B only noise
+	UintArray2d A(boost::extents[d1][d2]);
+	UintArray2d B(boost::extents[d1][d2]);
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			A[i][j] = rand() % 4 == 0 ? rand() % 100000 : (unsigned int)(i / 32 * 8 + j / 32);
+			B[i][j] = rand() % 300;
+		}
+	}
+
+	std::vector<UintArray2d> expected;
+	computeDownsamplesParallel(A, expected);
+
+	/// approximate from level 1, fewer counters than labels
+	std::vector<UintArray2d> results, errors;
+	computeDownsamplesApproximate<unsigned int, 2, 64>(B, results, errors, 0);
+	bool ok = checkErrorBounds(B, results, errors);
+
+	/// levels below exact_levels must be exact
+	for (size_t exact_levels = 0; exact_levels <= 8; exact_levels += 2) {
+		results.clear();
+		errors.clear();
+		computeDownsamplesApproximate<unsigned int, 2, 8>(A, results, errors, exact_levels);
+		ok = ok && checkErrorBounds(A, results, errors);
+		for (size_t l = 0; l != std::min(exact_levels, results.size()); ++l) {
+			ok = ok && results[l] == expected[l];
+		}
+	}
+
+	results.clear();
+	errors.clear();
+	computeDownsamplesApproximate<unsigned int, 2, 4>(A, results, errors);
+	ok = ok && checkErrorBounds(A, results, errors) && errors.back()[0][0] != 0;
+
+	/// enough counters for every label: exact
+	results.clear();
+	errors.clear();
+	computeDownsamplesApproximate<unsigned int, 2, 512>(B, results, errors, 0);
+	std::vector<UintArray2d> expected_B;
+	computeDownsamplesParallel(B, expected_B);
+	ok = ok && results == expected_B;
+
+	std::cout << "test10: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,57 @@
+/**
+	Downsampling assignment 
+
+	test11.cpp
+*/
+
+#include <cstdlib>
+#include "tiled_downsampling.h"
+#include "uniform_histogram.h"
+
+/**
+	Computes the pyramid of A with Histogram, breadth first and tiled, and compares it with expected.
+*/
+template <typename Histogram, typename Array>
+static bool checkHistogram(const Array &A, const std::vector<Array> &expected) {
+	std::vector<Array> results;
+	computeDownsamplesParallel<typename Array::element, Array::dimensionality, Histogram>(A, results);
+	std::vector<Array> tiled;
+	computeDownsamplesTiled<typename Array::element, Array::dimensionality, Histogram>(A, tiled, 8);
+	return results == expected && tiled == expected;
+}
+
+/**
+	Test harness for uniform cells: UniformHistogram<T, Histogram> and the uniform fast path of CompactHistogram<T>,
+	on images made of regions of one label with some noise (uniform and mixed cells next to each other).
+*/
+void test11() {
+	int d1 = 128;
+	int d2 = 64;
+
+	UintArray2d A(boost::extents[d1][d2]);
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			A[i][j] = rand() % 20 == 0 ? rand() % 16 : (unsigned int)((i + 3) / 13 * 5 + (j + 1) / 7) % 16;
+		}
+	}
+	UintArray3d V(boost::extents[32][16][64]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = rand() % 50 == 0 ? rand() % 16 : (unsigned int)(i / 700 % 16);
+	}
+
+	std::vector<UintArray2d> expected;
+	computeDownsamplesParallel<unsigned int, 2, HashMap>(A, expected);
+	std::vector<UintArray3d> expected_V;
+	computeDownsamplesParallel<unsigned int, 3, HashMap>(V, expected_V);
+
+	bool ok = checkHistogram<UniformHistogram<unsigned int, HashMap> >(A, expected)
+		&& checkHistogram<UniformHistogram<unsigned int, DenseHistogram<unsigned int, 16> > >(A, expected)
+		&& checkHistogram<UniformHistogram<unsigned int, CompactHistogram<unsigned int> > >(A, expected)
+		&& checkHistogram<CompactHistogram<unsigned int> >(A, expected)
+		&& checkHistogram<AutoHistogram>(A, expected)
+		&& checkHistogram<UniformHistogram<unsigned int, HashMap> >(V, expected_V)
+		&& checkHistogram<UniformHistogram<unsigned int, DenseHistogram<unsigned int, 16> > >(V, expected_V)
+		&& checkHistogram<CompactHistogram<unsigned int> >(V, expected_V);
+
+	std::cout << "test11: " << (ok ? "OK" : "FAILED") << std::endl;
+}
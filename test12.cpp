@@ -0,0 +1,91 @@
+/**
+	Downsampling assignment 
+
+	test12.cpp
+*/
+
+#include <cstdlib>
+#include "tiled_downsampling.h"
+
+/**
+	Compares modes2x2(..) at every instruction set the CPU supports with the scalar reference, 
+	for random widths (including the tails after the last full vector) and small alphabets (many ties).
+*/
+template <typename T>
+static bool checkKernels() {
+	bool ok = true;
+	for (int trial = 0; trial != 200; ++trial) {
+		size_t width = 2 * (rand() % 100 + 1);
+		unsigned int num_labels = trial % 4 == 0 ? 2 : rand() % 6 + 2;
+		std::vector<T> row0(width), row1(width);
+		for (size_t j = 0; j != width; ++j) {
+			/// large values too, so comparisons of the top bit are checked
+			row0[j] = (T)(rand() % num_labels) + (trial % 2 ? (T)~T(0) - (T)num_labels : T(0));
+			row1[j] = (T)(rand() % num_labels) + (trial % 2 ? (T)~T(0) - (T)num_labels : T(0));
+		}
+
+		std::vector<T> expected(width / 2);
+		modes2x2(row0.data(), row1.data(), width, expected.data(), SIMD_SCALAR);
+		for (int level = SIMD_SCALAR; level <= bestSimdLevel(); ++level) {
+			std::vector<T> out(width / 2);
+			modes2x2(row0.data(), row1.data(), width, out.data(), (SimdLevel)level);
+			ok = ok && out == expected;
+		}
+
+		for (size_t j = 0; j != width; j += 2) {
+			HashMap counts;
+			++counts[row0[j]]; ++counts[row0[j + 1]]; ++counts[row1[j]]; ++counts[row1[j + 1]];
+			ok = ok && (unsigned int)findMode(counts) == (unsigned int)expected[j / 2];
+		}
+	}
+	return ok;
+}
+
+/**
+	Compares the pyramid of a 2-d image of type T (the SIMD path) with the tiled pyramid (built from 
+	histograms of 2x2 blocks only), for row-major and column-major storage.
+*/
+template <typename T>
+static bool checkPyramid(size_t d1, size_t d2, unsigned int num_labels) {
+	ArrayNd<T, 2> A(boost::extents[d1][d2]);
+	ArrayNd<T, 2> F(boost::extents[d1][d2], boost::fortran_storage_order());
+	for (size_t i = 0; i != d1; ++i) {
+		for (size_t j = 0; j != d2; ++j) {
+			A[i][j] = F[i][j] = (T)(rand() % num_labels);
+		}
+	}
+
+	std::vector<ArrayNd<T, 2> > expected;
+	computeDownsamplesTiled<T, 2, BasicHashMap<T> >(A, expected, 8);
+
+	std::vector<ArrayNd<T, 2> > hash, compact, automatic, serial, column_major;
+	computeDownsamplesParallel<T, 2, BasicHashMap<T> >(A, hash);
+	computeDownsamplesParallel<T, 2, CompactHistogram<T> >(A, compact);
+	computeDownsamplesParallel<T, 2>(A, automatic);
+	computeDownsamples<T, 2>(A, serial);
+	computeDownsamplesParallel<T, 2>(F, column_major);
+
+	bool ok = hash == expected && compact == expected && automatic == expected && serial == expected
+		&& column_major.size() == expected.size();
+	for (size_t l = 0; ok && l != expected.size(); ++l) {
+		for (size_t i = 0; i != expected[l].shape()[0]; ++i) {
+			for (size_t j = 0; j != expected[l].shape()[1]; ++j) {
+				ok = ok && column_major[l][i][j] == expected[l][i][j];
+			}
+		}
+	}
+	return ok;
+}
+
+/**
+	Test harness for the SIMD mode kernels and the 2-d pyramid that starts with them.
+*/
+void test12() {
+	bool ok = checkKernels<uint8_t>() && checkKernels<uint16_t>() && checkKernels<uint32_t>() && checkKernels<uint64_t>()
+		&& checkPyramid<uint8_t>(128, 64, 5) && checkPyramid<uint8_t>(64, 256, 200)
+		&& checkPyramid<uint16_t>(64, 128, 3) && checkPyramid<uint16_t>(32, 32, 1000)
+		&& checkPyramid<uint32_t>(256, 128, 4) && checkPyramid<uint32_t>(2, 64, 3) && checkPyramid<uint32_t>(4, 8, 3)
+		&& checkPyramid<uint64_t>(64, 64, 7);
+
+	std::cout << "test12: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,76 @@
+/**
+	Downsampling assignment 
+
+	test13.cpp
+*/
+
+#include <cstdlib>
+#include "dataflow_downsampling.h"
+
+/**
+	Computes the dataflow pyramid of A and compares it with the breadth first one.
+	The trace must hold one task per tile and one per cell of every coarse level.
+*/
+template <typename Histogram, typename Array>
+static bool checkDataflow(const Array &A, size_t tile_size) {
+	typedef typename Array::element T;
+	const std::size_t NumDims = Array::dimensionality;
+
+	std::vector<Array> expected;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, expected);
+
+	std::vector<Array> results;
+	PyramidTrace trace;
+	computeDownsamplesDataflow<T, NumDims, Histogram>(A, results, tile_size, &trace);
+
+	std::array<size_t, NumDims> tile_extents;
+	size_t num_tiles = 1;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		tile_extents[k] = std::min(tile_size, (size_t)A.shape()[k]);
+		num_tiles *= A.shape()[k] / tile_extents[k];
+	}
+	std::size_t tile_levels = numDownsamples(tile_extents);
+
+	std::vector<size_t> tasks(expected.size() + 1, 0);
+	bool ok = results == expected;
+	for (std::size_t i = 0; i != trace.tasks.size(); ++i) {
+		ok = ok && trace.tasks[i].level >= tile_levels && trace.tasks[i].level <= expected.size()
+			&& trace.tasks[i].start <= trace.tasks[i].end && trace.tasks[i].end <= trace.seconds;
+		++tasks[std::min(trace.tasks[i].level, expected.size())];
+	}
+	ok = ok && tasks[tile_levels] == num_tiles;
+	for (std::size_t l = tile_levels + 1; l <= expected.size(); ++l) {
+		ok = ok && tasks[l] == expected[l - 1].num_elements();
+	}
+	return ok;
+}
+
+/**
+	Test harness for the dataflow (barrier free) pyramid.
+*/
+void test13() {
+	UintArray2d A(boost::extents[256][128]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 20 == 0 ? rand() % 16 : (unsigned int)(i / 300 % 16);
+	}
+	UintArray2d B(boost::extents[16][64]);
+	for (size_t i = 0; i != B.num_elements(); ++i) {
+		B.data()[i] = rand() % 5;
+	}
+	UintArray3d V(boost::extents[32][16][64]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = rand() % 3;
+	}
+
+	bool ok = checkDataflow<HashMap>(A, 8) && checkDataflow<DenseHistogram<unsigned int, 16> >(A, 16)
+		&& checkDataflow<CompactHistogram<unsigned int> >(A, 2) && checkDataflow<AutoHistogram>(A, 256)
+		&& checkDataflow<AutoHistogram>(B, 4) && checkDataflow<CompactHistogram<unsigned int> >(B, 32)
+		&& checkDataflow<HashMap>(V, 4) && checkDataflow<AutoHistogram>(V, 8);
+
+	std::vector<UintArray2d> empty;
+	UintArray2d E(boost::extents[1][8]);
+	computeDownsamplesDataflow(E, empty);
+	ok = ok && empty.empty();
+
+	std::cout << "test13: " << (ok ? "OK" : "FAILED") << std::endl;
+}
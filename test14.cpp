@@ -0,0 +1,63 @@
+/**
+	Downsampling assignment 
+
+	test14.cpp
+*/
+
+#include <cstdlib>
+#include "batch_downsampling.h"
+
+/**
+	Computes the pyramids of a batch and compares them with computeDownsamplesParallel(..) of each image.
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkBatch(const std::vector<ArrayNd<T, NumDims> > &images, BatchScratch<T, Histogram> *scratch) {
+	std::vector<std::vector<ArrayNd<T, NumDims> > > results;
+	computeDownsamplesBatch<T, NumDims, Histogram>(images, results, scratch);
+
+	bool ok = results.size() == images.size();
+	for (std::size_t i = 0; ok && i != images.size(); ++i) {
+		std::vector<ArrayNd<T, NumDims> > expected;
+		computeDownsamplesParallel<T, NumDims, BasicHashMap<T> >(images[i], expected);
+		ok = results[i] == expected;
+	}
+	return ok;
+}
+
+/**
+	Test harness for the batch API: images of different sizes and label ranges (so AutoHistogram picks
+	different histograms within a batch), scratch memory reused across batches.
+*/
+void test14() {
+	std::vector<UintArray2d> slices;
+	for (int i = 0; i != 24; ++i) {
+		size_t d1 = size_t(1) << (rand() % 6 + 1);
+		size_t d2 = size_t(1) << (rand() % 6 + 1);
+		unsigned int num_labels = i % 3 == 0 ? 1000 : i % 3 == 1 ? 40 : 6;
+		slices.push_back(UintArray2d(boost::extents[d1][d2]));
+		for (size_t j = 0; j != slices.back().num_elements(); ++j) {
+			slices.back().data()[j] = i % 4 == 0 ? (unsigned int)(j / 50 % 5) : rand() % num_labels;
+		}
+	}
+	slices.push_back(UintArray2d(boost::extents[1][16]));
+
+	std::vector<ArrayNd<uint16_t, 3> > volumes;
+	for (int i = 0; i != 6; ++i) {
+		volumes.push_back(ArrayNd<uint16_t, 3>(boost::extents[16][8][32]));
+		for (size_t j = 0; j != volumes.back().num_elements(); ++j) {
+			volumes.back().data()[j] = (uint16_t)(rand() % (i + 2));
+		}
+	}
+
+	BatchScratch<unsigned int, AutoHistogram> scratch;
+	BatchScratch<unsigned int, CompactHistogram<unsigned int> > compact_scratch;
+	bool ok = checkBatch<AutoHistogram>(slices, &scratch) && checkBatch<AutoHistogram>(slices, &scratch)
+		&& checkBatch<AutoHistogram>(slices, (BatchScratch<unsigned int, AutoHistogram> *)0)
+		&& checkBatch<CompactHistogram<unsigned int> >(slices, &compact_scratch) 
+		&& checkBatch<CompactHistogram<unsigned int> >(slices, &compact_scratch)
+		&& checkBatch<HashMap>(slices, (BatchScratch<unsigned int, HashMap> *)0)
+		&& checkBatch<AutoHistogram>(volumes, (BatchScratch<uint16_t, AutoHistogram> *)0)
+		&& checkBatch<AutoHistogram>(std::vector<UintArray2d>(), &scratch);
+
+	std::cout << "test14: " << (ok ? "OK" : "FAILED") << std::endl;
+}
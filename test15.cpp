@@ -0,0 +1,73 @@
+/**
+	Downsampling assignment 
+
+	test15.cpp
+*/
+
+#include <cstdlib>
+#include <type_traits>
+#include "tiled_downsampling.h"
+
+/**
+	Downsamples a 2-d image of type T with the 2-d entry points and compares the result with the pyramid 
+	of the same image widened to uint64 (labels and their order are the same in every width).
+*/
+template <typename T>
+static bool checkWidth(size_t d1, size_t d2, uint64_t num_labels) {
+	ArrayNd<T, 2> A(boost::extents[d1][d2]);
+	ArrayNd<uint64_t, 2> wide(boost::extents[d1][d2]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		/// labels near the top of the range, so a narrowing or sign problem would show up
+		A.data()[i] = (T)(T(~T(0)) - (T)((uint64_t)rand() * rand() % num_labels));
+		wide.data()[i] = A.data()[i];
+	}
+
+	std::vector<ArrayNd<T, 2> > parallel, serial;
+	computeDownsamplesParallel(A, parallel);
+	computeDownsamples(A, serial);
+	static_assert(std::is_same<typename ArrayNd<T, 2>::element, typename std::remove_reference<decltype(parallel[0])>::type::element>::value,
+		"downsamples must have the pixel type of the input");
+
+	std::vector<ArrayNd<uint64_t, 2> > expected;
+	computeDownsamplesTiled<uint64_t, 2, BasicHashMap<uint64_t> >(wide, expected, 4);
+
+	bool ok = parallel == serial && parallel.size() == expected.size();
+	for (size_t l = 0; ok && l != expected.size(); ++l) {
+		for (size_t i = 0; i != expected[l].num_elements(); ++i) {
+			ok = ok && (uint64_t)parallel[l].data()[i] == expected[l].data()[i];
+		}
+	}
+	return ok;
+}
+
+/**
+	createMap(..) and mergeMaps(..) of 2-d arrays for a pixel type T.
+*/
+template <typename T>
+static bool checkMaps() {
+	ArrayNd<T, 2> block(boost::extents[2][2]);
+	block[0][0] = 200; block[0][1] = 7; block[1][0] = 7; block[1][1] = 200;
+
+	ArrayNd<BasicHashMap<T>, 2> maps(boost::extents[2][2]);
+	bool ok = createMap(block, maps[0][0]) == 7;
+	block[0][1] = 200;
+	ok = ok && createMap(block, maps[0][1]) == 200;
+	block[1][0] = 9; block[1][1] = 9;
+	ok = ok && createMap(block, maps[1][0]) == 9 && createMap(block, maps[1][1]) == 9;
+
+	BasicHashMap<T> merged;
+	return ok && mergeMaps(maps, merged) == 200 && merged[200] == 9 && merged[9] == 4 && merged[7] == 3;
+}
+
+/**
+	Test harness for native pixel widths: uint8, uint16 and uint64 images through the 2-d entry points.
+*/
+void test15() {
+	bool ok = checkWidth<uint8_t>(64, 128, 5) && checkWidth<uint8_t>(128, 64, 256)
+		&& checkWidth<uint16_t>(64, 64, 12) && checkWidth<uint16_t>(32, 128, 60000)
+		&& checkWidth<unsigned int>(32, 32, 100000)
+		&& checkWidth<uint64_t>(64, 32, 3) && checkWidth<uint64_t>(16, 16, 1000000)
+		&& checkMaps<uint8_t>() && checkMaps<uint16_t>() && checkMaps<unsigned int>() && checkMaps<uint64_t>();
+
+	std::cout << "test15: " << (ok ? "OK" : "FAILED") << std::endl;
+}
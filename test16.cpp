@@ -0,0 +1,88 @@
+/**
+	Downsampling assignment 
+
+	test16.cpp
+*/
+
+#include <cstdlib>
+#include <stdexcept>
+#include "downsampling.h"
+
+/**
+	Returns true if the levels of pyramid are equal to the arrays of expected.
+*/
+template <typename T, std::size_t NumDims>
+static bool samePyramid(const PyramidBuffer<T, NumDims> &pyramid, const std::vector<ArrayNd<T, NumDims> > &expected) {
+	bool ok = pyramid.size() == expected.size();
+	size_t total = 0;
+	for (size_t l = 0; ok && l != expected.size(); ++l) {
+		boost::multi_array_ref<T, NumDims> level = pyramid.level(l);
+		ok = std::equal(level.shape(), level.shape() + NumDims, expected[l].shape())
+			&& std::equal(level.data(), level.data() + level.num_elements(), expected[l].data());
+		total += expected[l].num_elements();
+	}
+	return ok && pyramid.num_elements() == total;
+}
+
+/**
+	Downsamples A into a PyramidBuffer with the histogram type Histogram (serial and parallel)
+	and compares the result with the vector version.
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkBuffer(const ArrayNd<T, NumDims> &A, PyramidBuffer<T, NumDims> &pyramid) {
+	std::vector<ArrayNd<T, NumDims> > expected;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, expected);
+
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, pyramid);
+	bool ok = samePyramid(pyramid, expected);
+	computeDownsamples<T, NumDims, Histogram>(A, pyramid);
+	return ok && samePyramid(pyramid, expected);
+}
+
+/**
+	Test harness for PyramidBuffer: the same results as the vector version for every histogram type,
+	2-d and 3-d images, a buffer reused for images of different sizes and a buffer supplied by the caller.
+*/
+void test16() {
+	UintArray2d A(boost::extents[64][128]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 12;
+	}
+	ArrayNd<unsigned int, 3> V(boost::extents[16][8][32]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = rand() % 5;
+	}
+
+	PyramidBuffer<unsigned int, 2> pyramid;
+	bool ok = checkBuffer<AutoHistogram>(A, pyramid) && checkBuffer<HashMap>(A, pyramid)
+		&& checkBuffer<CompactHistogram<unsigned int> >(A, pyramid) && checkBuffer<DenseHistogram<unsigned int, 16> >(A, pyramid);
+	ok = ok && pyramid.size() == 6 && pyramid.num_elements() == PyramidBuffer<unsigned int, 2>::requiredSize({{64, 128}});
+
+	/// smaller image in the same buffer: no reallocation, the levels start at the beginning of the buffer
+	unsigned int *data = pyramid.data();
+	UintArray2d small(boost::extents[8][4]);
+	for (size_t i = 0; i != small.num_elements(); ++i) {
+		small.data()[i] = rand() % 3;
+	}
+	ok = ok && checkBuffer<AutoHistogram>(small, pyramid) && pyramid.data() == data && pyramid[0].origin == data;
+
+	PyramidBuffer<unsigned int, 3> volume;
+	ok = ok && checkBuffer<AutoHistogram>(V, volume) && checkBuffer<CompactHistogram<unsigned int> >(V, volume);
+
+	/// caller supplied buffer, exactly large enough and one element too small
+	std::vector<unsigned int> memory(PyramidBuffer<unsigned int, 2>::requiredSize({{64, 128}}));
+	PyramidBuffer<unsigned int, 2> external(memory.data(), memory.size());
+	ok = ok && checkBuffer<AutoHistogram>(A, external) && external.data() == memory.data();
+
+	PyramidBuffer<unsigned int, 2> too_small(memory.data(), memory.size() - 1);
+	bool thrown = false;
+	try {
+		computeDownsamplesParallel(A, too_small);
+	}
+	catch (const std::length_error &) {
+		thrown = true;
+	}
+	ok = ok && thrown;
+
+	std::cout << "test16: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,175 @@
+/**
+	Downsampling assignment
+
+	test17.cpp
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include "async_downsampling.h"
+
+/**
+	Delivers all levels of A and checks that they arrive finest first, equal to computeDownsamplesParallel(..).
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkAllLevels(const ArrayNd<T, NumDims> &A) {
+	std::vector<ArrayNd<T, NumDims> > expected;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, expected);
+
+	std::vector<std::size_t> order;
+	bool same = true;
+	std::unique_ptr<AsyncPyramid<T, NumDims> > pyramid = computeDownsamplesAsync<T, NumDims, Histogram>(A,
+		[&](std::size_t level, const ArrayNd<T, NumDims> &image) {
+			order.push_back(level);
+			same = same && image == expected[level - 1];
+			return true;
+		});
+
+	bool ok = pyramid->get() == expected && pyramid->numDelivered() == expected.size() && same;
+	for (std::size_t l = 0; l != order.size(); ++l) {
+		ok = ok && order[l] == l + 1;
+	}
+	return ok && order.size() == expected.size();
+}
+
+/**
+	The callback stops the build after num_wanted levels.
+*/
+static bool checkCancel(const UintArray2d &A, std::size_t num_wanted) {
+	std::vector<UintArray2d> expected;
+	computeDownsamplesParallel(A, expected);
+
+	std::unique_ptr<AsyncPyramid<unsigned int, 2> > pyramid = computeDownsamplesAsync(A,
+		[&](std::size_t level, const UintArray2d &) { return level < num_wanted; });
+	const std::vector<UintArray2d> &built = pyramid->get();
+
+	/// levels already being built when the callback stopped may be finished, but not delivered
+	bool ok = pyramid->numDelivered() == num_wanted && pyramid->cancelled()
+		&& built.size() >= num_wanted && built.size() <= expected.size();
+	for (std::size_t l = 0; ok && l != built.size(); ++l) {
+		ok = built[l] == expected[l];
+	}
+	return ok;
+}
+
+/**
+	The next level is computed while the callback of the previous one is still running.
+*/
+static bool checkOverlap(const UintArray2d &A) {
+	std::atomic<AsyncPyramid<unsigned int, 2> *> handle(0);
+	std::atomic<bool> overlapped(false);
+	std::unique_ptr<AsyncPyramid<unsigned int, 2> > pyramid = computeDownsamplesAsync(A,
+		[&](std::size_t level, const UintArray2d &) {
+			if (level == 1) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				while (std::chrono::steady_clock::now() - start < std::chrono::seconds(10) && !overlapped) {
+					AsyncPyramid<unsigned int, 2> *p = handle;
+					overlapped = p != 0 && p->numBuilt() > 2;
+					std::this_thread::yield();
+				}
+			}
+			return true;
+		});
+	handle = pyramid.get();
+	pyramid->wait();
+	return overlapped;
+}
+
+/**
+	Opened by the callback of level 1 in checkFirstLevelFirst(..), or by a hashmap that waited too long for it.
+*/
+static std::atomic<bool> gate_open(false);
+static std::atomic<bool> gate_timed_out(false);
+
+/**
+	Hashmap whose construction waits (up to 10 seconds) until the gate is open.
+*/
+struct GatedHashMap : HashMap {
+	GatedHashMap() {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		while (!gate_open) {
+			if (std::chrono::steady_clock::now() - start > std::chrono::seconds(10)) {
+				gate_timed_out = true;
+				gate_open = true;
+			}
+			std::this_thread::yield();
+		}
+	}
+};
+
+/**
+	mergeMaps(..) of the hashmaps underneath.
+*/
+template <std::size_t BlockSize>
+unsigned int mergeMaps(const std::array<GatedHashMap *, BlockSize> &maps, GatedHashMap &output_map) {
+	std::array<HashMap *, BlockSize> hashmaps;
+	std::copy(maps.begin(), maps.end(), hashmaps.begin());
+	return mergeMaps(hashmaps, (HashMap &)output_map);
+}
+
+/**
+	In 2-d the 1-downsample is delivered before the hashmaps of the 2-downsample are built 
+	(they wait for its callback).
+*/
+static bool checkFirstLevelFirst(const UintArray2d &A) {
+	std::unique_ptr<AsyncPyramid<unsigned int, 2> > pyramid(new AsyncPyramid<unsigned int, 2>(A, 
+		[&](std::size_t, const UintArray2d &) {
+			gate_open = true;
+			return false;
+		}, (GatedHashMap *)0));
+	const std::vector<UintArray2d> &built = pyramid->get();
+
+	std::vector<UintArray2d> expected;
+	computeDownsamplesParallel(A, expected);
+	bool ok = pyramid->numDelivered() == 1 && !built.empty() && !gate_timed_out;
+	for (std::size_t l = 0; ok && l != built.size(); ++l) {
+		ok = built[l] == expected[l];
+	}
+	return ok;
+}
+
+/**
+	Exceptions of the callback are rethrown by wait() and stop the build.
+*/
+static bool checkException(const UintArray2d &A) {
+	std::unique_ptr<AsyncPyramid<unsigned int, 2> > pyramid = computeDownsamplesAsync(A,
+		[&](std::size_t, const UintArray2d &) -> bool { throw std::runtime_error("write failed"); });
+	try {
+		pyramid->wait();
+	}
+	catch (const std::runtime_error &) {
+		return pyramid->numDelivered() == 0 && pyramid->cancelled();
+	}
+	return false;
+}
+
+/**
+	Test harness for computeDownsamplesAsync(..).
+*/
+void test17() {
+	UintArray2d A(boost::extents[256][128]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 10;
+	}
+	ArrayNd<uint16_t, 3> V(boost::extents[32][16][8]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = (uint16_t)(rand() % 1000);
+	}
+
+	bool ok = checkAllLevels<AutoHistogram>(A) && checkAllLevels<HashMap>(A) && checkAllLevels<CompactHistogram<uint16_t> >(V)
+		&& checkCancel(A, 1) && checkCancel(A, 3) && checkOverlap(A) && checkException(A) && checkFirstLevelFirst(A);
+
+	/// cancelled by the caller before anything was delivered
+	std::unique_ptr<AsyncPyramid<unsigned int, 2> > pyramid = computeDownsamplesAsync(A,
+		[&](std::size_t, const UintArray2d &) { return true; });
+	pyramid->cancel();
+	ok = ok && pyramid->get().size() <= numDownsamples(A) && pyramid->cancelled();
+
+	/// an image without downsamples
+	UintArray2d line(boost::extents[1][8]);
+	ok = ok && computeDownsamplesAsync(line, [](std::size_t, const UintArray2d &) { return true; })->get().empty();
+
+	std::cout << "test17: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,109 @@
+/**
+	Downsampling assignment
+
+	test18.cpp
+*/
+
+#include <cstdlib>
+#include "lazy_pyramid.h"
+
+/**
+	Computes the levels of range with the Histogram type (serial and parallel) and compares them
+	with the same levels of the whole pyramid.
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkRange(const ArrayNd<T, NumDims> &A, LevelRange range, std::size_t expected_size) {
+	std::vector<ArrayNd<T, NumDims> > all;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, all);
+
+	std::vector<ArrayNd<T, NumDims> > parallel, serial;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, parallel, range);
+	computeDownsamples<T, NumDims, Histogram>(A, serial, range);
+
+	bool ok = parallel.size() == expected_size && parallel == serial;
+	LevelRange resolved = range.resolve(all.size());
+	for (std::size_t i = 0; ok && i != parallel.size(); ++i) {
+		ok = parallel[i] == all[resolved.first - 1 + i];
+	}
+	return ok;
+}
+
+/**
+	Ranges of a 2-d image with pixel type T (8 levels).
+*/
+template <typename T, typename Histogram>
+static bool checkRanges2d(unsigned int num_labels) {
+	ArrayNd<T, 2> A(boost::extents[256][512]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = (T)(rand() % num_labels);
+	}
+	return checkRange<Histogram>(A, LevelRange(), 8) && checkRange<Histogram>(A, LevelRange(3, 5), 3)
+		&& checkRange<Histogram>(A, LevelRange(2), 7) && checkRange<Histogram>(A, LevelRange(1, 1), 1)
+		&& checkRange<Histogram>(A, LevelRange(1, 2), 2) && checkRange<Histogram>(A, LevelRange(2, 2), 1)
+		&& checkRange<Histogram>(A, LevelRange(LevelRange::coarsest), 1) && checkRange<Histogram>(A, LevelRange(6, 100), 3)
+		&& checkRange<Histogram>(A, LevelRange(9, 12), 0);
+}
+
+/**
+	Accesses the levels of a LazyPyramid in the given order and compares them with the whole pyramid.
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkLazy(const ArrayNd<T, NumDims> &A, const std::vector<std::size_t> &order) {
+	std::vector<ArrayNd<T, NumDims> > all;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, all);
+
+	LazyPyramid<T, NumDims, Histogram> pyramid(A);
+	bool ok = pyramid.size() == all.size();
+	for (std::size_t i = 0; ok && i != order.size(); ++i) {
+		ok = pyramid.level(order[i]) == all[order[i] - 1] && pyramid.isComputed(order[i]);
+	}
+
+	/// only the accessed levels are computed
+	for (std::size_t l = 1; ok && l <= pyramid.size(); ++l) {
+		ok = pyramid.isComputed(l) == (std::find(order.begin(), order.end(), l) != order.end());
+	}
+	return ok && &pyramid.level(order[0]) == &pyramid.level(order[0]);
+}
+
+/**
+	Test harness for level ranges and lazy pyramids.
+*/
+void test18() {
+	bool ok = checkRanges2d<unsigned int, AutoHistogram>(12) && checkRanges2d<unsigned int, HashMap>(1000)
+		&& checkRanges2d<uint8_t, CompactHistogram<uint8_t> >(200) && checkRanges2d<uint64_t, AutoHistogram>(50)
+		&& checkRanges2d<int, BasicHashMap<int> >(7) && checkRanges2d<uint16_t, DenseHistogram<uint16_t, 64> >(40);
+
+	ArrayNd<unsigned int, 3> V(boost::extents[32][16][64]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = rand() % 6;
+	}
+	ok = ok && checkRange<AutoHistogram>(V, LevelRange(2, 3), 2) && checkRange<CompactHistogram<unsigned int> >(V, LevelRange(4), 1);
+
+	UintArray2d A(boost::extents[128][256]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 9;
+	}
+	ok = ok && checkLazy<AutoHistogram>(A, {3, 5, 7}) && checkLazy<AutoHistogram>(A, {7, 2, 1, 4})
+		&& checkLazy<HashMap>(A, {1, 2, 3, 4, 5, 6, 7}) && checkLazy<CompactHistogram<unsigned int> >(A, {2, 6, 3})
+		&& checkLazy<AutoHistogram>(V, {1, 4, 2});
+
+	LazyPyramid<unsigned int, 2> thumbnail(A, false);
+	std::vector<UintArray2d> coarsest;
+	computeDownsamples(A, coarsest, LevelRange(LevelRange::coarsest));
+	ok = ok && thumbnail.coarsest() == coarsest[0] && !thumbnail.isComputed(1);
+
+	/// the histogram type is picked by the first access: labels written after construction do not fit a dense histogram
+	UintArray2d B(boost::extents[64][64]);
+	for (size_t i = 0; i != B.num_elements(); ++i) {
+		B.data()[i] = rand() % 9;
+	}
+	LazyPyramid<unsigned int, 2> late(B);
+	for (size_t i = 0; i != B.num_elements(); ++i) {
+		B.data()[i] = rand() % 1000;
+	}
+	std::vector<UintArray2d> expected;
+	computeDownsamples(B, expected);
+	ok = ok && late.level(2) == expected[1];
+
+	std::cout << "test18: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,106 @@
+/**
+	Downsampling assignment
+
+	test19.cpp
+*/
+
+#include <cstdlib>
+#include <map>
+#include "block_statistics.h"
+#include "uniform_histogram.h"
+
+/**
+	Counts the labels of the block of A below cell of level l (2^l pixels along each dimention).
+*/
+template <typename T, std::size_t NumDims>
+static std::map<T, unsigned int> countBlock(const ArrayNd<T, NumDims> &A, const std::array<size_t, NumDims> &cell, std::size_t l) {
+	std::array<size_t, NumDims> extents;
+	extents.fill(size_t(1) << l);
+	std::map<T, unsigned int> counts;
+	for (size_t i = 0; i != product(extents); ++i) {
+		std::array<size_t, NumDims> pixel = unflatten(i, extents);
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			pixel[k] += cell[k] * extents[k];
+		}
+		++counts[makeView(A)(pixel)];
+	}
+	return counts;
+}
+
+/**
+	Computes the modes and all statistics with the Histogram type and compares them with the modes of
+	computeDownsamplesParallel(..) and statistics counted from the pixels of every block.
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkStatistics(const ArrayNd<T, NumDims> &A) {
+	std::vector<ArrayNd<T, NumDims> > expected;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, expected);
+
+	std::vector<ArrayNd<T, NumDims> > results, serial_results;
+	StatisticPyramids<T, NumDims, RunnerUp, ModeShare, NumLabels> statistics, serial_statistics;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, results, statistics);
+	computeDownsamples<T, NumDims, Histogram>(A, serial_results, serial_statistics);
+
+	bool ok = results == expected && serial_results == expected && statistics.template get<RunnerUp>().size() == expected.size()
+		&& statistics.template get<RunnerUp>() == serial_statistics.template get<RunnerUp>()
+		&& statistics.template get<ModeShare>() == serial_statistics.template get<ModeShare>()
+		&& statistics.template get<NumLabels>() == serial_statistics.template get<NumLabels>();
+
+	for (std::size_t l = 1; ok && l <= expected.size(); ++l) {
+		for (size_t i = 0; ok && i != expected[l - 1].num_elements(); ++i) {
+			std::array<size_t, NumDims> extents;
+			std::copy(expected[l - 1].shape(), expected[l - 1].shape() + NumDims, extents.begin());
+			std::array<size_t, NumDims> cell = unflatten(i, extents);
+			std::map<T, unsigned int> counts = countBlock(A, cell, l);
+
+			T mode = counts.begin()->first, runner_up = mode;
+			unsigned int mode_count = counts.begin()->second, runner_up_count = 0, total = 0;
+			for (typename std::map<T, unsigned int>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+				total += it->second;
+				if (isBetterMode(it->first, it->second, mode, mode_count)) {
+					runner_up = mode;
+					runner_up_count = mode_count;
+					mode = it->first;
+					mode_count = it->second;
+				}
+				else if (it->first != mode && isBetterMode(it->first, it->second, runner_up, runner_up_count)) {
+					runner_up = it->first;
+					runner_up_count = it->second;
+				}
+			}
+
+			ok = makeView(expected[l - 1])(cell) == mode && makeView(statistics.template get<RunnerUp>()[l - 1])(cell) == runner_up
+				&& makeView(statistics.template get<ModeShare>()[l - 1])(cell) == (float)mode_count / (float)total
+				&& makeView(statistics.template get<NumLabels>()[l - 1])(cell) == counts.size();
+		}
+	}
+	return ok;
+}
+
+/**
+	Test harness for the fused statistics: runner-up, mode share and number of labels of every block.
+*/
+void test19() {
+	UintArray2d A(boost::extents[32][64]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 4 == 0 ? rand() % 12 : (unsigned int)(i / 7 % 5);
+	}
+	ArrayNd<uint16_t, 3> V(boost::extents[8][16][16]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = (uint16_t)(rand() % 3 == 0 ? rand() % 300 : 7);
+	}
+
+	bool ok = checkStatistics<AutoHistogram>(A) && checkStatistics<HashMap>(A) && checkStatistics<DenseHistogram<unsigned int, 16> >(A)
+		&& checkStatistics<CompactHistogram<unsigned int> >(A) && checkStatistics<UniformHistogram<unsigned int, HashMap> >(A)
+		&& checkStatistics<AutoHistogram>(V) && checkStatistics<CompactHistogram<uint16_t> >(V);
+
+	/// a single statistic, uniform image: the runner-up is the mode
+	UintArray2d flat(boost::extents[16][16]);
+	std::fill(flat.data(), flat.data() + flat.num_elements(), 5u);
+	std::vector<UintArray2d> modes;
+	StatisticPyramids<unsigned int, 2, RunnerUp> runner_up;
+	computeDownsamplesParallel(flat, modes, runner_up);
+	ok = ok && runner_up.get<RunnerUp>().size() == 4 && runner_up.get<RunnerUp>()[3][0][0] == 5 && runner_up.get<RunnerUp>() == modes;
+
+	std::cout << "test19: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,161 @@
+/**
+	Downsampling assignment
+
+	test20.cpp
+*/
+
+#include <cstdlib>
+#include <map>
+#include "foreground_downsampling.h"
+#include "dense_histogram.h"
+
+/**
+	Computes the downsamples of A without the ignored labels by counting the labels of every block.
+*/
+template <typename T, std::size_t NumDims>
+static std::vector<ArrayNd<T, NumDims> > bruteForce(const ArrayNd<T, NumDims> &A, const IgnoredLabels<T> &ignored) {
+	std::vector<ArrayNd<T, NumDims> > results;
+	for (std::size_t l = 1; l <= numDownsamples(A); ++l) {
+		results.emplace_back(levelExtents(A, l));
+		ArrayNd<T, NumDims> &level = results.back();
+
+		std::array<size_t, NumDims> extents, block;
+		std::copy(level.shape(), level.shape() + NumDims, extents.begin());
+		block.fill(size_t(1) << l);
+		for (size_t i = 0; i != level.num_elements(); ++i) {
+			std::array<size_t, NumDims> cell = unflatten(i, extents);
+			std::map<T, unsigned int> counts;
+			for (size_t j = 0; j != product(block); ++j) {
+				std::array<size_t, NumDims> pixel = unflatten(j, block);
+				for (std::size_t k = 0; k != NumDims; ++k) {
+					pixel[k] += cell[k] * block[k];
+				}
+				T value = makeView(A)(pixel);
+				if (!ignored.contains(value)) {
+					++counts[value];
+				}
+			}
+
+			T mode = ignored.background();
+			unsigned int mode_count = 0;
+			for (typename std::map<T, unsigned int>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+				if (isBetterMode(it->first, it->second, mode, mode_count)) {
+					mode = it->first;
+					mode_count = it->second;
+				}
+			}
+			makeView(level)(cell) = mode;
+		}
+	}
+	return results;
+}
+
+/**
+	Compares computeDownsamplesForeground(..) with the brute force result for the given tile size.
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkForeground(const ArrayNd<T, NumDims> &A, const IgnoredLabels<T> &ignored, size_t tile_size) {
+	ForegroundTiles<NumDims> tiles = findForegroundTiles(A, ignored, tile_size);
+	std::vector<ArrayNd<T, NumDims> > results;
+	computeDownsamplesForeground<T, NumDims, Histogram>(A, results, ignored, &tiles);
+	return results == bruteForce(A, ignored);
+}
+
+/**
+	Sparse image: a few rectangles of labels on the background label 0, some of them noisy.
+*/
+static UintArray2d sparseImage(size_t height, size_t width) {
+	UintArray2d A(boost::extents[height][width]);
+	std::fill(A.data(), A.data() + A.num_elements(), 0u);
+	for (int b = 0; b != 4; ++b) {
+		size_t y0 = rand() % height, x0 = rand() % width;
+		size_t y1 = std::min(height, y0 + 1 + rand() % 12), x1 = std::min(width, x0 + 1 + rand() % 12);
+		for (size_t y = y0; y != y1; ++y) {
+			for (size_t x = x0; x != x1; ++x) {
+				A[y][x] = rand() % 3 == 0 ? rand() % 6 : 1 + b;
+			}
+		}
+	}
+	return A;
+}
+
+/**
+	Test harness for the ignored labels mode.
+*/
+void test20() {
+	UintArray2d A = sparseImage(64, 128);
+	IgnoredLabels<unsigned int> background(0u);
+
+	bool ok = checkForeground<HashMap>(A, background, 32) && checkForeground<HashMap>(A, background, 4)
+		&& checkForeground<HashMap>(A, background, 256) && checkForeground<DenseHistogram<unsigned int, 16> >(A, background, 8);
+
+	/// several ignored labels, the first one is the output of blocks without foreground
+	IgnoredLabels<unsigned int> ignored = {5u, 0u, 3u};
+	ok = ok && checkForeground<HashMap>(A, ignored, 16);
+
+	/// tiles clipped to the image
+	UintArray2d narrow = sparseImage(8, 64);
+	ok = ok && checkForeground<HashMap>(narrow, background, 32);
+
+	/// volumes
+	ArrayNd<uint16_t, 3> V(boost::extents[16][16][32]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = (uint16_t)(i % 512 < 40 ? rand() % 4 : 0);
+	}
+	ok = ok && checkForeground<BasicHashMap<uint16_t> >(V, IgnoredLabels<uint16_t>(0), 8)
+		&& checkForeground<BasicHashMap<uint16_t> >(V, IgnoredLabels<uint16_t>(0), 2);
+
+	/// default tiles; with a label that is not in the image it is computeDownsamplesParallel(..)
+	std::vector<UintArray2d> results, expected;
+	computeDownsamplesForeground(A, results, background);
+	ok = ok && results == bruteForce(A, background);
+	results.clear();
+	computeDownsamplesForeground(A, results, IgnoredLabels<unsigned int>(1000u));
+	computeDownsamplesParallel(A, expected);
+	ok = ok && results == expected;
+
+	/// large labels (hashmaps by default)
+	UintArray2d large = A;
+	for (size_t i = 0; i != large.num_elements(); ++i) {
+		large.data()[i] *= 1000;
+	}
+	results.clear();
+	computeDownsamplesForeground(large, results, background);
+	ok = ok && results == bruteForce(large, background);
+
+	/// negative labels (hashmaps by default)
+	ArrayNd<int, 2> negative(boost::extents[64][64]);
+	for (size_t i = 0; i != negative.num_elements(); ++i) {
+		negative.data()[i] = i % 64 < 24 ? rand() % 8 - 4 : 0;
+	}
+	std::vector<ArrayNd<int, 2> > negative_results;
+	computeDownsamplesForeground(negative, negative_results, IgnoredLabels<int>(0));
+	ok = ok && negative_results == bruteForce(negative, IgnoredLabels<int>(0));
+
+	/// nothing but background: no tiles, every level is background
+	UintArray2d empty(boost::extents[32][32]);
+	std::fill(empty.data(), empty.data() + empty.num_elements(), 0u);
+	ForegroundTiles<2> no_tiles = findForegroundTiles(empty, background);
+	results.clear();
+	computeDownsamplesForeground(empty, results, background, &no_tiles);
+	ok = ok && no_tiles.tiles.empty() && results.size() == 5 && results == bruteForce(empty, background);
+
+	/// tiles given by the caller: pixels of the tiles that are not listed are never read
+	UintArray2d corner_only(boost::extents[64][64]);
+	std::fill(corner_only.data(), corner_only.data() + corner_only.num_elements(), 0u);
+	for (size_t y = 0; y != 16; ++y) {
+		for (size_t x = 0; x != 16; ++x) {
+			corner_only[y][x] = (unsigned int)(y * x % 3 + 1);
+		}
+	}
+	std::vector<UintArray2d> reference = bruteForce(corner_only, background);
+	corner_only[40][40] = 7;   // in a tile that is not listed, so it must be skipped
+	std::array<size_t, 2> extents = {{64, 64}};
+	ForegroundTiles<2> given(extents, 16);
+	given.tiles.push_back(0);
+	results.clear();
+	computeDownsamplesForeground(corner_only, results, background, &given);
+	ok = ok && results == reference;
+
+	std::cout << "test20: " << (ok ? "OK" : "FAILED") << std::endl;
+}
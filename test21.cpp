@@ -0,0 +1,111 @@
+/**
+	Downsampling assignment
+
+	test21.cpp
+*/
+
+#include <cstdlib>
+#include <type_traits>
+#include "morton_downsampling.h"
+#include "uniform_histogram.h"
+
+/**
+	Checks that the layout is a permutation and that the children of every cell of the next level
+	are the 2^NumDims elements from 2^NumDims times its offset.
+*/
+template <std::size_t NumDims>
+static bool checkLayout(const std::array<size_t, NumDims> &extents) {
+	MortonLayout<NumDims> layout(extents), parent_layout(halfExtents(extents));
+	std::vector<char> seen(product(extents), 0);
+	bool ok = true;
+	for (size_t i = 0; ok && i != seen.size(); ++i) {
+		std::array<size_t, NumDims> indices = unflatten(i, extents);
+		size_t offset = layout.offset(indices);
+		ok = offset < seen.size() && !seen[offset]
+			&& (layout.side_bits == 0 || offset >> NumDims == parent_layout.offset(halfExtents(indices)));
+		if (ok) {
+			seen[offset] = 1;
+		}
+	}
+
+	/// the offsets of the rows are the same as element by element
+	std::vector<size_t> offsets(extents[NumDims - 1]);
+	for (size_t i = 0; ok && i != seen.size(); i += extents[NumDims - 1]) {
+		std::array<size_t, NumDims> row = unflatten(i, extents);
+		layout.rowOffsets(row, offsets.data());
+		for (size_t x = 0; ok && x != offsets.size(); ++x) {
+			row[NumDims - 1] = x;
+			ok = offsets[x] == layout.offset(row);
+		}
+	}
+	return ok;
+}
+
+/**
+	Compares computeDownsamplesMorton(..) with computeDownsamplesParallel(..) for the Histogram type,
+	both from the row-major image and from the image in Z-order.
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkMorton(const ArrayNd<T, NumDims> &A) {
+	std::vector<ArrayNd<T, NumDims> > expected, results;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, expected);
+	computeDownsamplesMorton<T, NumDims, Histogram>(A, results);
+
+	MortonArray<T, NumDims> M;
+	toMorton(A, M);
+	ArrayNd<T, NumDims> round_trip;
+	fromMorton(M, round_trip, false);
+
+	/// AutoHistogram needs a row-major image
+	typedef typename std::conditional<std::is_same<Histogram, AutoHistogram>::value, CompactHistogram<T>, Histogram>::type MortonHistogram;
+	std::vector<MortonArray<T, NumDims> > levels;
+	computeDownsamplesMorton<T, NumDims, MortonHistogram>(M, levels);
+	bool ok = results == expected && round_trip == A && levels.size() == expected.size();
+	for (std::size_t l = 0; ok && l != levels.size(); ++l) {
+		ArrayNd<T, NumDims> level;
+		fromMorton(levels[l], level);
+		ok = level == expected[l];
+	}
+	return ok;
+}
+
+/**
+	Test harness for the Z-order layout.
+*/
+void test21() {
+	std::array<size_t, 2> square = {{16, 16}}, wide = {{4, 64}}, tall = {{32, 8}};
+	std::array<size_t, 3> box = {{4, 8, 16}};
+	std::array<size_t, 1> line = {{32}};
+	bool ok = checkLayout(square) && checkLayout(wide) && checkLayout(tall) && checkLayout(box) && checkLayout(line);
+
+	UintArray2d A(boost::extents[64][128]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 3 == 0 ? rand() % 40 : (unsigned int)(i / 9 % 6);
+	}
+	UintArray2d B(boost::extents[128][16]);
+	for (size_t i = 0; i != B.num_elements(); ++i) {
+		B.data()[i] = rand() % 100000;
+	}
+	ArrayNd<uint16_t, 3> V(boost::extents[16][8][32]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = (uint16_t)(rand() % 2 == 0 ? rand() % 500 : 3);
+	}
+
+	ok = ok && checkMorton<AutoHistogram>(A) && checkMorton<HashMap>(A) && checkMorton<DenseHistogram<unsigned int, 64> >(A)
+		&& checkMorton<CompactHistogram<unsigned int> >(A) && checkMorton<UniformHistogram<unsigned int, HashMap> >(A)
+		&& checkMorton<AutoHistogram>(B) && checkMorton<CompactHistogram<unsigned int> >(B)
+		&& checkMorton<AutoHistogram>(V) && checkMorton<BasicHashMap<uint16_t> >(V);
+
+	/// default histogram of Z-order images
+	MortonArray<unsigned int, 2> M;
+	toMorton(A, M);
+	std::vector<MortonArray<unsigned int, 2> > levels;
+	computeDownsamplesMorton(M, levels);
+	std::vector<UintArray2d> expected;
+	computeDownsamplesParallel(A, expected);
+	UintArray2d coarsest;
+	fromMorton(levels.back(), coarsest);
+	ok = ok && levels.size() == 6 && coarsest == expected.back();
+
+	std::cout << "test21: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,106 @@
+/**
+	Downsampling assignment
+
+	test22.cpp
+*/
+
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include "pyramid_profile.h"
+
+/**
+	Number of distinct labels of every block of level l, counted from the pixels: the smallest, the sum and the largest.
+*/
+template <typename T, std::size_t NumDims>
+static std::array<size_t, 3> countEntries(const ArrayNd<T, NumDims> &A, std::size_t l) {
+	std::array<size_t, NumDims> extents = levelExtents(A, l), block;
+	block.fill(size_t(1) << l);
+	std::array<size_t, 3> result = {{~size_t(0), 0, 0}};
+	for (size_t i = 0; i != product(extents); ++i) {
+		std::array<size_t, NumDims> cell = unflatten(i, extents);
+		std::set<T> labels;
+		for (size_t j = 0; j != product(block); ++j) {
+			std::array<size_t, NumDims> pixel = unflatten(j, block);
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				pixel[k] += cell[k] * block[k];
+			}
+			labels.insert(makeView(A)(pixel));
+		}
+		result[0] = std::min(result[0], labels.size());
+		result[1] += labels.size();
+		result[2] = std::max(result[2], labels.size());
+	}
+	return result;
+}
+
+/**
+	Checks a profile against the image: one entry per level in order, the paths, and the histogram sizes counted from the pixels.
+*/
+template <typename T, std::size_t NumDims>
+static bool checkProfile(const ArrayNd<T, NumDims> &A, const PyramidProfile &profile, const std::vector<const char *> &paths) {
+	bool ok = profile.levels.size() == paths.size() && profile.levels.size() == numDownsamples(A) && profile.total_seconds > 0
+		&& !profile.thread_busy_seconds.empty() && profile.peak_histogram_bytes > 0;
+	for (std::size_t l = 0; ok && l != profile.levels.size(); ++l) {
+		const LevelProfile &level = profile.levels[l];
+		ok = level.level == l + 1 && level.path == paths[l] && level.cells == product(levelExtents(A, l + 1)) && level.tasks >= 1;
+		if (level.path == "simd2x2") {
+			ok = ok && level.histograms == 0 && level.histogram_bytes == 0;
+			continue;
+		}
+		std::array<size_t, 3> entries = countEntries(A, l + 1);
+		ok = ok && level.histograms == level.cells && level.min_entries == entries[0] && level.max_entries == entries[2]
+			&& std::abs(level.mean_entries - (double)entries[1] / level.cells) < 1e-9 && level.histogram_bytes >= level.cells;
+	}
+	return ok;
+}
+
+/**
+	Test harness for the profile of a run.
+*/
+void test22() {
+	UintArray2d A(boost::extents[32][64]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 4 == 0 ? rand() % 100 : (unsigned int)(i / 11 % 3);
+	}
+	std::vector<UintArray2d> expected, results, serial_results;
+	computeDownsamplesParallel(A, expected);
+
+	/// 2-d, SIMD level 1 and hashmaps from 4x4 blocks
+	PyramidProfile profile, serial_profile;
+	computeDownsamplesParallel(A, results, profile);
+	computeDownsamples<unsigned int, 2, HashMap>(A, serial_results, serial_profile);
+	bool ok = results == expected && serial_results == expected
+		&& checkProfile(A, profile, {"simd2x2", "create4x4", "merge", "merge", "merge"})
+		&& checkProfile(A, serial_profile, {"simd2x2", "create4x4", "merge", "merge", "merge"})
+		&& serial_profile.histogram == "hashmap" && !serial_profile.parallel && serial_profile.select_seconds == 0
+		&& profile.histogram == "compact" && profile.parallel && profile.threads == tbb::this_task_arena::max_concurrency();
+
+	/// 3-d, every level from histograms
+	ArrayNd<uint16_t, 3> V(boost::extents[8][8][16]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = (uint16_t)(rand() % 10);
+	}
+	std::vector<ArrayNd<uint16_t, 3> > volume_results;
+	computeDownsamplesParallel(V, volume_results, profile);
+	ok = ok && checkProfile(V, profile, {"create", "merge", "merge"}) && profile.histogram == "dense16";
+
+	/// uniform image: every histogram has one label
+	UintArray2d flat(boost::extents[16][16]);
+	std::fill(flat.data(), flat.data() + flat.num_elements(), 7u);
+	results.clear();
+	computeDownsamplesParallel<unsigned int, 2, DenseHistogram<unsigned int, 16> >(flat, results, profile);
+	ok = ok && profile.levels.size() == 4 && profile.levels[3].uniform_share == 1 && profile.levels[3].max_entries == 1
+		&& profile.levels[3].histogram_bytes == sizeof(DenseHistogram<unsigned int, 16>);
+
+	/// JSON export
+	std::ostringstream json;
+	writeJson(json, profile);
+	std::string text = json.str();
+	ok = ok && text.front() == '{' && text.back() == '}' && std::count(text.begin(), text.end(), '{') == 5
+		&& std::count(text.begin(), text.end(), '{') == std::count(text.begin(), text.end(), '}')
+		&& text.find("\"histogram\": \"dense16\"") != std::string::npos && text.find("\"path\": \"merge\"") != std::string::npos
+		&& text.find("\"uniform_share\": 1") != std::string::npos;
+
+	std::cout << "test22: " << (ok ? "OK" : "FAILED") << std::endl;
+}
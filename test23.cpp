@@ -0,0 +1,49 @@
+/**
+	Downsampling assignment
+
+	test23.cpp
+*/
+
+#include <algorithm>
+#include <set>
+#include "synthetic_images.h"
+
+/**
+	Test harness for the synthetic images of the benchmarks: they are reproducible and have the properties of their regime.
+*/
+void test23() {
+	bool ok = true;
+	for (int r = 0; r != NUM_REGIMES; ++r) {
+		ImageRegime regime = (ImageRegime)r;
+		UintArray2d A = syntheticImage(regime, 256, 7);
+		ok = ok && A == syntheticImage(regime, 256, 7) && !(A == syntheticImage(regime, 256, 8));
+
+		/// the same seed gives the same pixels at any size
+		UintArray2d small = syntheticImage(regime, 64, 7);
+		for (size_t y = 0; ok && y != 64; ++y) {
+			for (size_t x = 0; ok && x != 64; ++x) {
+				ok = small[y][x] == A[y][x];
+			}
+		}
+	}
+
+	UintArray2d few_labels = syntheticImage(FEW_LABELS, 256, 1);
+	UintArray2d segmentation = syntheticImage(SEGMENTATION, 256, 1);
+	UintArray2d noise = syntheticImage(NOISE, 256, 1);
+	UintArray2d background = syntheticImage(MOSTLY_BACKGROUND, 1024, 1);
+
+	std::set<unsigned int> labels(few_labels.data(), few_labels.data() + few_labels.num_elements());
+	ok = ok && labels.size() == 8 && *labels.rbegin() == 7;
+
+	/// regions of about 64x64 pixels: a few dozen labels, nearly all 2x2 blocks uniform
+	labels = std::set<unsigned int>(segmentation.data(), segmentation.data() + segmentation.num_elements());
+	ok = ok && labels.size() > 8 && labels.size() < 64 && *labels.rbegin() < 4096 && uniformBlockShare(segmentation) > 0.9;
+
+	labels = std::set<unsigned int>(noise.data(), noise.data() + noise.num_elements());
+	ok = ok && labels.size() > noise.num_elements() * 9 / 10 && *labels.rbegin() < (1u << 20) && uniformBlockShare(noise) == 0;
+
+	size_t num_background = std::count(background.data(), background.data() + background.num_elements(), 0u);
+	ok = ok && num_background > background.num_elements() * 3 / 4 && num_background < background.num_elements() * 97 / 100;
+
+	std::cout << "test23: " << (ok ? "OK" : "FAILED") << std::endl;
+}
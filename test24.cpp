@@ -0,0 +1,349 @@
+/**
+	Downsampling assignment
+
+	test24.cpp
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "shard_downsampling.h"
+
+/**
+	Returns the corners of the shards of the given extents that cover an image.
+*/
+template <std::size_t NumDims>
+static std::vector<std::array<size_t, NumDims> > shardCorners(const std::array<size_t, NumDims> &image_extents,
+															  const std::array<size_t, NumDims> &shard_extents) {
+	std::array<size_t, NumDims> grid_extents;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		grid_extents[k] = image_extents[k] / shard_extents[k];
+	}
+	std::vector<std::array<size_t, NumDims> > corners;
+	for (size_t s = 0; s != product(grid_extents); ++s) {
+		corners.push_back(unflatten(s, grid_extents));
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			corners.back()[k] *= shard_extents[k];
+		}
+	}
+	return corners;
+}
+
+/**
+	Returns a copy of the sub-array of A with the given corner and extents (the pixels a worker would load).
+*/
+template <typename T, std::size_t NumDims>
+static ArrayNd<T, NumDims> cutShard(const ArrayNd<T, NumDims> &A, const std::array<size_t, NumDims> &corner,
+									const std::array<size_t, NumDims> &extents) {
+	ArrayNd<T, NumDims> shard(extents);
+	ArrayView<const T, NumDims> input = makeView(A).subView(corner, extents);
+	for (size_t i = 0; i != shard.num_elements(); ++i) {
+		shard.data()[i] = input(unflatten(i, extents));
+	}
+	return shard;
+}
+
+/**
+	Builds the pyramid of A from shards in one process, merging with the Histogram type,
+	and compares it with computeDownsamplesParallel(..).
+	The shard roots go through the file format in memory.
+*/
+template <typename ShardHistogram, typename Histogram, typename T, std::size_t NumDims>
+static bool checkShards(const ArrayNd<T, NumDims> &A, const std::array<size_t, NumDims> &shard_extents) {
+	std::vector<ArrayNd<T, NumDims> > expected;
+	computeDownsamplesParallel(A, expected);
+
+	std::array<size_t, NumDims> image_extents;
+	std::copy(A.shape(), A.shape() + NumDims, image_extents.begin());
+	std::vector<std::array<size_t, NumDims> > corners = shardCorners(image_extents, shard_extents);
+	std::vector<ArrayNd<T, NumDims> > results;
+	for (std::size_t l = 1; l <= expected.size(); ++l) {
+		results.emplace_back(levelExtents(A, l));
+	}
+
+	/// in reverse order, the merge does not depend on it
+	std::vector<ShardRoots<T, NumDims> > shards(corners.size());
+	for (size_t s = corners.size(); s-- > 0; ) {
+		std::vector<ArrayNd<T, NumDims> > shard_results;
+		ShardRoots<T, NumDims> roots;
+		computeShard<T, NumDims, ShardHistogram>(cutShard(A, corners[s], shard_extents), corners[s], image_extents, shard_results, roots, s % 2 == 0);
+		placeShardLevels(shard_results, corners[s], results);
+		std::vector<char> bytes;
+		encodeShardRoots(roots, bytes);
+		decodeShardRoots(bytes, shards[corners.size() - 1 - s]);
+	}
+
+	std::vector<ArrayNd<T, NumDims> > coarse;
+	mergeShards<T, NumDims, Histogram>(shards, coarse);
+	std::size_t level = shards[0].level;
+	bool ok = level + coarse.size() == expected.size();
+	for (std::size_t l = 0; ok && l != coarse.size(); ++l) {
+		results[level + l] = coarse[l];
+	}
+	return ok && results == expected;
+}
+
+/**
+	Work of one worker process: builds every num_workers-th shard of A and writes its roots
+	and its levels to files in dir. Returns false on errors.
+*/
+static bool runWorker(const UintArray2d &A, const std::vector<std::array<size_t, 2> > &corners, const std::array<size_t, 2> &shard_extents,
+					  size_t worker, size_t num_workers, const std::string &dir) {
+	try {
+		std::array<size_t, 2> image_extents = {{A.shape()[0], A.shape()[1]}};
+		for (size_t s = worker; s < corners.size(); s += num_workers) {
+			std::vector<UintArray2d> shard_results;
+			ShardRoots<unsigned int, 2> roots;
+			computeShard(cutShard(A, corners[s], shard_extents), corners[s], image_extents, shard_results, roots, false);
+			writeShardFile(dir + "/shard" + std::to_string(s) + ".roots", roots);
+
+			std::ofstream levels((dir + "/shard" + std::to_string(s) + ".levels").c_str(), std::ios::binary);
+			for (size_t l = 0; l != shard_results.size(); ++l) {
+				levels.write((const char *)shard_results[l].data(), shard_results[l].num_elements() * sizeof(unsigned int));
+			}
+			if (!levels) {
+				return false;
+			}
+		}
+		return true;
+	}
+	catch (const std::exception &) {
+		return false;
+	}
+}
+
+/**
+	Entry point of a worker process, called by main() for the arguments
+	--test24-worker dir worker num_workers d1 d2 s1 s2: the image (d1 x d2) is read from dir/image.raw
+	and the shards have the extents s1 x s2. Returns the exit status of the process.
+*/
+int test24Worker(int argc, char *argv[]) {
+	if (argc != 9) {
+		return 2;
+	}
+	std::string dir = argv[2];
+	size_t worker = std::stoul(argv[3]), num_workers = std::stoul(argv[4]);
+	std::array<size_t, 2> image_extents = {{std::stoul(argv[5]), std::stoul(argv[6])}};
+	std::array<size_t, 2> shard_extents = {{std::stoul(argv[7]), std::stoul(argv[8])}};
+
+	UintArray2d A(image_extents);
+	std::ifstream image((dir + "/image.raw").c_str(), std::ios::binary);
+	image.read((char *)A.data(), A.num_elements() * sizeof(unsigned int));
+	if (!image) {
+		return 1;
+	}
+	return runWorker(A, shardCorners(image_extents, shard_extents), shard_extents, worker, num_workers, dir) ? 0 : 1;
+}
+
+/**
+	Builds the pyramid of A with worker processes that exchange files in a temporary directory:
+	this process writes the image, the workers write the roots and the levels of their shards, this process merges them.
+	The workers are new processes of the test binary (posix_spawn(..) of /proc/self/exe, see test24Worker(..)), 
+	not forks of a process whose TBB threads are running.
+*/
+static bool checkWorkerProcesses(const UintArray2d &A, const std::array<size_t, 2> &shard_extents, size_t num_workers) {
+	/// in $TMPDIR if it is set, for sandboxes without a writable /tmp
+	const char *tmpdir = std::getenv("TMPDIR");
+	std::string dir = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/test24_XXXXXX";
+	if (!mkdtemp(&dir[0])) {
+		return false;
+	}
+	std::array<size_t, 2> image_extents = {{A.shape()[0], A.shape()[1]}};
+	std::vector<std::array<size_t, 2> > corners = shardCorners(image_extents, shard_extents);
+
+	bool ok = true;
+	{
+		std::ofstream image((dir + "/image.raw").c_str(), std::ios::binary);
+		image.write((const char *)A.data(), A.num_elements() * sizeof(unsigned int));
+		ok = bool(image);
+	}
+
+	std::vector<pid_t> workers;
+	for (size_t w = 0; ok && w != num_workers; ++w) {
+		std::vector<std::string> args = {"test24", "--test24-worker", dir, std::to_string(w), std::to_string(num_workers),
+			std::to_string(image_extents[0]), std::to_string(image_extents[1]), std::to_string(shard_extents[0]), std::to_string(shard_extents[1])};
+		std::vector<char *> argv;
+		for (size_t a = 0; a != args.size(); ++a) {
+			argv.push_back(&args[a][0]);
+		}
+		argv.push_back(0);
+
+		pid_t pid = 0;
+		ok = posix_spawn(&pid, "/proc/self/exe", 0, 0, argv.data(), environ) == 0;
+		if (ok) {
+			workers.push_back(pid);
+		}
+	}
+	for (size_t w = 0; w != workers.size(); ++w) {
+		int status = 0;
+		ok = waitpid(workers[w], &status, 0) == workers[w] && WIFEXITED(status) && WEXITSTATUS(status) == 0 && ok;
+	}
+
+	std::vector<UintArray2d> expected, results;
+	computeDownsamplesParallel(A, expected);
+	for (std::size_t l = 1; l <= expected.size(); ++l) {
+		results.emplace_back(levelExtents(A, l));
+	}
+	std::vector<ShardRoots<unsigned int, 2> > shards(corners.size());
+	for (size_t s = 0; ok && s != corners.size(); ++s) {
+		std::string name = dir + "/shard" + std::to_string(s);
+		try {
+			readShardFile(name + ".roots", shards[s]);
+		}
+		catch (const std::runtime_error &) {
+			ok = false;
+			break;
+		}
+
+		std::vector<UintArray2d> shard_results;
+		std::ifstream levels((name + ".levels").c_str(), std::ios::binary);
+		for (std::size_t l = 1; l <= shards[s].level; ++l) {
+			shard_results.emplace_back(std::array<size_t, 2>{{shard_extents[0] >> l, shard_extents[1] >> l}});
+			levels.read((char *)shard_results.back().data(), shard_results.back().num_elements() * sizeof(unsigned int));
+		}
+		ok = ok && levels && shards[s].corner == corners[s];
+		if (ok) {
+			placeShardLevels(shard_results, corners[s], results);
+		}
+	}
+
+	if (ok) {
+		std::vector<UintArray2d> coarse;
+		try {
+			mergeShards(shards, coarse);
+		}
+		catch (const std::runtime_error &) {
+			ok = false;
+		}
+		std::size_t level = shards[0].level;
+		ok = ok && level + coarse.size() == expected.size();
+		for (std::size_t l = 0; ok && l != coarse.size(); ++l) {
+			results[level + l] = coarse[l];
+		}
+		ok = ok && results == expected;
+	}
+
+	for (size_t s = 0; s != corners.size(); ++s) {
+		std::remove((dir + "/shard" + std::to_string(s) + ".roots").c_str());
+		std::remove((dir + "/shard" + std::to_string(s) + ".levels").c_str());
+	}
+	std::remove((dir + "/image.raw").c_str());
+	rmdir(dir.c_str());
+	return ok;
+}
+
+/**
+	Returns true if merging the shards with the Histogram type throws std::runtime_error.
+*/
+template <typename T, std::size_t NumDims, typename Histogram = BasicHashMap<T> >
+static bool mergeFails(const std::vector<ShardRoots<T, NumDims> > &shards) {
+	try {
+		std::vector<ArrayNd<T, NumDims> > results;
+		mergeShards<T, NumDims, Histogram>(shards, results);
+	}
+	catch (const std::runtime_error &) {
+		return true;
+	}
+	return false;
+}
+
+/**
+	Test harness for sharded builds.
+*/
+void test24() {
+	UintArray2d A(boost::extents[128][256]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 3 == 0 ? rand() % 40 : (unsigned int)(i / 7 % 5);
+	}
+	UintArray2d B(boost::extents[64][64]);
+	for (size_t i = 0; i != B.num_elements(); ++i) {
+		B.data()[i] = rand() % 100000;
+	}
+	ArrayNd<uint16_t, 3> V(boost::extents[16][32][32]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = (uint16_t)(rand() % 2 == 0 ? rand() % 50 : 3);
+	}
+
+	std::array<size_t, 2> quarter = {{32, 64}}, strip = {{128, 32}}, small = {{2, 8}}, whole = {{128, 256}};
+	std::array<size_t, 3> box = {{8, 8, 16}};
+	bool ok = checkShards<AutoHistogram, HashMap>(A, quarter) && checkShards<HashMap, DenseHistogram<unsigned int, 64> >(A, strip)
+		&& checkShards<CompactHistogram<unsigned int>, HashMap>(A, small) && checkShards<AutoHistogram, HashMap>(A, whole)
+		&& checkShards<AutoHistogram, HashMap>(B, std::array<size_t, 2>{{16, 16}})
+		&& checkShards<AutoHistogram, BasicHashMap<uint16_t> >(V, box) && checkShards<BasicHashMap<uint16_t>, DenseHistogram<uint16_t, 64> >(V, box);
+
+	/// four worker processes, sixteen shards
+	ok = ok && checkWorkerProcesses(A, quarter, 4);
+
+	/// a missing, a repeated and a truncated shard
+	std::array<size_t, 2> image_extents = {{128, 256}};
+	std::vector<std::array<size_t, 2> > corners = shardCorners(image_extents, strip);
+	std::vector<ShardRoots<unsigned int, 2> > shards(corners.size());
+	for (size_t s = 0; s != corners.size(); ++s) {
+		std::vector<UintArray2d> shard_results;
+		computeShard(cutShard(A, corners[s], strip), corners[s], image_extents, shard_results, shards[s]);
+	}
+	std::vector<ShardRoots<unsigned int, 2> > missing(shards.begin() + 1, shards.end()), repeated = shards;
+	repeated[1] = repeated[0];
+	ok = ok && mergeFails(missing) && mergeFails(repeated) && !mergeFails(shards);
+
+	/// shards that divide an image whose extents are not powers of 2 (96 x 64, six 32 x 32 shards)
+	std::array<size_t, 2> uneven_extents = {{96, 64}}, square = {{32, 32}};
+	UintArray2d uneven = cutShard(A, std::array<size_t, 2>{{0, 0}}, uneven_extents);
+	std::vector<std::array<size_t, 2> > uneven_corners = shardCorners(uneven_extents, square);
+	std::vector<ShardRoots<unsigned int, 2> > uneven_shards(uneven_corners.size());
+	for (size_t s = 0; s != uneven_corners.size(); ++s) {
+		std::vector<UintArray2d> shard_results;
+		computeShard(cutShard(uneven, uneven_corners[s], square), uneven_corners[s], uneven_extents, shard_results, uneven_shards[s]);
+	}
+	ok = ok && uneven_shards.size() == 6 && mergeFails(uneven_shards);
+
+	/// shards edited in memory: a histogram, a label or a count missing
+	std::vector<ShardRoots<unsigned int, 2> > no_histogram = shards, no_label = shards, no_count = shards;
+	no_histogram[0].sizes.pop_back();
+	no_label[0].labels.pop_back();
+	no_count[0].counts.pop_back();
+	ok = ok && mergeFails(no_histogram) && mergeFails(no_label) && mergeFails(no_count);
+
+	/// damaged shard files: truncated, a level beyond the shard (and beyond the width of size_t),
+	/// an image width that is not a power of 2, a corner that is not a multiple of the extents, sizes whose byte count overflows
+	std::vector<char> bytes;
+	encodeShardRoots(shards[0], bytes);
+	auto decodeFails = [](const std::vector<char> &damaged) {
+		ShardRoots<unsigned int, 2> roots;
+		try {
+			decodeShardRoots(damaged, roots);
+		}
+		catch (const std::runtime_error &) {
+			return true;
+		}
+		return false;
+	};
+	auto damage = [&](size_t offset, uint64_t value, size_t value_size) {
+		std::vector<char> damaged = bytes;
+		std::copy((const char *)&value, (const char *)&value + value_size, damaged.begin() + offset);
+		return damaged;
+	};
+	size_t level_offset = 16, image_offset = 24, corner_offset = 24 + 2 * sizeof(uint64_t), sizes_offset = 24 + 6 * sizeof(uint64_t);
+	ok = ok && !decodeFails(bytes) && decodeFails(std::vector<char>(bytes.begin(), bytes.end() - 1))
+		&& decodeFails(damage(level_offset, shards[0].level + 1, sizeof(uint32_t))) && decodeFails(damage(level_offset, 200, sizeof(uint32_t)))
+		&& decodeFails(damage(image_offset + sizeof(uint64_t), 96, sizeof(uint64_t)))
+		&& decodeFails(damage(corner_offset, 1, sizeof(uint64_t)))
+		&& decodeFails(damage(sizes_offset, uint64_t(1) << 62, sizeof(uint64_t)))
+		&& decodeFails(damage(sizes_offset + sizeof(uint64_t), uint64_t(1) << 61, sizeof(uint64_t)));
+
+	/// damaged labels and counts: the second label of a histogram equal to the first, a count off by one
+	/// and a count beyond INT_MAX; a label too large for the dense histogram of a merge
+	size_t labels_offset = sizes_offset + 2 * sizeof(uint64_t) + shards[0].sizes.size() * sizeof(uint32_t);
+	size_t counts_offset = labels_offset + shards[0].labels.size() * sizeof(unsigned int);
+	ok = ok && shards[0].sizes[0] >= 2 && decodeFails(damage(labels_offset + sizeof(unsigned int), shards[0].labels[0], sizeof(unsigned int)))
+		&& decodeFails(damage(counts_offset, shards[0].counts[0] + 1, sizeof(uint32_t)))
+		&& decodeFails(damage(counts_offset, uint32_t(1) << 31, sizeof(uint32_t)));
+	std::vector<ShardRoots<unsigned int, 2> > foreign = shards;
+	decodeShardRoots(damage(labels_offset + (shards[0].sizes[0] - 1) * sizeof(unsigned int), 1000, sizeof(unsigned int)), foreign[0]);
+	ok = ok && !mergeFails(foreign) && mergeFails<unsigned int, 2, DenseHistogram<unsigned int, 64> >(foreign)
+		&& !mergeFails<unsigned int, 2, DenseHistogram<unsigned int, 64> >(shards);
+
+	std::cout << "test24: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,93 @@
+/**
+	Downsampling assignment
+
+	test25.cpp
+*/
+
+#include <cstdlib>
+#include <thread>
+#include "execution_context.h"
+
+/**
+	Compares computeDownsamplesParallel(..) in the context, with a vector of arrays and with a PyramidBuffer,
+	with computeDownsamplesParallel(..) on the global pool.
+*/
+template <typename Histogram, typename T, std::size_t NumDims>
+static bool checkContext(const ArrayNd<T, NumDims> &A, const ExecutionContext &context) {
+	std::vector<ArrayNd<T, NumDims> > expected, results;
+	computeDownsamplesParallel(A, expected);
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, results, context);
+
+	PyramidBuffer<T, NumDims> buffer;
+	computeDownsamplesParallel<T, NumDims, Histogram>(A, buffer, context);
+	bool ok = results == expected && buffer.size() == expected.size();
+	for (size_t l = 0; ok && l != buffer.size(); ++l) {
+		boost::multi_array_ref<T, NumDims> level = buffer.level(l);
+		ok = std::equal(level.shape(), level.shape() + NumDims, expected[l].shape())
+			&& std::equal(level.data(), level.data() + level.num_elements(), expected[l].data());
+	}
+	return ok;
+}
+
+/**
+	Test harness for execution contexts.
+	A has horizontal bands of labels, so every NUMA partition has labels of its own, B is thinner along
+	dimention 0 than the number of nodes and V is a volume with a constant half.
+*/
+void test25() {
+	UintArray2d A(boost::extents[128][64]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 5 == 0 ? rand() % 12 : (unsigned int)(i / (64 * 24));
+	}
+	UintArray2d B(boost::extents[2][256]);
+	for (size_t i = 0; i != B.num_elements(); ++i) {
+		B.data()[i] = (unsigned int)(i * 2654435761u % 1000);
+	}
+	ArrayNd<uint16_t, 3> V(boost::extents[8][32][16]);
+	for (size_t i = 0; i != V.num_elements(); ++i) {
+		V.data()[i] = (uint16_t)(i % 16 < 8 ? 7 : rand() % 30);
+	}
+
+	/// thread caps and an arena of the caller
+	int threads = 0;
+	executeIn(ExecutionContext(3), [&] { threads = tbb::this_task_arena::max_concurrency(); });
+	tbb::task_arena arena(2);
+	bool ok = threads == 3 && checkContext<AutoHistogram>(A, ExecutionContext(2)) && checkContext<HashMap>(A, ExecutionContext(arena))
+		&& checkContext<AutoHistogram>(V, ExecutionContext(1));
+
+	/// partitions without binding (tbb::task_arena::automatic nodes), the machine may have a single node
+	ExecutionContext four(0, true), two(4, true);
+	four.numa_nodes.assign(4, (int)tbb::task_arena::automatic);
+	two.numa_nodes.assign(2, (int)tbb::task_arena::automatic);
+	ok = ok && numaPartitions(std::array<size_t, 2>{{128, 64}}, 4) == 4 && numaPartitions(std::array<size_t, 2>{{128, 64}}, 3) == 2
+		&& numaPartitions(std::array<size_t, 2>{{2, 256}}, 4) == 1
+		&& checkContext<AutoHistogram>(A, four) && checkContext<CompactHistogram<unsigned int> >(A, two)
+		&& checkContext<DenseHistogram<unsigned int, 64> >(A, four) && checkContext<AutoHistogram>(B, four)
+		&& checkContext<AutoHistogram>(V, two) && checkContext<AutoHistogram>(A, ExecutionContext(0, true));
+
+	/// partitions loaded by the arenas of their nodes, each arena has its share of the thread cap;
+	/// a partition loaded by the calling thread, which is not bound to a node, counts as 0 threads
+	std::thread::id caller = std::this_thread::get_id();
+	std::vector<UintArray2d> expected;
+	computeDownsamplesParallel(A, expected);
+	auto partitionThreads = [&](const ExecutionContext &context) {
+		std::vector<UintArray2d> results;
+		std::vector<int> threads(2, 0);
+		computeDownsamplesNuma<unsigned int, 2>(std::array<size_t, 2>{{128, 64}}, [&](const std::array<size_t, 2> &corner, UintArray2d &partition) {
+			threads[corner[0] / 64] = std::this_thread::get_id() == caller ? 0 : tbb::this_task_arena::max_concurrency();
+			std::copy(A.data() + corner[0] * 64, A.data() + corner[0] * 64 + partition.num_elements(), partition.data());
+		}, results, context);
+		return results == expected ? threads : std::vector<int>();
+	};
+	ok = ok && partitionThreads(two) == std::vector<int>{2, 2};
+
+	/// a thread cap below the number of nodes limits the partitions, an uneven cap gives the first arenas the remainder
+	ExecutionContext one(1, true), three(3, true);
+	one.numa_nodes.assign(2, (int)tbb::task_arena::automatic);
+	three.numa_nodes.assign(4, (int)tbb::task_arena::automatic);
+	ok = ok && numaPartitions(std::array<size_t, 2>{{128, 64}}, one) == 1 && numaPartitions(std::array<size_t, 2>{{128, 64}}, three) == 2
+		&& checkContext<AutoHistogram>(A, one) && checkContext<AutoHistogram>(V, three)
+		&& partitionThreads(one) == std::vector<int>{1, 0} && partitionThreads(three) == std::vector<int>{2, 1};
+
+	std::cout << "test25: " << (ok ? "OK" : "FAILED") << std::endl;
+}
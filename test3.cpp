@@ -0,0 +1,131 @@
+/**
+	Downsampling assignment 
+
+	test3.cpp
+*/
+
+#include <cstdlib>
+#include <map>
+#include "downsampling.h"
+#include "tbb/global_control.h"
+
+/**
+	Computes the l-downsample of a 3 dimentional array directly, by counting every 2^l x 2^l x 2^l block of A.
+	Used as a reference for the results of the hashmap pyramid.
+*/
+static UintArray3d bruteForceDownsample(const UintArray3d &A, int l) {
+	size_t b = size_t(1) << l;
+	UintArray3d result(boost::extents[A.shape()[0] / b][A.shape()[1] / b][A.shape()[2] / b]);
+	for (size_t x = 0; x != result.shape()[0]; ++x) {
+		for (size_t y = 0; y != result.shape()[1]; ++y) {
+			for (size_t z = 0; z != result.shape()[2]; ++z) {
+				std::map<unsigned int, unsigned int> counts;
+				for (size_t i = 0; i != b; ++i) {
+					for (size_t j = 0; j != b; ++j) {
+						for (size_t k = 0; k != b; ++k) {
+							++counts[A[x*b + i][y*b + j][z*b + k]];
+						}
+					}
+				}
+				result[x][y][z] = findMode(counts);
+			}
+		}
+	}
+	return result;
+}
+
+/**
+	Downsamples a random 3 dimentional volume with values in [0, num_labels) using all histogram types
+	and checks the pyramids against the brute force reference.
+*/
+static bool checkVolume(unsigned int num_labels) {
+	int d1 = 32;
+	int d2 = 16;
+	int d3 = 8;
+
+	UintArray3d A(boost::extents[d1][d2][d3]);
+
+	/// Assign values to the elements
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			for(size_t k = 0; k != A.shape()[2]; ++k) {
+				A[i][j][k] = rand() % num_labels;
+			}
+		}
+	}
+
+	std::vector<UintArray3d> results;
+	computeDownsamplesParallel(A, results);
+
+	std::vector<UintArray3d> results_single;
+	computeDownsamples(A, results_single);
+
+	std::vector<UintArray3d> results_hash;
+	computeDownsamplesParallel<unsigned int, 3, HashMap>(A, results_hash);
+
+	std::vector<UintArray3d> results_compact;
+	computeDownsamplesParallel<unsigned int, 3, CompactHistogram<unsigned int> >(A, results_compact);
+
+	bool ok = results.size() == 3 && results == results_single && results == results_hash && results == results_compact;
+	for (size_t l = 0; ok && l != results.size(); ++l) {
+		ok = results[l] == bruteForceDownsample(A, l + 1);
+	}
+	return ok;
+}
+
+/**
+	Builds a pyramid with levels of compact histograms created outside of a larger task arena, 
+	so threads of the arena have thread indices beyond the slots the arenas of the levels were created with.
+*/
+static bool checkArenaReuse() {
+	UintArray2d A(boost::extents[256][256]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = (unsigned int)(i * 2654435761u % 1000);
+	}
+	std::vector<UintArray2d> expected;
+	computeDownsamples(A, expected);
+
+	/// allow more workers than cores, so the large arena really has threads with large indices
+	tbb::global_control control(tbb::global_control::max_allowed_parallelism, 16);
+	HistogramLevels<CompactHistogram<unsigned int> > levels;
+	bool ok = true;
+	for (int threads = 1; ok && threads <= 16; threads *= 4) {
+		tbb::task_arena arena(threads);
+		std::vector<UintArray2d> results;
+		arena.execute([&] { buildPyramid(A, results, true, levels); });
+		ok = results == expected;
+	}
+	return ok;
+}
+
+/**
+	Downsamples a volume of signed labels in [-4, 4) and checks the automatically chosen histogram
+	against CompactHistogram<int>. Negative labels must not be counted in a dense histogram.
+*/
+static bool checkNegativeLabels() {
+	ArrayNd<int, 3> A(boost::extents[16][16][16]);
+	for (size_t i = 0; i != A.num_elements(); ++i) {
+		A.data()[i] = rand() % 8 - 4;
+	}
+
+	std::vector<ArrayNd<int, 3> > results;
+	computeDownsamples(A, results);
+
+	std::vector<ArrayNd<int, 3> > results_parallel;
+	computeDownsamplesParallel(A, results_parallel);
+
+	std::vector<ArrayNd<int, 3> > results_compact;
+	computeDownsamplesParallel<int, 3, CompactHistogram<int> >(A, results_compact);
+
+	return results.size() == 4 && results == results_compact && results_parallel == results_compact;
+}
+
+/**
+	Test harness for 3 dimentional volumes.
+	Small label alphabet (dense histograms are picked automatically) and high cardinality labels 
+	(compact histograms spill into their arenas), and negative labels.
+*/
+void test3() {
+	bool ok = checkVolume(4) && checkVolume(1000) && checkNegativeLabels() && checkArenaReuse();
+	std::cout << "test3: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,202 @@
+/**
+	Downsampling assignment 
+
+	test4.cpp
+
+	Allocation counting test, a separate program from main.cpp because it replaces the global operator new
+	and delete, which would slow down every other test:
+		g++ -std=c++17 test4.cpp downsampling.cpp utilities.cpp simd_modes.cpp -ltbb -o test4
+		./test4
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "downsampling.h"
+
+/// allocation counters, only updated while counting is on
+static std::atomic<bool> counting(false);
+static std::atomic<size_t> num_allocations(0);
+static std::atomic<size_t> num_input_copies(0);
+static size_t input_size_in_bytes = 0;
+static const void *input_data = 0;
+
+/// input sized allocations made while counting, checked against the input when they are released
+/// (a level of 16 byte histograms has the size of an unsigned int image, only a copy has its contents)
+static const size_t max_tracked = 64;
+static std::atomic<void *> tracked[max_tracked];
+static std::atomic<size_t> num_tracked(0);
+
+/**
+	Allocation and release behind all replaced forms of operator new and delete (plain, array and aligned),
+	so every pointer is released by the function that matches its allocation.
+*/
+static void *allocate(size_t size, size_t alignment) {
+	if (counting) {
+		++num_allocations;
+	}
+	void *p = 0;
+	if (alignment <= alignof(std::max_align_t)) {
+		p = std::malloc(size ? size : 1);
+	}
+	else if (posix_memalign(&p, alignment, size ? size : 1) != 0) {
+		p = 0;
+	}
+	if (p == 0) {
+		throw std::bad_alloc();
+	}
+	if (counting && size == input_size_in_bytes) {
+		for (size_t i = 0; i != max_tracked; ++i) {
+			void *empty = 0;
+			if (tracked[i].compare_exchange_strong(empty, p)) {
+				++num_tracked;
+				break;
+			}
+		}
+	}
+	return p;
+}
+
+static void release(void *p) noexcept {
+	/// nothing is tracked outside of the counted runs, so most releases skip the slots
+	for (size_t i = 0; p != 0 && num_tracked.load() != 0 && i != max_tracked; ++i) {
+		if (tracked[i].load() != p) {
+			continue;
+		}
+		void *expected = p;
+		if (tracked[i].compare_exchange_strong(expected, 0)) {
+			--num_tracked;
+			const char *data = (const char *)input_data;
+			if (std::equal(data, data + input_size_in_bytes, (const char *)p)) {
+				++num_input_copies;
+			}
+			break;
+		}
+	}
+	std::free(p);
+}
+
+void *operator new(size_t size) {
+	return allocate(size, 0);
+}
+
+void *operator new[](size_t size) {
+	return allocate(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+	return allocate(size, (size_t)alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+	return allocate(size, (size_t)alignment);
+}
+
+void operator delete(void *p) noexcept {
+	release(p);
+}
+
+void operator delete[](void *p) noexcept {
+	release(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	release(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+	release(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+	release(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+	release(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+	release(p);
+}
+
+/**
+	Counts the allocations made by computeDownsamplesParallel(..) for the histogram type Histogram
+	and checks that none of them holds a copy of the input image.
+*/
+template <typename Histogram>
+static bool checkNoInputCopies(const UintArray2d &A, const char *name) {
+	input_size_in_bytes = A.num_elements() * sizeof(unsigned int);
+	input_data = A.data();
+	num_allocations = 0;
+	num_input_copies = 0;
+
+	std::vector<UintArray2d> results;
+	counting = true;
+	computeDownsamplesParallel<unsigned int, 2, Histogram>(A, results);
+	counting = false;
+
+	std::cout << "test4: " << name << ": " << num_allocations << " allocations, " 
+		<< num_input_copies << " copies of the input" << std::endl;
+	return num_input_copies == 0;
+}
+
+/**
+	Counts the allocations of the second pyramid built with the same PyramidBuffer and levels of hashmaps
+	(the first one grows them), there should be none.
+*/
+static bool checkNoAllocationsWhenReused(const UintArray2d &A, bool parallel, const char *name) {
+	PyramidBuffer<unsigned int, 2> results;
+	HistogramLevels<DenseHistogram<unsigned int, 16> > levels;
+	buildPyramid(A, results, parallel, levels);
+
+	num_allocations = 0;
+	counting = true;
+	buildPyramid(A, results, parallel, levels);
+	counting = false;
+
+	std::cout << "test4: " << name << " reused: " << num_allocations << " allocations" << std::endl;
+	return num_allocations == 0;
+}
+
+/**
+	Test harness: the input image is never copied by the parallel pipeline
+	and a reused output buffer makes repeated calls allocation free.
+*/
+void test4() {
+	int d1 = 256;
+	int d2 = 128;
+
+	UintArray2d A(boost::extents[d1][d2]);
+
+	/// Assign values to the elements
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			A[i][j] = rand();
+		}
+	}
+
+	bool ok = checkNoInputCopies<HashMap>(A, "hashmap") && checkNoInputCopies<CompactHistogram<unsigned int> >(A, "compact");
+
+	UintArray2d B(boost::extents[d1][d2]);
+	for(size_t i = 0; i != B.shape()[0]; ++i) {
+		for(size_t j = 0; j != B.shape()[1]; ++j) {
+			B[i][j] = rand() % 16;
+		}
+	}
+	ok = checkNoAllocationsWhenReused(B, false, "serial") && ok;
+	ok = checkNoAllocationsWhenReused(B, true, "parallel") && ok;
+
+	std::cout << "test4: " << (ok ? "OK" : "FAILED") << std::endl;
+}
+
+int main() {
+	test4();
+	return 0;
+}
@@ -0,0 +1,45 @@
+/**
+	Downsampling assignment 
+
+	test5.cpp
+*/
+
+#include <cstdlib>
+#include "tiled_downsampling.h"
+
+/**
+	Test harness for the tiled (depth first) traversal.
+	Its pyramid must be identical to the breadth first one for any tile size, 
+	including tiles that are larger than the image along some dimention.
+*/
+void test5() {
+	int d1 = 256;
+	int d2 = 64;
+
+	UintArray2d A(boost::extents[d1][d2]);
+	UintArray2d B(boost::extents[d1][d2]);
+
+	/// A has few labels (dense histograms), B many (compact histograms)
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			A[i][j] = rand()%5;
+			B[i][j] = rand()%10000;
+		}
+	}
+
+	std::vector<UintArray2d> expected_A;
+	computeDownsamplesParallel(A, expected_A);
+	std::vector<UintArray2d> expected_B;
+	computeDownsamplesParallel(B, expected_B);
+
+	bool ok = true;
+	for (size_t tile_size = 2; tile_size <= 512; tile_size *= 4) {
+		std::vector<UintArray2d> results_A;
+		computeDownsamplesTiled(A, results_A, tile_size);
+		std::vector<UintArray2d> results_B;
+		computeDownsamplesTiled(B, results_B, tile_size);
+		ok = ok && results_A == expected_A && results_B == expected_B;
+	}
+
+	std::cout << "test5: " << (ok ? "OK" : "FAILED") << std::endl;
+}
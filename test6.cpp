@@ -0,0 +1,106 @@
+/**
+	Downsampling assignment 
+
+	test6.cpp
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+#include "streaming_downsampling.h"
+
+/**
+	Checks the files written by computeDownsamplesStreaming(..) to the directory dir against the in-memory pyramid of A.
+*/
+template <typename T>
+static bool checkStreaming(const std::string &dir, const ArrayNd<T, 2> &A, size_t memory_budget) {
+	std::string input_path = dir + "/test6_input.raw";
+	std::string output_prefix = dir + "/test6_output";
+
+	{
+		std::ofstream input(input_path, std::ios::binary);
+		input.write((const char *)A.data(), A.num_elements() * sizeof(T));
+	}
+
+	std::vector<ArrayNd<T, 2> > expected;
+	computeDownsamplesParallel(A, expected);
+
+	computeDownsamplesStreaming<T>(input_path, A.shape()[0], A.shape()[1], output_prefix, memory_budget);
+
+	bool ok = true;
+	for (size_t l = 1; l <= expected.size(); ++l) {
+		std::string path = streamingOutputPath(output_prefix, l);
+		{
+			MappedFile output(path, MappedFile::READ);
+			const ArrayNd<T, 2> &level = expected[l - 1];
+			ok = ok && output.size() == level.num_elements() * sizeof(T)
+				&& std::equal(level.data(), level.data() + level.num_elements(), (const T *)output.data());
+		}
+		std::remove(path.c_str());
+	}
+	std::remove(input_path.c_str());
+	return ok;
+}
+
+/**
+	Test harness for the out-of-core version. 
+	The memory budgets are tiny, so the image is processed in stripes of 4 to 32 rows 
+	and rows of hashmaps are carried over from one stripe to the next.
+*/
+void test6() {
+	int d1 = 256;
+	int d2 = 64;
+
+	UintArray2d A(boost::extents[d1][d2]);
+	UintArray2d B(boost::extents[d1][d2]);
+
+	/// A has few labels (dense histograms), B many (compact histograms)
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			A[i][j] = rand()%5;
+			B[i][j] = rand()%10000;
+		}
+	}
+
+	/// a private directory, so that two runs on the same host do not share files, in $TMPDIR if it is set
+	const char *tmpdir = std::getenv("TMPDIR");
+	std::string dir = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/test6_XXXXXX";
+	bool ok = mkdtemp(&dir[0]) != 0;
+
+	for (size_t budget = 4096; budget <= 65536; budget *= 4) {
+		ok = ok && checkStreaming(dir, A, budget) && checkStreaming(dir, B, budget);
+	}
+
+	/// images of one row or column have no levels
+	UintArray2d row(boost::extents[1][64]), column(boost::extents[64][1]);
+	ok = ok && checkStreaming(dir, row, 4096) && checkStreaming(dir, column, 4096)
+		&& !std::filesystem::exists(streamingOutputPath(dir + "/test6_output", 1));
+
+	/// negative labels do not fit into dense histograms
+	ArrayNd<int, 2> C(boost::extents[d1][d2]);
+	for (size_t i = 0; i != C.num_elements(); ++i) {
+		C.data()[i] = rand() % 8 - 4;
+	}
+	ok = ok && checkStreaming(dir, C, 4096);
+
+	/// a file shorter than d1 x d2 pixels is rejected before it is read
+	std::string short_path = dir + "/test6_short.raw";
+	{
+		std::ofstream input(short_path, std::ios::binary);
+		input.write((const char *)A.data(), A.num_elements() / 2 * sizeof(unsigned int));
+	}
+	bool thrown = false;
+	try {
+		computeDownsamplesStreaming<unsigned int>(short_path, d1, d2, short_path + "_output", 4096);
+	}
+	catch (const std::runtime_error &) {
+		thrown = true;
+	}
+	std::remove(short_path.c_str());
+	ok = ok && thrown;
+	rmdir(dir.c_str());
+
+	std::cout << "test6: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,253 @@
+/**
+	Downsampling assignment 
+
+	test7.cpp
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+#include "downsampling.h"
+#include "pyramid_file.h"
+
+/**
+	Writes A and its downsamples to a pyramid file in the directory dir and reads every chunk of every level back.
+	Returns the size of the file, or 0 if a chunk differs.
+*/
+template <typename T>
+static size_t checkPyramidFile(const std::string &dir, const ArrayNd<T, 2> &A, size_t chunk_size, bool compress) {
+	std::string path = dir + "/test7.pyramid";
+
+	std::vector<ArrayNd<T, 2> > results;
+	computeDownsamplesParallel(A, results);
+	writePyramid(path, A, results, chunk_size, compress);
+
+	bool ok = true;
+	{
+		PyramidReader reader(path);
+		const PyramidLayout &layout = reader.getLayout();
+		ok = layout.numLevels() == results.size() + 1;
+
+		for (size_t l = 0; ok && l != layout.numLevels(); ++l) {
+			const ArrayNd<T, 2> &level = l == 0 ? A : results[l - 1];
+			for (size_t i = 0; i != layout.numChunks(l, 0); ++i) {
+				for (size_t j = 0; j != layout.numChunks(l, 1); ++j) {
+					ArrayNd<T, 2> chunk;
+					reader.readChunk(l, std::array<size_t, 2>{{i, j}}, chunk);
+
+					size_t i0 = i * layout.chunk_shapes[l][0];
+					size_t j0 = j * layout.chunk_shapes[l][1];
+					ok = ok && chunk.shape()[0] == std::min(layout.chunk_shapes[l][0], level.shape()[0] - i0)
+						&& chunk.shape()[1] == std::min(layout.chunk_shapes[l][1], level.shape()[1] - j0);
+					for (size_t x = 0; ok && x != chunk.shape()[0]; ++x) {
+						for (size_t y = 0; y != chunk.shape()[1]; ++y) {
+							ok = ok && chunk[x][y] == level[i0 + x][j0 + y];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	size_t size = std::filesystem::file_size(path);
+	std::remove(path.c_str());
+	return ok ? size : 0;
+}
+
+/**
+	Returns true if function() throws std::runtime_error.
+*/
+template <typename Function>
+static bool throwsRuntimeError(Function function) {
+	try {
+		function();
+	}
+	catch (const std::runtime_error &) {
+		return true;
+	}
+	return false;
+}
+
+/**
+	Returns the number of open file descriptors of the process.
+*/
+static size_t numOpenFiles() {
+	size_t n = 0;
+	for (std::filesystem::directory_iterator it("/proc/self/fd"); it != std::filesystem::directory_iterator(); ++it) {
+		++n;
+	}
+	return n;
+}
+
+/**
+	Checks that damaged files, chunks of the wrong type and chunks the file does not have are reported 
+	with std::runtime_error, and that no file stays open after a failed open. The files are written to the directory dir.
+*/
+static bool checkCorruptFiles(const std::string &dir, const UintArray2d &A) {
+	std::string path = dir + "/test7_corrupt.pyramid";
+	std::vector<UintArray2d> results;
+	computeDownsamplesParallel(A, results);
+	writePyramid(path, A, results, 32, true);
+	std::vector<char> bytes(std::filesystem::file_size(path));
+	{
+		std::ifstream file(path.c_str(), std::ios::binary);
+		file.read(bytes.data(), bytes.size());
+	}
+	auto rewrite = [&](const std::vector<char> &contents) {
+		std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+		file.write(contents.data(), contents.size());
+	};
+
+	bool ok = true;
+	{
+		PyramidReader reader(path);
+		ArrayNd<uint16_t, 2> narrow;
+		ArrayNd<unsigned int, 3> volume;
+		UintArray2d chunk;
+		ok = throwsRuntimeError([&] { reader.readChunk(0, std::array<size_t, 2>{{0, 0}}, narrow); })
+			&& throwsRuntimeError([&] { reader.readChunk(0, std::array<size_t, 3>{{0, 0, 0}}, volume); })
+			&& throwsRuntimeError([&] { reader.readChunk(100, std::array<size_t, 2>{{0, 0}}, chunk); })
+			&& throwsRuntimeError([&] { reader.readChunk(0, std::array<size_t, 2>{{0, 1000}}, chunk); });
+	}
+
+	/// damaged chunks: unknown encoding, raw chunk of the wrong size, palette index beyond the palette
+	UintArray2d chunk;
+	std::array<size_t, 2> chunk_extents = {{2, 2}};
+	std::vector<char> unknown(1, 7), raw(1, (char)RAW_CHUNK);
+	std::vector<char> palette(1, (char)PALETTE_CHUNK);
+	appendBytes(palette, (uint32_t)1);
+	appendBytes(palette, 5u);
+	palette.push_back(1);
+	appendBytes(palette, (uint64_t)0xf);
+	ok = ok && throwsRuntimeError([&] { decodeChunk(unknown, chunk_extents, chunk); })
+		&& throwsRuntimeError([&] { decodeChunk(raw, chunk_extents, chunk); })
+		&& throwsRuntimeError([&] { decodeChunk(palette, chunk_extents, chunk); });
+
+	/// the size of a chunk is checked before it is allocated
+	UintArray2d unallocated;
+	std::array<size_t, 2> huge_extents = {{size_t(1) << 20, size_t(1) << 20}};
+	ok = ok && throwsRuntimeError([&] { decodeChunk(raw, huge_extents, unallocated); })
+		&& throwsRuntimeError([&] { decodeChunk(palette, huge_extents, unallocated); }) && unallocated.num_elements() == 0;
+
+	/// damaged files: truncated header, truncated chunk index, too many levels; none of them leaks its descriptor
+	size_t open_files = numOpenFiles();
+	std::vector<char> damaged(bytes.begin(), bytes.begin() + 20);
+	rewrite(damaged);
+	ok = ok && throwsRuntimeError([&] { PyramidReader reader(path); });
+	damaged.assign(bytes.begin(), bytes.begin() + 200);
+	rewrite(damaged);
+	ok = ok && throwsRuntimeError([&] { PyramidReader reader(path); });
+	damaged = bytes;
+	damaged[16] = (char)0xff;
+	rewrite(damaged);
+	ok = ok && throwsRuntimeError([&] { PyramidReader reader(path); }) && numOpenFiles() == open_files;
+
+	/// crafted layouts: a 2^40 pixels wide level of one uniform chunk, a level that does not halve the previous one,
+	/// a chunk larger than its level
+	std::vector<char> uniform(1, (char)PALETTE_CHUNK);
+	appendBytes(uniform, (uint32_t)1);
+	appendBytes(uniform, 5u);
+	uniform.push_back(0);
+	auto writeLayout = [&](const std::vector<std::vector<uint64_t> > &shapes, const std::vector<std::vector<uint64_t> > &chunk_shapes) {
+		PyramidLayout layout;
+		layout.num_dims = 2;
+		layout.pixel_size = sizeof(unsigned int);
+		layout.shapes = shapes;
+		layout.chunk_shapes = chunk_shapes;
+		PyramidWriter writer(path, layout);
+		for (size_t l = 0; l != layout.numLevels(); ++l) {
+			for (size_t c = 0; c != layout.numChunks(l); ++c) {
+				writer.writeChunk(l, c, uniform);
+			}
+		}
+		writer.close();
+	};
+	writeLayout({{1, uint64_t(1) << 40}}, {{1, uint64_t(1) << 40}});
+	ok = ok && throwsRuntimeError([&] { PyramidReader reader(path); });
+	writeLayout({{4, 4}, {4, 4}}, {{4, 4}, {4, 4}});
+	ok = ok && throwsRuntimeError([&] { PyramidReader reader(path); });
+	writeLayout({{4, 4}, {2, 2}}, {{4, 4}, {4, 4}});
+	ok = ok && throwsRuntimeError([&] { PyramidReader reader(path); });
+	writeLayout({{4, 4}, {2, 2}}, {{4, 4}, {2, 2}});
+	{
+		PyramidReader reader(path);
+		reader.readChunk(1, std::array<size_t, 2>{{0, 0}}, chunk);
+		ok = ok && chunk.num_elements() == 4 && chunk[1][1] == 5u;
+	}
+
+	/// empty chunks are rejected before the file is created
+	std::remove(path.c_str());
+	bool rejected = false;
+	try {
+		writePyramid(path, A, results, 0, true);
+	}
+	catch (const std::invalid_argument &) {
+		rejected = true;
+	}
+	ok = ok && rejected && !std::filesystem::exists(path);
+
+	/// so are levels the reader would reject: a level that is not half the previous one, or an empty level
+	auto rejectsLevels = [&](const std::vector<ArrayView<const unsigned int, 2> > &levels) {
+		std::remove(path.c_str());
+		try {
+			writePyramidLevels(path, levels, 4, true);
+		}
+		catch (const std::invalid_argument &) {
+			return !std::filesystem::exists(path);
+		}
+		return false;
+	};
+	const UintArray2d level8(boost::extents[8][8]);
+	const UintArray2d level4(boost::extents[4][4]);
+	const UintArray2d level2(boost::extents[2][2]);
+	const UintArray2d empty(boost::extents[4][0]);
+	ok = ok && rejectsLevels({makeView(level8), makeView(level2)});
+	ok = ok && rejectsLevels({makeView(level8), makeView(empty)});
+	ok = ok && rejectsLevels({makeView(empty)});
+	writePyramid(path, level8, std::vector<UintArray2d>{level4, level2}, 4, true);
+	ok = ok && PyramidReader(path).getLayout().numLevels() == 3;
+
+	std::remove(path.c_str());
+	return ok;
+}
+
+/**
+	Test harness for the pyramid file format.
+	A has 5 labels, so its palette encoded file must be much smaller than the raw one,
+	B has 64-bit labels that are all different, its chunks are stored raw.
+*/
+void test7() {
+	int d1 = 256;
+	int d2 = 64;
+
+	UintArray2d A(boost::extents[d1][d2]);
+	ArrayNd<uint64_t, 2> B(boost::extents[d1][d2]);
+
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			A[i][j] = rand()%5;
+			B[i][j] = (uint64_t(i) << 40) + j;
+		}
+	}
+
+	/// a private directory, so that two runs on the same host do not share files, in $TMPDIR if it is set
+	const char *tmpdir = std::getenv("TMPDIR");
+	std::string dir = std::string(tmpdir && *tmpdir ? tmpdir : "/tmp") + "/test7_XXXXXX";
+	bool ok = mkdtemp(&dir[0]) != 0;
+
+	for (size_t chunk_size = 1; ok && chunk_size <= 512; chunk_size *= 8) {
+		size_t raw = checkPyramidFile(dir, A, chunk_size, false);
+		size_t compressed = checkPyramidFile(dir, A, chunk_size, true);
+		ok = ok && raw != 0 && compressed != 0 && checkPyramidFile(dir, B, chunk_size, true) != 0;
+		if (chunk_size >= 8) {
+			ok = ok && compressed < raw / 4;
+		}
+	}
+	ok = ok && checkCorruptFiles(dir, A);
+	rmdir(dir.c_str());
+
+	std::cout << "test7: " << (ok ? "OK" : "FAILED") << std::endl;
+}
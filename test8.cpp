@@ -0,0 +1,63 @@
+/**
+	Downsampling assignment 
+
+	test8.cpp
+*/
+
+#include <cstdlib>
+#include "persistent_pyramid.h"
+
+/**
+	Applies random edits to a persistent pyramid of A and compares its downsamples 
+	with the pyramid computed from scratch after every edit.
+*/
+template <typename Histogram>
+static bool checkUpdates(UintArray2d A, unsigned int num_labels) {
+	PersistentPyramid<unsigned int, 2, Histogram> pyramid(A);
+
+	bool ok = true;
+	for (int edit = 0; edit != 50 && ok; ++edit) {
+		/// mostly small rectangles, sometimes single pixels and the whole image
+		size_t d1 = edit % 10 == 0 ? A.shape()[0] : 1 + rand() % (edit % 3 == 0 ? 1 : 16);
+		size_t d2 = edit % 10 == 0 ? A.shape()[1] : 1 + rand() % (edit % 3 == 0 ? 1 : 16);
+		std::array<size_t, 2> corner = {{rand() % (A.shape()[0] - d1 + 1), rand() % (A.shape()[1] - d2 + 1)}};
+
+		UintArray2d patch(boost::extents[d1][d2]);
+		unsigned int label = rand() % num_labels;
+		for(size_t i = 0; i != patch.shape()[0]; ++i) {
+			for(size_t j = 0; j != patch.shape()[1]; ++j) {
+				patch[i][j] = edit % 2 == 0 ? label : rand() % num_labels;
+				A[corner[0] + i][corner[1] + j] = patch[i][j];
+			}
+		}
+		pyramid.update(corner, patch);
+
+		std::vector<UintArray2d> expected;
+		computeDownsamplesParallel(A, expected);
+		ok = pyramid.image() == A && pyramid.downsamples() == expected;
+	}
+	return ok;
+}
+
+/**
+	Test harness for incremental updates of the pyramid.
+*/
+void test8() {
+	int d1 = 64;
+	int d2 = 128;
+
+	UintArray2d A(boost::extents[d1][d2]);
+	UintArray2d B(boost::extents[d1][d2]);
+
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			A[i][j] = rand()%5;
+			B[i][j] = rand()%1000;
+		}
+	}
+
+	bool ok = checkUpdates<HashMap>(A, 5) && checkUpdates<DenseHistogram<unsigned int, 16> >(A, 5)
+		&& checkUpdates<HashMap>(B, 1000);
+
+	std::cout << "test8: " << (ok ? "OK" : "FAILED") << std::endl;
+}
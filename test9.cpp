@@ -0,0 +1,68 @@
+/**
+	Downsampling assignment 
+
+	test9.cpp
+*/
+
+#include <cstdlib>
+#include "persistent_pyramid.h"
+
+/**
+	Compares region queries of a pyramid of A with counting the pixels of random rectangles.
+*/
+template <typename Histogram>
+static bool checkQueries(const PersistentPyramid<unsigned int, 2, Histogram> &pyramid, unsigned int num_labels) {
+	const UintArray2d &A = pyramid.image();
+
+	bool ok = true;
+	for (int query = 0; query != 200 && ok; ++query) {
+		std::array<size_t, 2> extents = {{1 + rand() % A.shape()[0], 1 + rand() % A.shape()[1]}};
+		if (query == 0) {
+			extents[0] = A.shape()[0];
+			extents[1] = A.shape()[1];
+		}
+		std::array<size_t, 2> corner = {{rand() % (A.shape()[0] - extents[0] + 1), rand() % (A.shape()[1] - extents[1] + 1)}};
+
+		HashMap counts;
+		for (size_t i = corner[0]; i != corner[0] + extents[0]; ++i) {
+			for (size_t j = corner[1]; j != corner[1] + extents[1]; ++j) {
+				++counts[A[i][j]];
+			}
+		}
+
+		unsigned int label = rand() % num_labels;
+		ok = pyramid.countLabel(corner, extents, label) == countOf(counts, label)
+			&& pyramid.regionMode(corner, extents) == findMode(counts);
+	}
+	return ok;
+}
+
+/**
+	Test harness for region queries, before and after edits of the image.
+*/
+void test9() {
+	int d1 = 128;
+	int d2 = 64;
+
+	UintArray2d A(boost::extents[d1][d2]);
+	UintArray2d B(boost::extents[d1][d2]);
+
+	for(size_t i = 0; i != A.shape()[0]; ++i) {
+		for(size_t j = 0; j != A.shape()[1]; ++j) {
+			A[i][j] = rand()%5;
+			B[i][j] = rand()%1000;
+		}
+	}
+
+	PersistentPyramid<unsigned int, 2> hash_pyramid(B);
+	PersistentPyramid<unsigned int, 2, DenseHistogram<unsigned int, 16> > dense_pyramid(A);
+	bool ok = checkQueries(hash_pyramid, 1000) && checkQueries(dense_pyramid, 5);
+
+	UintArray2d patch(boost::extents[20][30]);
+	std::fill(patch.data(), patch.data() + patch.num_elements(), 3u);
+	hash_pyramid.update(std::array<size_t, 2>{{10, 20}}, patch);
+	dense_pyramid.update(std::array<size_t, 2>{{10, 20}}, patch);
+	ok = ok && checkQueries(hash_pyramid, 1000) && checkQueries(dense_pyramid, 5);
+
+	std::cout << "test9: " << (ok ? "OK" : "FAILED") << std::endl;
+}
@@ -0,0 +1,227 @@
+/**
+	Downsampling assignment
+
+	tiled_downsampling.h
+*/
+
+#pragma once
+
+#include "downsampling.h"
+
+
+/**
+	Returns the default tile extent (along each dimention) for computeDownsamplesTiled(..).
+	A tile has about 2^16 pixels: 256x256 for 2-d images, 32x32x32 for 3-d volumes, 16x16x16x16 for 4-d arrays,
+	so a tile of the image together with the hashmaps of its first levels stays in L2 cache.
+*/
+template <std::size_t NumDims>
+size_t defaultTileSize() {
+	return size_t(1) << (16 / NumDims);
+}
+
+
+/**
+	Per thread storage of the tiled traversal: two buffers for the levels of hashmaps of the tile that is processed.
+	They are reused for all tiles processed by the thread.
+*/
+template <typename Histogram>
+struct TileLevels {
+	std::vector<Histogram> buffers[2];
+};
+
+
+/**
+    ParallelTiles class defines Body for TBB parallel_for over the tiles of an image.
+	Each iteration takes one tile through all the levels the tile can produce on its own (depth first),
+	while the pixels and hashmaps of the tile are still in cache. The hashmaps of the last of these levels
+	(the tile roots) are written to an array of hashmaps covering the whole image,
+	the coarser levels are built from it by mergeLevels(..).
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+class ParallelTiles {
+	typedef typename HistogramArena<Histogram>::type Arena;
+
+	ArrayView<const T, NumDims> A;
+	std::array<size_t, NumDims> tile_extents;   // extents of a tile of A
+	std::array<size_t, NumDims> num_tiles;      // number of tiles along each dimention
+	const std::vector<ArrayView<T, NumDims> > *results;   // downsampled images 1..tile_levels
+	ArrayView<Histogram, NumDims> roots;        // hashmaps of level tile_levels, for the whole image
+	Arena *root_arena;
+	Arena *tile_arenas;                         // two arenas for the private levels of the tiles
+	PerThread<TileLevels<Histogram> > *tile_levels;
+
+public:
+	/**
+		Constructor parameters:
+			A - original input array/image
+			tile_extents - extents of a tile
+			results - output, views of the downsampled images computed within tiles (level 1 first)
+			roots - output, array of hashmaps of the last level computed within tiles
+			root_arena - memory arena of roots
+			tile_arenas - two arenas for the levels that are private to a tile
+			tile_levels - per thread buffers for the levels that are private to a tile
+	*/
+	ParallelTiles(const ArrayView<const T, NumDims> &A, const std::array<size_t, NumDims> &tile_extents,
+			const std::vector<ArrayView<T, NumDims> > *results, const ArrayView<Histogram, NumDims> &roots, Arena *root_arena,
+			Arena *tile_arenas, PerThread<TileLevels<Histogram> > *tile_levels)
+		: A(A), tile_extents(tile_extents), results(results), roots(roots), root_arena(root_arena),
+		  tile_arenas(tile_arenas), tile_levels(tile_levels) {
+
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				num_tiles[k] = A.shape[k] / tile_extents[k];
+			}
+	}
+
+
+	/**
+		operator() processes a chunk of tiles.
+	*/
+	void operator()( const tbb::blocked_range<size_t>& r ) const {
+		TileLevels<Histogram> &levels = tile_levels->local();
+		std::size_t num_levels = results->size();
+
+		for( size_t t=r.begin(); t!=r.end(); ++t ) {
+
+			/// index of the first pixel of the tile
+			std::array<size_t, NumDims> corner = unflatten(t, num_tiles);
+			for (std::size_t k = 0; k != NumDims; ++k) {
+				corner[k] *= tile_extents[k];
+			}
+
+			std::array<size_t, NumDims> extents = halfExtents(tile_extents);
+			std::array<size_t, NumDims> cell = halfExtents(corner);
+
+			/// level 1, straight from the pixels of the tile
+			ArrayView<Histogram, NumDims> output = roots.subView(cell, extents);
+			Arena *output_arena = root_arena;
+			if (num_levels > 1) {
+				levels.buffers[0].clear();
+				levels.buffers[0].resize(product(extents));
+				output = makeView(levels.buffers[0].data(), extents);
+				output_arena = &tile_arenas[0];
+			}
+
+			ParallelCreateMaps<T, NumDims, Histogram> createMaps(A.subView(corner, tile_extents), output, output_arena,
+				(*results)[0].subView(cell, extents));
+			createMaps(tbb::blocked_range<size_t>(0, product(extents)));
+
+			/// levels 2..num_levels, merging the private levels of the tile
+			for (std::size_t l = 2; l <= num_levels; ++l) {
+				ArrayView<Histogram, NumDims> input = output;
+				Arena *input_arena = output_arena;
+
+				extents = halfExtents(extents);
+				cell = halfExtents(cell);
+
+				std::vector<Histogram> &buffer = levels.buffers[(l - 1) % 2];
+				if (l == num_levels) {
+					output = roots.subView(cell, extents);
+					output_arena = root_arena;
+				}
+				else {
+					buffer.clear();
+					buffer.resize(product(extents));
+					output = makeView(buffer.data(), extents);
+					output_arena = &tile_arenas[(l - 1) % 2];
+				}
+
+				ParallelMergeMaps<T, NumDims, Histogram> mergeMaps(input, output, output_arena, (*results)[l - 1].subView(cell, extents));
+				mergeMaps(tbb::blocked_range<size_t>(0, product(extents)));
+
+				input_arena->resetLocal();
+			}
+		}
+	}
+};
+
+
+/**
+	computeDownsamplesTiled(..) engine for a given Histogram type (see buildPyramid(..)).
+*/
+template <typename T, std::size_t NumDims, typename Histogram>
+void buildTiledPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, size_t tile_size, Histogram *) {
+
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		assert((A.shape()[k] & (A.shape()[k] - 1)) == 0 && "extents of A must be powers of 2");
+	}
+	assert(tile_size >= 2 && (tile_size & (tile_size - 1)) == 0 && "tile size must be a power of 2");
+
+	std::size_t num_levels = numDownsamples(A);
+	if (num_levels == 0) {
+		return;
+	}
+
+	/// tiles cover the whole image along dimentions shorter than tile_size
+	std::array<size_t, NumDims> tile_extents;
+	std::array<size_t, NumDims> root_extents;
+	size_t num_tiles = 1;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		tile_extents[k] = std::min(tile_size, (size_t)A.shape()[k]);
+		num_tiles *= A.shape()[k] / tile_extents[k];
+	}
+	std::size_t tile_levels = numDownsamples(tile_extents);
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		root_extents[k] = A.shape()[k] >> tile_levels;
+	}
+
+	/// the images of the levels computed within tiles are allocated up front, tiles write their parts directly into them
+	results.reserve(results.size() + num_levels);
+	std::vector<ArrayView<T, NumDims> > tile_results;
+	std::array<size_t, NumDims> extents = halfExtents(A);
+	for (std::size_t l = 1; l <= tile_levels; ++l) {
+		results.emplace_back(extents);
+		tile_results.push_back(makeView(results.back()));
+		extents = halfExtents(extents);
+	}
+
+	HistogramLevels<Histogram> levels;
+	std::vector<Histogram> &roots = levels.next(product(root_extents));
+	typename HistogramArena<Histogram>::type tile_arenas[2];
+	PerThread<TileLevels<Histogram> > tile_levels_storage;
+
+	/**
+		Parallel loop over tiles.
+		Each tile is taken through levels 1..tile_levels, only the hashmaps of level tile_levels leave the cache.
+	*/
+	ParallelTiles<T, NumDims, Histogram> parallelTiles(makeView(A), tile_extents, &tile_results, makeView(roots.data(), root_extents),
+		&levels.arenas[1 - levels.current], tile_arenas, &tile_levels_storage);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, num_tiles, 1), parallelTiles);
+	levels.swap();
+
+	/// the coarse levels are built breadth first from the tile roots
+	mergeLevels(levels, root_extents, results, true);
+}
+
+
+/**
+	AutoHistogram version of buildTiledPyramid(..).
+*/
+template <typename T, std::size_t NumDims>
+void buildTiledPyramid(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results, size_t tile_size, AutoHistogram *) {
+	withAutoHistogram(A, true, [&](auto *histogram) {
+		buildTiledPyramid(A, results, tile_size, histogram);
+	});
+}
+
+
+/**
+    Cache blocked (depth first) version of computeDownsamplesParallel(..).
+
+	computeDownsamplesParallel(..) builds the pyramid breadth first: every level is a separate parallel loop over
+	the whole array, so each level of hashmaps is written to memory and read back by the next level.
+	For large images that is a stream through DRAM per level.
+	Here each task takes a tile of tile_size^NumDims pixels through all levels the tile can produce
+	(log2(tile_size) of them) while its data is in cache, only the hashmaps of the tile roots are written
+	to memory and the few remaining coarse levels are built from them breadth first.
+	The result is bit-identical to computeDownsamplesParallel(..).
+
+	Parameters:
+		A - a NumDims-dimensional array of size 2^L1 x 2^L2 x ... x 2^Ld with pixels of type T.
+		results - Output vector contains all l-downsamplings of the original image.
+		tile_size - extent of a tile along each dimention, a power of 2 (see defaultTileSize())
+*/
+template <typename T, std::size_t NumDims, typename Histogram = AutoHistogram>
+void computeDownsamplesTiled(const ArrayNd<T, NumDims> &A, std::vector<ArrayNd<T, NumDims> > &results,
+							 size_t tile_size = defaultTileSize<NumDims>()) {
+	buildTiledPyramid(A, results, tile_size, (Histogram *)0);
+}
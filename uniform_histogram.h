@@ -0,0 +1,159 @@
+/**
+	Downsampling assignment
+
+	uniform_histogram.h
+*/
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include "compact_histogram.h"
+#include "dense_histogram.h"
+
+
+/**
+	Histogram that represents a uniform cell (all pixels below it have the same label) as just (label, count),
+	and any other cell with the wrapped Histogram.
+
+	Segmentations and class maps are mostly large regions of one label, so most cells of every level are uniform.
+	For them createMap(..) only compares the pixels of the block, and merging 2^ndims uniform children
+	with the same label costs O(2^ndims): no histogram is built, cleared, merged or allocated.
+	Only the cells on the boundaries of regions use the wrapped histogram.
+
+	count == 0 means the cell is not uniform and hist holds its histogram.
+*/
+template <typename T, typename Histogram>
+struct UniformHistogram {
+	T label;
+	unsigned int count;
+	Histogram hist;
+
+	UniformHistogram() : label(), count(0), hist() {}
+};
+
+
+/**
+	Arena of UniformHistogram<T, Histogram>: the arena of the wrapped histograms.
+*/
+template <typename Histogram>
+struct UniformArena {
+	typename HistogramArena<Histogram>::type inner;
+
+	void reset() {
+		inner.reset();
+	}
+
+	void resetLocal() {
+		inner.resetLocal();
+	}
+};
+
+
+template <typename T, typename Histogram>
+struct HistogramArena<UniformHistogram<T, Histogram> > {
+	typedef UniformArena<Histogram> type;
+};
+
+
+template <typename T, typename Histogram>
+void relocateMap(UniformHistogram<T, Histogram> &hist, UniformArena<Histogram> &arena) {
+	if (hist.count == 0) {
+		relocateMap(hist.hist, arena.inner);
+	}
+}
+
+
+/**
+	Fills hist with a single label occuring count times.
+	Used to turn a uniform cell into a histogram when it is merged with cells that are not uniform.
+*/
+template <typename T>
+void assignUniform(BasicHashMap<T> &hist, T label, unsigned int count, NoArena &) {
+	hist.clear();
+	hist[label] = count;
+}
+
+template <typename T, std::size_t NumBins>
+void assignUniform(DenseHistogram<T, NumBins> &hist, T label, unsigned int count, NoArena &) {
+	assert(!(label < T(0)) && (std::size_t)label < NumBins && "pixel value does not fit into the dense histogram");
+	hist.counts.fill(0);
+	hist.counts[label] = count;
+}
+
+template <typename T, std::size_t InlineCapacity>
+void assignUniform(CompactHistogram<T, InlineCapacity> &hist, T label, unsigned int count, CompactArena<T> &arena) {
+	LabelCount<T> entry;
+	entry.label = label;
+	entry.count = count;
+	hist.assign(&entry, 1, arena);
+}
+
+
+/**
+    Uniform histogram version of createMap(..).
+	Complexity: O(BlockSize) for a uniform block, createMap(..) of the wrapped histogram otherwise
+*/
+template <typename T, std::size_t BlockSize, typename Histogram>
+T createMap(const std::array<T, BlockSize> &block, UniformHistogram<T, Histogram> &hist, UniformArena<Histogram> &arena) {
+	bool uniform = true;
+	for (std::size_t i = 1; i != BlockSize; ++i) {
+		uniform = uniform && block[i] == block[0];
+	}
+
+	if (uniform) {
+		hist.label = block[0];
+		hist.count = (unsigned int)BlockSize;
+		return block[0];
+	}
+	hist.count = 0;
+	return createMap(block, hist.hist, arena.inner);
+}
+
+
+/**
+    Uniform histogram version of mergeMaps(..).
+	Children that are uniform with the same label are merged in O(BlockSize). Otherwise the uniform children
+	are turned into histograms (assignUniform(..)) and all children are merged with mergeMaps(..) of the wrapped
+	histogram.
+*/
+template <typename T, std::size_t BlockSize, typename Histogram>
+T mergeMaps(const std::array<UniformHistogram<T, Histogram> *, BlockSize> &maps, UniformHistogram<T, Histogram> &output_map,
+			UniformArena<Histogram> &arena) {
+	T label = maps[0]->label;
+	bool uniform = true;
+	unsigned int count = 0;
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		uniform = uniform && maps[i]->count != 0 && maps[i]->label == label;
+		count += maps[i]->count;
+	}
+
+	if (uniform) {
+		output_map.label = label;
+		output_map.count = count;
+		return label;
+	}
+
+	std::array<Histogram *, BlockSize> hists;
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		if (maps[i]->count != 0) {
+			assignUniform(maps[i]->hist, maps[i]->label, maps[i]->count, arena.inner);
+		}
+		hists[i] = &maps[i]->hist;
+	}
+	output_map.count = 0;
+	return mergeMaps(hists, output_map.hist, arena.inner);
+}
+
+
+/**
+	Calls function(label, count) for the label of a uniform cell or every label of the wrapped histogram.
+*/
+template <typename T, typename Histogram, typename Function>
+void forEachCount(const UniformHistogram<T, Histogram> &hist, Function function) {
+	if (hist.count != 0) {
+		function(hist.label, hist.count);
+	}
+	else {
+		forEachCount(hist.hist, function);
+	}
+}
@@ -7,14 +7,38 @@
 
 #pragma once
 #include "boost/multi_array.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
 #include <unordered_map>
+#include <vector>
+#include "tbb/task_arena.h"
+
+// hashmap that stores pixel values (keys) and the number of their occurances (values).
+template <typename T>
+using BasicHashMap = std::unordered_map<T, unsigned int>;
 
 // hashmap that that stores key-value pairs.  
-typedef std::unordered_map<unsigned int, unsigned int> HashMap;
+typedef BasicHashMap<unsigned int> HashMap;
+
+// n dimentional array of pixel values of type T.
+template <typename T, std::size_t NumDims>
+using ArrayNd = boost::multi_array<T, NumDims>;
 
 // 2 dimentional array of unsigned integers.
 typedef boost::multi_array<unsigned int, 2> UintArray2d;
 
+// 2 dimentional arrays of narrow and wide labels, processed in their own width (nothing is converted to unsigned int).
+typedef boost::multi_array<uint8_t, 2> Uint8Array2d;
+typedef boost::multi_array<uint16_t, 2> Uint16Array2d;
+typedef boost::multi_array<uint64_t, 2> Uint64Array2d;
+
+// 3 dimentional array of unsigned integers.
+typedef boost::multi_array<unsigned int, 3> UintArray3d;
+
 // 2 dimentional array of HashMap
 typedef boost::multi_array<HashMap, 2> HashMapArray2d;
 
@@ -25,19 +49,225 @@ typedef boost::multi_array_types::index index;
 typedef boost::multi_array_types::index_range range;
 
 
+/**
+	The takes a linear array index (single number) and array dimentions.
+	It returns the n-dimentional index into array.
+	Parameters:
+		input - input linear (1 dimentional) index
+		sizes - size of array along all n dimentions
+	Returns: 
+		vector containing n-dimentional index into array
+	Complexity: O(1)
+*/
+std::vector<size_t> getIndices(size_t input, std::vector<size_t> sizes);
+
+
+/**
+	Compile time version of getIndices(..).
+	The number of dimentions is a template parameter, so the loop below has a fixed trip count
+	and is completely unrolled by the compiler (no heap allocation, no runtime loop over dimentions).
+	Parameters:
+		input - input linear index of a 2x2..x2 block
+		sizes - size of array along all NumDims dimentions
+	Returns: 
+		n-dimentional index of the first (corner) element of the block
+	Complexity: O(1)
+*/
+template <std::size_t NumDims>
+inline std::array<size_t, NumDims> getIndices(size_t input, const std::array<size_t, NumDims> &sizes) {
+	std::array<size_t, NumDims> result;
+	for (std::size_t k = NumDims; k-- > 0; ) {
+		result[k] = input * 2 % sizes[k];
+		input = input * 2 / sizes[k];
+	}
+	return result;
+}
+
+
+/**
+	Returns the multi-index of the element with linear index i (c order) of an array with the given extents,
+	the inverse of the offset of an index in a contiguous row-major array.
+*/
+template <std::size_t NumDims>
+inline std::array<size_t, NumDims> unflatten(size_t i, const std::array<size_t, NumDims> &extents) {
+	std::array<size_t, NumDims> indices;
+	for (std::size_t k = NumDims; k-- > 0; ) {
+		indices[k] = i % extents[k];
+		i /= extents[k];
+	}
+	return indices;
+}
+
+
+/**
+	Returns the number of elements of an array with the given extents.
+*/
+template <std::size_t NumDims>
+inline size_t product(const std::array<size_t, NumDims> &extents) {
+	size_t n = 1;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		n *= extents[k];
+	}
+	return n;
+}
+
+
+/**
+	Returns the memory offset of the element with n-dimentional index `indices`
+	in an array with the given strides (see boost::multi_array::strides()).
+	Complexity: O(1)
+*/
+template <std::size_t NumDims>
+inline index flatOffset(const std::array<size_t, NumDims> &indices, const index *strides) {
+	index offset = 0;
+	for (std::size_t k = 0; k != NumDims; ++k) {
+		offset += (index)indices[k] * strides[k];
+	}
+	return offset;
+}
+
+
+/**
+	Non-owning view of an n dimentional array: the address of its first element, its extents 
+	and its strides (in elements, like boost::multi_array::strides()).
+	Views address whole arrays, tiles of arrays and levels of hashmaps stored in plain buffers without copying them.
+*/
+template <typename T, std::size_t NumDims>
+struct ArrayView {
+	T *origin;
+	std::array<size_t, NumDims> shape;
+	std::array<index, NumDims> strides;
+
+	T &operator()(const std::array<size_t, NumDims> &indices) const {
+		return origin[flatOffset<NumDims>(indices, strides.data())];
+	}
+
+	size_t num_elements() const {
+		return product(shape);
+	}
+
+	/**
+		Returns the view of the sub-array with the first element at `corner` and the given extents.
+	*/
+	ArrayView subView(const std::array<size_t, NumDims> &corner, const std::array<size_t, NumDims> &extents) const {
+		ArrayView view = *this;
+		view.origin = &(*this)(corner);
+		view.shape = extents;
+		return view;
+	}
+};
+
+
+/**
+	Returns a view of a boost::multi_array (or multi_array_ref).
+*/
+template <typename Array>
+ArrayView<typename Array::element, Array::dimensionality> makeView(Array &A) {
+	ArrayView<typename Array::element, Array::dimensionality> view;
+	view.origin = A.origin();
+	std::copy(A.shape(), A.shape() + Array::dimensionality, view.shape.begin());
+	std::copy(A.strides(), A.strides() + Array::dimensionality, view.strides.begin());
+	return view;
+}
+
+template <typename Array>
+ArrayView<const typename Array::element, Array::dimensionality> makeView(const Array &A) {
+	ArrayView<const typename Array::element, Array::dimensionality> view;
+	view.origin = A.origin();
+	std::copy(A.shape(), A.shape() + Array::dimensionality, view.shape.begin());
+	std::copy(A.strides(), A.strides() + Array::dimensionality, view.strides.begin());
+	return view;
+}
+
+
+/**
+	Returns a view of a row-major (c order) array with the given extents stored at data.
+*/
+template <typename T, std::size_t NumDims>
+ArrayView<T, NumDims> makeView(T *data, const std::array<size_t, NumDims> &extents) {
+	ArrayView<T, NumDims> view;
+	view.origin = data;
+	view.shape = extents;
+	index stride = 1;
+	for (std::size_t k = NumDims; k-- > 0; ) {
+		view.strides[k] = stride;
+		stride *= (index)extents[k];
+	}
+	return view;
+}
+
+
+/**
+	Returns memory offsets of all 2^NumDims elements of a 2x2..x2 block relative to its first element.
+	The elements are listed in row-major order (the last dimention changes fastest).
+*/
+template <std::size_t NumDims>
+std::array<index, (std::size_t(1) << NumDims)> blockOffsets(const index *strides) {
+	std::array<index, (std::size_t(1) << NumDims)> offsets;
+	for (std::size_t j = 0; j != offsets.size(); ++j) {
+		offsets[j] = 0;
+		for (std::size_t k = 0; k != NumDims; ++k) {
+			if ((j >> (NumDims - 1 - k)) & 1) {
+				offsets[j] += strides[k];
+			}
+		}
+	}
+	return offsets;
+}
+
+
+/**
+	Returns true if `label` occuring `count` times is a better mode candidate than `best` occuring `best_count` times.
+	Ties are broken in favour of the smaller label, so the mode does not depend on the iteration order
+	of a hash map and all histogram representations return exactly the same downsamples.
+*/
+template <typename T>
+inline bool isBetterMode(T label, unsigned int count, T best, unsigned int best_count) {
+	return count > best_count || (count == best_count && label < best);
+}
+
+
+/**
+	Returns the key with the largest value in hashmap (see isBetterMode(..) for how ties are broken).
+	Complexity: O(N) where N is the number of elements in hashmap
+*/
+template <typename Map>
+typename Map::key_type findMode(const Map &hashmap) {
+	typename Map::const_iterator it = hashmap.begin();
+	typename Map::key_type mode = it->first;
+	unsigned int max_num_occurances = it->second;
+	for (++it; it != hashmap.end(); ++it) {
+		if (isBetterMode(it->first, it->second, mode, max_num_occurances)) {
+			mode = it->first;
+			max_num_occurances = it->second;
+		}
+	}
+	return mode;
+}
+
+
 /**
     The function counts how many times each element occurs in array A.
 	Parameters:	
-		A  Input array
+		A  Input array of pixels of type T
 		hashmap - Output hashmap
 	Given array A the function returns hashmap. 
 	Hashmap's keys are elements of A. Each key contains a `value` 
 	which is equal to the number of occurances of that key in A. 
+	Returns the mode of A.
 
 	Complexity: Max number of elements in A is 2^ndims, where ndims is the number of dimentions.
 		Therefore, the function has O(1), where N is the total number of elements in the original array
 */
-unsigned int createMap(const UintArray2d &A, HashMap & hashmap);
+template <typename T>
+T createMap(const ArrayNd<T, 2> &A, BasicHashMap<T> &hashmap) {
+	for (size_t i = 0; i != A.shape()[0]; ++i) {
+		for (size_t j = 0; j != A.shape()[1]; ++j) {
+			++hashmap[A[i][j]];
+		}
+	}
+	return findMode(hashmap);
+}
 
 
 /**
@@ -47,23 +277,303 @@ unsigned int createMap(const UintArray2d &A, HashMap & hashmap);
 	Parameters:	
 		array_of_maps  Input array of hashmaps
 		output_map - Output hashmap	
+	Returns the mode of the merged hashmap.
 
 	Complexity: O(N) where N is the number of elements in output_map
 */
-unsigned int mergeMaps(HashMapArray2d array_of_maps, HashMap & output_map);
+template <typename T>
+T mergeMaps(const ArrayNd<BasicHashMap<T>, 2> &array_of_maps, BasicHashMap<T> &output_map) {
+	output_map = array_of_maps[0][0];
+	for (size_t i = 0; i != array_of_maps.shape()[0]; ++i) {
+		for (size_t j = 0; j != array_of_maps.shape()[1]; ++j) {
+			if (i == 0 && j == 0) {
+				continue;
+			}
+			for (typename BasicHashMap<T>::const_iterator it = array_of_maps[i][j].begin(); it != array_of_maps[i][j].end(); ++it) {
+				output_map[it->first] += it->second;
+			}
+		}
+	}
+	return findMode(output_map);
+}
 
 
 /**
-	The takes a linear array index (single number) and array dimentions.
-	It returns the n-dimentional index into array.
-	Parameters:
-		input - input linear (1 dimentional) index
-		sizes - size of array along all n dimentions
-	Returns: 
-		vector containing n-dimentional index into array
+    N-dimentional version of createMap(..).
+	Parameters:	
+		block - values of a 2x2..x2 block (BlockSize = 2^ndims elements)
+		hashmap - Output hashmap
+	Returns the mode of the block.
 	Complexity: O(1)
 */
-std::vector<size_t> getIndices(size_t input, std::vector<size_t> sizes);
+template <typename T, std::size_t BlockSize>
+T createMap(const std::array<T, BlockSize> &block, BasicHashMap<T> &hashmap) {
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		++hashmap[block[i]];
+	}
+	return findMode(hashmap);
+}
+
+
+/**
+	N-dimentional version of mergeMaps(..).
+	Parameters:	
+		maps - pointers to the 2^ndims hashmaps of a block, they are consumed (the largest one is moved into output_map)
+		output_map - Output hashmap	
+	Returns the mode of the merged hashmap.
+	Complexity: O(N) where N is the number of elements in output_map
+*/
+template <typename T, std::size_t BlockSize>
+T mergeMaps(const std::array<BasicHashMap<T> *, BlockSize> &maps, BasicHashMap<T> &output_map) {
+	std::size_t largest = 0;
+	for (std::size_t i = 1; i != BlockSize; ++i) {
+		if (maps[i]->size() > maps[largest]->size()) {
+			largest = i;
+		}
+	}
+
+	output_map = std::move(*maps[largest]);
+	for (std::size_t i = 0; i != BlockSize; ++i) {
+		if (i == largest) {
+			continue;
+		}
+		for (typename BasicHashMap<T>::const_iterator it = maps[i]->begin(); it != maps[i]->end(); ++it) {
+			output_map[it->first] += it->second;
+		}
+	}
+	return findMode(output_map);
+}
+
+
+/**
+	Adds the counts of hashmap `from` to hashmap `to`, `from` is not modified.
+	Used where the children must be kept (see PersistentPyramid), mergeMaps(..) consumes them.
+	Complexity: O(N) where N is the number of elements in from
+*/
+template <typename T>
+void addMap(const BasicHashMap<T> &from, BasicHashMap<T> &to) {
+	for (typename BasicHashMap<T>::const_iterator it = from.begin(); it != from.end(); ++it) {
+		to[it->first] += it->second;
+	}
+}
+
+
+/**
+	Adds delta to the number of occurances of label (a label whose count drops to 0 is removed).
+	Returns the new count.
+	Complexity: O(1)
+*/
+template <typename T>
+unsigned int addCount(BasicHashMap<T> &hashmap, T label, int delta) {
+	typename BasicHashMap<T>::iterator it = hashmap.insert(std::make_pair(label, 0u)).first;
+	assert(delta >= 0 || it->second >= (unsigned int)-delta);
+	it->second += delta;
+	if (it->second == 0) {
+		hashmap.erase(it);
+		return 0;
+	}
+	return it->second;
+}
+
+
+/**
+	Returns the number of occurances of label.
+	Complexity: O(1)
+*/
+template <typename T>
+unsigned int countOf(const BasicHashMap<T> &hashmap, T label) {
+	typename BasicHashMap<T>::const_iterator it = hashmap.find(label);
+	return it == hashmap.end() ? 0 : it->second;
+}
+
+
+/**
+	Calls function(label, count) for every label of hashmap (in no particular order).
+	Used by the statistics of BlockStatistics, the other histogram types have their own overloads.
+*/
+template <typename T, typename Function>
+void forEachCount(const BasicHashMap<T> &hashmap, Function function) {
+	for (typename BasicHashMap<T>::const_iterator it = hashmap.begin(); it != hashmap.end(); ++it) {
+		function(it->first, it->second);
+	}
+}
+
+
+/**
+	Per-level memory arena of histograms which do not need one (hashmaps, dense histograms).
+	See HistogramArena<Histogram> and CompactHistogram<T> for histograms that allocate from an arena.
+*/
+struct NoArena {
+	void reset() {}
+	void resetLocal() {}
+};
+
+
+/**
+	Type of the arena the histograms of one pyramid level allocate from.
+	The engine keeps one arena for the level that is being read and one for the level that is being written,
+	and resets the former as soon as the next level is built.
+*/
+template <typename Histogram>
+struct HistogramArena {
+	typedef NoArena type;
+};
+
+
+/**
+	createMap(..) and mergeMaps(..) called by the engine for histograms that do not use an arena.
+	relocateMap(hist, arena) moves the memory of a histogram that must outlive its level into another arena.
+*/
+template <typename T, std::size_t BlockSize, typename Histogram>
+T createMap(const std::array<T, BlockSize> &block, Histogram &hist, NoArena &) {
+	return createMap(block, hist);
+}
+
+template <typename Histogram>
+void relocateMap(Histogram &, NoArena &) {}
+
+template <std::size_t BlockSize, typename Histogram>
+auto mergeMaps(const std::array<Histogram *, BlockSize> &maps, Histogram &output_map, NoArena &) 
+	-> decltype(mergeMaps(maps, output_map)) {
+	return mergeMaps(maps, output_map);
+}
+
+
+/**
+	One object of type Local per worker thread of the current TBB task arena.
+	Threads that are not running TBB tasks (e.g. the single threaded version of the algorithm) use the first slot.
+
+	The slots of the arena the object is created in are allocated up front. Slots never move: a thread
+	of a larger arena (e.g. a HistogramLevels reused inside a bigger tbb::task_arena) allocates a block of
+	extra slots for its index on first use, so an object can be reused in arenas of any size.
+
+	Note: tbb::enumerable_thread_specific would do the same job, but it includes <strings.h> 
+	whose index(..) function clashes with the `index` typedef above.
+*/
+template <typename Local>
+class PerThread {
+	struct Slot {
+		Local local;
+		char padding[64];   // keeps slots of different threads on different cache lines
+	};
+	static const std::size_t block_size = 64;     // slots of every extra block
+	static const std::size_t max_blocks = 256;
+	std::size_t first_size;                       // slots of blocks[0], the arena the object was created in
+	std::atomic<Slot *> blocks[max_blocks];
+
+	/**
+		Returns block b, allocating it (and the blocks before it) if no thread has done so yet.
+	*/
+	Slot *block(std::size_t b) {
+		Slot *slots = blocks[b].load(std::memory_order_acquire);
+		if (slots) {
+			return slots;
+		}
+		for (std::size_t c = 0; c <= b; ++c) {
+			slots = blocks[c].load(std::memory_order_acquire);
+			if (!slots) {
+				Slot *fresh = new Slot[c == 0 ? first_size : block_size]();
+				if (blocks[c].compare_exchange_strong(slots, fresh, std::memory_order_acq_rel)) {
+					slots = fresh;
+				}
+				else {
+					delete[] fresh;
+				}
+			}
+		}
+		return slots;
+	}
+
+	std::size_t blockSize(std::size_t b) const {
+		return b == 0 ? first_size : block_size;
+	}
+
+	void release() {
+		for (std::size_t b = 0; b != max_blocks; ++b) {
+			delete[] blocks[b].exchange(0);
+		}
+	}
+
+	void copyFrom(const PerThread &other) {
+		first_size = other.first_size;
+		for (std::size_t b = 0; b != max_blocks; ++b) {
+			const Slot *slots = other.blocks[b].load(std::memory_order_acquire);
+			Slot *copy = 0;
+			if (slots) {
+				copy = new Slot[blockSize(b)];
+				std::copy(slots, slots + blockSize(b), copy);
+			}
+			blocks[b].store(copy);
+		}
+	}
+
+public:
+	PerThread() : first_size(tbb::this_task_arena::max_concurrency()) {
+		for (std::size_t b = 0; b != max_blocks; ++b) {
+			blocks[b].store(0);
+		}
+		block(0);
+	}
+
+	PerThread(const PerThread &other) {
+		copyFrom(other);
+	}
+
+	PerThread &operator=(const PerThread &other) {
+		if (this != &other) {
+			release();
+			copyFrom(other);
+		}
+		return *this;
+	}
+
+	~PerThread() {
+		release();
+	}
+
+	Local &local() {
+		int i = tbb::this_task_arena::current_thread_index();
+		std::size_t slot = i < 0 ? 0 : (std::size_t)i;
+		if (slot < first_size) {
+			return blocks[0].load(std::memory_order_relaxed)[slot].local;
+		}
+		std::size_t b = (slot - first_size) / block_size + 1;
+		if (b >= max_blocks) {
+			throw std::length_error("PerThread used in a task arena with too many threads");
+		}
+		return block(b)[(slot - first_size) % block_size].local;
+	}
+
+	/**
+		Number of slots, including the extra ones of larger arenas.
+		Must not be called while other threads may call local().
+	*/
+	std::size_t size() const {
+		std::size_t n = 0;
+		for (std::size_t b = 0; b != max_blocks && blocks[b].load(std::memory_order_acquire); ++b) {
+			n += blockSize(b);
+		}
+		return n;
+	}
+
+	Local &operator[](std::size_t i) {
+		std::size_t b = 0;
+		while (i >= blockSize(b)) {
+			i -= blockSize(b);
+			++b;
+		}
+		return blocks[b].load(std::memory_order_acquire)[i].local;
+	}
+
+	/**
+		Replaces the objects of all threads with default constructed ones.
+	*/
+	void clear() {
+		for (std::size_t i = 0; i != size(); ++i) {
+			(*this)[i] = Local();
+		}
+	}
+};
 
 
 /**